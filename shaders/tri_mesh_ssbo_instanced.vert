@@ -1,5 +1,6 @@
 #version 450
-layout (location = 0) in vec3 vPosition;
+//16 bit unorm position inside the mesh bounds, the object matrix includes the dequantization. w is not part of the position
+layout (location = 0) in vec4 vPosition;
 layout (location = 1) in vec2 vOctNormal;
 layout (location = 2) in vec3 vColor;
 layout (location = 3) in vec2 vTexCoord;
@@ -66,10 +67,10 @@ void main()
 
 	mat4 modelMatrix = objectBuffer.objects[index].model;
 	mat4 transformMatrix = (cameraData.viewproj * modelMatrix);
-	gl_Position = transformMatrix * vec4(vPosition, 1.0f);
+	gl_Position = transformMatrix * vec4(vPosition.xyz, 1.0f);
 	outNormal = normalize((modelMatrix * vec4(vNormal,0.f)).xyz);
 	outColor = vColor;
 	texCoord = vTexCoord;
 
-	ShadowCoord = sceneData.sunlightShadowMatrix * (modelMatrix* vec4(vPosition, 1.0f)  );
+	ShadowCoord = sceneData.sunlightShadowMatrix * (modelMatrix* vec4(vPosition.xyz, 1.0f)  );
 }
@@ -0,0 +1,281 @@
+#include <asset_archive.h>
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+using namespace assets;
+
+static_assert(sizeof(ArchiveHeader) == 40, "archive header layout changed");
+static_assert(sizeof(ArchiveEntry) == 40, "archive entry layout changed");
+
+namespace {
+	struct MountedArchive {
+		std::string mountPath;
+		void* mappedData;
+		size_t mappedSize;
+		const ArchiveHeader* header;
+		const ArchiveEntry* toc;
+		const char* strings;
+	};
+
+	std::vector<MountedArchive> mountedArchives;
+
+	char normalize_separator(char c)
+	{
+		return c == '\\' ? '/' : c;
+	}
+
+	bool paths_equal(std::string_view a, std::string_view b)
+	{
+		if (a.size() != b.size()) return false;
+		for (size_t i = 0; i < a.size(); i++)
+		{
+			if (normalize_separator(a[i]) != normalize_separator(b[i])) return false;
+		}
+		return true;
+	}
+
+	uint64_t align_up(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	//slot of the path in the table, or of the empty slot where it would go. tableSize when the table is full and doesn't have it
+	uint32_t find_slot(const ArchiveEntry* toc, uint32_t tableSize, const char* strings, uint64_t hash, std::string_view path)
+	{
+		uint32_t mask = tableSize - 1;
+		uint32_t slot = static_cast<uint32_t>(hash) & mask;
+		for (uint32_t probe = 0; probe < tableSize; probe++)
+		{
+			if (toc[slot].pathLength == 0)
+			{
+				return slot;
+			}
+			if (toc[slot].pathHash == hash && paths_equal(std::string_view(strings + toc[slot].pathOffset, toc[slot].pathLength), path))
+			{
+				return slot;
+			}
+			slot = (slot + 1) & mask;
+		}
+		return tableSize;
+	}
+}
+
+uint64_t assets::hash_asset_path(std::string_view path)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (char c : path)
+	{
+		hash ^= static_cast<uint8_t>(normalize_separator(c));
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+bool assets::save_archive(const char* path, const std::vector<ArchiveInput>& inputs)
+{
+	//keep the table at most half full so probe sequences stay short
+	uint32_t tableSize = 1;
+	while (tableSize < inputs.size() * 2)
+	{
+		tableSize *= 2;
+	}
+
+	std::vector<ArchiveEntry> toc(tableSize);
+	memset(toc.data(), 0, toc.size() * sizeof(ArchiveEntry));
+
+	std::string strings;
+	std::vector<std::vector<char>> contents;
+	std::vector<uint32_t> slots;
+
+	for (auto& input : inputs)
+	{
+		std::ifstream infile(input.sourceFile, std::ios::binary | std::ios::ate);
+		if (!infile.is_open())
+		{
+			std::cout << "Error when trying to read file: " << input.sourceFile << std::endl;
+			return false;
+		}
+
+		std::vector<char> data(static_cast<size_t>(infile.tellg()));
+		infile.seekg(0);
+		infile.read(data.data(), data.size());
+
+		MappedAssetFile view;
+		if (!view_binaryfile(data.data(), data.size(), view))
+		{
+			std::cout << "Not an asset file: " << input.sourceFile << std::endl;
+			return false;
+		}
+
+		std::string normalized = input.path;
+		for (char& c : normalized)
+		{
+			c = normalize_separator(c);
+		}
+
+		uint64_t hash = hash_asset_path(normalized);
+		uint32_t slot = find_slot(toc.data(), tableSize, strings.data(), hash, normalized);
+		if (toc[slot].pathLength != 0)
+		{
+			std::cout << "Duplicated archive path: " << normalized << std::endl;
+			return false;
+		}
+
+		ArchiveEntry& entry = toc[slot];
+		entry.pathHash = hash;
+		entry.size = data.size();
+		entry.pathOffset = static_cast<uint32_t>(strings.size());
+		entry.pathLength = static_cast<uint32_t>(normalized.size());
+		memcpy(entry.type, view.type, 4);
+		entry.version = view.version;
+
+		strings += normalized;
+		slots.push_back(slot);
+		contents.push_back(std::move(data));
+	}
+
+	ArchiveHeader header;
+	memcpy(header.magic, "VKAR", 4);
+	header.version = ARCHIVE_VERSION;
+	header.entryCount = static_cast<uint32_t>(inputs.size());
+	header.tableSize = tableSize;
+	header.tocOffset = sizeof(ArchiveHeader);
+	header.stringsOffset = header.tocOffset + tableSize * sizeof(ArchiveEntry);
+	header.stringsSize = strings.size();
+
+	//asset files go after the strings, in input order so that a front to back read follows the pack order
+	uint64_t offset = header.stringsOffset + header.stringsSize;
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		offset = align_up(offset, ARCHIVE_ALIGNMENT);
+		toc[slots[i]].offset = offset;
+		offset += toc[slots[i]].size;
+	}
+
+	std::ofstream outfile;
+	outfile.open(path, std::ios::binary | std::ios::out);
+	if (!outfile.is_open())
+	{
+		std::cout << "Error when trying to write file: " << path << std::endl;
+		return false;
+	}
+
+	outfile.write((const char*)&header, sizeof(ArchiveHeader));
+	outfile.write((const char*)toc.data(), toc.size() * sizeof(ArchiveEntry));
+	outfile.write(strings.data(), strings.size());
+
+	const char padding[ARCHIVE_ALIGNMENT] = {};
+	uint64_t written = header.stringsOffset + header.stringsSize;
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		const ArchiveEntry& entry = toc[slots[i]];
+		outfile.write(padding, entry.offset - written);
+		outfile.write(contents[i].data(), contents[i].size());
+		written = entry.offset + entry.size;
+	}
+
+	outfile.close();
+
+	return true;
+}
+
+bool assets::mount_archive(const char* archivePath, const char* mountPath)
+{
+	void* mapped = nullptr;
+	size_t size = 0;
+	if (!map_file(archivePath, &mapped, &size)) return false;
+
+	const ArchiveHeader* header = (const ArchiveHeader*)mapped;
+
+	bool valid = size >= sizeof(ArchiveHeader)
+		&& memcmp(header->magic, "VKAR", 4) == 0
+		&& header->version == ARCHIVE_VERSION
+		&& header->tableSize != 0 && (header->tableSize & (header->tableSize - 1)) == 0
+		&& header->tocOffset + header->tableSize * sizeof(ArchiveEntry) <= size
+		&& header->stringsOffset + header->stringsSize <= size;
+
+	if (!valid)
+	{
+		std::cout << "Invalid asset archive: " << archivePath << std::endl;
+		unmap_file(mapped, size);
+		return false;
+	}
+
+	//every path and file of the table has to be inside the archive, lookups don't check them again
+	const ArchiveEntry* toc = (const ArchiveEntry*)((const char*)mapped + header->tocOffset);
+	for (uint32_t i = 0; i < header->tableSize; i++)
+	{
+		const ArchiveEntry& entry = toc[i];
+		if (entry.pathLength == 0) continue;
+
+		if (uint64_t(entry.pathOffset) + entry.pathLength > header->stringsSize || entry.offset > size || entry.size > size - entry.offset)
+		{
+			std::cout << "Corrupted asset archive table: " << archivePath << std::endl;
+			unmap_file(mapped, size);
+			return false;
+		}
+	}
+
+	MountedArchive archive;
+	archive.mountPath = mountPath;
+	for (char& c : archive.mountPath)
+	{
+		c = normalize_separator(c);
+	}
+	if (!archive.mountPath.empty() && archive.mountPath.back() != '/')
+	{
+		archive.mountPath += '/';
+	}
+	archive.mappedData = mapped;
+	archive.mappedSize = size;
+	archive.header = header;
+	archive.toc = toc;
+	archive.strings = (const char*)mapped + header->stringsOffset;
+
+	mountedArchives.push_back(std::move(archive));
+	return true;
+}
+
+void assets::unmount_archives()
+{
+	for (auto& archive : mountedArchives)
+	{
+		unmap_file(archive.mappedData, archive.mappedSize);
+	}
+	mountedArchives.clear();
+}
+
+bool assets::find_in_archives(const char* path, MappedAssetFile& outputFile)
+{
+	std::string_view fullPath{ path };
+
+	for (auto& archive : mountedArchives)
+	{
+		if (fullPath.size() < archive.mountPath.size() || !paths_equal(fullPath.substr(0, archive.mountPath.size()), archive.mountPath))
+		{
+			continue;
+		}
+
+		std::string_view relative = fullPath.substr(archive.mountPath.size());
+
+		uint32_t slot = find_slot(archive.toc, archive.header->tableSize, archive.strings, hash_asset_path(relative), relative);
+		if (slot == archive.header->tableSize)
+		{
+			continue;
+		}
+
+		const ArchiveEntry& entry = archive.toc[slot];
+		if (entry.pathLength == 0)
+		{
+			continue;
+		}
+
+		if (view_binaryfile((const char*)archive.mappedData + entry.offset, entry.size, outputFile))
+		{
+			return true;
+		}
+	}
+	return false;
+}
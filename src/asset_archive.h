@@ -0,0 +1,53 @@
+#pragma once
+#include <asset_loader.h>
+
+namespace assets {
+
+	//single file holding many asset files, laid out as
+	//header | table of contents | path strings | asset files
+	//every asset file starts on an ARCHIVE_ALIGNMENT boundary, so it can be mapped and viewed in place.
+	//the table of contents is an open addressed hash table keyed by the hashed asset path
+	constexpr uint32_t ARCHIVE_VERSION = 1;
+	constexpr size_t ARCHIVE_ALIGNMENT = 4096;
+
+	struct ArchiveHeader {
+		char magic[4]; //VKAR
+		uint32_t version;
+		uint32_t entryCount;
+		uint32_t tableSize; //slots in the table of contents, always a power of 2
+		uint64_t tocOffset;
+		uint64_t stringsOffset;
+		uint64_t stringsSize;
+	};
+
+	struct ArchiveEntry {
+		uint64_t pathHash;
+		uint64_t offset; //from the start of the archive
+		uint64_t size;
+		uint32_t pathOffset; //into the string table
+		uint32_t pathLength; //0 for empty slots
+		char type[4];
+		uint32_t version;
+	};
+
+	struct ArchiveInput {
+		//path the asset is looked up with, relative to the mount point
+		std::string path;
+		//file on disk to pack
+		std::string sourceFile;
+	};
+
+	//fnv-1a of the path, with backslashes hashed as forward slashes
+	uint64_t hash_asset_path(std::string_view path);
+
+	bool save_archive(const char* path, const std::vector<ArchiveInput>& inputs);
+
+	//maps the archive and serves every map_binaryfile call for paths under mountPath from it.
+	//mount before loading starts, lookups do not lock against mounting
+	bool mount_archive(const char* archivePath, const char* mountPath);
+
+	void unmount_archives();
+
+	//looks the path up in the mounted archives. outputFile views into the archive mapping and does not own it
+	bool find_in_archives(const char* path, MappedAssetFile& outputFile);
+}
@@ -0,0 +1,267 @@
+#include <asset_compression.h>
+
+#include "lz4.h"
+#include "lz4hc.h"
+#include <zstd.h>
+#include <zdict.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+namespace {
+	struct Dictionary {
+		std::vector<char> data;
+		ZSTD_DDict* ddict{ nullptr };
+		uint32_t id{ 0 };
+
+		~Dictionary()
+		{
+			ZSTD_freeDDict(ddict);
+		}
+	};
+
+	//replaced as a whole, decoders that still hold the previous one keep it alive until they are done
+	std::shared_ptr<const Dictionary> currentDictionary;
+	std::mutex dictionaryMutex;
+
+	std::shared_ptr<const Dictionary> get_dictionary()
+	{
+		std::lock_guard<std::mutex> lock(dictionaryMutex);
+		return currentDictionary;
+	}
+
+	//zstd contexts are expensive to create, every thread keeps its own
+	struct ZstdContexts {
+		ZSTD_CCtx* compress{ nullptr };
+		ZSTD_DCtx* decompress{ nullptr };
+
+		~ZstdContexts()
+		{
+			ZSTD_freeCCtx(compress);
+			ZSTD_freeDCtx(decompress);
+		}
+	};
+	thread_local ZstdContexts zstdContexts;
+
+	ZSTD_CCtx* compress_context()
+	{
+		if (!zstdContexts.compress) zstdContexts.compress = ZSTD_createCCtx();
+		return zstdContexts.compress;
+	}
+
+	ZSTD_DCtx* decompress_context()
+	{
+		if (!zstdContexts.decompress) zstdContexts.decompress = ZSTD_createDCtx();
+		return zstdContexts.decompress;
+	}
+}
+
+const char* assets::compression_name(CompressionMode mode)
+{
+	switch (mode) {
+	case CompressionMode::None:
+		return "None";
+	case CompressionMode::LZ4:
+		return "LZ4";
+	case CompressionMode::LZ4HC:
+		return "LZ4HC";
+	case CompressionMode::Zstd:
+		return "ZSTD";
+	}
+	return "Unknown";
+}
+
+bool assets::parse_compression_settings(const char* text, CompressionSettings& settings)
+{
+	std::string name = text;
+	int level = 0;
+
+	size_t separator = name.find(':');
+	if (separator != std::string::npos)
+	{
+		level = atoi(name.c_str() + separator + 1);
+		name.resize(separator);
+	}
+	std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+
+	for (CompressionMode mode : { CompressionMode::None, CompressionMode::LZ4, CompressionMode::LZ4HC, CompressionMode::Zstd })
+	{
+		if (name == compression_name(mode))
+		{
+			settings.mode = mode;
+			settings.level = level;
+			return true;
+		}
+	}
+	return false;
+}
+
+size_t assets::compress_bound(CompressionMode mode, size_t sourceSize)
+{
+	switch (mode) {
+	case CompressionMode::LZ4:
+	case CompressionMode::LZ4HC:
+		return LZ4_compressBound(static_cast<int>(sourceSize));
+	case CompressionMode::Zstd:
+		return ZSTD_compressBound(sourceSize);
+	default:
+		return sourceSize;
+	}
+}
+
+size_t assets::compress_block(const CompressionSettings& settings, const char* source, size_t sourceSize, char* destination, size_t capacity, bool useDictionary)
+{
+	switch (settings.mode) {
+	case CompressionMode::None:
+		if (capacity < sourceSize) return 0;
+		memcpy(destination, source, sourceSize);
+		return sourceSize;
+	case CompressionMode::LZ4:
+		//the level is the acceleration of the fast compressor, higher trades ratio for speed
+		return LZ4_compress_fast(source, destination, static_cast<int>(sourceSize), static_cast<int>(capacity), std::max(settings.level, 1));
+	case CompressionMode::LZ4HC:
+		return LZ4_compress_HC(source, destination, static_cast<int>(sourceSize), static_cast<int>(capacity),
+			settings.level > 0 ? settings.level : LZ4HC_CLEVEL_DEFAULT);
+	case CompressionMode::Zstd:
+	{
+		int level = settings.level > 0 ? settings.level : ZSTD_CLEVEL_DEFAULT;
+
+		std::shared_ptr<const Dictionary> dictionary = useDictionary ? get_dictionary() : nullptr;
+		size_t result = dictionary
+			? ZSTD_compress_usingDict(compress_context(), destination, capacity, source, sourceSize, dictionary->data.data(), dictionary->data.size(), level)
+			: ZSTD_compressCCtx(compress_context(), destination, capacity, source, sourceSize, level);
+		return ZSTD_isError(result) ? 0 : result;
+	}
+	}
+	return 0;
+}
+
+bool assets::decompress_block(CompressionMode mode, const char* source, size_t sourceSize, char* destination, size_t destinationSize)
+{
+	switch (mode) {
+	case CompressionMode::None:
+		if (sourceSize != destinationSize) return false;
+		memcpy(destination, source, sourceSize);
+		return true;
+	case CompressionMode::LZ4:
+	case CompressionMode::LZ4HC:
+		//both write the same block format
+		return LZ4_decompress_safe(source, destination, static_cast<int>(sourceSize), static_cast<int>(destinationSize)) == static_cast<int>(destinationSize);
+	case CompressionMode::Zstd:
+	{
+		size_t result;
+		uint32_t dictionaryId = ZSTD_getDictID_fromFrame(source, sourceSize);
+		if (dictionaryId != 0)
+		{
+			std::shared_ptr<const Dictionary> dictionary = get_dictionary();
+			if (!dictionary || dictionary->id != dictionaryId)
+			{
+				std::cout << "Missing compression dictionary " << dictionaryId << std::endl;
+				return false;
+			}
+			result = ZSTD_decompress_usingDDict(decompress_context(), destination, destinationSize, source, sourceSize, dictionary->ddict);
+		}
+		else
+		{
+			result = ZSTD_decompressDCtx(decompress_context(), destination, destinationSize, source, sourceSize);
+		}
+		return !ZSTD_isError(result) && result == destinationSize;
+	}
+	}
+	return false;
+}
+
+bool assets::train_dictionary(const std::vector<std::string>& samples, size_t capacity, std::vector<char>& dictionary)
+{
+	std::string buffer;
+	std::vector<size_t> sampleSizes;
+	for (const std::string& sample : samples)
+	{
+		buffer += sample;
+		sampleSizes.push_back(sample.size());
+	}
+
+	dictionary.resize(capacity);
+	size_t size = ZDICT_trainFromBuffer(dictionary.data(), capacity, buffer.data(), sampleSizes.data(), static_cast<unsigned>(sampleSizes.size()));
+	if (ZDICT_isError(size))
+	{
+		//too few or too uniform samples
+		dictionary.clear();
+		return false;
+	}
+	dictionary.resize(size);
+	return true;
+}
+
+assets::AssetFile assets::pack_dictionary(const std::vector<char>& dictionary)
+{
+	AssetFile file;
+	file.type[0] = 'D';
+	file.type[1] = 'I';
+	file.type[2] = 'C';
+	file.type[3] = 'T';
+	file.version = ASSET_VERSION_BINARY;
+	file.binaryBlob = dictionary;
+
+	return file;
+}
+
+bool assets::load_dictionary(const char* path)
+{
+	MappedAssetFile file;
+	if (!map_binaryfile(path, file) || memcmp(file.type, "DICT", 4) != 0)
+	{
+		return false;
+	}
+
+	set_dictionary(file.binaryBlob, file.binaryBlobSize);
+	return true;
+}
+
+void assets::set_dictionary(const char* data, size_t size)
+{
+	auto dictionary = std::make_shared<Dictionary>();
+	dictionary->data.assign(data, data + size);
+	dictionary->ddict = ZSTD_createDDict(dictionary->data.data(), dictionary->data.size());
+	dictionary->id = ZDICT_getDictID(dictionary->data.data(), dictionary->data.size());
+
+	std::lock_guard<std::mutex> lock(dictionaryMutex);
+	currentDictionary = std::move(dictionary);
+}
+
+std::string assets::compress_metadata(std::string_view metadata, int level)
+{
+	std::string result(sizeof(uint32_t) + compress_bound(CompressionMode::Zstd, metadata.size()), '\0');
+
+	uint32_t size = static_cast<uint32_t>(metadata.size());
+	memcpy(result.data(), &size, sizeof(uint32_t));
+
+	CompressionSettings settings{ CompressionMode::Zstd, level };
+	size_t compressedSize = compress_block(settings, metadata.data(), metadata.size(), result.data() + sizeof(uint32_t), result.size() - sizeof(uint32_t), true);
+	result.resize(sizeof(uint32_t) + compressedSize);
+	return result;
+}
+
+bool assets::decompress_metadata(int& version, std::string_view& metadata, std::string& storage)
+{
+	if (version != ASSET_VERSION_COMPRESSED) return true;
+
+	uint32_t size;
+	if (metadata.size() < sizeof(uint32_t)) return false;
+	memcpy(&size, metadata.data(), sizeof(uint32_t));
+
+	storage.resize(size);
+	if (!decompress_block(CompressionMode::Zstd, metadata.data() + sizeof(uint32_t), metadata.size() - sizeof(uint32_t), storage.data(), size))
+	{
+		return false;
+	}
+
+	version = ASSET_VERSION_BINARY;
+	metadata = storage;
+	return true;
+}
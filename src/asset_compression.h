@@ -0,0 +1,45 @@
+#pragma once
+#include <asset_loader.h>
+
+namespace assets {
+
+	//codec and level a block gets compressed with. Level 0 picks the default of the codec,
+	//the level only matters when compressing, the mode alone is enough to decode
+	struct CompressionSettings {
+		CompressionMode mode{ CompressionMode::LZ4 };
+		int level{ 0 };
+	};
+
+	const char* compression_name(CompressionMode mode);
+
+	//parses a codec name with an optional level, as in "lz4", "lz4hc:12" or "zstd:19". Names are case insensitive
+	bool parse_compression_settings(const char* text, CompressionSettings& settings);
+
+	//largest compressed size of sourceSize bytes
+	size_t compress_bound(CompressionMode mode, size_t sourceSize);
+
+	//returns the compressed size, 0 when the codec failed. None copies the source.
+	//dictionaries are only used by zstd, the decoder finds them again from the id stored in the frame
+	size_t compress_block(const CompressionSettings& settings, const char* source, size_t sourceSize, char* destination, size_t capacity, bool useDictionary = false);
+
+	//decodes exactly destinationSize bytes, false when the block is corrupted or the codec is unknown
+	bool decompress_block(CompressionMode mode, const char* source, size_t sourceSize, char* destination, size_t destinationSize);
+
+	//zstd dictionary trained on the metadata of many small assets, materials and prefabs mostly.
+	//stored as its own asset file so it can live in an archive next to the assets it belongs to
+	bool train_dictionary(const std::vector<std::string>& samples, size_t capacity, std::vector<char>& dictionary);
+
+	AssetFile pack_dictionary(const std::vector<char>& dictionary);
+
+	//makes the dictionary of the asset file at path the one every thread compresses and decodes with
+	bool load_dictionary(const char* path);
+
+	void set_dictionary(const char* data, size_t size);
+
+	//metadata of version ASSET_VERSION_COMPRESSED is a binary block compressed with zstd and the loaded dictionary,
+	//prefixed by its uncompressed size. This compresses a binary block into that form
+	std::string compress_metadata(std::string_view metadata, int level = 0);
+
+	//turns compressed metadata back into a binary block, decoded into storage. Other versions pass through untouched
+	bool decompress_metadata(int& version, std::string_view& metadata, std::string& storage);
+}
@@ -1,10 +1,23 @@
 
 #include <asset_loader.h>
+#include <asset_archive.h>
+#include <asset_compression.h>
 
 #include <cstring>
 #include <fstream>
 #include <iostream>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using namespace assets;
 
 bool assets::save_binaryfile(const  char* path, const AssetFile& file)
@@ -68,11 +81,175 @@ bool assets::load_binaryfile(const  char* path, AssetFile& outputFile)
 	return true;
 }
 
+//size of the fixed header: type, version, json lenght and blob lenght
+constexpr size_t ASSET_HEADER_SIZE = 4 + 3 * sizeof(uint32_t);
+
+bool assets::map_file(const char* path, void** data, size_t* dataSize)
+{
+	void* mapped = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(fileHandle);
+		return false;
+	}
+	size = static_cast<size_t>(fileSize.QuadPart);
+
+	HANDLE mapping = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping)
+	{
+		mapped = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		//the view keeps the mapping alive, handles can go
+		CloseHandle(mapping);
+	}
+	CloseHandle(fileHandle);
+
+	if (!mapped) return false;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+	size = static_cast<size_t>(st.st_size);
+
+	mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	//the mapping keeps the file alive, the descriptor can go
+	close(fd);
+
+	if (mapped == MAP_FAILED) return false;
+
+	//files are read front to back, so ask the kernel to start reading the whole thing now
+	madvise(mapped, size, MADV_SEQUENTIAL);
+	madvise(mapped, size, MADV_WILLNEED);
+#endif
+
+	*data = mapped;
+	*dataSize = size;
+	return true;
+}
+
+void assets::unmap_file(void* data, size_t size)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap(data, size);
+#endif
+}
+
+bool assets::map_binaryfile(const char* path, MappedAssetFile& outputFile)
+{
+	unmap_binaryfile(outputFile);
+
+	//mounted archives resolve the path without touching the filesystem
+	if (find_in_archives(path, outputFile))
+	{
+		return true;
+	}
+
+	void* mapped = nullptr;
+	size_t size = 0;
+	if (!map_file(path, &mapped, &size)) return false;
+
+	if (!view_binaryfile((const char*)mapped, size, outputFile))
+	{
+		std::cout << "Truncated asset file: " << path << std::endl;
+		unmap_file(mapped, size);
+		return false;
+	}
+
+	outputFile.mappedData = mapped;
+	outputFile.mappedSize = size;
+
+	return true;
+}
+
+bool assets::view_binaryfile(const char* data, size_t size, MappedAssetFile& outputFile)
+{
+	if (size < ASSET_HEADER_SIZE) return false;
+
+	memcpy(outputFile.type, data, 4);
+	uint32_t version, jsonlen, bloblen;
+	memcpy(&version, data + 4, sizeof(uint32_t));
+	memcpy(&jsonlen, data + 8, sizeof(uint32_t));
+	memcpy(&bloblen, data + 12, sizeof(uint32_t));
+
+	//truncated file, the lenghts point outside of the mapping
+	if (ASSET_HEADER_SIZE + size_t(jsonlen) + size_t(bloblen) > size)
+	{
+		return false;
+	}
+
+	outputFile.version = version;
+	outputFile.json = std::string_view(data + ASSET_HEADER_SIZE, jsonlen);
+	outputFile.binaryBlob = data + ASSET_HEADER_SIZE + jsonlen;
+	outputFile.binaryBlobSize = bloblen;
+
+	return true;
+}
+
+void assets::unmap_binaryfile(MappedAssetFile& file)
+{
+	if (file.mappedData)
+	{
+		unmap_file(file.mappedData, file.mappedSize);
+	}
+	file.mappedData = nullptr;
+	file.mappedSize = 0;
+	file.json = {};
+	file.binaryBlob = nullptr;
+	file.binaryBlobSize = 0;
+}
+
+assets::MappedAssetFile::MappedAssetFile(MappedAssetFile&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+assets::MappedAssetFile& assets::MappedAssetFile::operator=(MappedAssetFile&& other) noexcept
+{
+	if (this != &other)
+	{
+		unmap_binaryfile(*this);
+
+		memcpy(type, other.type, 4);
+		version = other.version;
+		json = other.json;
+		binaryBlob = other.binaryBlob;
+		binaryBlobSize = other.binaryBlobSize;
+		mappedData = other.mappedData;
+		mappedSize = other.mappedSize;
+
+		other.mappedData = nullptr;
+		other.mappedSize = 0;
+		other.json = {};
+		other.binaryBlob = nullptr;
+		other.binaryBlobSize = 0;
+	}
+	return *this;
+}
+
+assets::MappedAssetFile::~MappedAssetFile()
+{
+	unmap_binaryfile(*this);
+}
+
 assets::CompressionMode assets::parse_compression(const char* f)
 {
-	if (strcmp(f, "LZ4") == 0)
+	CompressionSettings settings;
+	if (parse_compression_settings(f, settings))
 	{
-		return assets::CompressionMode::LZ4;
+		return settings.mode;
 	}
 	else {
 		return assets::CompressionMode::None;
@@ -1,6 +1,7 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <string_view>
 
 namespace assets {
 	struct AssetFile {
@@ -10,14 +11,58 @@ namespace assets {
 		std::vector<char> binaryBlob;
 	};
 
+	//read-only asset file backed by a memory mapping.
+	//header, json and blob are views into the mapped file, nothing is copied on load
+	struct MappedAssetFile {
+		char type[4];
+		int version;
+		std::string_view json;
+		const char* binaryBlob{ nullptr };
+		size_t binaryBlobSize{ 0 };
+
+		//base of the mapping owned by this file, null when the view points into memory owned by someone else
+		void* mappedData{ nullptr };
+		size_t mappedSize{ 0 };
+
+		MappedAssetFile() = default;
+		MappedAssetFile(const MappedAssetFile&) = delete;
+		MappedAssetFile& operator=(const MappedAssetFile&) = delete;
+		MappedAssetFile(MappedAssetFile&& other) noexcept;
+		MappedAssetFile& operator=(MappedAssetFile&& other) noexcept;
+		~MappedAssetFile();
+	};
+
+	//asset file versions. Version 1 stores the metadata as json, version 2 as a fixed layout binary block in the same field.
+	//version 3 is a version 2 block compressed with zstd and the shared dictionary, see asset_compression.h
+	constexpr int ASSET_VERSION_JSON = 1;
+	constexpr int ASSET_VERSION_BINARY = 2;
+	constexpr int ASSET_VERSION_COMPRESSED = 3;
+
+	//codec of the binary blob
 	enum class CompressionMode : uint32_t {
 		None,
-		LZ4
+		LZ4,
+		LZ4HC, //decodes as LZ4, slower to compress for a better ratio
+		Zstd
 	};
 
 	bool save_binaryfile(const char* path, const AssetFile& file);
 
-	bool load_binaryfile(const char* path, AssetFile& outputFile);	
+	bool load_binaryfile(const char* path, AssetFile& outputFile);
+
+	//maps the file and points the header, json and blob views into it. Readahead is requested for the whole file.
+	//paths inside a mounted archive are served from the archive mapping instead
+	bool map_binaryfile(const char* path, MappedAssetFile& outputFile);
+
+	void unmap_binaryfile(MappedAssetFile& file);
+
+	//points the views of outputFile into an asset file that is already in memory. Ownership of the memory stays with the caller
+	bool view_binaryfile(const char* data, size_t size, MappedAssetFile& outputFile);
+
+	//read-only mapping of a whole file
+	bool map_file(const char* path, void** data, size_t* size);
+
+	void unmap_file(void* data, size_t size);
 
 	assets::CompressionMode parse_compression(const char* f);
 }
@@ -0,0 +1,73 @@
+#pragma once
+#include <asset_loader.h>
+#include <cstring>
+#include <type_traits>
+
+namespace assets {
+
+	//appends fixed layout records and length prefixed strings into a binary metadata block
+	struct MetadataWriter {
+		std::string data;
+
+		template<typename T>
+		void write(const T& value)
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "metadata records must be plain data");
+			data.append((const char*)&value, sizeof(T));
+		}
+
+		template<typename T>
+		void write_array(const T* values, size_t count)
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "metadata records must be plain data");
+			data.append((const char*)values, sizeof(T) * count);
+		}
+
+		void write_string(std::string_view str)
+		{
+			write(static_cast<uint32_t>(str.size()));
+			data.append(str.data(), str.size());
+		}
+	};
+
+	//reads a binary metadata block in place. Every read is bounds checked, after a failed read ok stays false
+	struct MetadataReader {
+		std::string_view data;
+		size_t cursor{ 0 };
+		bool ok{ true };
+
+		MetadataReader(std::string_view block) : data(block) {}
+
+		const char* read_bytes(size_t size)
+		{
+			if (!ok || data.size() - cursor < size)
+			{
+				ok = false;
+				return nullptr;
+			}
+			const char* bytes = data.data() + cursor;
+			cursor += size;
+			return bytes;
+		}
+
+		template<typename T>
+		bool read(T& value)
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "metadata records must be plain data");
+			const char* bytes = read_bytes(sizeof(T));
+			if (bytes)
+			{
+				memcpy(&value, bytes, sizeof(T));
+			}
+			return bytes != nullptr;
+		}
+
+		std::string_view read_string()
+		{
+			uint32_t size = 0;
+			if (!read(size)) return {};
+			const char* bytes = read_bytes(size);
+			return bytes ? std::string_view(bytes, size) : std::string_view{};
+		}
+	};
+}
@@ -1,14 +1,76 @@
 
-#include "lz4.h"
 #include <nlohmann/json.hpp>
 
 #include <material_asset.h>
+#include <asset_compression.h>
+#include <asset_metadata.h>
+
+#include <iostream>
+
+namespace {
+	//fixed part of the binary metadata, followed by the base effect string and the texture and property key/value strings
+	struct MaterialMetadata {
+		uint32_t transparency;
+		uint32_t textureCount;
+		uint32_t propertyCount;
+	};
+}
+
+//written to disk as it is
+static_assert(sizeof(MaterialMetadata) == 12, "material metadata layout changed");
 
 assets::MaterialInfo assets::read_material_info(AssetFile* file)
+{
+	return read_material_info(file->version, std::string_view{ file->json });
+}
+
+assets::MaterialInfo assets::read_material_info(const MappedAssetFile* file)
+{
+	return read_material_info(file->version, file->json);
+}
+
+assets::MaterialInfo assets::read_material_info(int version, std::string_view json)
 {
 	assets::MaterialInfo info;
 
-	nlohmann::json material_metadata = nlohmann::json::parse(file->json);
+	//compressed metadata decodes into this, and json points at it from here on
+	std::string decompressed;
+	if (!decompress_metadata(version, json, decompressed))
+	{
+		std::cout << "Corrupted material metadata" << std::endl;
+		return MaterialInfo{};
+	}
+
+	if (version >= ASSET_VERSION_BINARY)
+	{
+		MetadataReader reader{ json };
+
+		MaterialMetadata metadata;
+		reader.read(metadata);
+		info.baseEffect = reader.read_string();
+		info.transparency = static_cast<TransparencyMode>(metadata.transparency);
+
+		for (uint32_t i = 0; i < metadata.textureCount && reader.ok; i++)
+		{
+			std::string_view key = reader.read_string();
+			info.textures[std::string(key)] = reader.read_string();
+		}
+
+		for (uint32_t i = 0; i < metadata.propertyCount && reader.ok; i++)
+		{
+			std::string_view key = reader.read_string();
+			info.customProperties[std::string(key)] = reader.read_string();
+		}
+
+		if (!reader.ok)
+		{
+			std::cout << "Corrupted material metadata" << std::endl;
+			return MaterialInfo{};
+		}
+		return info;
+	}
+
+	nlohmann::json material_metadata = nlohmann::json::parse(json);
 	info.baseEffect = material_metadata["baseEffect"];
 
 
@@ -43,6 +105,44 @@ assets::MaterialInfo assets::read_material_info(AssetFile* file)
 
 assets::AssetFile assets::pack_material(MaterialInfo* info)
 {
+	//core file header
+	AssetFile file;
+	file.type[0] = 'M';
+	file.type[1] = 'A';
+	file.type[2] = 'T';
+	file.type[3] = 'X';
+	file.version = ASSET_VERSION_BINARY;
+
+	file.json = write_material_metadata(info, file.version);
+
+	return file;
+}
+
+std::string assets::write_material_metadata(const MaterialInfo* info, int version)
+{
+	if (version >= ASSET_VERSION_BINARY)
+	{
+		MaterialMetadata metadata{};
+		metadata.transparency = static_cast<uint32_t>(info->transparency);
+		metadata.textureCount = static_cast<uint32_t>(info->textures.size());
+		metadata.propertyCount = static_cast<uint32_t>(info->customProperties.size());
+
+		MetadataWriter writer;
+		writer.write(metadata);
+		writer.write_string(info->baseEffect);
+		for (auto& [key, value] : info->textures)
+		{
+			writer.write_string(key);
+			writer.write_string(value);
+		}
+		for (auto& [key, value] : info->customProperties)
+		{
+			writer.write_string(key);
+			writer.write_string(value);
+		}
+		return writer.data;
+	}
+
 	nlohmann::json material_metadata;
 	material_metadata["baseEffect"] = info->baseEffect;
 	material_metadata["textures"] = info->textures;
@@ -58,20 +158,5 @@ assets::AssetFile assets::pack_material(MaterialInfo* info)
 		break;
 	}
 
-	
-
-	//core file header
-	AssetFile file;
-	file.type[0] = 'M';
-	file.type[1] = 'A';
-	file.type[2] = 'T';
-	file.type[3] = 'X';
-	file.version = 1;
-
-
-	std::string stringified = material_metadata.dump();
-	file.json = stringified;
-
-
-	return file;
+	return material_metadata.dump();
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include <asset_loader.h>
+#include <unordered_map>
 
 
 namespace assets {
@@ -18,6 +19,11 @@ namespace assets {
 	};
 
 	MaterialInfo read_material_info(AssetFile* file);
+	MaterialInfo read_material_info(const MappedAssetFile* file);
+	MaterialInfo read_material_info(int version, std::string_view metadata);
 
 	AssetFile pack_material(MaterialInfo* info);
+
+	//metadata block of the given asset file version, as stored in AssetFile.json
+	std::string write_material_metadata(const MaterialInfo* info, int version);
 }
\ No newline at end of file
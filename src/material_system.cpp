@@ -295,6 +295,61 @@ vkutil::Material* vkutil::MaterialSystem::get_material(const std::string& materi
 	}
 }
 
+void vkutil::MaterialSystem::replace_texture_views(const std::unordered_map<VkImageView, VkImageView>& replacements)
+{
+	//the cache is keyed by the views too, changed materials get inserted again under their new data
+	std::vector<std::pair<MaterialData, Material*>> changed;
+
+	for (auto it = materialCache.begin(); it != materialCache.end();)
+	{
+		Material* mat = it->second;
+
+		std::vector<VkWriteDescriptorSet> writes;
+		std::vector<VkDescriptorImageInfo> imageInfos(mat->textures.size());
+		for (int i = 0; i < mat->textures.size(); i++)
+		{
+			auto replacement = replacements.find(mat->textures[i].view);
+			if (replacement == replacements.end()) continue;
+
+			mat->textures[i].view = replacement->second;
+
+			imageInfos[i].sampler = mat->textures[i].sampler;
+			imageInfos[i].imageView = replacement->second;
+			imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+			for (MeshpassType pass : { MeshpassType::Forward, MeshpassType::Transparency })
+			{
+				VkWriteDescriptorSet write = {};
+				write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				write.dstSet = mat->passSets[pass];
+				write.dstBinding = i;
+				write.descriptorCount = 1;
+				write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+				write.pImageInfo = &imageInfos[i];
+				writes.push_back(write);
+			}
+		}
+
+		if (writes.empty())
+		{
+			++it;
+			continue;
+		}
+
+		vkUpdateDescriptorSets(engine->_device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+
+		MaterialData data = it->first;
+		data.textures = mat->textures;
+		changed.push_back({ std::move(data), mat });
+		it = materialCache.erase(it);
+	}
+
+	for (auto& [data, mat] : changed)
+	{
+		materialCache[data] = mat;
+	}
+}
+
 void vkutil::MaterialSystem::fill_builders()
 {
 	{
@@ -144,6 +144,10 @@ namespace vkutil {
 
 		Material* build_material(const std::string& materialName, const MaterialData& info);
 		Material* get_material(const std::string& materialName);
+
+		//points every material sampling one of the old views at its replacement, rewriting their descriptor sets in place.
+		//the sets must not be in use by any frame still in flight
+		void replace_texture_views(const std::unordered_map<VkImageView, VkImageView>& replacements);
 		
 		void fill_builders();
 	private:
@@ -1,8 +1,25 @@
 #include "mesh_asset.h"
-
-#include "lz4.h"
+#include "asset_metadata.h"
 
 #include <nlohmann/json.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace {
+	//fixed part of the binary metadata, followed by the original file string
+	struct MeshMetadata {
+		uint64_t vertexBuferSize;
+		uint64_t indexBuferSize;
+		assets::MeshBounds bounds;
+		uint32_t vertexFormat;
+		uint32_t compressionMode;
+		uint32_t indexSize;
+	};
+}
+
+//written to disk as it is
+static_assert(sizeof(MeshMetadata) == 56, "mesh metadata layout changed");
 
 
 assets::VertexFormat parse_format(const char* f) {
@@ -15,6 +32,10 @@ assets::VertexFormat parse_format(const char* f) {
 	{
 		return assets::VertexFormat::P32N8C8V16;
 	}
+	else if (strcmp(f, "P16N8C8V16") == 0)
+	{
+		return assets::VertexFormat::P16N8C8V16;
+	}
 	else
 	{
 		return assets::VertexFormat::Unknown;
@@ -22,10 +43,77 @@ assets::VertexFormat parse_format(const char* f) {
 }
 
 assets::MeshInfo assets::read_mesh_info(AssetFile* file)
+{
+	return read_mesh_info(file->version, std::string_view{ file->json });
+}
+
+assets::MeshInfo assets::read_mesh_info(const MappedAssetFile* file)
+{
+	return read_mesh_info(file->version, file->json);
+}
+
+assets::MeshInfo assets::read_mesh_info(int version, std::string_view json)
 {
 	MeshInfo info;
 
-	nlohmann::json metadata = nlohmann::json::parse(file->json);
+	//compressed metadata decodes into this, and json points at it from here on
+	std::string decompressed;
+	if (!decompress_metadata(version, json, decompressed))
+	{
+		std::cout << "Corrupted mesh metadata" << std::endl;
+		return MeshInfo{};
+	}
+
+	if (version >= ASSET_VERSION_BINARY)
+	{
+		MetadataReader reader{ json };
+
+		MeshMetadata metadata;
+		reader.read(metadata);
+		std::string_view originalFile = reader.read_string();
+
+		//lod ranges and then clusters were appended later, files written before stop early
+		uint32_t lodCount = 0;
+		if (reader.ok && reader.cursor < reader.data.size())
+		{
+			reader.read(lodCount);
+			const char* lodData = reader.read_bytes(size_t(lodCount) * sizeof(MeshLod));
+			if (lodData)
+			{
+				info.lods.resize(lodCount);
+				memcpy(info.lods.data(), lodData, size_t(lodCount) * sizeof(MeshLod));
+			}
+		}
+
+		uint32_t clusterCount = 0;
+		if (reader.ok && reader.cursor < reader.data.size())
+		{
+			reader.read(clusterCount);
+			const char* clusterData = reader.read_bytes(size_t(clusterCount) * sizeof(MeshCluster));
+			if (clusterData)
+			{
+				info.clusters.resize(clusterCount);
+				memcpy(info.clusters.data(), clusterData, size_t(clusterCount) * sizeof(MeshCluster));
+			}
+		}
+
+		if (!reader.ok)
+		{
+			std::cout << "Corrupted mesh metadata" << std::endl;
+			return MeshInfo{};
+		}
+
+		info.vertexBuferSize = metadata.vertexBuferSize;
+		info.indexBuferSize = metadata.indexBuferSize;
+		info.bounds = metadata.bounds;
+		info.vertexFormat = static_cast<VertexFormat>(metadata.vertexFormat);
+		info.compressionMode = static_cast<CompressionMode>(metadata.compressionMode);
+		info.indexSize = static_cast<char>(metadata.indexSize);
+		info.originalFile = originalFile;
+		return info;
+	}
+
+	nlohmann::json metadata = nlohmann::json::parse(json);
 
 	
 	info.vertexBuferSize = metadata["vertex_buffer_size"];		
@@ -52,37 +140,293 @@ assets::MeshInfo assets::read_mesh_info(AssetFile* file)
 
 	std::string vertexFormat = metadata["vertex_format"];
 	info.vertexFormat = parse_format(vertexFormat.c_str());
+
+	if (metadata.contains("lods"))
+	{
+		//flat pairs of first index and index count
+		std::vector<uint32_t> lodData = metadata["lods"].get<std::vector<uint32_t>>();
+		for (size_t i = 0; i + 1 < lodData.size(); i += 2)
+		{
+			info.lods.push_back({ lodData[i], lodData[i + 1] });
+		}
+	}
+
+	if (metadata.contains("clusters"))
+	{
+		for (auto& c : metadata["clusters"])
+		{
+			MeshCluster cluster;
+			cluster.firstIndex = c["first_index"];
+			cluster.indexCount = c["index_count"];
+
+			std::vector<float> sphere = c["sphere"].get<std::vector<float>>();
+			std::vector<float> cone = c["cone"].get<std::vector<float>>();
+			for (int i = 0; i < 3; i++)
+			{
+				cluster.center[i] = sphere[i];
+				cluster.coneAxis[i] = cone[i];
+			}
+			cluster.radius = sphere[3];
+			cluster.coneCutoff = cone[3];
+			info.clusters.push_back(cluster);
+		}
+	}
     return info;
 }
 
-void assets::unpack_mesh(MeshInfo* info, const char* sourcebuffer, size_t sourceSize, char* vertexBufer, char* indexBuffer)
+bool assets::unpack_mesh(MeshInfo* info, const char* sourcebuffer, size_t sourceSize, char* vertexBufer, char* indexBuffer)
 {
-	//decompressing into temporal vector. TODO: streaming decompress directly on the buffers
+	//decompressing into temporal vector. unpack_mesh_contiguous decodes without it when the caller can take both buffers in one allocation
 	std::vector<char> decompressedBuffer;
 	decompressedBuffer.resize(info->vertexBuferSize + info->indexBuferSize);
 
-	LZ4_decompress_safe(sourcebuffer, decompressedBuffer.data(), static_cast<int>(sourceSize), static_cast<int>(decompressedBuffer.size()));
+	if (!decompress_block(info->compressionMode, sourcebuffer, sourceSize, decompressedBuffer.data(), decompressedBuffer.size()))
+	{
+		return false;
+	}
 
 	//copy vertex buffer
 	memcpy(vertexBufer, decompressedBuffer.data(), info->vertexBuferSize);
 
 	//copy index buffer
 	memcpy(indexBuffer, decompressedBuffer.data() + info->vertexBuferSize, info->indexBuferSize);
+	return true;
+}
+
+bool assets::unpack_mesh_contiguous(MeshInfo* info, const char* sourcebuffer, size_t sourceSize, char* destination)
+{
+	size_t decompressedSize = info->vertexBuferSize + info->indexBuferSize;
+
+	return decompress_block(info->compressionMode, sourcebuffer, sourceSize, destination, decompressedSize);
+}
+
+size_t assets::vertex_format_size(VertexFormat format)
+{
+	switch (format)
+	{
+	case VertexFormat::PNCV_F32:
+		return sizeof(Vertex_f32_PNCV);
+	case VertexFormat::P32N8C8V16:
+		return sizeof(Vertex_P32N8C8V16);
+	case VertexFormat::P16N8C8V16:
+		return sizeof(Vertex_P16N8C8V16);
+	default:
+		return 0;
+	}
+}
+
+assets::PositionQuantization assets::get_position_quantization(const MeshBounds& bounds)
+{
+	PositionQuantization quantization;
+	float size = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		quantization.offset[i] = bounds.origin[i] - bounds.extents[i];
+		size = std::max(size, bounds.extents[i] * 2);
+	}
+	//flat or empty meshes still need a valid scale
+	quantization.scale = size > 0 ? size : 1.f;
+	return quantization;
+}
+
+uint16_t assets::float_to_half(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(float));
+
+	uint32_t sign = (bits >> 16) & 0x8000;
+	uint32_t floatExponent = (bits >> 23) & 0xff;
+	uint32_t mantissa = bits & 0x7fffff;
+	int32_t exponent = int32_t(floatExponent) - 127 + 15;
+
+	//infinity and nan
+	if (floatExponent == 0xff) return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+	//too big, becomes infinity
+	if (exponent >= 31) return static_cast<uint16_t>(sign | 0x7c00);
+
+	if (exponent <= 0)
+	{
+		//too small even for a denormal
+		if (exponent < -10) return static_cast<uint16_t>(sign);
+
+		mantissa |= 0x800000;
+		uint32_t shift = 14 - exponent;
+		uint32_t half = mantissa >> shift;
+		//round to nearest
+		if ((mantissa >> (shift - 1)) & 1) half++;
+		return static_cast<uint16_t>(sign | half);
+	}
+
+	uint32_t half = sign | (uint32_t(exponent) << 10) | (mantissa >> 13);
+	//round to nearest, a carry out of the mantissa correctly bumps the exponent
+	if (mantissa & 0x1000) half++;
+	return static_cast<uint16_t>(half);
+}
+
+void assets::oct_normal_encode(const float normal[3], uint8_t result[2])
+{
+	float length = std::abs(normal[0]) + std::abs(normal[1]) + std::abs(normal[2]);
+	float n[3] = { normal[0], normal[1], normal[2] };
+	if (length > 0)
+	{
+		n[0] /= length;
+		n[1] /= length;
+		n[2] /= length;
+	}
+
+	float x = n[0];
+	float y = n[1];
+	if (n[2] < 0)
+	{
+		x = (1.0f - std::abs(n[1])) * (n[0] >= 0.0f ? 1.0f : -1.0f);
+		y = (1.0f - std::abs(n[0])) * (n[1] >= 0.0f ? 1.0f : -1.0f);
+	}
+
+	result[0] = uint8_t((x * 0.5f + 0.5f) * 255);
+	result[1] = uint8_t((y * 0.5f + 0.5f) * 255);
+}
+
+namespace {
+	uint16_t quantize_unorm16(float value)
+	{
+		value = std::min(std::max(value, 0.f), 1.f);
+		return static_cast<uint16_t>(value * 65535.f + 0.5f);
+	}
+
+	void quantize_position(const float position[3], const assets::PositionQuantization& quantization, uint16_t result[3])
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			result[i] = quantize_unorm16((position[i] - quantization.offset[i]) / quantization.scale);
+		}
+	}
+}
+
+void assets::quantize_vertices(VertexFormat format, const char* source, size_t count, const PositionQuantization& quantization, Vertex_P16N8C8V16* destination)
+{
+	//every source vertex is copied out before its destination is written, and destination i never reaches past source i,
+	//so walking forward is safe when both point at the same memory
+	if (format == VertexFormat::PNCV_F32)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			Vertex_f32_PNCV unpacked;
+			memcpy(&unpacked, source + i * sizeof(Vertex_f32_PNCV), sizeof(Vertex_f32_PNCV));
+
+			Vertex_P16N8C8V16 vert;
+			quantize_position(unpacked.position, quantization, vert.position);
+			assets::oct_normal_encode(unpacked.normal, vert.oct_normal);
+			for (int c = 0; c < 3; c++)
+			{
+				vert.color[c] = static_cast<uint8_t>(unpacked.color[c] * 255);
+			}
+			vert.color[3] = 255;
+			vert.uv[0] = float_to_half(unpacked.uv[0]);
+			vert.uv[1] = float_to_half(unpacked.uv[1]);
+
+			memcpy(destination + i, &vert, sizeof(Vertex_P16N8C8V16));
+		}
+	}
+	else if (format == VertexFormat::P32N8C8V16)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			Vertex_P32N8C8V16 unpacked;
+			memcpy(&unpacked, source + i * sizeof(Vertex_P32N8C8V16), sizeof(Vertex_P32N8C8V16));
+
+			Vertex_P16N8C8V16 vert;
+			quantize_position(unpacked.position, quantization, vert.position);
+
+			float normal[3] = { float(unpacked.normal[0]), float(unpacked.normal[1]), float(unpacked.normal[2]) };
+			assets::oct_normal_encode(normal, vert.oct_normal);
+
+			for (int c = 0; c < 3; c++)
+			{
+				vert.color[c] = unpacked.color[c];
+			}
+			vert.color[3] = 255;
+			vert.uv[0] = float_to_half(unpacked.uv[0]);
+			vert.uv[1] = float_to_half(unpacked.uv[1]);
+
+			memcpy(destination + i, &vert, sizeof(Vertex_P16N8C8V16));
+		}
+	}
+	else if (format == VertexFormat::P16N8C8V16)
+	{
+		memmove(destination, source, count * sizeof(Vertex_P16N8C8V16));
+	}
 }
 
-assets::AssetFile assets::pack_mesh(MeshInfo* info, char* vertexData, char* indexData)
+assets::AssetFile assets::pack_mesh(MeshInfo* info, char* vertexData, char* indexData, const CompressionSettings& compression)
 {
     AssetFile file;
 	file.type[0] = 'M';
 	file.type[1] = 'E';
 	file.type[2] = 'S';
 	file.type[3] = 'H';
-	file.version = 1;
+	file.version = ASSET_VERSION_BINARY;
+
+	size_t fullsize = info->vertexBuferSize + info->indexBuferSize;
+
+	std::vector<char> merged_buffer;
+	merged_buffer.resize(fullsize);
+
+	//copy vertex buffer
+	memcpy(merged_buffer.data(), vertexData, info->vertexBuferSize);
+
+	//copy index buffer
+	memcpy(merged_buffer.data() + info->vertexBuferSize, indexData, info->indexBuferSize);
+
+
+	//compress buffer and copy it into the file struct
+	size_t compressStaging = compress_bound(compression.mode, fullsize);
+
+	file.binaryBlob.resize(compressStaging);
+
+	size_t compressedSize = compress_block(compression, merged_buffer.data(), merged_buffer.size(), file.binaryBlob.data(), compressStaging);
+	file.binaryBlob.resize(compressedSize);
+
+	info->compressionMode = compression.mode;
+
+	file.json = write_mesh_metadata(info, file.version);
+
+	return file;
+}
+
+std::string assets::write_mesh_metadata(const MeshInfo* info, int version)
+{
+	if (version >= ASSET_VERSION_BINARY)
+	{
+		MeshMetadata metadata{};
+		metadata.vertexBuferSize = info->vertexBuferSize;
+		metadata.indexBuferSize = info->indexBuferSize;
+		metadata.bounds = info->bounds;
+		metadata.vertexFormat = static_cast<uint32_t>(info->vertexFormat);
+		metadata.compressionMode = static_cast<uint32_t>(info->compressionMode);
+		metadata.indexSize = static_cast<uint32_t>(info->indexSize);
+
+		MetadataWriter writer;
+		writer.write(metadata);
+		writer.write_string(info->originalFile);
+		if (!info->lods.empty() || !info->clusters.empty())
+		{
+			writer.write(static_cast<uint32_t>(info->lods.size()));
+			writer.write_array(info->lods.data(), info->lods.size());
+
+			writer.write(static_cast<uint32_t>(info->clusters.size()));
+			writer.write_array(info->clusters.data(), info->clusters.size());
+		}
+		return writer.data;
+	}
 
 	nlohmann::json metadata;
 	if (info->vertexFormat == VertexFormat::P32N8C8V16) {
 		metadata["vertex_format"] = "P32N8C8V16";
 	}
+	else if (info->vertexFormat == VertexFormat::P16N8C8V16)
+	{
+		metadata["vertex_format"] = "P16N8C8V16";
+	}
 	else if (info->vertexFormat == VertexFormat::PNCV_F32)
 	{
 		metadata["vertex_format"] = "PNCV_F32";
@@ -107,31 +451,35 @@ assets::AssetFile assets::pack_mesh(MeshInfo* info, char* vertexData, char* inde
 
 	metadata["bounds"] = boundsData;
 
-	size_t fullsize = info->vertexBuferSize + info->indexBuferSize;
-
-	std::vector<char> merged_buffer;
-	merged_buffer.resize(fullsize);
-
-	//copy vertex buffer
-	memcpy(merged_buffer.data(), vertexData, info->vertexBuferSize);
-
-	//copy index buffer
-	memcpy(merged_buffer.data() + info->vertexBuferSize, indexData, info->indexBuferSize);
-
-
-	//compress buffer and copy it into the file struct
-	size_t compressStaging = LZ4_compressBound(static_cast<int>(fullsize));
-
-	file.binaryBlob.resize(compressStaging);
-
-	int compressedSize = LZ4_compress_default(merged_buffer.data(), file.binaryBlob.data(), static_cast<int>(merged_buffer.size()), static_cast<int>(compressStaging));
-	file.binaryBlob.resize(compressedSize);
+	if (!info->lods.empty())
+	{
+		std::vector<uint32_t> lodData;
+		for (const MeshLod& lod : info->lods)
+		{
+			lodData.push_back(lod.firstIndex);
+			lodData.push_back(lod.indexCount);
+		}
+		metadata["lods"] = lodData;
+	}
 
-	metadata["compression"] = "LZ4";
+	if (!info->clusters.empty())
+	{
+		nlohmann::json clusters = nlohmann::json::array();
+		for (const MeshCluster& cluster : info->clusters)
+		{
+			nlohmann::json c;
+			c["first_index"] = cluster.firstIndex;
+			c["index_count"] = cluster.indexCount;
+			c["sphere"] = { cluster.center[0], cluster.center[1], cluster.center[2], cluster.radius };
+			c["cone"] = { cluster.coneAxis[0], cluster.coneAxis[1], cluster.coneAxis[2], cluster.coneCutoff };
+			clusters.push_back(c);
+		}
+		metadata["clusters"] = clusters;
+	}
 
-	file.json = metadata.dump();
+	metadata["compression"] = compression_name(info->compressionMode);
 
-	return file;
+	return metadata.dump();
 }
 
 assets::MeshBounds assets::calculateBounds(Vertex_f32_PNCV* vertices, size_t count)
@@ -1,5 +1,6 @@
 #pragma once
 #include <asset_loader.h>
+#include <asset_compression.h>
 
 
 namespace assets {
@@ -20,13 +21,24 @@ namespace assets {
 		float uv[2];
 	};
 
+	//16 byte vertex, also the layout the engine renders with.
+	//position is 16 bit unorm inside the mesh bounds (see get_position_quantization), normal is octahedral encoded, uvs are half floats
+	struct Vertex_P16N8C8V16 {
+
+		uint16_t position[3];
+		uint8_t oct_normal[2];
+		uint8_t color[4]; //alpha unused, keeps the uvs 4 byte aligned
+		uint16_t uv[2];
+	};
+
 
 
 	enum class VertexFormat : uint32_t
 	{
 		Unknown = 0,
 		PNCV_F32, //everything at 32 bits
-		P32N8C8V16 //position at 32 bits, normal at 8 bits, color at 8 bits, uvs at 16 bits float
+		P32N8C8V16, //position at 32 bits, normal at 8 bits, color at 8 bits, uvs at 32 bits float despite the name
+		P16N8C8V16 //quantized position at 16 bits, octahedral normal at 8 bits, color at 8 bits, uvs at 16 bits float
 	};
 
 	struct MeshBounds {
@@ -37,6 +49,30 @@ namespace assets {
 	};
 
 
+	//maps quantized positions back to mesh space: position = offset + unorm * scale.
+	//the scale is the same on every axis so dequantizing is a uniform scale that leaves normals valid
+	struct PositionQuantization {
+		float offset[3];
+		float scale;
+	};
+
+	//range of the index buffer that draws one level of detail, in indices. All levels share the vertex buffer
+	struct MeshLod {
+		uint32_t firstIndex;
+		uint32_t indexCount;
+	};
+
+	//run of triangles of the most detailed level that gets culled as a unit. Bounds are in mesh space.
+	//the cone axis is the average facing of the triangles, with a cutoff of 1 when they face too many ways to be culled by it
+	struct MeshCluster {
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		float center[3];
+		float radius;
+		float coneAxis[3];
+		float coneCutoff;
+	};
+
 	struct MeshInfo {
 		uint64_t vertexBuferSize;
 		uint64_t indexBuferSize;
@@ -45,13 +81,42 @@ namespace assets {
 		char indexSize;
 		CompressionMode compressionMode;
 		std::string originalFile;
+		//from the most to the least detailed. Empty when the whole index buffer is the only level
+		std::vector<MeshLod> lods;
+		//empty for meshes that are only culled as a whole
+		std::vector<MeshCluster> clusters;
 	};
 
 	MeshInfo read_mesh_info(AssetFile* file);
+	MeshInfo read_mesh_info(const MappedAssetFile* file);
+	MeshInfo read_mesh_info(int version, std::string_view metadata);
+
+	//false when the blob is corrupted or its dictionary is missing, the buffers hold garbage then
+	bool unpack_mesh(MeshInfo* info, const char* sourcebuffer, size_t sourceSize, char* vertexBufer, char* indexBuffer);
+
+	//decodes vertices followed by indices straight into a single destination of vertexBuferSize + indexBuferSize bytes, without intermediate copies.
+	//false like unpack_mesh
+	bool unpack_mesh_contiguous(MeshInfo* info, const char* sourcebuffer, size_t sourceSize, char* destination);
+
+	//size in bytes of a single vertex of the given format, 0 for unknown formats
+	size_t vertex_format_size(VertexFormat format);
+
+	//quantization of the positions of a mesh with the given bounds, the cube at the bounds minimum that spans the largest axis
+	PositionQuantization get_position_quantization(const MeshBounds& bounds);
+
+	//converts vertices of any format into P16N8C8V16. Destination can alias the source, as no format is smaller
+	void quantize_vertices(VertexFormat format, const char* source, size_t count, const PositionQuantization& quantization, Vertex_P16N8C8V16* destination);
+
+	uint16_t float_to_half(float value);
+
+	//octahedral normal in [0,1] at 8 bits per axis, the mapping the vertex shaders decode. The only encoder, the engine vertices use it too
+	void oct_normal_encode(const float normal[3], uint8_t result[2]);
 
-	void unpack_mesh(MeshInfo* info, const char* sourcebuffer, size_t sourceSize, char* vertexBufer, char* indexBuffer);
+	//vertices and indices are compressed as one block with the given codec, which is recorded in info
+	AssetFile pack_mesh(MeshInfo* info, char* vertexData, char* indexData, const CompressionSettings& compression = {});
 
-	AssetFile pack_mesh(MeshInfo* info, char* vertexData, char* indexData);
+	//metadata block of the given asset file version, as stored in AssetFile.json
+	std::string write_mesh_metadata(const MeshInfo* info, int version);
 
 	MeshBounds calculateBounds(Vertex_f32_PNCV* vertices, size_t count);
 }
\ No newline at end of file
@@ -1,25 +1,265 @@
 #include "prefab_asset.h"
+#include "asset_compression.h"
+#include "asset_metadata.h"
 #include <nlohmann/json.hpp>
-#include "lz4.h"
+#include <algorithm>
+#include <iostream>
+
+namespace {
+	//fixed part of the binary metadata, followed by one array per node map and the string table they point into
+	struct PrefabMetadata {
+		uint32_t matrixCount;
+		uint32_t nameCount;
+		uint32_t parentCount;
+		uint32_t meshCount;
+		uint32_t stringsSize;
+	};
+
+	struct NodeMatrix {
+		uint64_t node;
+		uint64_t matrix;
+	};
+
+	struct NodeParent {
+		uint64_t node;
+		uint64_t parent;
+	};
+
+	struct NodeName {
+		uint64_t node;
+		uint32_t nameOffset;
+		uint32_t nameLength;
+	};
+
+	struct NodeMesh {
+		uint64_t node;
+		uint32_t meshPathOffset;
+		uint32_t meshPathLength;
+		uint32_t materialPathOffset;
+		uint32_t materialPathLength;
+	};
+
+	//flattened layout, after the string table. Files that have it leave the node id arrays above empty
+	struct FlatPrefabMetadata {
+		uint32_t nodeCount;
+		uint32_t meshCount;
+	};
+
+	struct FlatNode {
+		int32_t parent;
+		uint32_t matrix;
+		int32_t mesh;
+		uint32_t nameOffset;
+		uint32_t nameLength;
+	};
+
+	struct FlatMesh {
+		uint32_t meshPathOffset;
+		uint32_t meshPathLength;
+		uint32_t materialPathOffset;
+		uint32_t materialPathLength;
+	};
+
+	template<typename T>
+	const char* read_node_array(assets::MetadataReader& reader, uint32_t count)
+	{
+		return reader.read_bytes(size_t(count) * sizeof(T));
+	}
+
+	template<typename T>
+	T node_at(const char* array, uint32_t index)
+	{
+		T value;
+		memcpy(&value, array + size_t(index) * sizeof(T), sizeof(T));
+		return value;
+	}
+
+	//the loader resolves parents in a single pass, nodes that point forward or out of range would break it
+	bool valid_node(const assets::PrefabInfo::Node& node, size_t index, size_t meshCount, size_t matrixCount)
+	{
+		return node.parent >= -1 && node.parent < static_cast<int64_t>(index)
+			&& node.mesh >= -1 && node.mesh < static_cast<int64_t>(meshCount)
+			&& node.matrix < matrixCount;
+	}
+}
+
+//written to disk and read back in place, as they are
+static_assert(sizeof(PrefabMetadata) == 20, "prefab metadata layout changed");
+static_assert(sizeof(NodeMatrix) == 16, "prefab node matrix layout changed");
+static_assert(sizeof(NodeParent) == 16, "prefab node parent layout changed");
+static_assert(sizeof(NodeName) == 16, "prefab node name layout changed");
+static_assert(sizeof(NodeMesh) == 24, "prefab node mesh layout changed");
+static_assert(sizeof(FlatPrefabMetadata) == 8, "flat prefab metadata layout changed");
+static_assert(sizeof(FlatNode) == 20, "flat prefab node layout changed");
+static_assert(sizeof(FlatMesh) == 16, "flat prefab mesh layout changed");
 
 assets::PrefabInfo assets::read_prefab_info(AssetFile* file)
+{
+	return read_prefab_info(file->version, std::string_view{ file->json }, file->binaryBlob.data(), file->binaryBlob.size());
+}
+
+assets::PrefabInfo assets::read_prefab_info(const MappedAssetFile* file)
+{
+	return read_prefab_info(file->version, file->json, file->binaryBlob, file->binaryBlobSize);
+}
+
+assets::PrefabInfo assets::read_prefab_info(int version, std::string_view json, const char* binaryBlob, size_t binaryBlobSize)
 {
 	PrefabInfo info;
-	nlohmann::json prefab_metadata = nlohmann::json::parse(file->json);
+
+	//compressed metadata decodes into this, and json points at it from here on
+	std::string decompressed;
+	if (!decompress_metadata(version, json, decompressed))
+	{
+		std::cout << "Corrupted prefab metadata" << std::endl;
+		return PrefabInfo{};
+	}
+
+	size_t nmatrices = binaryBlobSize / (sizeof(float) * 16);
+	info.matrices.resize(nmatrices);
+
+	memcpy(info.matrices.data(), binaryBlob, nmatrices * sizeof(float) * 16);
+
+	if (version >= ASSET_VERSION_BINARY)
+	{
+		MetadataReader reader{ json };
+
+		PrefabMetadata metadata;
+		reader.read(metadata);
+		const char* matrices = read_node_array<NodeMatrix>(reader, metadata.matrixCount);
+		const char* names = read_node_array<NodeName>(reader, metadata.nameCount);
+		const char* parents = read_node_array<NodeParent>(reader, metadata.parentCount);
+		const char* meshes = read_node_array<NodeMesh>(reader, metadata.meshCount);
+		const char* strings = reader.read_bytes(metadata.stringsSize);
+
+		if (!reader.ok)
+		{
+			std::cout << "Corrupted prefab metadata" << std::endl;
+			return PrefabInfo{};
+		}
+
+		auto string_at = [&](uint32_t offset, uint32_t length) {
+			return offset + size_t(length) <= metadata.stringsSize ? std::string_view(strings + offset, length) : std::string_view{};
+		};
+
+		//the flattened nodes follow the string table
+		if (reader.cursor < reader.data.size())
+		{
+			FlatPrefabMetadata flat;
+			reader.read(flat);
+			const char* flatNodes = read_node_array<FlatNode>(reader, flat.nodeCount);
+			const char* flatMeshes = read_node_array<FlatMesh>(reader, flat.meshCount);
+
+			if (!reader.ok)
+			{
+				std::cout << "Corrupted prefab metadata" << std::endl;
+				return PrefabInfo{};
+			}
+
+			info.nodes.resize(flat.nodeCount);
+			info.node_names.resize(flat.nodeCount);
+			for (uint32_t i = 0; i < flat.nodeCount; i++)
+			{
+				FlatNode node = node_at<FlatNode>(flatNodes, i);
+
+				info.nodes[i] = { node.parent, node.matrix, node.mesh };
+				if (!valid_node(info.nodes[i], i, flat.meshCount, nmatrices))
+				{
+					std::cout << "Corrupted prefab metadata" << std::endl;
+					return PrefabInfo{};
+				}
+				info.node_names[i] = string_at(node.nameOffset, node.nameLength);
+			}
+
+			info.meshes.resize(flat.meshCount);
+			for (uint32_t i = 0; i < flat.meshCount; i++)
+			{
+				FlatMesh mesh = node_at<FlatMesh>(flatMeshes, i);
+				info.meshes[i].mesh_path = string_at(mesh.meshPathOffset, mesh.meshPathLength);
+				info.meshes[i].material_path = string_at(mesh.materialPathOffset, mesh.materialPathLength);
+			}
+
+			return info;
+		}
+
+		LegacyPrefabNodes legacy;
+
+		legacy.node_matrices.reserve(metadata.matrixCount);
+		for (uint32_t i = 0; i < metadata.matrixCount; i++)
+		{
+			NodeMatrix node = node_at<NodeMatrix>(matrices, i);
+			legacy.node_matrices[node.node] = static_cast<int>(node.matrix);
+		}
+
+		legacy.node_names.reserve(metadata.nameCount);
+		for (uint32_t i = 0; i < metadata.nameCount; i++)
+		{
+			NodeName node = node_at<NodeName>(names, i);
+			legacy.node_names[node.node] = string_at(node.nameOffset, node.nameLength);
+		}
+
+		legacy.node_parents.reserve(metadata.parentCount);
+		for (uint32_t i = 0; i < metadata.parentCount; i++)
+		{
+			NodeParent node = node_at<NodeParent>(parents, i);
+			legacy.node_parents[node.node] = node.parent;
+		}
+
+		legacy.node_meshes.reserve(metadata.meshCount);
+		for (uint32_t i = 0; i < metadata.meshCount; i++)
+		{
+			NodeMesh node = node_at<NodeMesh>(meshes, i);
+
+			PrefabInfo::NodeMesh& mesh = legacy.node_meshes[node.node];
+			mesh.mesh_path = string_at(node.meshPathOffset, node.meshPathLength);
+			mesh.material_path = string_at(node.materialPathOffset, node.materialPathLength);
+		}
+
+		flatten_prefab_nodes(legacy, info);
+		return info;
+	}
+
+	nlohmann::json prefab_metadata = nlohmann::json::parse(json);
+
+	if (prefab_metadata.contains("nodes"))
+	{
+		for (auto& mesh : prefab_metadata["meshes"])
+		{
+			info.meshes.push_back({ mesh["material_path"].get<std::string>(), mesh["mesh_path"].get<std::string>() });
+		}
+
+		for (auto& node : prefab_metadata["nodes"])
+		{
+			PrefabInfo::Node flat{ node[0].get<int32_t>(), node[1].get<uint32_t>(), node[2].get<int32_t>() };
+			if (!valid_node(flat, info.nodes.size(), info.meshes.size(), nmatrices))
+			{
+				std::cout << "Corrupted prefab metadata" << std::endl;
+				return PrefabInfo{};
+			}
+			info.nodes.push_back(flat);
+		}
+
+		//parallel to the nodes, like the binary layout has them
+		info.node_names = prefab_metadata["names"].get<std::vector<std::string>>();
+		info.node_names.resize(info.nodes.size());
+		return info;
+	}
+
+	LegacyPrefabNodes legacy;
 
 	//info.node_matrices = std::unordered_map<uint64_t,int>(prefab_metadata["node_matrices"]) ;
 	for (auto pair : prefab_metadata["node_matrices"].items())
 	{
 		auto value = pair.value();
 		auto k = pair.key();
-		info.node_matrices[value[0]] = value[1];
+		legacy.node_matrices[value[0]] = value[1];
 	}
 
 	//info.node_names = std::unordered_map<uint64_t, std::string>(prefab_metadata["node_names"]);
 	//auto nodenames =;
 	for (auto& [key, value]  : prefab_metadata["node_names"].items())
 	{
-		info.node_names[value[0]] = value[1];
+		legacy.node_names[value[0]] = value[1];
 	}
 
 	//info.node_parents = std::unordered_map<uint64_t, uint64_t>(prefab_metadata["node_parents"]);
@@ -27,7 +267,7 @@ assets::PrefabInfo assets::read_prefab_info(AssetFile* file)
 	for (auto& [key, value] : prefab_metadata["node_parents"].items())
 	{
 
-		info.node_parents[value[0]] = value[1];
+		legacy.node_parents[value[0]] = value[1];
 	}
 
 	std::unordered_map<uint64_t, nlohmann::json> meshnodes = prefab_metadata["node_meshes"];
@@ -38,50 +278,210 @@ assets::PrefabInfo assets::read_prefab_info(AssetFile* file)
 		node.mesh_path = pair.second["mesh_path"];
 		node.material_path = pair.second["material_path"];
 
-		info.node_meshes[pair.first] = node;
+		legacy.node_meshes[pair.first] = node;
 	}
 
-
-	size_t nmatrices = file->binaryBlob.size() / (sizeof(float) * 16);
-	info.matrices.resize(nmatrices);
-
-	memcpy(info.matrices.data(),file->binaryBlob.data(), file->binaryBlob.size());
-
+	flatten_prefab_nodes(legacy, info);
 	return info;
 }
 
 assets::AssetFile assets::pack_prefab(const PrefabInfo& info)
 {
-	nlohmann::json prefab_metadata;
-	prefab_metadata["node_matrices"] = info.node_matrices;
-	prefab_metadata["node_names"]    = info.node_names;
-	prefab_metadata["node_parents"]  = info.node_parents;
-
-	std::unordered_map<uint64_t, nlohmann::json> meshindex;
-	for (auto pair : info.node_meshes)
-	{
-		nlohmann::json meshnode;
-		meshnode["mesh_path"] = pair.second.mesh_path;
-		meshnode["material_path"] = pair.second.material_path;
-		meshindex[pair.first] = meshnode;
-	}
-
-	prefab_metadata["node_meshes"] = meshindex;
-
 	//core file header
 	AssetFile file;
 	file.type[0] = 'P';
 	file.type[1] = 'R';
 	file.type[2] = 'F';
 	file.type[3] = 'B';
-	file.version = 1;
+	file.version = ASSET_VERSION_BINARY;
 
 	file.binaryBlob.resize(info.matrices.size() * sizeof(float) * 16);
 	memcpy(file.binaryBlob.data(), info.matrices.data(), info.matrices.size() * sizeof(float) * 16);
 
-	std::string stringified = prefab_metadata.dump();
-	file.json = stringified;
-
+	file.json = write_prefab_metadata(info, file.version);
 
 	return file;
 }
+
+std::string assets::write_prefab_metadata(const PrefabInfo& info, int version)
+{
+	if (version >= ASSET_VERSION_BINARY)
+	{
+		std::string strings;
+		auto add_string = [&](const std::string& str) {
+			uint32_t offset = static_cast<uint32_t>(strings.size());
+			strings += str;
+			return offset;
+		};
+
+		std::vector<FlatNode> nodes;
+		nodes.reserve(info.nodes.size());
+		for (size_t i = 0; i < info.nodes.size(); i++)
+		{
+			const PrefabInfo::Node& node = info.nodes[i];
+			const std::string& name = i < info.node_names.size() ? info.node_names[i] : std::string{};
+			nodes.push_back({ node.parent, node.matrix, node.mesh, add_string(name), static_cast<uint32_t>(name.size()) });
+		}
+
+		std::vector<FlatMesh> meshes;
+		meshes.reserve(info.meshes.size());
+		for (const PrefabInfo::NodeMesh& mesh : info.meshes)
+		{
+			FlatMesh flatmesh;
+			flatmesh.meshPathOffset = add_string(mesh.mesh_path);
+			flatmesh.meshPathLength = static_cast<uint32_t>(mesh.mesh_path.size());
+			flatmesh.materialPathOffset = add_string(mesh.material_path);
+			flatmesh.materialPathLength = static_cast<uint32_t>(mesh.material_path.size());
+			meshes.push_back(flatmesh);
+		}
+
+		//the node id arrays stay empty, the string table is shared with the flattened part
+		PrefabMetadata metadata{};
+		metadata.stringsSize = static_cast<uint32_t>(strings.size());
+
+		FlatPrefabMetadata flat;
+		flat.nodeCount = static_cast<uint32_t>(nodes.size());
+		flat.meshCount = static_cast<uint32_t>(meshes.size());
+
+		MetadataWriter writer;
+		writer.write(metadata);
+		writer.write_array(strings.data(), strings.size());
+		writer.write(flat);
+		writer.write_array(nodes.data(), nodes.size());
+		writer.write_array(meshes.data(), meshes.size());
+		return writer.data;
+	}
+
+	nlohmann::json prefab_metadata;
+
+	nlohmann::json nodes = nlohmann::json::array();
+	for (const PrefabInfo::Node& node : info.nodes)
+	{
+		nodes.push_back({ node.parent, node.matrix, node.mesh });
+	}
+	prefab_metadata["nodes"] = nodes;
+	prefab_metadata["names"] = info.node_names;
+
+	nlohmann::json meshes = nlohmann::json::array();
+	for (const PrefabInfo::NodeMesh& mesh : info.meshes)
+	{
+		nlohmann::json meshnode;
+		meshnode["mesh_path"] = mesh.mesh_path;
+		meshnode["material_path"] = mesh.material_path;
+		meshes.push_back(meshnode);
+	}
+	prefab_metadata["meshes"] = meshes;
+
+	return prefab_metadata.dump();
+}
+
+void assets::flatten_prefab_nodes(const LegacyPrefabNodes& legacy, PrefabInfo& info)
+{
+	//every node id any of the maps knows about, sorted so the same file always flattens the same way
+	std::vector<uint64_t> ids;
+	for (auto& [node, matrix] : legacy.node_matrices) ids.push_back(node);
+	for (auto& [node, name] : legacy.node_names) ids.push_back(node);
+	for (auto& [node, parent] : legacy.node_parents) ids.push_back(node);
+	for (auto& [node, mesh] : legacy.node_meshes) ids.push_back(node);
+	std::sort(ids.begin(), ids.end());
+	ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+	std::unordered_map<uint64_t, std::vector<uint64_t>> children;
+	std::vector<uint64_t> roots;
+	for (uint64_t node : ids)
+	{
+		auto parent = legacy.node_parents.find(node);
+		if (parent != legacy.node_parents.end() && std::binary_search(ids.begin(), ids.end(), parent->second))
+		{
+			children[parent->second].push_back(node);
+		}
+		else
+		{
+			roots.push_back(node);
+		}
+	}
+
+	//nodes without a matrix of their own sit where their parent is
+	int32_t identity = -1;
+	auto identity_matrix = [&]() {
+		if (identity < 0)
+		{
+			identity = static_cast<int32_t>(info.matrices.size());
+			info.matrices.push_back({ 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f });
+		}
+		return static_cast<uint32_t>(identity);
+	};
+
+	std::unordered_map<std::string, int32_t> meshIndices;
+	//node id of every flattened node, and the other way around
+	std::vector<uint64_t> order;
+	std::unordered_map<uint64_t, int32_t> nodeIndices;
+
+	info.nodes.clear();
+	info.node_names.clear();
+	info.meshes.clear();
+	info.nodes.reserve(ids.size());
+	info.node_names.reserve(ids.size());
+
+	auto add_node = [&](uint64_t node, int32_t parent) {
+		PrefabInfo::Node flat{ parent, 0, -1 };
+
+		auto matrix = legacy.node_matrices.find(node);
+		if (matrix != legacy.node_matrices.end() && matrix->second >= 0 && size_t(matrix->second) < info.matrices.size())
+		{
+			flat.matrix = static_cast<uint32_t>(matrix->second);
+		}
+		else
+		{
+			flat.matrix = identity_matrix();
+		}
+
+		auto mesh = legacy.node_meshes.find(node);
+		if (mesh != legacy.node_meshes.end())
+		{
+			auto [found, inserted] = meshIndices.try_emplace(mesh->second.mesh_path + '\n' + mesh->second.material_path, static_cast<int32_t>(info.meshes.size()));
+			if (inserted)
+			{
+				info.meshes.push_back(mesh->second);
+			}
+			flat.mesh = found->second;
+		}
+
+		auto name = legacy.node_names.find(node);
+		nodeIndices[node] = static_cast<int32_t>(info.nodes.size());
+		order.push_back(node);
+		info.nodes.push_back(flat);
+		info.node_names.push_back(name != legacy.node_names.end() ? name->second : std::string{});
+	};
+
+	//breadth first from every root. Nodes the walk never reaches hang off a cycle, the first of them becomes a root and the walk goes on
+	size_t next = 0;
+	size_t root = 0;
+	size_t unreached = 0;
+	while (info.nodes.size() < ids.size())
+	{
+		if (next == info.nodes.size())
+		{
+			if (root < roots.size())
+			{
+				add_node(roots[root++], -1);
+			}
+			else
+			{
+				while (nodeIndices.count(ids[unreached])) unreached++;
+				add_node(ids[unreached], -1);
+			}
+		}
+
+		auto nodeChildren = children.find(order[next]);
+		if (nodeChildren != children.end())
+		{
+			for (uint64_t child : nodeChildren->second)
+			{
+				//a cycle broken open above already placed its first node
+				if (!nodeIndices.count(child)) add_node(child, static_cast<int32_t>(next));
+			}
+		}
+		next++;
+	}
+}
@@ -1,27 +1,50 @@
 #pragma once
 #include <asset_loader.h>
 #include <unordered_map>
+#include <array>
 
 namespace assets {
 
 	struct PrefabInfo {
-		//points to matrix array in the blob
-		std::unordered_map<uint64_t, int> node_matrices;
-		std::unordered_map<uint64_t, std::string> node_names;
-
-		std::unordered_map<uint64_t, uint64_t> node_parents;
+		//flattened hierarchy, a parent always comes before its children so world matrices resolve front to back in one pass
+		struct Node {
+			int32_t parent; //index into nodes, -1 for roots
+			uint32_t matrix; //local matrix, index into matrices
+			int32_t mesh; //index into meshes, -1 for nodes that only place their children
+		};
 
 		struct NodeMesh {
 			std::string material_path;
 			std::string mesh_path;
 		};
 
-		std::unordered_map<uint64_t, NodeMesh> node_meshes;
+		std::vector<Node> nodes;
+		//parallel to nodes
+		std::vector<std::string> node_names;
+
+		//every mesh and material pair the nodes draw, once
+		std::vector<NodeMesh> meshes;
 
 		std::vector<std::array<float,16>> matrices;
 	};
 
+	//files written before the flattened layout keyed their nodes by id in maps. They get flattened on load
+	struct LegacyPrefabNodes {
+		std::unordered_map<uint64_t, int> node_matrices;
+		std::unordered_map<uint64_t, std::string> node_names;
+		std::unordered_map<uint64_t, uint64_t> node_parents;
+		std::unordered_map<uint64_t, PrefabInfo::NodeMesh> node_meshes;
+	};
+
+	//orders the nodes parents first, nodes whose parent is missing or part of a cycle become roots
+	void flatten_prefab_nodes(const LegacyPrefabNodes& legacy, PrefabInfo& info);
+
 
 	PrefabInfo read_prefab_info(AssetFile* file);
+	PrefabInfo read_prefab_info(const MappedAssetFile* file);
+	PrefabInfo read_prefab_info(int version, std::string_view metadata, const char* binaryBlob, size_t binaryBlobSize);
 	AssetFile pack_prefab(const PrefabInfo& info);
+
+	//metadata block of the given asset file version, as stored in AssetFile.json
+	std::string write_prefab_metadata(const PrefabInfo& info, int version);
 }
\ No newline at end of file
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+//stable LSD radix sort on a 64 bit key with a 32 bit tiebreak, giving the order of a comparator sort on (key, tiebreak).
+//made for the sort keys of the render batches, with the object handle as tiebreak
+namespace radix_sort {
+
+	//8 bit digits, the 4 of the tiebreak first then the 8 of the key
+	constexpr size_t DIGIT_COUNT = 12;
+	constexpr size_t BUCKET_COUNT = 256;
+
+	//below it the histograms cost more than the comparator sort does
+	constexpr size_t MIN_RADIX_SIZE = 256;
+	//above it the passes split over the pool, every chunk scattering its part with its own offsets
+	constexpr size_t PARALLEL_THRESHOLD = 64 * 1024;
+	constexpr size_t MIN_CHUNK_SIZE = 16 * 1024;
+
+	using Histogram = std::array<uint32_t, BUCKET_COUNT>;
+
+	inline uint32_t digit(uint64_t key, uint32_t tiebreak, size_t index)
+	{
+		return index < 4 ? (tiebreak >> (index * 8)) & 0xFF : static_cast<uint32_t>(key >> ((index - 4) * 8)) & 0xFF;
+	}
+
+	//sorts data by key(element), then by tiebreak(element). scratch is grown to the size of data and the two can swap buffers,
+	//keep it around between sorts so they don't allocate. Digits every element shares are skipped, which with the render
+	//batch keys is most of the high ones
+	template<typename T, typename KeyFunction, typename TiebreakFunction>
+	void sort(std::vector<T>& data, std::vector<T>& scratch, KeyFunction key, TiebreakFunction tiebreak, ThreadPool* pool = nullptr)
+	{
+		const size_t count = data.size();
+		if (count < MIN_RADIX_SIZE)
+		{
+			std::sort(data.begin(), data.end(), [&](const T& A, const T& B) {
+				uint64_t keyA = key(A);
+				uint64_t keyB = key(B);
+				return keyA < keyB || (keyA == keyB && tiebreak(A) < tiebreak(B));
+			});
+			return;
+		}
+
+		uint32_t chunkCount = 1;
+		if (pool && count >= PARALLEL_THRESHOLD)
+		{
+			chunkCount = static_cast<uint32_t>(std::clamp<size_t>(count / MIN_CHUNK_SIZE, 1, pool->worker_count() + 1));
+		}
+		auto chunk_begin = [&](uint32_t chunk) { return count * chunk / chunkCount; };
+		auto for_chunks = [&](const std::function<void(uint32_t)>& function) {
+			if (chunkCount == 1) function(0);
+			else pool->parallel_for(chunkCount, function);
+		};
+
+		scratch.resize(count);
+
+		//counts of every digit in every chunk. The totals don't depend on the order, so this one read finds the passes to skip
+		std::vector<std::array<Histogram, DIGIT_COUNT>> chunkCounts(chunkCount);
+		for_chunks([&](uint32_t chunk) {
+			std::array<Histogram, DIGIT_COUNT>& counts = chunkCounts[chunk];
+			for (size_t i = chunk_begin(chunk); i < chunk_begin(chunk + 1); i++)
+			{
+				uint64_t elementKey = key(data[i]);
+				uint32_t elementTiebreak = tiebreak(data[i]);
+				for (size_t d = 0; d < DIGIT_COUNT; d++)
+				{
+					counts[d][digit(elementKey, elementTiebreak, d)]++;
+				}
+			}
+		});
+
+		T* source = data.data();
+		T* destination = scratch.data();
+		std::vector<Histogram> offsets(chunkCount);
+		bool firstPass = true;
+
+		for (size_t d = 0; d < DIGIT_COUNT; d++)
+		{
+			bool shared = false;
+			for (size_t bucket = 0; bucket < BUCKET_COUNT && !shared; bucket++)
+			{
+				size_t total = 0;
+				for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+				{
+					total += chunkCounts[chunk][d][bucket];
+				}
+				shared = total == count;
+			}
+			if (shared) continue;
+
+			//the counts per chunk only hold until the first pass moved elements between chunks
+			if (!firstPass && chunkCount > 1)
+			{
+				for_chunks([&](uint32_t chunk) {
+					Histogram& counts = chunkCounts[chunk][d];
+					counts.fill(0);
+					for (size_t i = chunk_begin(chunk); i < chunk_begin(chunk + 1); i++)
+					{
+						counts[digit(key(source[i]), tiebreak(source[i]), d)]++;
+					}
+				});
+			}
+			firstPass = false;
+
+			//every chunk writes its elements of a bucket after those of the chunks before it, which keeps the sort stable
+			uint32_t offset = 0;
+			for (size_t bucket = 0; bucket < BUCKET_COUNT; bucket++)
+			{
+				for (uint32_t chunk = 0; chunk < chunkCount; chunk++)
+				{
+					offsets[chunk][bucket] = offset;
+					offset += chunkCounts[chunk][d][bucket];
+				}
+			}
+
+			for_chunks([&](uint32_t chunk) {
+				Histogram& chunkOffsets = offsets[chunk];
+				for (size_t i = chunk_begin(chunk); i < chunk_begin(chunk + 1); i++)
+				{
+					destination[chunkOffsets[digit(key(source[i]), tiebreak(source[i]), d)]++] = source[i];
+				}
+			});
+			std::swap(source, destination);
+		}
+
+		if (source != data.data())
+		{
+			data.swap(scratch);
+		}
+	}
+}
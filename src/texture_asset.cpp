@@ -1,25 +1,165 @@
 #include <texture_asset.h>
+#include <asset_metadata.h>
 #include <nlohmann/json.hpp>
 
-#include <lz4.h>
 #include <iostream>
 
+namespace {
+	//fixed part of the binary metadata, followed by the page array and the original file string
+	struct TextureMetadata {
+		uint64_t textureSize;
+		uint32_t textureFormat;
+		uint32_t compressionMode;
+		uint32_t pageCount;
+	};
+
+	//page as stored in the binary metadata
+	struct PageRecord {
+		uint32_t width;
+		uint32_t height;
+		uint32_t compressedSize;
+		uint32_t originalSize;
+	};
+
+	void compute_page_offsets(assets::TextureInfo& info)
+	{
+		uint64_t compressedOffset = 0;
+		uint64_t originalOffset = 0;
+		for (auto& page : info.pages)
+		{
+			page.compressedOffset = compressedOffset;
+			page.originalOffset = originalOffset;
+			compressedOffset += page.compressedSize;
+			originalOffset += page.originalSize;
+		}
+	}
+}
+
+//written to disk as they are, padding included
+static_assert(sizeof(TextureMetadata) == 24, "texture metadata layout changed");
+static_assert(sizeof(PageRecord) == 16, "texture page record layout changed");
+
 assets::TextureFormat tex_parse_format(const char* f) {
 
-	if (strcmp(f, "RGBA8") == 0)
+	for (uint32_t i = 1; i <= static_cast<uint32_t>(assets::TextureFormat::BC7); i++)
 	{
-		return assets::TextureFormat::RGBA8;
+		assets::TextureFormat format = static_cast<assets::TextureFormat>(i);
+		if (strcmp(f, assets::texture_format_name(format)) == 0)
+		{
+			return format;
+		}
 	}
-	else {
-		return assets::TextureFormat::Unknown;
+	return assets::TextureFormat::Unknown;
+}
+
+uint32_t assets::texture_block_bytes(TextureFormat format)
+{
+	switch (format) {
+	case TextureFormat::RGBA8:
+		return 4;
+	case TextureFormat::BC1:
+		return 8;
+	case TextureFormat::BC3:
+	case TextureFormat::BC5:
+	case TextureFormat::BC7:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+bool assets::is_block_compressed(TextureFormat format)
+{
+	return format == TextureFormat::BC1 || format == TextureFormat::BC3 || format == TextureFormat::BC5 || format == TextureFormat::BC7;
+}
+
+uint64_t assets::texture_mip_size(TextureFormat format, uint32_t width, uint32_t height)
+{
+	if (is_block_compressed(format))
+	{
+		uint64_t blocksX = (width + 3) / 4;
+		uint64_t blocksY = (height + 3) / 4;
+		return blocksX * blocksY * texture_block_bytes(format);
+	}
+	return uint64_t(width) * height * texture_block_bytes(format);
+}
+
+const char* assets::texture_format_name(TextureFormat format)
+{
+	switch (format) {
+	case TextureFormat::RGBA8:
+		return "RGBA8";
+	case TextureFormat::BC1:
+		return "BC1";
+	case TextureFormat::BC3:
+		return "BC3";
+	case TextureFormat::BC5:
+		return "BC5";
+	case TextureFormat::BC7:
+		return "BC7";
+	default:
+		return "Unknown";
 	}
 }
 
 assets::TextureInfo assets::read_texture_info(AssetFile* file)
+{
+	return read_texture_info(file->version, std::string_view{ file->json });
+}
+
+assets::TextureInfo assets::read_texture_info(const MappedAssetFile* file)
+{
+	return read_texture_info(file->version, file->json);
+}
+
+assets::TextureInfo assets::read_texture_info(int version, std::string_view json)
 {
 	TextureInfo info;
 
-	nlohmann::json texture_metadata = nlohmann::json::parse(file->json);
+	//compressed metadata decodes into this, and json points at it from here on
+	std::string decompressed;
+	if (!decompress_metadata(version, json, decompressed))
+	{
+		std::cout << "Corrupted texture metadata" << std::endl;
+		return TextureInfo{};
+	}
+
+	if (version >= ASSET_VERSION_BINARY)
+	{
+		MetadataReader reader{ json };
+
+		TextureMetadata metadata;
+		reader.read(metadata);
+		const char* pages = reader.read_bytes(size_t(metadata.pageCount) * sizeof(PageRecord));
+		std::string_view originalFile = reader.read_string();
+
+		if (!reader.ok)
+		{
+			std::cout << "Corrupted texture metadata" << std::endl;
+			return TextureInfo{};
+		}
+
+		info.textureSize = metadata.textureSize;
+		info.textureFormat = static_cast<TextureFormat>(metadata.textureFormat);
+		info.compressionMode = static_cast<CompressionMode>(metadata.compressionMode);
+		info.originalFile = originalFile;
+
+		info.pages.resize(metadata.pageCount);
+		for (uint32_t i = 0; i < metadata.pageCount; i++)
+		{
+			PageRecord record;
+			memcpy(&record, pages + i * sizeof(PageRecord), sizeof(PageRecord));
+
+			info.pages[i].width = record.width;
+			info.pages[i].height = record.height;
+			info.pages[i].compressedSize = record.compressedSize;
+			info.pages[i].originalSize = record.originalSize;
+		}
+		compute_page_offsets(info);
+		return info;
+	}
+
+	nlohmann::json texture_metadata = nlohmann::json::parse(json);
 
 	std::string formatString = texture_metadata["format"];
 	info.textureFormat = tex_parse_format(formatString.c_str());
@@ -41,19 +181,30 @@ assets::TextureInfo assets::read_texture_info(AssetFile* file)
 
 		info.pages.push_back(page);
 	}
-		
+	compute_page_offsets(info);
 
 	return info;
 }
 
-void assets::unpack_texture(TextureInfo* info, const char* sourcebuffer, size_t sourceSize, char* destination)
+bool assets::unpack_texture(TextureInfo* info, const char* sourcebuffer, size_t sourceSize, char* destination)
 {
-	if (info->compressionMode == CompressionMode::LZ4) {
+	if (info->compressionMode != CompressionMode::None) {
 	
 		
 		for (auto& page : info->pages)
 		{
-			LZ4_decompress_safe(sourcebuffer, destination, page.compressedSize, page.originalSize);
+			//pages that did not compress well are stored raw
+			if (page.compressedSize != page.originalSize)
+			{
+				if (!decompress_block(info->compressionMode, sourcebuffer, page.compressedSize, destination, page.originalSize))
+				{
+					return false;
+				}
+			}
+			else
+			{
+				memcpy(destination, sourcebuffer, page.originalSize);
+			}
 			sourcebuffer += page.compressedSize;
 			destination += page.originalSize;
 		}
@@ -62,23 +213,21 @@ void assets::unpack_texture(TextureInfo* info, const char* sourcebuffer, size_t
 	else {
 		memcpy(destination, sourcebuffer, sourceSize);
 	}
+	return true;
 }
 
-void assets::unpack_texture_page(TextureInfo* info, int pageIndex, char* sourcebuffer, char* destination)
+bool assets::unpack_texture_page(TextureInfo* info, int pageIndex, const char* sourcebuffer, char* destination)
 {
-	char* source = sourcebuffer;
-	for (int i = 0; i < pageIndex; i++) {
-		source += info->pages[i].compressedSize;
-	}
+	const char* source = sourcebuffer + info->pages[pageIndex].compressedOffset;
 
-	if (info->compressionMode == CompressionMode::LZ4) {
+	if (info->compressionMode != CompressionMode::None) {
 
 		
 		
 		//size doesnt fully match, its compressed
 		if(info->pages[pageIndex].compressedSize != info->pages[pageIndex].originalSize)
 		{
-			LZ4_decompress_safe(source, destination, info->pages[pageIndex].compressedSize, info->pages[pageIndex].originalSize);
+			return decompress_block(info->compressionMode, source, info->pages[pageIndex].compressedSize, destination, info->pages[pageIndex].originalSize);
 		}
 		else {
 			//size matched, uncompressed page
@@ -88,10 +237,11 @@ void assets::unpack_texture_page(TextureInfo* info, int pageIndex, char* sourceb
 	else {
 		memcpy(destination, source, info->pages[pageIndex].originalSize);
 	}
+	return true;
 }
 
 
-assets::AssetFile assets::pack_texture(TextureInfo* info, void* pixelData)
+assets::AssetFile assets::pack_texture(TextureInfo* info, void* pixelData, const CompressionSettings& compression)
 {
 	//core file header
 	AssetFile file;	
@@ -99,7 +249,7 @@ assets::AssetFile assets::pack_texture(TextureInfo* info, void* pixelData)
 	file.type[1] = 'E';
 	file.type[2] = 'X';
 	file.type[3] = 'I';
-	file.version = 1;
+	file.version = ASSET_VERSION_BINARY;
 
 
 	char* pixels = (char*)pixelData;
@@ -110,17 +260,19 @@ assets::AssetFile assets::pack_texture(TextureInfo* info, void* pixelData)
 
 
 		//compress buffer into blob
-		int compressStaging = LZ4_compressBound(p.originalSize);
+		size_t compressStaging = compress_bound(compression.mode, p.originalSize);
 
 		page_buffer.resize(compressStaging);
 
-		int compressedSize = LZ4_compress_default(pixels, page_buffer.data(), p.originalSize, compressStaging);
+		size_t compressedSize = compress_block(compression, pixels, p.originalSize, page_buffer.data(), compressStaging);
 		
 
-		float compression_rate = float(compressedSize) / float(info->textureSize);
+		//per page, a rate over the whole texture would let pages that do not shrink through, and a page whose
+		//compressed size matches its original size would be read back as raw
+		float compression_rate = float(compressedSize) / float(p.originalSize);
 
 		//if the compression is more than 80% of the original size, its not worth to use it
-		if (compression_rate > 0.8)
+		if (compressedSize == 0 || compression_rate > 0.8)
 		{
 			compressedSize = p.originalSize;
 			page_buffer.resize(compressedSize);
@@ -130,19 +282,53 @@ assets::AssetFile assets::pack_texture(TextureInfo* info, void* pixelData)
 		else {
 			page_buffer.resize(compressedSize);
 		}
-		p.compressedSize = compressedSize;
+		p.compressedSize = static_cast<uint32_t>(compressedSize);
 
 		file.binaryBlob.insert(file.binaryBlob.end(), page_buffer.begin(), page_buffer.end());
 
 		//advance pixel pointer to next page
 		pixels += p.originalSize;
 	}
+
+	if (info->textureFormat == TextureFormat::Unknown)
+	{
+		info->textureFormat = TextureFormat::RGBA8;
+	}
+	info->compressionMode = compression.mode;
+	compute_page_offsets(*info);
+
+	file.json = write_texture_metadata(info, file.version);
+
+	return file;
+}
+
+std::string assets::write_texture_metadata(const TextureInfo* info, int version)
+{
+	if (version >= ASSET_VERSION_BINARY)
+	{
+		//value initialized, the padding after pageCount goes to disk too
+		TextureMetadata metadata{};
+		metadata.textureSize = info->textureSize;
+		metadata.textureFormat = static_cast<uint32_t>(info->textureFormat);
+		metadata.compressionMode = static_cast<uint32_t>(info->compressionMode);
+		metadata.pageCount = static_cast<uint32_t>(info->pages.size());
+
+		MetadataWriter writer;
+		writer.write(metadata);
+		for (auto& page : info->pages)
+		{
+			writer.write(PageRecord{ page.width, page.height, page.compressedSize, page.originalSize });
+		}
+		writer.write_string(info->originalFile);
+		return writer.data;
+	}
+
 	nlohmann::json texture_metadata;
-	texture_metadata["format"] = "RGBA8";
+	texture_metadata["format"] = texture_format_name(info->textureFormat);
 
 	texture_metadata["buffer_size"] = info->textureSize;
 	texture_metadata["original_file"] = info->originalFile;
-	texture_metadata["compression"] = "LZ4";
+	texture_metadata["compression"] = compression_name(info->compressionMode);
 
 	std::vector<nlohmann::json> page_json;
 	for (auto& p : info->pages) {
@@ -155,9 +341,6 @@ assets::AssetFile assets::pack_texture(TextureInfo* info, void* pixelData)
 	}
 	texture_metadata["pages"] = page_json;
 
-	std::string stringified = texture_metadata.dump();
-	file.json = stringified;
-
-	return file;
+	return texture_metadata.dump();
 }
 
@@ -1,19 +1,38 @@
 #pragma once
 #include "asset_loader.h"
+#include "asset_compression.h"
 
 namespace assets {
 
 	enum class TextureFormat : uint32_t
 	{
 		Unknown = 0,
-		RGBA8
+		RGBA8,
+		//block compressed formats, every 4x4 texel block is stored as 8 (BC1) or 16 bytes
+		BC1, //opaque rgb
+		BC3, //rgb with interpolated alpha
+		BC5, //two channels, for normal maps
+		BC7
 	};
+
+	//4x4 blocks for the compressed formats, a single texel for RGBA8. 0 for unknown formats
+	uint32_t texture_block_bytes(TextureFormat format);
+	bool is_block_compressed(TextureFormat format);
+
+	//bytes of a width x height mip, partial blocks at the edges take a whole block
+	uint64_t texture_mip_size(TextureFormat format, uint32_t width, uint32_t height);
+
+	const char* texture_format_name(TextureFormat format);
 	
 	struct PageInfo {
 		uint32_t width;
 		uint32_t height;
 		uint32_t compressedSize;
 		uint32_t originalSize;
+
+		//where the page starts in the blob and in the unpacked texture, filled when the info is read
+		uint64_t compressedOffset;
+		uint64_t originalOffset;
 	};
 
 	struct TextureInfo {
@@ -26,10 +45,19 @@ namespace assets {
 	};
 
 	TextureInfo read_texture_info(AssetFile* file);
+	TextureInfo read_texture_info(const MappedAssetFile* file);
+	TextureInfo read_texture_info(int version, std::string_view metadata);
+
+	//false when a page is corrupted or its dictionary is missing, the destination holds garbage then
+	bool unpack_texture(TextureInfo* info, const char* sourcebuffer, size_t sourceSize, char* destination);
 
-	void unpack_texture(TextureInfo* info, const char* sourcebuffer, size_t sourceSize, char* destination);
+	//pages are independent, so different pages can be unpacked from different threads. False like unpack_texture
+	bool unpack_texture_page(TextureInfo* info, int pageIndex ,const char* sourcebuffer, char* destination);
 
-	void unpack_texture_page(TextureInfo* info, int pageIndex ,char* sourcebuffer, char* destination);
+	//pixelData holds every page back to back in info->textureFormat, RGBA8 when it is unknown.
+	//pages are compressed one by one with the given codec, the ones that barely shrink are stored raw
+	AssetFile pack_texture(TextureInfo* info, void* pixelData, const CompressionSettings& compression = {});
 
-	AssetFile pack_texture(TextureInfo* info, void* pixelData);
+	//metadata block of the given asset file version, as stored in AssetFile.json
+	std::string write_texture_metadata(const TextureInfo* info, int version);
 }
\ No newline at end of file
@@ -0,0 +1,264 @@
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <cstdio>
+
+//the engine profiles the jobs, the tools building this file without Tracy don't
+#if defined(TRACY_ENABLE) && __has_include("Tracy.hpp")
+#include "Tracy.hpp"
+#define POOL_JOB_ZONE ZoneScopedNC("Pool Job", tracy::Color::Gray)
+#define POOL_THREAD_NAME(name) tracy::SetThreadName(name)
+#else
+#define POOL_JOB_ZONE
+#define POOL_THREAD_NAME(name)
+#endif
+
+struct ThreadPool::Task {
+	std::function<void()> function;
+
+	//dependencies still running, plus one held by schedule until it linked all of them
+	std::atomic<uint32_t> blockers{ 1 };
+	std::atomic<bool> done{ false };
+
+	//guards finished and dependents, a task linking to this one either sees it finished or gets released by it
+	std::mutex mutex;
+	bool finished{ false };
+	std::vector<TaskHandle> dependents;
+};
+
+namespace {
+	//pool and queue of the worker threads, null on every other thread
+	thread_local const ThreadPool* currentPool = nullptr;
+	thread_local uint32_t currentQueueIndex = 0;
+
+	//ranges a parallel_for makes per thread, so the ones finishing early have something left to steal
+	constexpr uint32_t RANGES_PER_THREAD = 4;
+}
+
+void ThreadPool::init(uint32_t workerCount)
+{
+	_exit = false;
+	for (uint32_t i = 0; i < workerCount + 1; i++)
+	{
+		_queues.push_back(std::make_unique<WorkQueue>());
+	}
+	for (uint32_t i = 0; i < workerCount; i++)
+	{
+		_workers.emplace_back([this, i] { worker_loop(i); });
+	}
+}
+
+void ThreadPool::cleanup()
+{
+	{
+		std::lock_guard<std::mutex> lock(_sleepMutex);
+		_exit = true;
+	}
+	_wakeCondition.notify_all();
+
+	for (auto& worker : _workers)
+	{
+		worker.join();
+	}
+	_workers.clear();
+	_queues.clear();
+}
+
+uint32_t ThreadPool::current_queue() const
+{
+	return currentPool == this ? currentQueueIndex : static_cast<uint32_t>(_queues.size() - 1);
+}
+
+void ThreadPool::push_jobs(std::vector<Job>& jobs)
+{
+	//counted before they are visible, so the count never drops below what the queues hold
+	_pendingJobs.fetch_add(static_cast<uint32_t>(jobs.size()), std::memory_order_release);
+	{
+		WorkQueue& queue = *_queues[current_queue()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		for (Job& job : jobs)
+		{
+			queue.jobs.push_back(std::move(job));
+		}
+	}
+
+	//a worker between checking the count and going to sleep holds the mutex, this waits for it to sleep so it gets woken
+	{
+		std::lock_guard<std::mutex> lock(_sleepMutex);
+	}
+	if (jobs.size() == 1) _wakeCondition.notify_one();
+	else _wakeCondition.notify_all();
+}
+
+bool ThreadPool::pop_job(Job& job)
+{
+	if (_pendingJobs.load(std::memory_order_acquire) == 0) return false;
+
+	const uint32_t own = current_queue();
+	{
+		WorkQueue& queue = *_queues[own];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.jobs.empty())
+		{
+			job = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+			_pendingJobs.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+
+	const uint32_t queueCount = static_cast<uint32_t>(_queues.size());
+	for (uint32_t i = 1; i < queueCount; i++)
+	{
+		WorkQueue& queue = *_queues[(own + i) % queueCount];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.jobs.empty())
+		{
+			job = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+			_pendingJobs.fetch_sub(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool ThreadPool::run_pending_job()
+{
+	Job job;
+	if (!pop_job(job)) return false;
+
+	POOL_JOB_ZONE;
+	job();
+	return true;
+}
+
+void ThreadPool::parallel_for(uint32_t count, const std::function<void(uint32_t)>& function)
+{
+	if (count == 0) return;
+
+	//nothing to spread the work over
+	if (_workers.empty() || count == 1)
+	{
+		for (uint32_t i = 0; i < count; i++)
+		{
+			function(i);
+		}
+		return;
+	}
+
+	const uint32_t rangeCount = std::min(count, (worker_count() + 1) * RANGES_PER_THREAD);
+	std::atomic<uint32_t> remaining{ rangeCount };
+
+	std::vector<Job> jobs;
+	jobs.reserve(rangeCount);
+	//the own queue is worked from the back, so the first range goes last to start first
+	for (uint32_t r = rangeCount; r-- > 0;)
+	{
+		uint32_t begin = static_cast<uint32_t>(uint64_t(count) * r / rangeCount);
+		uint32_t end = static_cast<uint32_t>(uint64_t(count) * (r + 1) / rangeCount);
+		jobs.push_back([&, begin, end] {
+			for (uint32_t i = begin; i < end; i++)
+			{
+				function(i);
+			}
+			remaining.fetch_sub(1, std::memory_order_release);
+		});
+	}
+	push_jobs(jobs);
+
+	//help with the queues instead of blocking, the jobs ran here may belong to other callers
+	while (remaining.load(std::memory_order_acquire) > 0)
+	{
+		if (!run_pending_job())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+ThreadPool::TaskHandle ThreadPool::schedule(std::function<void()> function, const std::vector<TaskHandle>& dependencies)
+{
+	TaskHandle task = std::make_shared<Task>();
+	task->function = std::move(function);
+
+	for (const TaskHandle& dependency : dependencies)
+	{
+		if (!dependency) continue;
+
+		std::lock_guard<std::mutex> lock(dependency->mutex);
+		if (!dependency->finished)
+		{
+			task->blockers.fetch_add(1, std::memory_order_relaxed);
+			dependency->dependents.push_back(task);
+		}
+	}
+
+	release_task(task);
+	return task;
+}
+
+void ThreadPool::wait(const TaskHandle& task)
+{
+	while (!task->done.load(std::memory_order_acquire))
+	{
+		if (!run_pending_job())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+bool ThreadPool::is_done(const TaskHandle& task) const
+{
+	return task->done.load(std::memory_order_acquire);
+}
+
+void ThreadPool::release_task(const TaskHandle& task)
+{
+	if (task->blockers.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+	std::vector<Job> jobs;
+	jobs.push_back([this, task] { run_task(task); });
+	push_jobs(jobs);
+}
+
+void ThreadPool::run_task(const TaskHandle& task)
+{
+	task->function();
+	//the captures would otherwise live as long as the last handle to the task
+	task->function = nullptr;
+
+	std::vector<TaskHandle> dependents;
+	{
+		std::lock_guard<std::mutex> lock(task->mutex);
+		task->finished = true;
+		dependents.swap(task->dependents);
+	}
+	task->done.store(true, std::memory_order_release);
+
+	for (const TaskHandle& dependent : dependents)
+	{
+		release_task(dependent);
+	}
+}
+
+void ThreadPool::worker_loop(uint32_t index)
+{
+	currentPool = this;
+	currentQueueIndex = index;
+
+	char name[32];
+	snprintf(name, sizeof(name), "Worker %u", index);
+	POOL_THREAD_NAME(name);
+
+	while (true)
+	{
+		if (run_pending_job()) continue;
+
+		std::unique_lock<std::mutex> lock(_sleepMutex);
+		_wakeCondition.wait(lock, [this] { return _exit || _pendingJobs.load(std::memory_order_acquire) > 0; });
+
+		if (_exit && _pendingJobs.load(std::memory_order_acquire) == 0) return;
+	}
+}
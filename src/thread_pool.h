@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//fixed set of worker threads, each with its own job queue. A thread runs the newest jobs of its own queue first,
+//and steals the oldest ones of the others when it runs out.
+//threads that wait on work run queued jobs themselves, so parallel_for and wait can be called from inside a job
+class ThreadPool {
+public:
+	struct Task;
+	using TaskHandle = std::shared_ptr<Task>;
+
+	void init(uint32_t workerCount);
+
+	//the queues must be empty, nothing waits on them anymore
+	void cleanup();
+
+	//runs function(i) for every i in [0, count) and returns once all of them finished.
+	//the indices are split in a few ranges per thread, the idle ones steal ranges the busy ones didn't start yet
+	void parallel_for(uint32_t count, const std::function<void(uint32_t)>& function);
+
+	//queues function to run once every task of dependencies finished, right away if none is left running.
+	//null dependencies are ignored
+	TaskHandle schedule(std::function<void()> function, const std::vector<TaskHandle>& dependencies = {});
+
+	//returns once the task finished, running queued jobs meanwhile
+	void wait(const TaskHandle& task);
+
+	//whether the task finished, without blocking
+	bool is_done(const TaskHandle& task) const;
+
+	uint32_t worker_count() const { return static_cast<uint32_t>(_workers.size()); }
+
+private:
+	using Job = std::function<void()>;
+
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	//queue of the calling thread, threads outside the pool share the last one
+	uint32_t current_queue() const;
+
+	void push_jobs(std::vector<Job>& jobs);
+
+	//pops a job of the own queue or steals one of the others, false if all of them were empty
+	bool pop_job(Job& job);
+
+	//pops and runs one queued job, false if there was none
+	bool run_pending_job();
+
+	//drops one blocker of the task, it gets queued when it was the last
+	void release_task(const TaskHandle& task);
+	void run_task(const TaskHandle& task);
+
+	void worker_loop(uint32_t index);
+
+	std::vector<std::thread> _workers;
+	std::vector<std::unique_ptr<WorkQueue>> _queues;
+
+	//sleeping workers wake when jobs get queued
+	std::atomic<uint32_t> _pendingJobs{ 0 };
+	std::mutex _sleepMutex;
+	std::condition_variable _wakeCondition;
+	bool _exit{ false };
+};
@@ -14,6 +14,7 @@
 #include <fstream>
 #include <chrono>
 #include <sstream>
+#include <unordered_set>
 #include "vk_textures.h"
 #include "vk_shaders.h"
 
@@ -25,6 +26,9 @@
 #include "imgui_impl_vulkan.h"
 #include "prefab_asset.h"
 #include "material_asset.h"
+#include "mesh_asset.h"
+#include "asset_archive.h"
+#include "asset_compression.h"
 
 #include "Tracy.hpp"
 #include "TracyVulkan.hpp"
@@ -49,6 +53,8 @@ AutoCVar_Float CVAR_DrawDistance("gpu.drawDistance", "Distance cull", 5000);
 
 AutoCVar_Int CVAR_FreezeShadows("gpu.freezeShadows", "Stop the rendering of shadows", 0, CVarFlags::EditCheckbox);
 
+AutoCVar_Int CVAR_RespawnObjects("scene.respawnPerFrame", "Random objects unregistered and registered again every frame, they land in the slots just freed", 0);
+
 
 constexpr bool bUseValidationLayers = false;
 
@@ -123,6 +129,21 @@ void VulkanEngine::init()
 
 	LOG_INFO("Engine Initialized, starting Load");
 	
+	//the main thread helps while it waits on pool work, so leave it a core
+	_threadPool.init(std::max(1u, std::thread::hardware_concurrency()) - 1);
+	_renderScene.threadPool = &_threadPool;
+
+	//a packed archive in the asset folder serves every asset lookup, loose files are the fallback
+	if (assets::mount_archive(asset_path("assets.pak").c_str(), asset_path("").c_str()))
+	{
+		LOG_INFO("Mounted asset archive {}", asset_path("assets.pak"));
+	}
+
+	//the baker compresses the metadata of small assets against a shared dictionary, it has to be there before any of them loads
+	if (assets::load_dictionary(asset_path("metadata.dict").c_str()))
+	{
+		LOG_INFO("Loaded metadata dictionary {}", asset_path("metadata.dict"));
+	}
 
 	load_images();
 
@@ -130,11 +151,26 @@ void VulkanEngine::init()
 
 	init_scene();
 
+	{
+		double seconds = _loadStats.meshLoadTime / 1000.0;
+		double megabytes = _loadStats.meshBytesDecoded / (1024.0 * 1024.0);
+		LOG_INFO("Loaded {} meshes, {:.1f} MB in {:.1f} ms ({:.1f} MB/s, {} path)", _loadStats.meshesLoaded, megabytes, _loadStats.meshLoadTime,
+			seconds > 0 ? megabytes / seconds : 0.0, stagedMeshDecode ? "staged" : "vector");
+
+		seconds = _loadStats.textureDecodeTime / 1000.0;
+		megabytes = _loadStats.textureBytesDecoded / (1024.0 * 1024.0);
+		LOG_INFO("Decoded {} textures, {:.1f} MB in {:.1f} ms ({:.1f} MB/s on {} workers)", _loadStats.texturesLoaded, megabytes, _loadStats.textureDecodeTime,
+			seconds > 0 ? megabytes / seconds : 0.0, _threadPool.worker_count());
+
+		LOG_INFO("Prefab decode stages took {:.1f} ms", _loadStats.prefabDecodeTime);
+	}
+
 	init_imgui();
 	
-	_renderScene.build_batches();
-
+	//merged first, the batches only get rebuilt when objects enter or leave a pass and they pick the merged draw path when built
 	_renderScene.merge_meshes(this);
+
+	_renderScene.build_batches();
 	//everything went fine
 	_isInitialized = true;
 
@@ -155,6 +191,9 @@ void VulkanEngine::cleanup()
 			vkWaitForFences(_device, 1, &frame._renderFence, true, 1000000000);
 		}
 
+		_uploader.cleanup();
+		_textureStreamer.cleanup();
+
 		_mainDeletionQueue.flush();
 
 		for (auto& frame : _frames)
@@ -172,6 +211,10 @@ void VulkanEngine::cleanup()
 		vkDestroyInstance(_instance, nullptr);
 
 		SDL_DestroyWindow(_window);
+
+		_threadPool.cleanup();
+
+		assets::unmount_archives();
 	}
 }
 
@@ -211,10 +254,16 @@ void VulkanEngine::draw()
 
 				auto out = fmt::output_file(filename);
 
+				//the commands of every batch repeat once per level of detail
+				const auto& batches = _renderScene._forwardPass.batches;
 				for (int o = 0; o < objectCount; o++)
 				{
 					out.print("DRAW: {} ------------ \n", o);
-					out.print("	OG Count: {} \n", _renderScene._forwardPass.batches[o].count);
+					if (!batches.empty())
+					{
+						out.print("	LOD: {} \n", o / batches.size());
+						out.print("	OG Count: {} \n", batches[o % batches.size()].count);
+					}
 					out.print("	Visible Count: {} \n", objects[o].command.instanceCount);
 					out.print("	First: {} \n", objects[o].command.firstInstance);
 					out.print("	Indices: {} \n", objects[o].command.indexCount);
@@ -234,6 +283,12 @@ void VulkanEngine::draw()
 	get_current_frame()._frameDeletionQueue.flush();
 	get_current_frame().dynamicDescriptorAllocator->reset_pools();
 
+	poll_uploads();
+
+	//pixels covered by a unit sized object one unit away, what the coverage of the streamed textures is measured in
+	float projectionScale = std::abs(_camera.get_projection_matrix(true)[1][1]) * _windowExtent.height * 0.5f;
+	_textureStreamer.update(_renderScene, _camera.position, projectionScale);
+
 	//now that we are sure that the commands finished executing, we can safely reset the command buffer to begin recording again.
 	VK_CHECK(vkResetCommandBuffer(get_current_frame()._mainCommandBuffer, 0));
 	uint32_t swapchainImageIndex;
@@ -253,6 +308,9 @@ void VulkanEngine::draw()
 
 	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
 
+	//take ownership of everything the transfer queue finished since last frame
+	bool waitUploads = _uploader.record_acquires(cmd);
+
 	//make a clear-color from frame number. This will flash with a 120 frame period.
 	VkClearValue clearValue;
 	float flash = abs(sin(_frameNumber / 120.f));
@@ -345,12 +403,26 @@ void VulkanEngine::draw()
 	//we will signal the _renderSemaphore, to signal that rendering has finished
 
 	VkSubmitInfo submit = vkinit::submit_info(&cmd);
-	VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT };
+	VkSemaphore waitSemaphores[] = { get_current_frame()._presentSemaphore, _uploader.get_semaphore() };
+
+	submit.pWaitDstStageMask = waitStages;
 
-	submit.pWaitDstStageMask = &waitStage;
+	submit.waitSemaphoreCount = waitUploads ? 2 : 1;
+	submit.pWaitSemaphores = waitSemaphores;
 
-	submit.waitSemaphoreCount = 1;
-	submit.pWaitSemaphores = &get_current_frame()._presentSemaphore;
+	//the upload semaphore is a timeline one, the value for the binary present semaphore is ignored.
+	//its value is already reached, the wait only orders the acquire barriers after the release on the transfer queue
+	uint64_t waitValues[] = { 0, _uploader.get_acquire_value() };
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.waitSemaphoreValueCount = submit.waitSemaphoreCount;
+	timelineInfo.pWaitSemaphoreValues = waitValues;
+	if (waitUploads)
+	{
+		submit.pNext = &timelineInfo;
+	}
 
 	submit.signalSemaphoreCount = 1;
 	submit.pSignalSemaphores = &get_current_frame()._renderSemaphore;
@@ -644,6 +716,20 @@ void VulkanEngine::run()
 			//ImGui::Text("Drawcalls: %d", stats.drawcalls);
 			ImGui::Text("Batches: %d", stats.draws);
 			//ImGui::Text("Triangles: %d", stats.triangles);		
+			if (_loadStats.textureDecodeTime > 0)
+			{
+				ImGui::Text("Texture decode: %.1f MB/s", (_loadStats.textureBytesDecoded / (1024.0 * 1024.0)) / (_loadStats.textureDecodeTime / 1000.0));
+			}
+			if (_textureStreamer.texture_count() > 0)
+			{
+				ImGui::Text("Streamed textures: %zu, %.1f MB resident, %zu uploading", _textureStreamer.texture_count(),
+					_textureStreamer.resident_bytes() / (1024.0 * 1024.0), _textureStreamer.streaming_count());
+			}
+			if (_loadStats.meshCpuBytesReleased + _loadStats.meshBufferBytesReleased > 0)
+			{
+				ImGui::Text("Mesh memory released: %.1f MB cpu, %.1f MB buffers", _loadStats.meshCpuBytesReleased / (1024.0 * 1024.0),
+					_loadStats.meshBufferBytesReleased / (1024.0 * 1024.0));
+			}
 			
 			CVAR_OutputIndirectToFile.Set(false);
 			if (ImGui::Button("Output Indirect"))
@@ -672,14 +758,43 @@ void VulkanEngine::run()
 			//test flagging some objects for changes
 
 			int N_changes = 1000;
-			for (int i = 0; i < N_changes; i++)
+			for (int i = 0; i < N_changes && _renderScene.renderables.size() > 0; i++)
 			{
 				int rng = rand() % _renderScene.renderables.size();
 
 				Handle<RenderObject> h;
 				h.handle = rng;
+				h.generation = _renderScene.renderables.generations[rng];
+				//freed slots are at a generation no handle is valid for
+				if (!_renderScene.is_valid(h)) continue;
+
 				_renderScene.update_object(h);
 			}
+
+			//despawn and spawn again, the objects come back in the recycled slots of the ones just removed
+			std::vector<MeshObject> respawned;
+			for (int i = 0; i < CVAR_RespawnObjects.Get() && _renderScene.renderables.size() > 0; i++)
+			{
+				int rng = rand() % _renderScene.renderables.size();
+
+				Handle<RenderObject> h;
+				h.handle = rng;
+				h.generation = _renderScene.renderables.generations[rng];
+				if (!_renderScene.is_valid(h)) continue;
+
+				MeshObject object;
+				object.mesh = _renderScene.get_mesh(_renderScene.renderables.meshIDs[rng])->original;
+				object.material = _renderScene.get_material(_renderScene.renderables.materials[rng]);
+				object.customSortKey = _renderScene.renderables.customSortKeys[rng];
+				object.transformMatrix = _renderScene.renderables.transforms[rng];
+				object.bounds = _renderScene.renderables.bounds[rng];
+				object.bDrawForwardPass = true;
+				object.bDrawShadowPass = true;
+				respawned.push_back(object);
+
+				_renderScene.unregister_object(h);
+			}
+			_renderScene.register_object_batch(respawned.data(), static_cast<uint32_t>(respawned.size()));
 			_camera.bLocked = CVAR_CamLock.Get();
 
 			_camera.update_camera(stats.frametime);
@@ -751,6 +866,7 @@ void VulkanEngine::init_vulkan()
 	vkb::InstanceBuilder builder;
 	//make the vulkan instance, with basic debug features
 	auto inst_ret = builder.set_app_name("Example Vulkan Application")
+		.require_api_version(1, 2, 0)
 
 		.request_validation_layers(bUseValidationLayers)
 		.use_default_debug_messenger()
@@ -777,10 +893,12 @@ void VulkanEngine::init_vulkan()
 	feats.multiDrawIndirect = true;
 	feats.drawIndirectFirstInstance = true;
 	feats.samplerAnisotropy = true;
+	//baked textures are block compressed
+	feats.textureCompressionBC = true;
 	selector.set_required_features(feats);
 
 	vkb::PhysicalDevice physicalDevice = selector
-		.set_minimum_version(1, 1)
+		.set_minimum_version(1, 2)
 		.set_surface(_surface)
 		.add_required_extension(VK_EXT_SAMPLER_FILTER_MINMAX_EXTENSION_NAME)
 		
@@ -793,8 +911,25 @@ void VulkanEngine::init_vulkan()
 
 	vkb::DeviceBuilder deviceBuilder{ physicalDevice };
 
+	//cluster culling draws with a gpu written draw count, which not every vulkan 1.2 gpu has. Without it the objects get culled whole
+	VkPhysicalDeviceVulkan12Features supported12 = {};
+	supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	VkPhysicalDeviceFeatures2 supportedFeatures = {};
+	supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supportedFeatures.pNext = &supported12;
+	vkGetPhysicalDeviceFeatures2(physicalDevice.physical_device, &supportedFeatures);
+	_drawIndirectCountSupported = supported12.drawIndirectCount == VK_TRUE;
+	if (!_drawIndirectCountSupported)
+	{
+		LOG_INFO("GPU has no drawIndirectCount, cluster culling is off");
+	}
 
-	
+	//the async uploader tracks its submits with a timeline semaphore, which vulkan 1.2 always has
+	VkPhysicalDeviceVulkan12Features features12 = {};
+	features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	features12.timelineSemaphore = VK_TRUE;
+	features12.drawIndirectCount = _drawIndirectCountSupported ? VK_TRUE : VK_FALSE;
+	deviceBuilder.add_pNext(&features12);
 
 	vkb::Device vkbDevice = deviceBuilder.build().value();
 	
@@ -807,6 +942,20 @@ void VulkanEngine::init_vulkan()
 
 	_graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
+	//uploads run on a dedicated transfer queue when the gpu has one, so they overlap with rendering.
+	//otherwise they share the graphics queue
+	auto transferQueue = vkbDevice.get_dedicated_queue(vkb::QueueType::transfer);
+	if (transferQueue)
+	{
+		_transferQueue = transferQueue.value();
+		_transferQueueFamily = vkbDevice.get_dedicated_queue_index(vkb::QueueType::transfer).value();
+	}
+	else
+	{
+		_transferQueue = _graphicsQueue;
+		_transferQueueFamily = _graphicsQueueFamily;
+	}
+
 	//initialize the memory allocator
 	VmaAllocatorCreateInfo allocatorInfo = {};
 	allocatorInfo.physicalDevice = _chosenGPU;
@@ -1285,6 +1434,9 @@ void VulkanEngine::init_commands()
 	_mainDeletionQueue.push_function([=]() {
 		vkDestroyCommandPool(_device, _uploadContext._commandPool, nullptr);
 		});
+
+	_uploader.init(_device, _allocator, _transferQueue, _transferQueueFamily, _graphicsQueueFamily);
+	_textureStreamer.init(this);
 }
 
 void VulkanEngine::init_sync_structures()
@@ -1379,6 +1531,8 @@ void VulkanEngine::init_pipelines()
 	//load the compute shaders
 	load_compute_shader(shader_path("indirect_cull.comp.spv").c_str(), _cullPipeline, _cullLayout);
 
+	load_compute_shader(shader_path("cluster_cull.comp.spv").c_str(), _clusterCullPipeline, _clusterCullLayout);
+
 	load_compute_shader(shader_path("depthReduce.comp.spv").c_str(), _depthReducePipeline, _depthReduceLayout);
 
 	load_compute_shader(shader_path("sparse_upload.comp.spv").c_str(), _sparseUploadPipeline, _sparseUploadLayout);
@@ -1425,19 +1579,27 @@ void VulkanEngine::load_meshes()
 {
 	Mesh triMesh{};
 	triMesh.bounds.valid = false;
-	//make the array 3 vertices long
-	triMesh._vertices.resize(3);
+	
+	assets::Vertex_f32_PNCV vertices[3] = {};
 
 	//vertex positions
-	triMesh._vertices[0].position = { 1.f,1.f, 0.0f };
-	triMesh._vertices[1].position = { -1.f,1.f, 0.0f };
-	triMesh._vertices[2].position = { 0.f,-1.f, 0.0f };
+	vertices[0].position[0] = 1.f; vertices[0].position[1] = 1.f;
+	vertices[1].position[0] = -1.f; vertices[1].position[1] = 1.f;
+	vertices[2].position[0] = 0.f; vertices[2].position[1] = -1.f;
 
 	//vertex colors, all green
-	triMesh._vertices[0].color = { 0.f,1.f, 0.0f }; //pure green
-	triMesh._vertices[1].color = { 0.f,1.f, 0.0f }; //pure green
-	triMesh._vertices[2].color = { 0.f,1.f, 0.0f }; //pure green
+	for (auto& v : vertices) {
+		v.color[1] = 1.f; //pure green
+	}
 	//we dont care about the vertex normals
+
+	//positions still get quantized even if the triangle has no valid render bounds
+	assets::PositionQuantization quantization = assets::get_position_quantization(assets::calculateBounds(vertices, 3));
+	triMesh.set_quantization(quantization);
+
+	triMesh._vertices.resize(3);
+	convert_vertices(assets::VertexFormat::PNCV_F32, (const char*)vertices, 3, quantization, triMesh._vertices.data());
+
 	upload_mesh(triMesh);
 	_meshes["triangle"] = triMesh;
 }
@@ -1475,6 +1637,62 @@ bool VulkanEngine::load_image_to_cache(const char* name, const char* path)
 	return true;
 }
 
+bool VulkanEngine::stream_image_to_cache(const char* name, const char* path)
+{
+	ZoneScopedNC("Stream Texture", tracy::Color::Yellow);
+
+	if (_loadedTextures.find(name) != _loadedTextures.end()) return true;
+	for (auto& streaming : _streamingTextures)
+	{
+		if (streaming.name == name) return true;
+	}
+
+	vkutil::StagedImage staged;
+	if (!vkutil::stage_image_from_asset(*this, path, staged))
+	{
+		LOG_ERROR("Error When texture {} at path {}", name, path);
+		return false;
+	}
+
+	StreamingTexture streaming;
+	streaming.name = name;
+	streaming.texture.image = vkutil::create_image_mipmapped(*this, staged);
+	streaming.texture.imageView = streaming.texture.image._defaultView;
+	streaming.upload = _uploader.upload_image(staged, streaming.texture.image);
+
+	_streamingTextures.push_back(std::move(streaming));
+	return true;
+}
+
+void VulkanEngine::poll_uploads()
+{
+	ZoneScopedNC("Poll Uploads", tracy::Color::Yellow);
+
+	_uploader.flush();
+	_uploader.poll();
+
+	//streamed textures join the cache once their copy finished, and this frame acquires them
+	for (size_t i = 0; i < _streamingTextures.size();)
+	{
+		StreamingTexture& streaming = _streamingTextures[i];
+		if (_uploader.is_finished(streaming.upload))
+		{
+			LOG_SUCCESS("Streamed texture {}", streaming.name);
+			_loadedTextures[streaming.name] = streaming.texture;
+
+			if (i + 1 != _streamingTextures.size())
+			{
+				streaming = std::move(_streamingTextures.back());
+			}
+			_streamingTextures.pop_back();
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
 void VulkanEngine::upload_mesh(Mesh& mesh)
 {
 	ZoneScopedNC("Upload Mesh", tracy::Color::Orange);
@@ -1483,6 +1701,10 @@ void VulkanEngine::upload_mesh(Mesh& mesh)
 	const size_t vertex_buffer_size = mesh._vertices.size() * sizeof(Vertex);
 	const size_t index_buffer_size = mesh._indices.size() * sizeof(uint32_t);
 	const size_t bufferSize = vertex_buffer_size + index_buffer_size;
+
+	mesh._vertexCount = static_cast<uint32_t>(mesh._vertices.size());
+	mesh._indexCount = static_cast<uint32_t>(mesh._indices.size());
+	mesh._indexBufferOffset = 0;
 	//allocate vertex buffer
 	VkBufferCreateInfo vertexBufferInfo = {};
 	vertexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1535,6 +1757,102 @@ void VulkanEngine::upload_mesh(Mesh& mesh)
 	}
 }
 
+bool VulkanEngine::load_mesh_staged(Mesh& mesh, const char* path)
+{
+	ZoneScopedNC("Load Mesh Staged", tracy::Color::Orange);
+
+	assets::MappedAssetFile file;
+	if (!assets::map_binaryfile(path, file)) {
+		LOG_ERROR("Error when loading mesh {}", path);
+		return false;
+	}
+
+	assets::MeshInfo meshinfo = assets::read_mesh_info(&file);
+
+	const size_t assetVertexSize = assets::vertex_format_size(meshinfo.vertexFormat);
+	if (assetVertexSize == 0) {
+		LOG_ERROR("Unknown vertex format in mesh {}", path);
+		return false;
+	}
+
+	if (meshinfo.indexSize != sizeof(uint16_t) && meshinfo.indexSize != sizeof(uint32_t)) {
+		LOG_ERROR("Unsupported index size in mesh {}", path);
+		return false;
+	}
+
+	const size_t vertexCount = meshinfo.vertexBuferSize / assetVertexSize;
+	const size_t indexCount = meshinfo.indexBuferSize / meshinfo.indexSize;
+	const size_t decodedSize = meshinfo.vertexBuferSize + meshinfo.indexBuferSize;
+
+	//a single cached allocation holds vertices followed by indices. Cached memory keeps the lz4 back-references
+	//and the in place vertex conversion, which both read what was just written, out of uncached reads
+	AllocatedBufferUntyped stagingBuffer = create_buffer(decodedSize,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+		VMA_MEMORY_USAGE_UNKNOWN, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+
+	char* data;
+	vmaMapMemory(_allocator, stagingBuffer._allocation, (void**)&data);
+
+	if (!assets::unpack_mesh_contiguous(&meshinfo, file.binaryBlob, file.binaryBlobSize, data))
+	{
+		LOG_ERROR("Corrupted mesh data in {}", path);
+		vmaUnmapMemory(_allocator, stagingBuffer._allocation);
+		vmaDestroyBuffer(_allocator, stagingBuffer._buffer, stagingBuffer._allocation);
+		return false;
+	}
+
+	//compact the asset vertices into the engine layout, the indices stay where they were decoded
+	assets::PositionQuantization quantization = assets::get_position_quantization(meshinfo.bounds);
+	mesh.set_quantization(quantization);
+	convert_vertices(meshinfo.vertexFormat, data, vertexCount, quantization, reinterpret_cast<Vertex*>(data));
+
+	//32 bit indices of meshes that can be addressed with 16 bits get narrowed in place, halving their index memory and fetch.
+	//every 16 bit write lands at or before the 32 bit index it came from, so the forward pass never overwrites unread data
+	bool index16 = meshinfo.indexSize == sizeof(uint16_t);
+	if (!index16 && vertexCount <= std::numeric_limits<uint16_t>::max() + size_t(1))
+	{
+		char* indices = data + meshinfo.vertexBuferSize;
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			uint32_t index;
+			memcpy(&index, indices + i * sizeof(uint32_t), sizeof(uint32_t));
+			uint16_t narrow = static_cast<uint16_t>(index);
+			memcpy(indices + i * sizeof(uint16_t), &narrow, sizeof(uint16_t));
+		}
+		index16 = true;
+	}
+
+	//cached memory is not guaranteed to be coherent
+	vmaFlushAllocation(_allocator, stagingBuffer._allocation, 0, VK_WHOLE_SIZE);
+	vmaUnmapMemory(_allocator, stagingBuffer._allocation);
+
+	mesh._vertexBuffer = stagingBuffer;
+	mesh._indexBuffer = stagingBuffer;
+	mesh._indexBufferOffset = meshinfo.vertexBuferSize;
+	mesh._vertexCount = static_cast<uint32_t>(vertexCount);
+	mesh._indexCount = static_cast<uint32_t>(indexCount);
+	mesh._indexType = index16 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+	mesh._lods = meshinfo.lods;
+	mesh._clusters = meshinfo.clusters;
+
+	mesh.bounds.extents.x = meshinfo.bounds.extents[0];
+	mesh.bounds.extents.y = meshinfo.bounds.extents[1];
+	mesh.bounds.extents.z = meshinfo.bounds.extents[2];
+
+	mesh.bounds.origin.x = meshinfo.bounds.origin[0];
+	mesh.bounds.origin.y = meshinfo.bounds.origin[1];
+	mesh.bounds.origin.z = meshinfo.bounds.origin[2];
+
+	mesh.bounds.radius = meshinfo.bounds.radius;
+	mesh.bounds.valid = true;
+
+	if (logMeshUpload)
+	{
+		LOG_SUCCESS("Loaded mesh {} : Verts={}, Tris={}", path, mesh._vertexCount, mesh._indexCount / 3);
+	}
+	return true;
+}
+
 Mesh* VulkanEngine::get_mesh(const std::string& name)
 {
 	auto it = _meshes.find(name);
@@ -1653,10 +1971,24 @@ void VulkanEngine::ready_cull_data(RenderScene::MeshPass& pass, VkCommandBuffer
 	//copy from the cleared indirect buffer into the one we will use on rendering. This one happens every frame
 	VkBufferCopy indirectCopy;
 	indirectCopy.dstOffset = 0;
-	indirectCopy.size = pass.batches.size() * sizeof(GPUIndirectObject);
+	indirectCopy.size = pass.batches.size() * pass.lodLevels * sizeof(GPUIndirectObject);
 	indirectCopy.srcOffset = 0;
 	vkCmdCopyBuffer(cmd, pass.clearIndirectBuffer._buffer, pass.drawIndirectBuffer._buffer, 1, &indirectCopy);
 
+	//the cluster cull appends from zero every frame, and its dispatch grows from zero groups
+	if (pass.clusterDraws > 0)
+	{
+		uint32_t dispatchArgs[4] = { 0, 1, 1, 0 };
+		vkCmdUpdateBuffer(cmd, pass.clusterCountBuffer._buffer, 0, sizeof(dispatchArgs), dispatchArgs);
+		vkCmdFillBuffer(cmd, pass.clusterCountBuffer._buffer, CLUSTER_COUNT_OFFSET, pass.batches.size() * sizeof(uint32_t), 0);
+
+		VkBufferMemoryBarrier barrier = vkinit::buffer_barrier(pass.clusterCountBuffer._buffer, _graphicsQueueFamily);
+		barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		cullReadyBarriers.push_back(barrier);
+	}
+
 	{
 		VkBufferMemoryBarrier barrier = vkinit::buffer_barrier(pass.drawIndirectBuffer._buffer, _graphicsQueueFamily);
 		barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
@@ -1754,210 +2086,346 @@ void VulkanEngine::immediate_submit(std::function<void(VkCommandBuffer cmd)>&& f
 }
 
 
+//prefab as the engine keeps it between instances: node matrices already resolved inside the prefab,
+//meshes and materials already resolved to the loaded ones
+struct CachedPrefab {
+	assets::PrefabInfo info;
+
+	//prefab space matrix of every node, parallel to info.nodes
+	std::vector<glm::mat4> worldMatrices;
+
+	struct DrawNode {
+		uint32_t node;
+		Mesh* mesh;
+		vkutil::Material* material;
+	};
+	std::vector<DrawNode> drawNodes;
+
+	bool assetsLoaded{ false };
+};
+
 bool VulkanEngine::load_prefab(const char* path, glm::mat4 root)
 {
-	int rng = rand();
-	
-	ZoneScopedNC("Load Prefab", tracy::Color::Red);
+	ZoneScopedNC("Load Prefab", tracy::Color::Red);
+
+	CachedPrefab* prefab;
 
 	auto pf = _prefabCache.find(path);
 	if (pf == _prefabCache.end())
 	{
-		assets::AssetFile file;
-		bool loaded = assets::load_binaryfile(path, file);
+		assets::MappedAssetFile file;
+		bool loaded = assets::map_binaryfile(path, file);
 
-		if (!loaded) {
-			LOG_FATAL("Error When loading prefab file at path {}",path);
-			return false;
+		if (!loaded) {
+			LOG_FATAL("Error When loading prefab file at path {}",path);
+			return false;
 		}
 		else {
 			LOG_SUCCESS("Prefab {} loaded to cache", path);
 		}
 
-		_prefabCache[path] = new assets::PrefabInfo;
+		prefab = new CachedPrefab;
+		prefab->info = assets::read_prefab_info(&file);
+
+		//parents come before their children, a single pass front to back resolves every node
+		const std::vector<assets::PrefabInfo::Node>& nodes = prefab->info.nodes;
+		prefab->worldMatrices.resize(nodes.size());
+		for (size_t i = 0; i < nodes.size(); i++)
+		{
+			glm::mat4 nodematrix;
+			memcpy(&nodematrix, &prefab->info.matrices[nodes[i].matrix], sizeof(glm::mat4));
+
+			prefab->worldMatrices[i] = nodes[i].parent < 0 ? nodematrix : prefab->worldMatrices[nodes[i].parent] * nodematrix;
+		}
+
+		_prefabCache[path] = prefab;
+	}
+	else {
+		prefab = pf->second;
+	}
 
-		*_prefabCache[path] = assets::read_prefab_info(&file);
+	if (!prefab->assetsLoaded)
+	{
+		load_prefab_assets(*prefab);
 	}
 
-	assets::PrefabInfo* prefab = _prefabCache[path];
+	//every other instance only multiplies its root into the nodes it draws
+	std::vector<MeshObject> prefab_renderables;
+	prefab_renderables.reserve(prefab->drawNodes.size());
+
+	for (const CachedPrefab::DrawNode& drawNode : prefab->drawNodes)
+	{
+		MeshObject loadmesh;
+		//transparent objects will be invisible
+		
+		loadmesh.bDrawForwardPass = true;
+		loadmesh.bDrawShadowPass = true;
+
+		loadmesh.mesh = drawNode.mesh;
+		loadmesh.transformMatrix = root * prefab->worldMatrices[drawNode.node];
+		loadmesh.material = drawNode.material;
+
+		refresh_renderbounds(&loadmesh);
+
+		loadmesh.customSortKey = 0;
+
+		prefab_renderables.push_back(loadmesh);
+	}
+
+	_renderScene.register_object_batch(prefab_renderables.data(), static_cast<uint32_t>(prefab_renderables.size()));
+
+	return true;
+}
+
+void VulkanEngine::load_prefab_assets(CachedPrefab& prefab)
+{
+	ZoneScopedNC("Load Prefab Assets", tracy::Color::Red);
 
 	VkSamplerCreateInfo samplerInfo = vkinit::sampler_create_info(VK_FILTER_LINEAR);
 	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 
-
+
 	VkSampler smoothSampler;
 	vkCreateSampler(_device, &samplerInfo, nullptr, &smoothSampler);
 
-
-	std::unordered_map<uint64_t, glm::mat4> node_worldmats;
-
-	std::vector<std::pair<uint64_t, glm::mat4>> pending_nodes;
-	for (auto& [k, v] : prefab->node_matrices)
+	//discovery: every mesh and material the prefab uses that is not loaded yet, in first use order
+	std::vector<std::string> newMeshes;
+	std::vector<std::string> newMaterials;
 	{
-		
-		glm::mat4 nodematrix{ 1.f };
-
-		auto nm = prefab->matrices[v];
-		memcpy(&nodematrix, &nm, sizeof(glm::mat4));
+		std::unordered_set<std::string> seenMeshes;
+		std::unordered_set<std::string> seenMaterials;
+		for (const assets::PrefabInfo::NodeMesh& v : prefab.info.meshes)
+		{
+			if (v.mesh_path.find("Sky") != std::string::npos) {
+				continue;
+			}
 
-		//check if it has parents
-		auto matrixIT = prefab->node_parents.find(k);
-		if (matrixIT == prefab->node_parents.end()) {
-			//add to worldmats 
-			node_worldmats[k] = root* nodematrix;
-		}
-		else {
-			//enqueue
-			pending_nodes.push_back({ k,nodematrix });
+			if (!get_mesh(v.mesh_path) && seenMeshes.insert(v.mesh_path).second)
+			{
+				newMeshes.push_back(v.mesh_path);
+			}
+			if (!_materialSystem->get_material(v.material_path) && seenMaterials.insert(v.material_path).second)
+			{
+				newMaterials.push_back(v.material_path);
+			}
 		}
 	}
 
-	//process pending nodes list until it empties
-	while (pending_nodes.size() > 0)
+	//decode stage: meshes and textures decode on the engine workers, each into its own staging buffer.
+	//the meshes start right away, the textures once the materials told which ones they are
+	std::vector<Mesh> meshes(newMeshes.size());
+	std::vector<uint8_t> meshLoaded(newMeshes.size());
+	std::vector<double> meshTimes(newMeshes.size());
+	auto decodeStart = std::chrono::high_resolution_clock::now();
+
+	std::vector<ThreadPool::TaskHandle> meshTasks;
+	meshTasks.reserve(newMeshes.size());
+	for (size_t i = 0; i < newMeshes.size(); i++)
 	{
-		for (int i = 0; i < pending_nodes.size(); i++)
-		{
-			uint64_t node = pending_nodes[i].first;
-			uint64_t parent = prefab->node_parents[node];
+		meshTasks.push_back(_threadPool.schedule([&, i] {
+			auto start = std::chrono::high_resolution_clock::now();
+			if (stagedMeshDecode)
+			{
+				meshLoaded[i] = load_mesh_staged(meshes[i], asset_path(newMeshes[i]).c_str());
+			}
+			else
+			{
+				meshLoaded[i] = meshes[i].load_from_meshasset(asset_path(newMeshes[i]).c_str());
+				if (meshLoaded[i])
+				{
+					upload_mesh(meshes[i]);
+				}
+			}
+			meshTimes[i] = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		}));
+	}
 
-			//try to find parent in cache
-			auto matrixIT = node_worldmats.find(parent);
-			if (matrixIT != node_worldmats.end()) {
+	//material files are tiny, but they are needed to find out which textures to decode
+	struct PendingMaterial {
+		bool loaded{ false };
+		assets::MaterialInfo info;
+		std::string texture;
+	};
+	std::vector<PendingMaterial> materials(newMaterials.size());
 
-				//transform with the parent
-				glm::mat4 nodematrix = (matrixIT)->second * pending_nodes[i].second;
+	_threadPool.parallel_for(static_cast<uint32_t>(newMaterials.size()), [&](uint32_t i) {
+		assets::MappedAssetFile materialFile;
+		if (!assets::map_binaryfile(asset_path(newMaterials[i]).c_str(), materialFile)) return;
 
-				node_worldmats[node] = nodematrix;
+		materials[i].loaded = true;
+		materials[i].info = assets::read_material_info(&materialFile);
 
-				//remove from queue, pop last
-				pending_nodes[i] = pending_nodes.back();
-				pending_nodes.pop_back();
-				i--;
+		materials[i].texture = materials[i].info.textures["baseColor"];
+		if (materials[i].texture.size() <= 3)
+		{
+			materials[i].texture = "Sponza/white.tx";
+		}
+	});
+
+	std::vector<std::string> newTextures;
+	{
+		std::unordered_set<std::string> seenTextures;
+		for (auto& material : materials)
+		{
+			if (material.loaded && _loadedTextures.find(material.texture) == _loadedTextures.end() && seenTextures.insert(material.texture).second)
+			{
+				newTextures.push_back(material.texture);
 			}
 		}
-		
 	}
 
-	std::vector<MeshObject> prefab_renderables;
-	prefab_renderables.reserve(prefab->node_meshes.size());
-
-	for (auto& [k, v] : prefab->node_meshes)
+	std::vector<vkutil::StagedImage> images(newTextures.size());
+	std::vector<uint8_t> imageLoaded(newTextures.size());
+	std::vector<double> imageTimes(newTextures.size());
+	//with streaming on only the coarse mips load here, the streamer brings in the finer ones the screen needs
+	const uint32_t residentSize = _textureStreamer.resident_size();
 	{
-		
-		//load mesh
+		ZoneScopedNC("Prefab Decode", tracy::Color::Orange);
 
-		if (v.mesh_path.find("Sky") != std::string::npos) {
-			continue;
+		_threadPool.parallel_for(static_cast<uint32_t>(newTextures.size()), [&](uint32_t t) {
+			auto start = std::chrono::high_resolution_clock::now();
+			imageLoaded[t] = vkutil::stage_image_from_asset(*this, asset_path(newTextures[t]).c_str(), images[t], residentSize);
+			imageTimes[t] = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		});
+		for (auto& task : meshTasks)
+		{
+			_threadPool.wait(task);
 		}
 
-		if (!get_mesh(v.mesh_path.c_str()))
+		auto decodeEnd = std::chrono::high_resolution_clock::now();
+		_loadStats.prefabDecodeTime += std::chrono::duration<double, std::milli>(decodeEnd - decodeStart).count();
+	}
+
+	for (size_t i = 0; i < newMeshes.size(); i++)
+	{
+		//the nodes drawing a mesh that failed to load get skipped, as it is never found
+		if (!meshLoaded[i])
 		{
-			Mesh mesh{};
-			mesh.load_from_meshasset(asset_path(v.mesh_path).c_str());
+			LOG_ERROR("Error When loading mesh {} at path {}", newMeshes[i], asset_path(newMeshes[i]));
+			continue;
+		}
 
-			upload_mesh(mesh);
+		_loadStats.meshLoadTime += meshTimes[i];
+		_loadStats.meshBytesDecoded += size_t(meshes[i]._vertexCount) * sizeof(Vertex) + size_t(meshes[i]._indexCount) * meshes[i].get_index_size();
+		_loadStats.meshesLoaded++;
 
-			_meshes[v.mesh_path.c_str()] = mesh;
-		}
+		_meshes[newMeshes[i]] = std::move(meshes[i]);
+	}
 
-		
-		auto materialName = v.material_path.c_str();
-		//load material
-		
-		vkutil::Material* objectMaterial = _materialSystem->get_material(materialName);
-		if (!objectMaterial)
+	//upload stage: the textures of the whole prefab go through a single submit
+	if (!newTextures.empty())
+	{
+		ZoneScopedNC("Prefab Upload", tracy::Color::Yellow);
+
+		std::vector<AllocatedImage> uploadedImages(newTextures.size());
+		for (size_t i = 0; i < newTextures.size(); i++)
 		{
-			assets::AssetFile materialFile;
-			bool loaded = assets::load_binaryfile(asset_path(materialName).c_str(), materialFile);
-			
-			if (loaded)
+			if (imageLoaded[i])
 			{
-				assets::MaterialInfo material = assets::read_material_info(&materialFile);
+				uploadedImages[i] = residentSize > 0 ? vkutil::allocate_image_mipmapped(*this, images[i]) : vkutil::create_image_mipmapped(*this, images[i]);
+			}
+		}
 
-				auto texture = material.textures["baseColor"];
-				if (texture.size() <= 3)
+		immediate_submit([&](VkCommandBuffer cmd) {
+			for (size_t i = 0; i < newTextures.size(); i++)
+			{
+				if (imageLoaded[i])
 				{
-					texture = "Sponza/white.tx";
+					vkutil::record_image_upload(cmd, images[i], uploadedImages[i]);
 				}
+			}
+		});
 
-				loaded = load_image_to_cache(texture.c_str(), asset_path(texture).c_str());
-				
-				if (loaded)
-				{
-					vkutil::SampledTexture tex;
-					tex.view = _loadedTextures[texture].imageView;
-					tex.sampler = smoothSampler;
-
-					vkutil::MaterialData info;
-					info.parameters = nullptr;
+		for (size_t i = 0; i < newTextures.size(); i++)
+		{
+			if (!imageLoaded[i])
+			{
+				LOG_ERROR("Error When texture {} at path {}", newTextures[i], asset_path(newTextures[i]));
+				continue;
+			}
+			LOG_SUCCESS("Loaded texture {} at path {}", newTextures[i], asset_path(newTextures[i]));
 
-					if (material.transparency == assets::TransparencyMode::Transparent)
-					{
-						info.baseTemplate = "texturedPBR_transparent";
-					}
-					else {
-						info.baseTemplate = "texturedPBR_opaque";
-					}
-					
-					info.textures.push_back(tex);
+			vmaDestroyBuffer(_allocator, images[i].stagingBuffer._buffer, images[i].stagingBuffer._allocation);
 
-					objectMaterial = _materialSystem->build_material(materialName, info);
+			Texture newtex;
+			newtex.image = uploadedImages[i];
+			newtex.imageView = uploadedImages[i]._defaultView;
+			_loadedTextures[newTextures[i]] = newtex;
 
-					if (!objectMaterial)
-					{
-						LOG_ERROR("Error When building material {}", v.material_path);
-					}
-				}
-				else
-				{
-					LOG_ERROR("Error When loading image at {}", v.material_path);
-				}
-			}
-			else
+			if (residentSize > 0)
 			{
-				LOG_ERROR("Error When loading material at path {}", v.material_path);
+				_textureStreamer.add_texture(newTextures[i], asset_path(newTextures[i]), uploadedImages[i], images[i].firstMip);
 			}
-		}
-		
-		MeshObject loadmesh;
-		//transparent objects will be invisible
-		
-		loadmesh.bDrawForwardPass = true;
-		loadmesh.bDrawShadowPass = true;
-		
 
-		glm::mat4 nodematrix{ 1.f };
+			_loadStats.textureDecodeTime += imageTimes[i];
+			_loadStats.textureBytesDecoded += images[i].stagingBuffer._size;
+			_loadStats.texturesLoaded++;
+		}
+	}
 
-		auto matrixIT = node_worldmats.find(k);
-		if (matrixIT != node_worldmats.end()) {
-			auto nm = (*matrixIT).second;
-			memcpy(&nodematrix, &nm, sizeof(glm::mat4));
-		}		
-		
-		loadmesh.mesh = get_mesh(v.mesh_path.c_str());
-		loadmesh.transformMatrix = nodematrix;
-		loadmesh.material = objectMaterial;
+	//materials are built on the main thread, in first use order
+	for (size_t i = 0; i < newMaterials.size(); i++)
+	{
+		if (!materials[i].loaded)
+		{
+			LOG_ERROR("Error When loading material at path {}", newMaterials[i]);
+			continue;
+		}
 
-		refresh_renderbounds(&loadmesh);
+		auto textureIt = _loadedTextures.find(materials[i].texture);
+		if (textureIt == _loadedTextures.end())
+		{
+			LOG_ERROR("Error When loading image at {}", newMaterials[i]);
+			continue;
+		}
 
-		//sort key from location
-		int32_t lx = int(loadmesh.bounds.origin.x / 10.f);
-		int32_t ly = int(loadmesh.bounds.origin.y / 10.f);
+		vkutil::SampledTexture tex;
+		tex.view = textureIt->second.imageView;
+		tex.sampler = smoothSampler;
 
-		uint32_t key =  uint32_t(std::hash<int32_t>()(lx) ^ std::hash<int32_t>()(ly^1337));
+		vkutil::MaterialData info;
+		info.parameters = nullptr;
 
-		loadmesh.customSortKey = 0;// rng;// key;
+		if (materials[i].info.transparency == assets::TransparencyMode::Transparent)
+		{
+			info.baseTemplate = "texturedPBR_transparent";
+		}
+		else {
+			info.baseTemplate = "texturedPBR_opaque";
+		}
 		
+		info.textures.push_back(tex);
 
-		prefab_renderables.push_back(loadmesh);
-		//_renderables.push_back(loadmesh);
+		if (!_materialSystem->build_material(newMaterials[i], info))
+		{
+			LOG_ERROR("Error When building material {}", newMaterials[i]);
+		}
 	}
 
-	_renderScene.register_object_batch(prefab_renderables.data(), static_cast<uint32_t>(prefab_renderables.size()));
+	//resolved once here, instances of the prefab never look a name up again
+	std::vector<Mesh*> resolvedMeshes(prefab.info.meshes.size(), nullptr);
+	std::vector<vkutil::Material*> resolvedMaterials(prefab.info.meshes.size(), nullptr);
+	for (size_t i = 0; i < prefab.info.meshes.size(); i++)
+	{
+		const assets::PrefabInfo::NodeMesh& v = prefab.info.meshes[i];
+		if (v.mesh_path.find("Sky") != std::string::npos) {
+			continue;
+		}
 
+		resolvedMeshes[i] = get_mesh(v.mesh_path);
+		resolvedMaterials[i] = _materialSystem->get_material(v.material_path);
+	}
 
+	for (uint32_t node = 0; node < prefab.info.nodes.size(); node++)
+	{
+		int32_t mesh = prefab.info.nodes[node].mesh;
+		if (mesh >= 0 && resolvedMeshes[mesh])
+		{
+			prefab.drawNodes.push_back({ node, resolvedMeshes[mesh], resolvedMaterials[mesh] });
+		}
+	}
 
-	return true;
+	prefab.assetsLoaded = true;
 }
 
 
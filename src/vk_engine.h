@@ -15,6 +15,9 @@
 #include <player_camera.h>
 #include <unordered_map>
 #include <material_system.h>
+#include <thread_pool.h>
+#include <vk_upload.h>
+#include <vk_texture_streaming.h>
 
 
 
@@ -32,6 +35,8 @@ namespace tracy { class VkCtx; }
 
 namespace assets { struct PrefabInfo; }
 
+struct CachedPrefab;
+
 
 //forward declarations
 namespace vkutil {
@@ -75,6 +80,13 @@ struct Texture {
 	VkImageView imageView;
 };
 
+//texture whose copy is still running on the transfer queue
+struct StreamingTexture {
+	std::string name;
+	Texture texture;
+	vkutil::UploadHandle upload;
+};
+
 
 
 struct MeshObject {
@@ -148,6 +160,22 @@ struct EngineStats {
 	int triangles;
 };
 
+struct AssetLoadStats {
+	uint32_t meshesLoaded{ 0 };
+	size_t meshBytesDecoded{ 0 };
+	double meshLoadTime{ 0 }; //milliseconds
+
+	uint32_t texturesLoaded{ 0 };
+	size_t textureBytesDecoded{ 0 };
+	double textureDecodeTime{ 0 }; //milliseconds, summed over textures
+
+	double prefabDecodeTime{ 0 }; //milliseconds, wall clock of the parallel prefab decode stages
+
+	//per mesh copies freed once the scene merged them, see releaseMergedMeshes
+	size_t meshCpuBytesReleased{ 0 };
+	size_t meshBufferBytesReleased{ 0 };
+};
+
 
 struct MeshDrawCommands {
 	struct RenderBatch {
@@ -168,6 +196,7 @@ struct /*alignas(16)*/DrawCullData
 	float pyramidWidth, pyramidHeight; // depth pyramid size in texels
 
 	uint32_t drawCount;
+	uint32_t batchCount; // stride between the commands of consecutive lods
 
 	int cullingEnabled;
 	int lodEnabled;
@@ -180,7 +209,10 @@ struct /*alignas(16)*/DrawCullData
 	float aabbmax_x;
 	float aabbmax_y;
 	float aabbmax_z;
-	
+
+	uint32_t clusterInstanceBase; // first instance slot of the cluster draws, after the lod ranges
+	int clusterEnabled;
+	int coneCullEnabled;
 };
 
 //struct EngineConfig {
@@ -231,10 +263,16 @@ public:
 
 	VkPhysicalDeviceProperties _gpuProperties;
 
+	//optional in vulkan 1.2, the cluster cull and its draws are skipped without it
+	bool _drawIndirectCountSupported{ false };
+
 	FrameData _frames[FRAME_OVERLAP];
 	
 	VkQueue _graphicsQueue;
 	uint32_t _graphicsQueueFamily;
+
+	VkQueue _transferQueue;
+	uint32_t _transferQueueFamily;
 	
 	tracy::VkCtx* _graphicsQueueContext;
 
@@ -290,6 +328,8 @@ public:
 	std::vector<VkBufferMemoryBarrier> postCullBarriers;
 
 	UploadContext _uploadContext;
+	vkutil::AsyncUploader _uploader;
+	vkutil::TextureStreamer _textureStreamer;
 
 	PlayerCamera _camera;
 	DirectionalLight _mainLight;
@@ -297,6 +337,9 @@ public:
 	VkPipeline _cullPipeline;
 	VkPipelineLayout _cullLayout;
 
+	VkPipeline _clusterCullPipeline;
+	VkPipelineLayout _clusterCullLayout;
+
 	VkPipeline _depthReducePipeline;
 	VkPipelineLayout _depthReduceLayout;
 
@@ -340,7 +383,12 @@ public:
 
 	std::unordered_map<std::string, Mesh> _meshes;
 	std::unordered_map<std::string, Texture> _loadedTextures;
-	std::unordered_map<std::string, assets::PrefabInfo*> _prefabCache;
+	std::vector<StreamingTexture> _streamingTextures;
+	std::unordered_map<std::string, CachedPrefab*> _prefabCache;
+
+	//persistent workers of the loaders and of the per frame batch refresh and buffer fills
+	ThreadPool _threadPool;
+	AssetLoadStats _loadStats;
 	//functions
 
 	//returns nullptr if it cant be found
@@ -368,7 +416,14 @@ public:
 
 	void immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function);
 
-	bool load_prefab(const char* path, glm::mat4 root);
+	bool load_prefab(const char* path, glm::mat4 root);
+
+	//loads every mesh, texture and material the prefab draws, on the first instance of it
+	void load_prefab_assets(CachedPrefab& prefab);
+
+	//decodes the texture and queues its upload on the transfer queue without waiting for it.
+	//the texture shows up in _loadedTextures on the first frame after the copy finished
+	bool stream_image_to_cache(const char* name, const char* path);
 
 	static std::string asset_path(std::string_view path);
 	
@@ -417,6 +472,12 @@ private:
 
 	void upload_mesh(Mesh& mesh);
 
+	//submits the queued uploads and moves the finished streamed textures into the cache
+	void poll_uploads();
+
+	//decodes the mesh asset straight into a mapped staging buffer that backs both its vertices and indices
+	bool load_mesh_staged(Mesh& mesh, const char* path);
+
 	void copy_render_to_swapchain(uint32_t swapchainImageIndex, VkCommandBuffer cmd);
 };
 
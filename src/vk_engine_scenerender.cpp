@@ -22,6 +22,14 @@ AutoCVar_Int CVAR_Shadowcast("gpu.shadowcast", "Use shadowcasting", 1, CVarFlags
 AutoCVar_Float CVAR_ShadowBias("gpu.shadowBias", "Distance cull", 5.25f);
 AutoCVar_Float CVAR_SlopeBias("gpu.shadowBiasSlope", "Distance cull", 4.75f);
 
+AutoCVar_Int CVAR_LodSelect("culling.lod", "Select mesh levels of detail by distance", 1, CVarFlags::EditCheckbox);
+AutoCVar_Float CVAR_LodBase("culling.lodBase", "Distance in bounding radii where the first lod switch happens", 10.f);
+AutoCVar_Float CVAR_LodStep("culling.lodStep", "Distance factor between lod switches", 1.5f);
+
+AutoCVar_Int CVAR_ClusterCull("culling.clusters", "Cull the clusters of clustered meshes one by one", 1, CVarFlags::EditCheckbox);
+//the forward pipelines draw without back face culling, so clusters facing away can still be visible on open meshes
+AutoCVar_Int CVAR_ClusterConeCull("culling.clusterCones", "Cull clusters that face away from the camera", 0, CVarFlags::EditCheckbox);
+
 
 glm::vec4 normalizePlane(glm::vec4 p)
 {
@@ -45,6 +53,10 @@ void VulkanEngine::execute_compute_cull(VkCommandBuffer cmd, RenderScene::MeshPa
 
 	VkDescriptorBufferInfo indirectInfo = pass.drawIndirectBuffer.get_info();
 
+	VkDescriptorBufferInfo clusterWorkInfo = pass.clusterWorkBuffer.get_info();
+
+	VkDescriptorBufferInfo clusterCountInfo = pass.clusterCountBuffer.get_info();
+
 	VkDescriptorImageInfo depthPyramid;
 	depthPyramid.sampler = _depthSampler;
 	depthPyramid.imageView = _depthPyramid._defaultView;
@@ -59,6 +71,8 @@ void VulkanEngine::execute_compute_cull(VkCommandBuffer cmd, RenderScene::MeshPa
 		.bind_buffer(3, &finalInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
 		.bind_image(4, &depthPyramid, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT)
 		.bind_buffer(5, &dynamicInfo, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.bind_buffer(6, &clusterWorkInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+		.bind_buffer(7, &clusterCountInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
 		.build(COMPObjectDataSet);
 
 
@@ -77,12 +91,15 @@ void VulkanEngine::execute_compute_cull(VkCommandBuffer cmd, RenderScene::MeshPa
 	cullData.frustum[1] = frustumX.z;
 	cullData.frustum[2] = frustumY.y;
 	cullData.frustum[3] = frustumY.z;
-	cullData.drawCount = static_cast<uint32_t>(pass.flat_batches.size());
+	//one instance slot per pass object, the free ones get skipped
+	cullData.drawCount = static_cast<uint32_t>(pass.objects.size());
+	cullData.batchCount = static_cast<uint32_t>(pass.batches.size());
 	cullData.cullingEnabled = params.frustrumCull;
-	cullData.lodEnabled = false;
+	//the aabb cull of the shadow pass has no camera to measure distance from
+	cullData.lodEnabled = CVAR_LodSelect.Get() && pass.lodLevels > 1 && !params.aabb;
 	cullData.occlusionEnabled = params.occlusionCull;
-	cullData.lodBase = 10.f;
-	cullData.lodStep = 1.5f;
+	cullData.lodBase = CVAR_LodBase.GetFloat();
+	cullData.lodStep = CVAR_LodStep.GetFloat();
 	cullData.pyramidWidth = static_cast<float>(depthPyramidWidth);
 	cullData.pyramidHeight = static_cast<float>(depthPyramidHeight);
 	cullData.viewMat = params.viewmat;//get_view_matrix();
@@ -96,6 +113,12 @@ void VulkanEngine::execute_compute_cull(VkCommandBuffer cmd, RenderScene::MeshPa
 	cullData.aabbmax_y = params.aabbmax.y;
 	cullData.aabbmax_z = params.aabbmax.z;
 
+	//like lods, clusters need a camera. The shadow pass keeps culling whole objects
+	bool clusterCull = CVAR_ClusterCull.Get() && _drawIndirectCountSupported && pass.clusterDraws > 0 && !params.aabb && _renderScene.clusterBuffer._buffer != VK_NULL_HANDLE;
+	cullData.clusterInstanceBase = pass.instanceStride * pass.lodLevels;
+	cullData.clusterEnabled = clusterCull;
+	cullData.coneCullEnabled = CVAR_ClusterConeCull.Get();
+
 	if (params.drawDist > 10000)
 	{
 		cullData.distanceCheck = false; 
@@ -111,7 +134,60 @@ void VulkanEngine::execute_compute_cull(VkCommandBuffer cmd, RenderScene::MeshPa
 
 	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _cullLayout, 0, 1, &COMPObjectDataSet, 0, nullptr);
 	
-	vkCmdDispatch(cmd, static_cast<uint32_t>((pass.flat_batches.size() / 256)+1), 1, 1);
+	vkCmdDispatch(cmd, static_cast<uint32_t>((pass.objects.size() / 256)+1), 1, 1);
+
+	if (clusterCull)
+	{
+		TracyVkZone(_graphicsQueueContext, cmd, "Cluster Cull Dispatch");
+
+		//the object cull wrote the visible clustered objects and the group count to dispatch for them
+		VkBufferMemoryBarrier workBarrier = vkinit::buffer_barrier(pass.clusterWorkBuffer._buffer, _graphicsQueueFamily);
+		workBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		workBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+		VkBufferMemoryBarrier countBarrier = vkinit::buffer_barrier(pass.clusterCountBuffer._buffer, _graphicsQueueFamily);
+		countBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		countBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+		VkBufferMemoryBarrier clusterBarriers[] = { workBarrier, countBarrier };
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 2, clusterBarriers, 0, nullptr);
+
+		VkDescriptorBufferInfo clusterInfo = _renderScene.clusterBuffer.get_info();
+
+		VkDescriptorBufferInfo clusterDrawInfo = pass.clusterDrawBuffer.get_info();
+
+		VkDescriptorSet clusterSet;
+		vkutil::DescriptorBuilder::begin(_descriptorLayoutCache, get_current_frame().dynamicDescriptorAllocator)
+			.bind_buffer(0, &objectBufferInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.bind_buffer(1, &indirectInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.bind_buffer(2, &clusterInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.bind_buffer(3, &clusterWorkInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.bind_buffer(4, &clusterCountInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.bind_buffer(5, &clusterDrawInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.bind_buffer(6, &finalInfo, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.bind_image(7, &depthPyramid, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT)
+			.build(clusterSet);
+
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _clusterCullPipeline);
+
+		vkCmdPushConstants(cmd, _clusterCullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DrawCullData), &cullData);
+
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _clusterCullLayout, 0, 1, &clusterSet, 0, nullptr);
+
+		//one group for each visible clustered object
+		vkCmdDispatchIndirect(cmd, pass.clusterCountBuffer._buffer, 0);
+
+		VkBufferMemoryBarrier drawBarrier = vkinit::buffer_barrier(pass.clusterDrawBuffer._buffer, _graphicsQueueFamily);
+		drawBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		drawBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+		VkBufferMemoryBarrier drawCountBarrier = vkinit::buffer_barrier(pass.clusterCountBuffer._buffer, _graphicsQueueFamily);
+		drawCountBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		drawCountBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+		postCullBarriers.push_back(drawBarrier);
+		postCullBarriers.push_back(drawCountBarrier);
+	}
 
 
 	//barrier the 2 buffers we just wrote for culling, the indirect draw one, and the instances one, so that they can be read well when rendering the pass
@@ -135,14 +211,14 @@ void VulkanEngine::execute_compute_cull(VkCommandBuffer cmd, RenderScene::MeshPa
 		uint32_t offset = get_current_frame().debugDataOffsets.back();
 		VkBufferCopy debugCopy;
 		debugCopy.dstOffset = offset;
-		debugCopy.size = pass.batches.size() * sizeof(GPUIndirectObject);
+		debugCopy.size = pass.batches.size() * pass.lodLevels * sizeof(GPUIndirectObject);
 		debugCopy.srcOffset = 0;
 		vkCmdCopyBuffer(cmd, pass.drawIndirectBuffer._buffer, get_current_frame().debugOutputBuffer._buffer, 1, &debugCopy);
 		get_current_frame().debugDataOffsets.push_back(offset + static_cast<uint32_t>(debugCopy.size));
 		get_current_frame().debugDataNames.push_back("Cull Indirect Output");
 	}
 }
-#include <future>
+
 void VulkanEngine::ready_mesh_draw(VkCommandBuffer cmd)
 {
 	
@@ -267,26 +343,62 @@ void VulkanEngine::ready_mesh_draw(VkCommandBuffer cmd)
 
 		//reallocate the gpu side buffers if needed
 
-		if (pass.drawIndirectBuffer._size < pass.batches.size() * sizeof(GPUIndirectObject))
+		//commands and instance ranges are repeated for every level of detail
+		size_t indirectSize = pass.batches.size() * pass.lodLevels * sizeof(GPUIndirectObject);
+		if (pass.drawIndirectBuffer._size < indirectSize)
+		{
+			reallocate_buffer(pass.drawIndirectBuffer, indirectSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		}
+
+		//the cleared commands only get copied where they changed, a new buffer needs all of them
+		if (pass.clearIndirectBuffer._size < indirectSize)
 		{
-			reallocate_buffer(pass.drawIndirectBuffer, pass.batches.size() * sizeof(GPUIndirectObject), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			reallocate_buffer(pass.clearIndirectBuffer, indirectSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			pass.needsIndirectRefresh = true;
 		}
 
-		if (pass.compactedInstanceBuffer._size < pass.flat_batches.size() * sizeof(uint32_t))
+		size_t compactedSize = (size_t(pass.instanceStride) * pass.lodLevels + pass.clusterDraws) * sizeof(uint32_t);
+		if (pass.compactedInstanceBuffer._size < compactedSize)
 		{
-			reallocate_buffer(pass.compactedInstanceBuffer, pass.flat_batches.size() * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			reallocate_buffer(pass.compactedInstanceBuffer, compactedSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
 		}
 
-		if (pass.passObjectsBuffer._size < pass.flat_batches.size() * sizeof(GPUInstance))
+		//the object cull binds the cluster work and count buffers even when no mesh of the pass has clusters
+		size_t clusterWorkSize = pass.objects.size() * sizeof(GPUInstance);
+		if (pass.clusterWorkBuffer._size < clusterWorkSize)
 		{
-			reallocate_buffer(pass.passObjectsBuffer, pass.flat_batches.size() * sizeof(GPUInstance), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			reallocate_buffer(pass.clusterWorkBuffer, clusterWorkSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		}
+
+		size_t clusterCountSize = CLUSTER_COUNT_OFFSET + pass.batches.size() * sizeof(uint32_t);
+		if (pass.clusterCountBuffer._size < clusterCountSize)
+		{
+			reallocate_buffer(pass.clusterCountBuffer, clusterCountSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		}
+
+		size_t clusterDrawSize = pass.clusterDraws * sizeof(VkDrawIndexedIndirectCommand);
+		if (pass.clusterDrawBuffer._size < clusterDrawSize)
+		{
+			reallocate_buffer(pass.clusterDrawBuffer, clusterDrawSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+		}
+
+		//new objects keep adding slots without a rebuild, and a new buffer needs every instance again. It grows with room to spare
+		size_t instanceSize = pass.objects.size() * sizeof(GPUInstance);
+		if (pass.passObjectsBuffer._size < instanceSize)
+		{
+			reallocate_buffer(pass.passObjectsBuffer, instanceSize + instanceSize / 2, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+			pass.needsInstanceRefresh = true;
 		}
 	}
 
-	std::vector<std::future<void>> async_calls;
-	async_calls.reserve(9);
+	//the buffer fills run on the engine workers while the commands get recorded, and are waited on before the unmaps
+	std::vector<ThreadPool::TaskHandle> fillTasks;
+	fillTasks.reserve(6);
 
 	std::vector<AllocatedBufferUntyped> unmaps;
+
+	//the cleared commands are read by the copies of ready_cull_data, not by the cull
+	std::vector<VkBufferMemoryBarrier> indirectBarriers;
 	
 
 	for (int p = 0; p < 3; p++)
@@ -295,57 +407,55 @@ void VulkanEngine::ready_mesh_draw(VkCommandBuffer cmd)
 		RenderScene::MeshPass* ppass = passes[p];
 
 		RenderScene* pScene = &_renderScene;
-		//if the pass has changed the batches, need to reupload them
-		if (pass.needsIndirectRefresh && pass.batches.size() > 0)
+		//rebuilt batches upload every command, batches that only changed their count the commands from the first of them on
+		uint32_t firstBatch = pass.needsIndirectRefresh ? 0 : pass.firstDirtyBatch;
+		if (firstBatch < pass.batches.size())
 		{
 			ZoneScopedNC("Refresh Indirect Buffer", tracy::Color::Red);
 
-			AllocatedBuffer<GPUIndirectObject> newBuffer = create_buffer(sizeof(GPUIndirectObject) * pass.batches.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+			const uint32_t batchCount = static_cast<uint32_t>(pass.batches.size());
+			const uint32_t dirtyCount = batchCount - firstBatch;
+			AllocatedBuffer<GPUIndirectObject> newBuffer = create_buffer(sizeof(GPUIndirectObject) * dirtyCount * pass.lodLevels, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
 
 			GPUIndirectObject* indirect = map_buffer(newBuffer);
 
-			
-
-			async_calls.push_back(std::async(std::launch::async, [=] { 
-				
-				
-				pScene->fill_indirectArray(indirect, *ppass);
-				
+			fillTasks.push_back(_threadPool.schedule([=] {
+				pScene->fill_indirectArray(indirect, *ppass, firstBatch);
 			}));
-			//async_calls.push_back([&]() {
-			//	_renderScene.fill_indirectArray(indirect, pass);
-			//});
 			
 			unmaps.push_back(newBuffer);
 
-			//unmap_buffer(newBuffer);
+			get_current_frame()._frameDeletionQueue.push_function([=]() {
 
-			if (pass.clearIndirectBuffer._buffer != VK_NULL_HANDLE)
-			{
-				AllocatedBufferUntyped deletionBuffer = pass.clearIndirectBuffer;
-				//add buffer to deletion queue of this frame
-				get_current_frame()._frameDeletionQueue.push_function([=]() {
+				vmaDestroyBuffer(_allocator, newBuffer._buffer, newBuffer._allocation);
+			});
 
-					vmaDestroyBuffer(_allocator, deletionBuffer._buffer, deletionBuffer._allocation);
-				});
+			//the changed commands of every level are one range
+			std::vector<VkBufferCopy> copies;
+			for (uint32_t lod = 0; lod < pass.lodLevels; lod++)
+			{
+				copies.push_back({ lod * dirtyCount * sizeof(GPUIndirectObject), (lod * batchCount + firstBatch) * sizeof(GPUIndirectObject), dirtyCount * sizeof(GPUIndirectObject) });
 			}
+			vkCmdCopyBuffer(cmd, newBuffer._buffer, pass.clearIndirectBuffer._buffer, static_cast<uint32_t>(copies.size()), copies.data());
 
-			pass.clearIndirectBuffer = newBuffer;
-			pass.needsIndirectRefresh = false;
+			VkBufferMemoryBarrier barrier = vkinit::buffer_barrier(pass.clearIndirectBuffer._buffer, _graphicsQueueFamily);
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+			indirectBarriers.push_back(barrier);
 		}
+		pass.needsIndirectRefresh = false;
+		pass.firstDirtyBatch = ~0u;
 
-		if (pass.needsInstanceRefresh && pass.flat_batches.size() >0)
+		if (pass.needsInstanceRefresh && pass.objects.size() >0)
 		{
 			ZoneScopedNC("Refresh Instancing Buffer", tracy::Color::Red);
 
-			AllocatedBuffer<GPUInstance> newBuffer = create_buffer(sizeof(GPUInstance) * pass.flat_batches.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+			AllocatedBuffer<GPUInstance> newBuffer = create_buffer(sizeof(GPUInstance) * pass.objects.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
 
 			GPUInstance* instanceData = map_buffer(newBuffer);
-			async_calls.push_back(std::async(std::launch::async, [=] {
-
-
+			fillTasks.push_back(_threadPool.schedule([=] {
 				pScene->fill_instancesArray(instanceData, *ppass);
-
 			}));
 			unmaps.push_back(newBuffer);
 			//_renderScene.fill_instancesArray(instanceData, pass);
@@ -359,7 +469,7 @@ void VulkanEngine::ready_mesh_draw(VkCommandBuffer cmd)
 			//copy from the uploaded cpu side instance buffer to the gpu one
 			VkBufferCopy indirectCopy;
 			indirectCopy.dstOffset = 0;
-			indirectCopy.size = pass.flat_batches.size() * sizeof(GPUInstance);
+			indirectCopy.size = pass.objects.size() * sizeof(GPUInstance);
 			indirectCopy.srcOffset = 0;
 			vkCmdCopyBuffer(cmd, newBuffer._buffer, pass.passObjectsBuffer._buffer, 1, &indirectCopy);
 
@@ -370,12 +480,40 @@ void VulkanEngine::ready_mesh_draw(VkCommandBuffer cmd)
 			uploadBarriers.push_back(barrier);
 
 			pass.needsInstanceRefresh = false;
+			pass.dirtyInstances.clear();
+		}
+		else if (pass.dirtyInstances.size() > 0)
+		{
+			ZoneScopedNC("Refresh Dirty Instances", tracy::Color::Red);
+
+			//objects joining or leaving a batch that already exists only change their own instances, the rest of the buffer stays
+			AllocatedBuffer<GPUInstance> newBuffer = create_buffer(sizeof(GPUInstance) * pass.dirtyInstances.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+			std::vector<VkBufferCopy> copies;
+			GPUInstance* instanceData = map_buffer(newBuffer);
+			_renderScene.fill_dirty_instances(instanceData, pass, copies);
+			unmap_buffer(newBuffer);
+
+			get_current_frame()._frameDeletionQueue.push_function([=]() {
+
+				vmaDestroyBuffer(_allocator, newBuffer._buffer, newBuffer._allocation);
+			});
+
+			vkCmdCopyBuffer(cmd, newBuffer._buffer, pass.passObjectsBuffer._buffer, static_cast<uint32_t>(copies.size()), copies.data());
+
+			VkBufferMemoryBarrier barrier = vkinit::buffer_barrier(pass.passObjectsBuffer._buffer, _graphicsQueueFamily);
+			barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+			uploadBarriers.push_back(barrier);
+
+			pass.dirtyInstances.clear();
 		}
 	}
 
-	for (auto& s : async_calls)
+	for (auto& task : fillTasks)
 	{
-		s.get();
+		_threadPool.wait(task);
 	}
 	for (auto b : unmaps)
 	{
@@ -384,6 +522,11 @@ void VulkanEngine::ready_mesh_draw(VkCommandBuffer cmd)
 
 	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, static_cast<uint32_t>(uploadBarriers.size()), uploadBarriers.data(), 0, nullptr);//1, &readBarrier);
 	uploadBarriers.clear();
+
+	if (indirectBarriers.size() > 0)
+	{
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, static_cast<uint32_t>(indirectBarriers.size()), indirectBarriers.data(), 0, nullptr);
+	}
 }
 
 void VulkanEngine::draw_objects_forward(VkCommandBuffer cmd, RenderScene::MeshPass& pass)
@@ -468,9 +611,10 @@ void VulkanEngine::execute_draw_commands(VkCommandBuffer cmd, RenderScene::MeshP
 		VkDeviceSize offset = 0;
 		vkCmdBindVertexBuffers(cmd, 0, 1, &_renderScene.mergedVertexBuffer._buffer, &offset);
 
-		vkCmdBindIndexBuffer(cmd, _renderScene.mergedIndexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+		//merged meshes use the merged index buffer of their index type, bound lazily as the type changes
+		VkIndexType mergedIndexType = VK_INDEX_TYPE_MAX_ENUM;
 
-		stats.objects = static_cast<uint32_t>(pass.flat_batches.size());
+		stats.objects = static_cast<uint32_t>(pass.objects.size() - pass.reusableObjects.size());
 		for (int i = 0; i < pass.multibatches.size(); i++)
 		{
 			auto& multibatch = pass.multibatches[i];
@@ -497,17 +641,23 @@ void VulkanEngine::execute_draw_commands(VkCommandBuffer cmd, RenderScene::MeshP
 				vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, newLayout, 2, 1, &newMaterialSet, 0, nullptr);
 			}
 
-			bool merged = _renderScene.get_mesh(instanceDraw.meshID)->isMerged;
-			if (merged)
+			DrawMesh* drawInfo = _renderScene.get_mesh(instanceDraw.meshID);
+			if (drawInfo->isMerged)
 			{
 				if (lastMesh != nullptr)
 				{
 					VkDeviceSize offset = 0;
 					vkCmdBindVertexBuffers(cmd, 0, 1, &_renderScene.mergedVertexBuffer._buffer, &offset);
 
-					vkCmdBindIndexBuffer(cmd, _renderScene.mergedIndexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+					mergedIndexType = VK_INDEX_TYPE_MAX_ENUM;
 					lastMesh = nullptr;
 				}
+				if (drawInfo->indexType != mergedIndexType && drawInfo->indexCount > 0)
+				{
+					VkBuffer mergedIndices = drawInfo->indexType == VK_INDEX_TYPE_UINT16 ? _renderScene.mergedIndexBuffer16._buffer : _renderScene.mergedIndexBuffer._buffer;
+					vkCmdBindIndexBuffer(cmd, mergedIndices, 0, drawInfo->indexType);
+					mergedIndexType = drawInfo->indexType;
+				}
 			}
 			else if (lastMesh != drawMesh) {
 
@@ -516,23 +666,44 @@ void VulkanEngine::execute_draw_commands(VkCommandBuffer cmd, RenderScene::MeshP
 				vkCmdBindVertexBuffers(cmd, 0, 1, &drawMesh->_vertexBuffer._buffer, &offset);
 
 				if (drawMesh->_indexBuffer._buffer != VK_NULL_HANDLE) {
-					vkCmdBindIndexBuffer(cmd, drawMesh->_indexBuffer._buffer, 0, VK_INDEX_TYPE_UINT32);
+					vkCmdBindIndexBuffer(cmd, drawMesh->_indexBuffer._buffer, drawMesh->_indexBufferOffset, drawMesh->_indexType);
 				}
 				lastMesh = drawMesh;
 			}
 
-			bool bHasIndices = drawMesh->_indices.size() > 0;
+			bool bHasIndices = drawMesh->_indexCount > 0;
 			if (!bHasIndices) {
 				stats.draws++;
-				stats.triangles += static_cast<int32_t>(drawMesh->_vertices.size() / 3) * instanceDraw.count;
-				vkCmdDraw(cmd, static_cast<uint32_t>(drawMesh->_vertices.size()), instanceDraw.count, 0, instanceDraw.first);
+				stats.triangles += static_cast<int32_t>(drawMesh->_vertexCount / 3) * instanceDraw.count;
+				vkCmdDraw(cmd, drawMesh->_vertexCount, instanceDraw.count, 0, instanceDraw.first);
 			}
 			else {
-				stats.triangles += static_cast<int32_t>(drawMesh->_indices.size() / 3) * instanceDraw.count;
+				//counted at full detail, the lod selection happens on the gpu
+				stats.triangles += static_cast<int32_t>(drawInfo->lods[0].indexCount / 3) * instanceDraw.count;
 
-				vkCmdDrawIndexedIndirect(cmd, pass.drawIndirectBuffer._buffer, multibatch.first * sizeof(GPUIndirectObject), multibatch.count, sizeof(GPUIndirectObject));
+				//the same batches once per level of detail, each level reads its own commands
+				for (uint32_t lod = 0; lod < pass.lodLevels; lod++)
+				{
+					size_t firstCommand = lod * pass.batches.size() + multibatch.first;
+					vkCmdDrawIndexedIndirect(cmd, pass.drawIndirectBuffer._buffer, firstCommand * sizeof(GPUIndirectObject), multibatch.count, sizeof(GPUIndirectObject));
+				}
 
-				stats.draws++;
+				stats.draws += pass.lodLevels;
+
+				//visible clusters of clustered meshes, drawn with the count the cluster cull wrote for their batch
+				if (_drawIndirectCountSupported && drawInfo->isMerged && pass.clusterDraws > 0)
+				{
+					for (uint32_t b = multibatch.first; b < multibatch.first + multibatch.count; b++)
+					{
+						auto& batch = pass.batches[b];
+						uint32_t clusterCount = _renderScene.get_mesh(batch.meshID)->clusterCount;
+						if (clusterCount == 0) continue;
+
+						vkCmdDrawIndexedIndirectCount(cmd, pass.clusterDrawBuffer._buffer, batch.clusterDrawFirst * sizeof(VkDrawIndexedIndirectCommand),
+							pass.clusterCountBuffer._buffer, CLUSTER_COUNT_OFFSET + b * sizeof(uint32_t), batch.count * clusterCount, sizeof(VkDrawIndexedIndirectCommand));
+						stats.draws++;
+					}
+				}
 				stats.drawcalls += instanceDraw.count;
 			}
 		}
@@ -18,11 +18,12 @@ VertexInputDescription Vertex::get_vertex_description()
 
 	description.bindings.push_back(mainBinding);
 
-	//Position will be stored at Location 0
+	//Position will be stored at Location 0.
+	//3 component 16 bit formats are rarely supported for vertex input, so it is read as 4 components and the shader ignores w, which overlaps the normal
 	VkVertexInputAttributeDescription positionAttribute = {};
 	positionAttribute.binding = 0;
 	positionAttribute.location = 0;
-	positionAttribute.format = VK_FORMAT_R32G32B32_SFLOAT;
+	positionAttribute.format = VK_FORMAT_R16G16B16A16_UNORM;
 	positionAttribute.offset = offsetof(Vertex, position);
 
 	//Normal will be stored at Location 1
@@ -36,14 +37,14 @@ VertexInputDescription Vertex::get_vertex_description()
 	VkVertexInputAttributeDescription colorAttribute = {};
 	colorAttribute.binding = 0;
 	colorAttribute.location = 2;
-	colorAttribute.format = VK_FORMAT_R8G8B8_UNORM;//VK_FORMAT_R32G32B32_SFLOAT;
+	colorAttribute.format = VK_FORMAT_R8G8B8A8_UNORM;//VK_FORMAT_R32G32B32_SFLOAT;
 	colorAttribute.offset = offsetof(Vertex, color);
 
 	//UV will be stored at Location 2
 	VkVertexInputAttributeDescription uvAttribute = {};
 	uvAttribute.binding = 0;
 	uvAttribute.location = 3;
-	uvAttribute.format = VK_FORMAT_R32G32_SFLOAT;
+	uvAttribute.format = VK_FORMAT_R16G16_SFLOAT;
 	uvAttribute.offset = offsetof(Vertex, uv);
 
 
@@ -54,30 +55,6 @@ VertexInputDescription Vertex::get_vertex_description()
 	return description;
 }
 using namespace glm;
-vec2 OctNormalWrap(vec2 v)
-{
-	vec2 wrap;
-	wrap.x = (1.0f - glm::abs(v.y)) * (v.x >= 0.0f ? 1.0f : -1.0f);
-	wrap.y = (1.0f - glm::abs(v.x)) * (v.y >= 0.0f ? 1.0f : -1.0f);
-	return wrap;
-}
-
-vec2 OctNormalEncode(vec3 n)
-{
-	n /= (glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z));
-
-	vec2 wrapped = OctNormalWrap(n);
-
-	vec2 result;
-	result.x = n.z >= 0.0f ? n.x : wrapped.x;
-	result.y = n.z >= 0.0f ? n.y : wrapped.y;
-
-	result.x = result.x * 0.5f + 0.5f;
-	result.y = result.y * 0.5f + 0.5f;
-
-	return result;
-}
-
 vec3 OctNormalDecode(vec2 encN)
 {
 	encN = encN * 2.0f - 1.0f;
@@ -96,10 +73,8 @@ vec3 OctNormalDecode(vec2 encN)
 
 void Vertex::pack_normal(glm::vec3 n)
 {
-	vec2 oct = OctNormalEncode(n);
-
-	oct_normal.x = uint8_t(oct.x * 255);
-	oct_normal.y = uint8_t(oct.y * 255);
+	//same encoder as the asset vertex conversion
+	assets::oct_normal_encode(&n.x, &oct_normal.x);
 }
 
 void Vertex::pack_color(glm::vec3 c)
@@ -109,10 +84,38 @@ void Vertex::pack_color(glm::vec3 c)
 	color.b = static_cast<uint8_t>(c.z * 255);
 }
 
+static_assert(sizeof(Vertex) == sizeof(assets::Vertex_P16N8C8V16), "the engine vertex is the P16N8C8V16 asset vertex");
+static_assert(offsetof(Vertex, oct_normal) == offsetof(assets::Vertex_P16N8C8V16, oct_normal), "the engine vertex is the P16N8C8V16 asset vertex");
+static_assert(offsetof(Vertex, color) == offsetof(assets::Vertex_P16N8C8V16, color), "the engine vertex is the P16N8C8V16 asset vertex");
+static_assert(offsetof(Vertex, uv) == offsetof(assets::Vertex_P16N8C8V16, uv), "the engine vertex is the P16N8C8V16 asset vertex");
+
+void convert_vertices(assets::VertexFormat format, const char* source, size_t count, const assets::PositionQuantization& quantization, Vertex* destination)
+{
+	assets::quantize_vertices(format, source, count, quantization, reinterpret_cast<assets::Vertex_P16N8C8V16*>(destination));
+}
+
+void Mesh::set_quantization(const assets::PositionQuantization& quantization)
+{
+	_positionOffset = glm::vec3(quantization.offset[0], quantization.offset[1], quantization.offset[2]);
+	_positionScale = quantization.scale;
+}
+
+size_t Mesh::release_cpu_data()
+{
+	size_t released = _vertices.capacity() * sizeof(Vertex) + _indices.capacity() * sizeof(uint32_t) + _clusters.capacity() * sizeof(assets::MeshCluster);
+
+	//clear() keeps the capacity, swapping with empty vectors gives the memory back
+	std::vector<Vertex>().swap(_vertices);
+	std::vector<uint32_t>().swap(_indices);
+	std::vector<assets::MeshCluster>().swap(_clusters);
+
+	return released;
+}
+
 bool Mesh::load_from_meshasset(const char* filename)
 {
-	assets::AssetFile file;
-	bool loaded = assets::load_binaryfile(filename, file);
+	assets::MappedAssetFile file;
+	bool loaded = assets::map_binaryfile(filename, file);
 
 	if (!loaded) {
 		std::cout << "Error when loading mesh " << filename << std::endl;;
@@ -132,7 +135,11 @@ bool Mesh::load_from_meshasset(const char* filename)
 	vertexBuffer.resize(meshinfo.vertexBuferSize);
 	indexBuffer.resize(meshinfo.indexBuferSize);
 
-	assets::unpack_mesh(&meshinfo, file.binaryBlob.data(), file.binaryBlob.size(), vertexBuffer.data(), indexBuffer.data());
+	if (!assets::unpack_mesh(&meshinfo, file.binaryBlob, file.binaryBlobSize, vertexBuffer.data(), indexBuffer.data()))
+	{
+		std::cout << "Corrupted mesh data in " << filename << std::endl;
+		return false;
+	}
 
 	bounds.extents.x = meshinfo.bounds.extents[0];
 	bounds.extents.y = meshinfo.bounds.extents[1];
@@ -148,63 +155,39 @@ bool Mesh::load_from_meshasset(const char* filename)
 	_vertices.clear();
 	_indices.clear();
 
-	_indices.resize(indexBuffer.size() / sizeof(uint32_t));
-	for (int i = 0; i < _indices.size(); i++) {
-		uint32_t* unpacked_indices = (uint32_t*)indexBuffer.data();
-		_indices[i] = unpacked_indices[i];
-	}
-
-	if (meshinfo.vertexFormat == assets::VertexFormat::PNCV_F32)
+	if (meshinfo.indexSize == sizeof(uint16_t))
 	{
-		assets::Vertex_f32_PNCV* unpackedVertices = (assets::Vertex_f32_PNCV*)vertexBuffer.data();
-
-		_vertices.resize(vertexBuffer.size() / sizeof(assets::Vertex_f32_PNCV));
-
-		for (int i = 0; i < _vertices.size(); i++) {
-
-			_vertices[i].position.x = unpackedVertices[i].position[0];
-			_vertices[i].position.y = unpackedVertices[i].position[1];
-			_vertices[i].position.z = unpackedVertices[i].position[2];
-
-			vec3 normal = vec3( 
-				unpackedVertices[i].normal[0],
-				unpackedVertices[i].normal[1],
-				unpackedVertices[i].normal[2] );
-			_vertices[i].pack_normal(normal);
-
-			_vertices[i].pack_color(vec3{ unpackedVertices[i].color[0] ,unpackedVertices[i].color[1] ,unpackedVertices[i].color[2] });
-
-
-			_vertices[i].uv.x = unpackedVertices[i].uv[0];
-			_vertices[i].uv.y = unpackedVertices[i].uv[1];
+		_indices.resize(indexBuffer.size() / sizeof(uint16_t));
+		for (int i = 0; i < _indices.size(); i++) {
+			uint16_t* unpacked_indices = (uint16_t*)indexBuffer.data();
+			_indices[i] = unpacked_indices[i];
 		}
 	}
-	else if (meshinfo.vertexFormat == assets::VertexFormat::P32N8C8V16)
+	else
 	{
-		assets::Vertex_P32N8C8V16* unpackedVertices = (assets::Vertex_P32N8C8V16*)vertexBuffer.data();
-
-		_vertices.resize(vertexBuffer.size() / sizeof(assets::Vertex_P32N8C8V16));
-
-		for (int i = 0; i < _vertices.size(); i++) {
-
-			_vertices[i].position.x = unpackedVertices[i].position[0];
-			_vertices[i].position.y = unpackedVertices[i].position[1];
-			_vertices[i].position.z = unpackedVertices[i].position[2];
+		_indices.resize(indexBuffer.size() / sizeof(uint32_t));
+		for (int i = 0; i < _indices.size(); i++) {
+			uint32_t* unpacked_indices = (uint32_t*)indexBuffer.data();
+			_indices[i] = unpacked_indices[i];
+		}
+	}
 
-			_vertices[i].pack_normal(vec3{ 
-				 unpackedVertices[i].normal[0]
-				,unpackedVertices[i].normal[1]
-				,unpackedVertices[i].normal[2] });
+	assets::PositionQuantization quantization = assets::get_position_quantization(meshinfo.bounds);
+	set_quantization(quantization);
 
-			_vertices[i].color.x = unpackedVertices[i].color[0];// / 255.f;
-			_vertices[i].color.y = unpackedVertices[i].color[1];// / 255.f;
-			_vertices[i].color.z = unpackedVertices[i].color[2];// / 255.f;
+	size_t vertexSize = assets::vertex_format_size(meshinfo.vertexFormat);
+	if (vertexSize != 0)
+	{
+		_vertices.resize(vertexBuffer.size() / vertexSize);
 
-			_vertices[i].uv.x = unpackedVertices[i].uv[0];
-			_vertices[i].uv.y = unpackedVertices[i].uv[1];
-		}
+		convert_vertices(meshinfo.vertexFormat, vertexBuffer.data(), _vertices.size(), quantization, _vertices.data());
 	}
 
+	_vertexCount = static_cast<uint32_t>(_vertices.size());
+	_indexCount = static_cast<uint32_t>(_indices.size());
+	_lods = meshinfo.lods;
+	_clusters = meshinfo.clusters;
+
 	
 	if (logMeshUpload)
 	{
@@ -4,8 +4,19 @@
 #include <vector>
 #include <glm/vec3.hpp>
 #include <glm/vec2.hpp>
+#include <glm/mat4x4.hpp>
 
 constexpr bool logMeshUpload = false;
+//decode meshes straight into mapped staging memory instead of going through the cpu side vertex/index vectors.
+//tools/load_bench times both paths on the same assets
+constexpr bool stagedMeshDecode = true;
+//once the scene merged a mesh, drop its cpu vectors and its own buffers. It keeps only counts, bounds and lods
+constexpr bool releaseMergedMeshes = true;
+
+namespace assets {
+	enum class VertexFormat : uint32_t;
+	struct PositionQuantization;
+}
 
 
 struct VertexInputDescription {
@@ -17,13 +28,14 @@ struct VertexInputDescription {
 
 
 
+//same layout as assets::Vertex_P16N8C8V16.
+//position is 16 bit unorm inside the mesh bounds, the dequantization is folded into the object matrix by RenderScene::write_object
 struct Vertex {
 
-	glm::vec3 position;
-	//glm::vec3 normal;
-	glm::vec<2, uint8_t> oct_normal;//color;
-	glm::vec<3, uint8_t> color;
-	glm::vec2 uv;
+	glm::vec<3, uint16_t> position;
+	glm::vec<2, uint8_t> oct_normal;
+	glm::vec<4, uint8_t> color; //alpha unused
+	glm::vec<2, uint16_t> uv; //half floats
 	static VertexInputDescription get_vertex_description();
 
 	void pack_normal(glm::vec3 n);
@@ -41,8 +53,38 @@ struct Mesh {
 
 	AllocatedBuffer<Vertex> _vertexBuffer;
 	AllocatedBuffer<uint32_t> _indexBuffer;
+	//vertices and indices can share one buffer, with the indices starting at this offset
+	VkDeviceSize _indexBufferOffset{ 0 };
+
+	//element counts of the uploaded buffers. The vectors above stay empty for meshes decoded into staging memory,
+	//and the buffers are null for meshes released after the merge
+	uint32_t _vertexCount{ 0 };
+	uint32_t _indexCount{ 0 };
+
+	//meshes with few enough vertices keep 16 bit indices in their index buffer. _indices is always 32 bit
+	VkIndexType _indexType{ VK_INDEX_TYPE_UINT32 };
+
+	//index ranges of the levels of detail, most detailed first. Empty when the whole index buffer is the only level
+	std::vector<assets::MeshLod> _lods;
+
+	//clusters of the most detailed level, in mesh space. Empty when the mesh is only culled as a whole
+	std::vector<assets::MeshCluster> _clusters;
 
 	RenderBounds bounds;
 
+	//maps the quantized positions back to mesh space, position = offset + unorm * scale
+	glm::vec3 _positionOffset{ 0.f };
+	float _positionScale{ 1.f };
+
 	bool load_from_meshasset(const char* filename);
-};
\ No newline at end of file
+
+	void set_quantization(const assets::PositionQuantization& quantization);
+
+	//frees the cpu side vertices, indices and clusters, returns the bytes they held. The counts stay valid
+	size_t release_cpu_data();
+
+	size_t get_index_size() const { return _indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t); }
+};
+
+//converts asset vertices into the engine layout. Destination can alias the source, the engine vertex is never bigger than the asset ones
+void convert_vertices(assets::VertexFormat format, const char* source, size_t count, const assets::PositionQuantization& quantization, Vertex* destination);
\ No newline at end of file
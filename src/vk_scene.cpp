@@ -1,8 +1,71 @@
 ﻿#include <vk_scene.h>
 #include <vk_engine.h>
+#include <radix_sort.h>
 #include "Tracy.hpp"
 #include "logger.h"
 
+//the object buffer is written with non temporal stores, every x64 compiler provides them
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SCENE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+	//the dequantize matrix is a uniform scale and an offset, so only the translation column needs a full transform
+	glm::mat4 dequantized_transform(const glm::mat4& transform, const Mesh* mesh)
+	{
+		glm::mat4 result;
+		result[0] = transform[0] * mesh->_positionScale;
+		result[1] = transform[1] * mesh->_positionScale;
+		result[2] = transform[2] * mesh->_positionScale;
+		result[3] = transform * glm::vec4(mesh->_positionOffset, 1.f);
+		return result;
+	}
+
+	//orders the objects of a pass by custom key first, then by material and mesh so equal draws end up next to each other
+	uint64_t batch_sort_key(const RenderScene::PassObject& obj, const DrawMesh* mesh)
+	{
+		uint64_t pipelinehash = std::hash<uint64_t>()(uint64_t(obj.material.shaderPass->pipeline));
+		uint64_t sethash = std::hash<uint64_t>()((uint64_t)obj.material.materialSet);
+
+		uint32_t mathash = static_cast<uint32_t>(pipelinehash ^ sethash);
+
+		//16 bit meshes sort apart from the 32 bit ones of the same material, so they can still merge into one multibatch
+		uint32_t indexbit = mesh->indexType == VK_INDEX_TYPE_UINT16 ? (1u << 31) : 0;
+		uint32_t meshmat = uint64_t(mathash) ^ uint64_t(obj.meshID.handle) ^ indexbit;
+
+		//pack mesh id and material into 64 bits
+		return uint64_t(meshmat) | (uint64_t(obj.customKey) << 32);
+	}
+}
+
+void RenderObjectArrays::reserve(size_t count)
+{
+	transforms.reserve(count);
+	bounds.reserve(count);
+	meshIDs.reserve(count);
+	materials.reserve(count);
+	customSortKeys.reserve(count);
+	passIndices.reserve(count);
+	updateIndices.reserve(count);
+	generations.reserve(count);
+}
+
+void RenderObjectArrays::resize(size_t count)
+{
+	vkutil::PerPassData<int32_t> noPasses;
+	noPasses.clear(-1);
+
+	transforms.resize(count);
+	bounds.resize(count);
+	meshIDs.resize(count);
+	materials.resize(count);
+	customSortKeys.resize(count);
+	passIndices.resize(count, noPasses);
+	updateIndices.resize(count, (uint32_t)-1);
+	generations.resize(count, 0);
+}
+
 void RenderScene::init()
 {
 	_forwardPass.type = MeshpassType::Forward;
@@ -12,18 +75,26 @@ void RenderScene::init()
 
 Handle<RenderObject> RenderScene::register_object(MeshObject* object)
 {
-	RenderObject newObj;
-	newObj.bounds = object->bounds;
-	newObj.transformMatrix = object->transformMatrix;	
-	newObj.material = getMaterialHandle(object->material);
-	newObj.meshID = getMeshHandle(object->mesh);
-	newObj.updateIndex = (uint32_t)-1;
-	newObj.customSortKey = object->customSortKey;
-	newObj.passIndices.clear(-1);
 	Handle<RenderObject> handle;
-	handle.handle = static_cast<uint32_t>(renderables.size());
-	
-	renderables.push_back(newObj);
+	if (!freeObjects.empty())
+	{
+		//a freed slot is already out of every pass. Its update index is kept, it can still be in the dirty list
+		handle.handle = freeObjects.back();
+		freeObjects.pop_back();
+		renderables.generations[handle.handle]++;
+	}
+	else
+	{
+		handle.handle = static_cast<uint32_t>(renderables.size());
+		renderables.resize(renderables.size() + 1);
+	}
+	handle.generation = renderables.generations[handle.handle];
+
+	renderables.transforms[handle.handle] = object->transformMatrix;
+	renderables.bounds[handle.handle] = object->bounds;
+	renderables.meshIDs[handle.handle] = getMeshHandle(object->mesh);
+	renderables.materials[handle.handle] = getMaterialHandle(object->material);
+	renderables.customSortKeys[handle.handle] = object->customSortKey;
 
 	if (object->bDrawForwardPass)
 	{
@@ -48,25 +119,80 @@ Handle<RenderObject> RenderScene::register_object(MeshObject* object)
 	return handle;
 }
 
-void RenderScene::register_object_batch(MeshObject* first, uint32_t count)
+void RenderScene::register_object_batch(MeshObject* first, uint32_t count, Handle<RenderObject>* outHandles)
 {
-	renderables.reserve(count);
+	if (count > freeObjects.size())
+	{
+		renderables.reserve(renderables.size() + count - freeObjects.size());
+	}
 
 	for (uint32_t i = 0; i < count; i++) {
-		register_object(&(first[i]));
+		Handle<RenderObject> handle = register_object(&(first[i]));
+		if (outHandles)
+		{
+			outHandles[i] = handle;
+		}
 	}
 }
 
+void RenderScene::unregister_object(Handle<RenderObject> objectID)
+{
+	if (!is_valid(objectID))
+	{
+		LOG_ERROR("Unregistering stale object handle {}", objectID.handle);
+		return;
+	}
+
+	//the pass objects get removed from the batches on the next refresh of their pass
+	auto& passIndices = renderables.passIndices[objectID.handle];
+	for (MeshpassType type : { MeshpassType::Forward, MeshpassType::Transparency, MeshpassType::DirectionalShadow })
+	{
+		if (passIndices[type] != -1)
+		{
+			Handle<PassObject> obj;
+			obj.handle = passIndices[type];
+
+			get_mesh_pass(type)->objectsToDelete.push_back(obj);
+
+			passIndices[type] = -1;
+		}
+	}
+
+	//empty bounds keep the slot out of scans over every object, like the texture coverage sweep
+	renderables.bounds[objectID.handle] = {};
+	renderables.generations[objectID.handle]++;
+	freeObjects.push_back(objectID.handle);
+}
+
+bool RenderScene::is_valid(Handle<RenderObject> objectID) const
+{
+	//freed slots were bumped past every handle given out for them, and to an odd generation no handle is given out with
+	return objectID.handle < renderables.size() && renderables.generations[objectID.handle] == objectID.generation
+		&& (objectID.generation & 1) == 0;
+}
+
 void RenderScene::update_transform(Handle<RenderObject> objectID, const glm::mat4& localToWorld)
 {
-	get_object(objectID)->transformMatrix = localToWorld;
+	if (!is_valid(objectID))
+	{
+		LOG_ERROR("Updating the transform of stale object handle {}", objectID.handle);
+		return;
+	}
+
+	renderables.transforms[objectID.handle] = localToWorld;
 	update_object(objectID);
 }
 
 
 void RenderScene::update_object(Handle<RenderObject> objectID)
 {
-	auto& passIndices = get_object(objectID)->passIndices;
+	if (!is_valid(objectID))
+	{
+		LOG_ERROR("Updating stale object handle {}", objectID.handle);
+		return;
+	}
+
+	auto& passIndices = renderables.passIndices[objectID.handle];
 	if (passIndices[MeshpassType::Forward] != -1)
 	{
 		Handle<PassObject> obj;
@@ -103,10 +229,11 @@ void RenderScene::update_object(Handle<RenderObject> objectID)
 	}
 
 	
-	if (get_object(objectID)->updateIndex == (uint32_t)-1)
+	uint32_t& updateIndex = renderables.updateIndices[objectID.handle];
+	if (updateIndex == (uint32_t)-1)
 	{
 
-		get_object(objectID)->updateIndex = static_cast<uint32_t>(dirtyObjects.size());
+		updateIndex = static_cast<uint32_t>(dirtyObjects.size());
 
 		dirtyObjects.push_back(objectID);
 	}
@@ -114,63 +241,146 @@ void RenderScene::update_object(Handle<RenderObject> objectID)
 
 void RenderScene::write_object(GPUObjectData* target, Handle<RenderObject> objectID)
 {
-	RenderObject* renderable = get_object(objectID);
+	const uint32_t i = objectID.handle;
+	const RenderBounds& bounds = renderables.bounds[i];
 	GPUObjectData object;
 
-	object.modelMatrix = renderable->transformMatrix;
-	object.origin_rad = glm::vec4(renderable->bounds.origin, renderable->bounds.radius);
-	object.extents = glm::vec4(renderable->bounds.extents, renderable->bounds.valid ? 1.f : 0.f);
+	//vertex positions are quantized, the matrix takes them from the unit cube back to mesh space first
+	object.modelMatrix = dequantized_transform(renderables.transforms[i], get_mesh(renderables.meshIDs[i])->original);
+	object.origin_rad = glm::vec4(bounds.origin, bounds.radius);
+	object.extents = glm::vec4(bounds.extents, bounds.valid ? 1.f : 0.f);
 
 	memcpy(target, &object, sizeof(GPUObjectData));
 }
 
 void RenderScene::fill_objectData(GPUObjectData* data)
 {
-	
-	for(int i = 0; i < renderables.size(); i++)
+	ZoneScopedNC("Fill Object Data", tracy::Color::Red);
+
+	//the target is write combined memory the cpu never reads back, streaming stores skip the cache on the way there
+#ifdef SCENE_SSE2
+	const bool streamed = reinterpret_cast<uintptr_t>(data) % 16 == 0;
+#endif
+
+	const size_t count = renderables.size();
+	for (size_t i = 0; i < count; i++)
 	{
 		Handle<RenderObject> h;
-		h.handle = i;
-		write_object(data + i, h);
+		h.handle = static_cast<uint32_t>(i);
+
+		GPUObjectData object;
+		write_object(&object, h);
+
+#ifdef SCENE_SSE2
+		if (streamed)
+		{
+			const float* source = reinterpret_cast<const float*>(&object);
+			float* destination = reinterpret_cast<float*>(data + i);
+			for (size_t f = 0; f < sizeof(GPUObjectData) / sizeof(float); f += 4)
+			{
+				_mm_stream_ps(destination + f, _mm_loadu_ps(source + f));
+			}
+			continue;
+		}
+#endif
+		memcpy(data + i, &object, sizeof(GPUObjectData));
 	}
+
+#ifdef SCENE_SSE2
+	//streaming stores are weakly ordered, they have to land before the buffer is unmapped and submitted
+	_mm_sfence();
+#endif
 }
 
 
-void RenderScene::fill_indirectArray(GPUIndirectObject* data, MeshPass& pass)
+void RenderScene::fill_indirectArray(GPUIndirectObject* data, MeshPass& pass, uint32_t firstBatch)
 {
 	ZoneScopedNC("Fill Indirect", tracy::Color::Red);
 	int dataIndex = 0;
-	for (int i = 0; i < pass.batches.size(); i++) {
+	for (uint32_t lod = 0; lod < pass.lodLevels; lod++) {
+
+		//every level gets its own range of instances, as all of them could land in the same one
+		uint32_t instanceOffset = lod * pass.instanceStride;
 
-		auto batch = pass.batches[i];
+		for (uint32_t i = firstBatch; i < pass.batches.size(); i++) {
 
-		data[dataIndex].command.firstInstance = batch.first;//i;
-		data[dataIndex].command.instanceCount = 0;
-		data[dataIndex].command.firstIndex = get_mesh(batch.meshID)->firstIndex;
-		data[dataIndex].command.vertexOffset = get_mesh(batch.meshID)->firstVertex;
-		data[dataIndex].command.indexCount = get_mesh(batch.meshID)->indexCount;
-		data[dataIndex].objectID = 0;
-		data[dataIndex].batchID = i;
+			auto batch = pass.batches[i];
+			DrawMesh* mesh = get_mesh(batch.meshID);
 
-		dataIndex++;
+			//meshes with fewer levels never get instances in the extra ones
+			const DrawMeshLod& meshLod = mesh->lods[std::min(lod, mesh->lodCount - 1)];
+
+			data[dataIndex].command.firstInstance = instanceOffset + batch.first;
+			data[dataIndex].command.instanceCount = 0;
+			data[dataIndex].command.firstIndex = mesh->firstIndex + meshLod.firstIndex;
+			data[dataIndex].command.vertexOffset = mesh->firstVertex;
+			data[dataIndex].command.indexCount = meshLod.indexCount;
+			data[dataIndex].objectID = 0;
+			data[dataIndex].batchID = i;
+			data[dataIndex].lodCount = mesh->lodCount;
+			//clusters are only uploaded for merged meshes
+			data[dataIndex].firstCluster = mesh->firstCluster;
+			data[dataIndex].clusterCount = mesh->isMerged ? mesh->clusterCount : 0;
+			data[dataIndex].clusterDrawFirst = batch.clusterDrawFirst;
+
+			dataIndex++;
+		}
 	}
 }
 
 void RenderScene::fill_instancesArray(GPUInstance* data, MeshPass& pass)
 {
 	ZoneScopedNC("Fill Instances", tracy::Color::Red);
-	int dataIndex = 0;
-	for (int i = 0; i < pass.batches.size(); i++) {
 
-		auto batch = pass.batches[i];
+	//every pass object has its own slot, so large passes split over the workers
+	constexpr uint32_t objectsPerJob = 4096;
+	const uint32_t objectCount = static_cast<uint32_t>(pass.objects.size());
+	auto fill_job = [&](uint32_t job) {
+		uint32_t end = std::min(objectCount, (job + 1) * objectsPerJob);
+		for (uint32_t i = job * objectsPerJob; i < end; i++) {
 
-		
-		for (int b = 0; b < batch.count; b++)
+			//freed objects already hold ~0u as their original
+			data[i].objectID = pass.objects[i].original.handle;
+			data[i].batchID = pass.objects[i].builtbatch;
+		}
+	};
+
+	const uint32_t jobCount = (objectCount + objectsPerJob - 1) / objectsPerJob;
+	if (threadPool)
+	{
+		threadPool->parallel_for(jobCount, fill_job);
+	}
+	else
+	{
+		for (uint32_t job = 0; job < jobCount; job++)
 		{
-			
-			data[dataIndex].objectID = pass.get(pass.flat_batches[b + batch.first].object)->original.handle;
-			data[dataIndex].batchID = i;
-			dataIndex++;
+			fill_job(job);
+		}
+	}
+}
+
+void RenderScene::fill_dirty_instances(GPUInstance* data, MeshPass& pass, std::vector<VkBufferCopy>& copies)
+{
+	ZoneScopedNC("Fill Dirty Instances", tracy::Color::Red);
+
+	std::sort(pass.dirtyInstances.begin(), pass.dirtyInstances.end());
+	pass.dirtyInstances.erase(std::unique(pass.dirtyInstances.begin(), pass.dirtyInstances.end()), pass.dirtyInstances.end());
+
+	for (size_t i = 0; i < pass.dirtyInstances.size(); i++)
+	{
+		uint32_t position = pass.dirtyInstances[i];
+
+		data[i].objectID = pass.objects[position].original.handle;
+		data[i].batchID = pass.objects[position].builtbatch;
+
+		//neighbouring instances go in one copy
+		if (!copies.empty() && copies.back().dstOffset + copies.back().size == position * sizeof(GPUInstance))
+		{
+			copies.back().size += sizeof(GPUInstance);
+		}
+		else
+		{
+			copies.push_back({ i * sizeof(GPUInstance), position * sizeof(GPUInstance), sizeof(GPUInstance) });
 		}
 	}
 }
@@ -179,27 +389,25 @@ void RenderScene::clear_dirty_objects()
 {
 	for (auto obj : dirtyObjects)
 	{
-		get_object(obj)->updateIndex = (uint32_t)-1;
+		renderables.updateIndices[obj.handle] = (uint32_t)-1;
 	}
 	dirtyObjects.clear();
 }
-#include <future>
 void RenderScene::build_batches()
 {
-#if 1
-	auto fwd = std::async(std::launch::async, [&] { refresh_pass(&_forwardPass); });
-	auto shadow = std::async(std::launch::async, [&] { refresh_pass(&_shadowPass); });
-	auto transparent = std::async(std::launch::async, [&] { refresh_pass(&_transparentForwardPass); });
-
-	transparent.get();
-	shadow.get();
-	fwd.get();
-#else
-	refresh_pass(&_forwardPass);
-	refresh_pass(&_transparentForwardPass);
-	refresh_pass(&_shadowPass);
-#endif
-	
+	//the passes refresh on the engine workers, their sorts split further over the ones left idle
+	MeshPass* passes[] = { &_forwardPass, &_shadowPass, &_transparentForwardPass };
+	if (threadPool)
+	{
+		threadPool->parallel_for(3, [&](uint32_t i) { refresh_pass(passes[i]); });
+	}
+	else
+	{
+		for (MeshPass* pass : passes)
+		{
+			refresh_pass(pass);
+		}
+	}
 }
 
 void RenderScene::merge_meshes(VulkanEngine* engine)
@@ -207,14 +415,22 @@ void RenderScene::merge_meshes(VulkanEngine* engine)
 	ZoneScopedNC("Mesh Merge", tracy::Color::Magenta)
 	size_t total_vertices = 0;
 	size_t total_indices = 0;
+	size_t total_indices16 = 0;
+	size_t total_clusters = 0;
 
 	for (auto& m : meshes)
 	{
-		m.firstIndex = static_cast<uint32_t>(total_indices);
+		//16 and 32 bit meshes get merged into separate index buffers, each counting its own first index
+		size_t& indexTotal = m.indexType == VK_INDEX_TYPE_UINT16 ? total_indices16 : total_indices;
+
+		m.firstIndex = static_cast<uint32_t>(indexTotal);
 		m.firstVertex = static_cast<uint32_t>(total_vertices);
 
+		m.firstCluster = static_cast<uint32_t>(total_clusters);
+
 		total_vertices += m.vertexCount;
-		total_indices += m.indexCount;
+		indexTotal += m.indexCount;
+		total_clusters += m.clusterCount;
 
 		m.isMerged = true;
 	}
@@ -222,11 +438,63 @@ void RenderScene::merge_meshes(VulkanEngine* engine)
 	mergedVertexBuffer = engine->create_buffer(total_vertices * sizeof(Vertex), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 
 		VMA_MEMORY_USAGE_GPU_ONLY);
 
-	mergedIndexBuffer = engine->create_buffer(total_indices * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-		VMA_MEMORY_USAGE_GPU_ONLY);
+	//zero sized buffers are invalid, a scene without meshes of one index type leaves that buffer null
+	if (total_indices > 0)
+	{
+		mergedIndexBuffer = engine->create_buffer(total_indices * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+			VMA_MEMORY_USAGE_GPU_ONLY);
+	}
+	if (total_indices16 > 0)
+	{
+		mergedIndexBuffer16 = engine->create_buffer(total_indices16 * sizeof(uint16_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+			VMA_MEMORY_USAGE_GPU_ONLY);
+	}
+
+	//cluster bounds move into the quantized space the vertices are in, where the object model matrix applies
+	AllocatedBuffer<GPUCluster> clusterStaging;
+	if (total_clusters > 0)
+	{
+		clusterBuffer = engine->create_buffer(total_clusters * sizeof(GPUCluster), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			VMA_MEMORY_USAGE_GPU_ONLY);
+		clusterStaging = engine->create_buffer(total_clusters * sizeof(GPUCluster), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+
+		GPUCluster* gpuClusters = engine->map_buffer(clusterStaging);
+		for (auto& m : meshes)
+		{
+			const Mesh* original = m.original;
+			float inverseScale = 1.f / original->_positionScale;
+
+			for (uint32_t c = 0; c < m.clusterCount; c++)
+			{
+				const assets::MeshCluster& cluster = original->_clusters[c];
+
+				glm::vec3 center{ cluster.center[0], cluster.center[1], cluster.center[2] };
+				center = (center - original->_positionOffset) * inverseScale;
+
+				GPUCluster& gpuCluster = gpuClusters[m.firstCluster + c];
+				gpuCluster.sphere = glm::vec4(center, cluster.radius * inverseScale);
+				gpuCluster.cone = glm::vec4(cluster.coneAxis[0], cluster.coneAxis[1], cluster.coneAxis[2], cluster.coneCutoff);
+				//cluster ranges are relative to the index buffer of the mesh
+				gpuCluster.firstIndex = m.firstIndex + cluster.firstIndex;
+				gpuCluster.indexCount = cluster.indexCount;
+				gpuCluster.vertexOffset = static_cast<int32_t>(m.firstVertex);
+				gpuCluster.pad = 0;
+			}
+		}
+		engine->unmap_buffer(clusterStaging);
+	}
 
 	engine->immediate_submit([&](VkCommandBuffer cmd)
 	{
+		if (total_clusters > 0)
+		{
+			VkBufferCopy clusterCopy;
+			clusterCopy.dstOffset = 0;
+			clusterCopy.size = total_clusters * sizeof(GPUCluster);
+			clusterCopy.srcOffset = 0;
+			vkCmdCopyBuffer(cmd, clusterStaging._buffer, clusterBuffer._buffer, 1, &clusterCopy);
+		}
+
 		for (auto& m : meshes)
 		{
 			VkBufferCopy vertexCopy;
@@ -236,100 +504,127 @@ void RenderScene::merge_meshes(VulkanEngine* engine)
 
 			vkCmdCopyBuffer(cmd, m.original->_vertexBuffer._buffer, mergedVertexBuffer._buffer, 1, &vertexCopy);
 
+			if (m.indexCount == 0) continue;
+
+			const size_t indexSize = m.original->get_index_size();
+
 			VkBufferCopy indexCopy;
-			indexCopy.dstOffset = m.firstIndex * sizeof(uint32_t);
-			indexCopy.size = m.indexCount * sizeof(uint32_t);
-			indexCopy.srcOffset = 0;
+			indexCopy.dstOffset = m.firstIndex * indexSize;
+			indexCopy.size = m.indexCount * indexSize;
+			indexCopy.srcOffset = m.original->_indexBufferOffset;
 
-			vkCmdCopyBuffer(cmd, m.original->_indexBuffer._buffer, mergedIndexBuffer._buffer, 1, &indexCopy);
+			VkBuffer mergedIndices = m.indexType == VK_INDEX_TYPE_UINT16 ? mergedIndexBuffer16._buffer : mergedIndexBuffer._buffer;
+			vkCmdCopyBuffer(cmd, m.original->_indexBuffer._buffer, mergedIndices, 1, &indexCopy);
 		}
 	});
+
+	if (total_clusters > 0)
+	{
+		vmaDestroyBuffer(engine->_allocator, clusterStaging._buffer, clusterStaging._allocation);
+	}
+
+	//the submit waited for the copies, the merged buffers are the only ones drawn from now
+	if (releaseMergedMeshes)
+	{
+		ZoneScopedNC("Release Merged Meshes", tracy::Color::Magenta);
+
+		size_t cpuBytes = 0;
+		size_t bufferBytes = 0;
+		auto release_buffer = [&](const AllocatedBufferUntyped& buffer) {
+			VmaAllocationInfo info;
+			vmaGetAllocationInfo(engine->_allocator, buffer._allocation, &info);
+			bufferBytes += info.size;
+			vmaDestroyBuffer(engine->_allocator, buffer._buffer, buffer._allocation);
+		};
+
+		for (auto& m : meshes)
+		{
+			Mesh* original = m.original;
+			cpuBytes += original->release_cpu_data();
+
+			//staged meshes keep vertices and indices in the same buffer
+			if (original->_vertexBuffer._buffer != VK_NULL_HANDLE)
+			{
+				release_buffer(original->_vertexBuffer);
+			}
+			if (original->_indexBuffer._buffer != VK_NULL_HANDLE && original->_indexBuffer._buffer != original->_vertexBuffer._buffer)
+			{
+				release_buffer(original->_indexBuffer);
+			}
+			original->_vertexBuffer = AllocatedBufferUntyped{};
+			original->_indexBuffer = AllocatedBufferUntyped{};
+		}
+
+		engine->_loadStats.meshCpuBytesReleased += cpuBytes;
+		engine->_loadStats.meshBufferBytesReleased += bufferBytes;
+		LOG_INFO("Released {:.1f} MB of cpu mesh data and {:.1f} MB of per mesh buffers after merging {} meshes",
+			cpuBytes / (1024.0 * 1024.0), bufferBytes / (1024.0 * 1024.0), meshes.size());
+	}
 }
 
 void RenderScene::refresh_pass(MeshPass* pass)
 {
-	pass->needsIndirectRefresh = true;
-	pass->needsInstanceRefresh = true;
+	//nothing entered or left the pass, its batches and buffers are still valid
+	if (pass->objectsToDelete.empty() && pass->unbatchedObjects.empty()) return;
 
-	std::vector<uint32_t> new_objects;
+	//batch of every object that left or joined the pass, with -1 or +1 to its count
+	std::vector<std::pair<uint32_t, int32_t>> countChanges;
 	if(pass->objectsToDelete.size() > 0)
 	{
 		ZoneScopedNC("Delete objects", tracy::Color::Blue3);
 
-		//create the render batches so that then we can do the deletion on the flat-array directly
-
-		std::vector<RenderScene::RenderBatch> deletion_batches;
-		deletion_batches.reserve(new_objects.size());
-		
-	
+		countChanges.reserve(pass->objectsToDelete.size());
 		for (auto i : pass->objectsToDelete) {
 			pass->reusableObjects.push_back(i);
-			RenderScene::RenderBatch newCommand;
-
-			auto obj = pass->objects[i.handle];
-			newCommand.object= i;
-
-			uint64_t pipelinehash = std::hash<uint64_t>()(uint64_t(obj.material.shaderPass->pipeline));
-			uint64_t sethash = std::hash<uint64_t>()((uint64_t)obj.material.materialSet);
-
-			uint32_t mathash = static_cast<uint32_t>(pipelinehash ^ sethash);
 
-			uint32_t meshmat = uint64_t(mathash) ^ uint64_t(obj.meshID.handle);
+			PassObject& obj = pass->objects[i.handle];
+			countChanges.push_back({ obj.builtbatch, -1 });
+			//the slot stays in the instance buffer without an object, until a new one takes it
+			pass->dirtyInstances.push_back(i.handle);
 
-			//pack mesh id and material into 64 bits				
-			newCommand.sortKey = uint64_t(meshmat) | (uint64_t(obj.customKey) << 32);
-
-			pass->objects[i.handle].customKey = 0;
-			pass->objects[i.handle].material.shaderPass = nullptr;
-			pass->objects[i.handle].meshID.handle = -1;
-			pass->objects[i.handle].original.handle = -1;
-
-			deletion_batches.push_back(newCommand);
-			
+			obj.customKey = 0;
+			obj.material.shaderPass = nullptr;
+			obj.meshID.handle = -1;
+			obj.original.handle = -1;
 		}
 		pass->objectsToDelete.clear();
-		{
-			ZoneScopedNC("Deletion Sort", tracy::Color::Blue1);
-			std::sort(deletion_batches.begin(), deletion_batches.end(), [](const RenderScene::RenderBatch& A, const RenderScene::RenderBatch& B) {
-				if (A.sortKey < B.sortKey) { return true; }
-				else if (A.sortKey == B.sortKey) { return A.object.handle < B.object.handle; }
-				else { return false; }
-			});
-		}
-		{
-			ZoneScopedNC("removal", tracy::Color::Blue1);
-
-			std::vector<RenderScene::RenderBatch> newbatches;
-			newbatches.reserve(pass->flat_batches.size());
-
-			{
-				ZoneScopedNC("Set Difference", tracy::Color::Red);
-
-				std::set_difference(pass->flat_batches.begin(), pass->flat_batches.end(), deletion_batches.begin(), deletion_batches.end(), std::back_inserter(newbatches), [](const RenderScene::RenderBatch& A, const RenderScene::RenderBatch& B) {
-					if (A.sortKey < B.sortKey) { return true; }
-					else if (A.sortKey == B.sortKey) { return A.object.handle < B.object.handle; }
-					else { return false; }
-				});
-			}
-			pass->flat_batches = std::move(newbatches);
-		}
 	}
+
+	//a new object whose key has no batch yet shifts the index of the batches after the one it needs, which every instance stores
+	bool rebuild = false;
 	{
 		ZoneScopedNC("Fill ObjectList", tracy::Color::Blue2);
 			
-		new_objects.reserve(pass->unbatchedObjects.size());
+		countChanges.reserve(countChanges.size() + pass->unbatchedObjects.size());
 		for (auto o : pass->unbatchedObjects)
 		{
+			//unregistered before its pass got refreshed
+			if (!is_valid(o)) continue;
+
 			RenderScene::PassObject newObject;
 
 			newObject.original = o;
-			newObject.meshID = get_object(o)->meshID;
+			newObject.meshID = renderables.meshIDs[o.handle];
 
 			//pack mesh id and material into 32 bits
-			vkutil::Material* mt = get_material(get_object(o)->material);
+			vkutil::Material* mt = get_material(renderables.materials[o.handle]);
 			newObject.material.materialSet = mt->passSets[pass->type];
 			newObject.material.shaderPass = mt->original->passShaders[pass->type];
-			newObject.customKey = get_object(o)->customSortKey;
+			newObject.customKey = renderables.customSortKeys[o.handle];
+			newObject.builtbatch = ~0u;
+
+			//the key only finds the batch, which still has to be of the same mesh and material
+			auto lookup = pass->batchLookup.find(batch_sort_key(newObject, get_mesh(newObject.meshID)));
+			if (lookup != pass->batchLookup.end() && lookup->second != ~0u &&
+				pass->batches[lookup->second].meshID.handle == newObject.meshID.handle && pass->batches[lookup->second].material == newObject.material)
+			{
+				newObject.builtbatch = lookup->second;
+				countChanges.push_back({ lookup->second, 1 });
+			}
+			else
+			{
+				rebuild = true;
+			}
 
 			uint32_t handle = -1;
 
@@ -346,82 +641,101 @@ void RenderScene::refresh_pass(MeshPass* pass)
 				pass->objects.push_back(newObject);
 			}
 
-			
-			new_objects.push_back(handle);
-			get_object(o)->passIndices[pass->type] = static_cast<int32_t>(handle);
+			pass->dirtyInstances.push_back(handle);
+			renderables.passIndices[o.handle][pass->type] = static_cast<int32_t>(handle);
 		}
 
 		pass->unbatchedObjects.clear();
 	}
 
-	std::vector<RenderScene::RenderBatch> new_batches;
-	new_batches.reserve(new_objects.size());
-
+	if (!rebuild)
 	{
-		ZoneScopedNC("Fill DrawList", tracy::Color::Blue2);	
-		
-		for (auto i : new_objects) {
+		ZoneScopedNC("Update Batches", tracy::Color::Blue2);
+
+		//objects replaced by one of the same batch, as with objects that only got updated, cancel out
+		std::sort(countChanges.begin(), countChanges.end());
+		uint32_t firstChanged = ~0u;
+		for (size_t i = 0; i < countChanges.size();)
+		{
+			uint32_t batch = countChanges[i].first;
+			int32_t change = 0;
+			for (; i < countChanges.size() && countChanges[i].first == batch; i++)
 			{
-				RenderScene::RenderBatch newCommand;
+				change += countChanges[i].second;
+			}
+			if (change == 0) continue;
 
-				auto obj = pass->objects[i];
-				newCommand.object.handle = i;
+			//batches that lose their last object stay, without instances, until the next rebuild
+			pass->batches[batch].count += change;
+			firstChanged = std::min(firstChanged, batch);
+		}
 
-				uint64_t pipelinehash = std::hash<uint64_t>()(uint64_t(obj.material.shaderPass->pipeline));
-				uint64_t sethash = std::hash<uint64_t>()((uint64_t)obj.material.materialSet);
+		//only the instances changed, the batches and commands stay the same
+		if (firstChanged == ~0u) return;
 
-				uint32_t mathash = static_cast<uint32_t>(pipelinehash ^ sethash);
-				
-				uint32_t meshmat = uint64_t(mathash) ^ uint64_t(obj.meshID.handle);
+		//every batch after the first one that changed moves its ranges
+		uint32_t first = 0;
+		uint32_t clusterDraws = 0;
+		if (firstChanged > 0)
+		{
+			const IndirectBatch& previous = pass->batches[firstChanged - 1];
+			first = previous.first + previous.count;
+			clusterDraws = previous.clusterDrawFirst + previous.count * get_mesh(previous.meshID)->clusterCount;
+		}
+		for (uint32_t b = firstChanged; b < pass->batches.size(); b++)
+		{
+			IndirectBatch& batch = pass->batches[b];
+			batch.first = first;
+			batch.clusterDrawFirst = clusterDraws;
 
-				//pack mesh id and material into 64 bits				
-				newCommand.sortKey = uint64_t(meshmat) | (uint64_t(obj.customKey) << 32);
+			first += batch.count;
+			clusterDraws += batch.count * get_mesh(batch.meshID)->clusterCount;
+		}
+		pass->clusterDraws = clusterDraws;
 
-				new_batches.push_back(newCommand);
-			}
+		//the levels after the first start at multiples of the stride, growing it moves all of their commands.
+		//it grows with room to spare so that happens rarely
+		if (first > pass->instanceStride)
+		{
+			pass->instanceStride = first + first / 2;
+			if (pass->lodLevels > 1) firstChanged = 0;
 		}
-	}
 
-	{
-		ZoneScopedNC("Draw Sort", tracy::Color::Blue1);
-		std::sort(new_batches.begin(), new_batches.end(), [](const RenderScene::RenderBatch& A, const RenderScene::RenderBatch& B) {
-			if (A.sortKey < B.sortKey) { return true; }
-			else if (A.sortKey == B.sortKey) { return A.object.handle < B.object.handle; }
-			else { return false; }
-		});
+		pass->firstDirtyBatch = std::min(pass->firstDirtyBatch, firstChanged);
+		return;
 	}
-	{
-		ZoneScopedNC("Draw Merge batches", tracy::Color::Blue2);
 
-		//merge the new batches into the main batch array
+	//the batches get built again from every object of the pass
+	pass->needsIndirectRefresh = true;
+	pass->needsInstanceRefresh = true;
+	pass->firstDirtyBatch = ~0u;
+	pass->dirtyInstances.clear();
 
-		if (pass->flat_batches.size() > 0 && new_batches.size() > 0)
-		{
-			size_t index = pass->flat_batches.size();
-			pass->flat_batches.reserve(pass->flat_batches.size() + new_batches.size());
-			
-			for (auto b : new_batches)
-			{
-				pass->flat_batches.push_back(b);
-			}
+	{
+		ZoneScopedNC("Fill DrawList", tracy::Color::Blue2);
 
-			RenderScene::RenderBatch* begin = pass->flat_batches.data();
-			RenderScene::RenderBatch* mid = begin + index;
-			RenderScene::RenderBatch* end = begin + pass->flat_batches.size();
-			//std::sort(pass->flat_batches.begin(), pass->flat_batches.end(), [](const RenderScene::RenderBatch& A, const RenderScene::RenderBatch& B) {
-			//	return A.sortKey < B.sortKey;
-			//	});
-			std::inplace_merge(begin, mid, end, [](const RenderScene::RenderBatch& A, const RenderScene::RenderBatch& B) {
-				if (A.sortKey < B.sortKey) { return true; }
-				else if (A.sortKey == B.sortKey) { return A.object.handle < B.object.handle; }
-				else { return false; }
-			});
-		}
-		else if (pass->flat_batches.size() == 0)
+		pass->flat_batches.clear();
+		for (uint32_t i = 0; i < pass->objects.size(); i++)
 		{
-			pass->flat_batches = std::move(new_batches);
+			const PassObject& obj = pass->objects[i];
+			//free slot, waiting for reuse
+			if (obj.original.handle == static_cast<uint32_t>(-1)) continue;
+
+			RenderScene::RenderBatch newCommand;
+			newCommand.object.handle = i;
+			newCommand.sortKey = batch_sort_key(obj, get_mesh(obj.meshID));
+
+			pass->flat_batches.push_back(newCommand);
 		}
 	}
+
+	{
+		ZoneScopedNC("Draw Sort", tracy::Color::Blue1);
+		//by sort key, then by object handle
+		radix_sort::sort(pass->flat_batches, pass->sortScratch,
+			[](const RenderScene::RenderBatch& batch) { return batch.sortKey; },
+			[](const RenderScene::RenderBatch& batch) { return batch.object.handle; }, threadPool);
+	}
 	
 	{
 		ZoneScopedNC("Draw Merge", tracy::Color::Blue);
@@ -430,6 +744,36 @@ void RenderScene::refresh_pass(MeshPass* pass)
 
 		build_indirect_batches(pass,pass->batches,pass->flat_batches);
 
+		pass->lodLevels = 1;
+		pass->clusterDraws = 0;
+		pass->batchLookup.clear();
+		for (uint32_t b = 0; b < pass->batches.size(); b++)
+		{
+			IndirectBatch& batch = pass->batches[b];
+			DrawMesh* mesh = get_mesh(batch.meshID);
+			pass->lodLevels = std::max(pass->lodLevels, mesh->lodCount);
+
+			//room for every cluster of every instance to be visible
+			batch.clusterDrawFirst = pass->clusterDraws;
+			pass->clusterDraws += batch.count * mesh->clusterCount;
+
+			for (uint32_t i = batch.first; i < batch.first + batch.count; i++)
+			{
+				const RenderScene::RenderBatch& entry = pass->flat_batches[i];
+				pass->objects[entry.object.handle].builtbatch = b;
+
+				//entries of a key are next to each other, it is enough to look at the first one of it in every batch
+				if (i != batch.first && pass->flat_batches[i - 1].sortKey == entry.sortKey) continue;
+
+				auto lookup = pass->batchLookup.emplace(entry.sortKey, b);
+				if (!lookup.second && lookup.first->second != b)
+				{
+					lookup.first->second = ~0u;
+				}
+			}
+		}
+		pass->instanceStride = static_cast<uint32_t>(pass->flat_batches.size());
+
 		//flatten batches into multibatch
 		Multibatch newbatch;
 		pass->multibatches.clear();
@@ -445,7 +789,9 @@ void RenderScene::refresh_pass(MeshPass* pass)
 			IndirectBatch* batch = &pass->batches[i];
 
 			
-			bool bCompatibleMesh = get_mesh(joinbatch->meshID)->isMerged;
+			//a multibatch is a single indirect draw, which reads one index buffer of one index type
+			bool bCompatibleMesh = get_mesh(joinbatch->meshID)->isMerged &&
+				get_mesh(joinbatch->meshID)->indexType == get_mesh(batch->meshID)->indexType;
 			
 					
 			bool bSameMat = false;
@@ -536,11 +882,6 @@ void RenderScene::build_indirect_batches(MeshPass* pass, std::vector<IndirectBat
 	}
 }
 
-RenderObject* RenderScene::get_object(Handle<RenderObject> objectID)
-{
-	return &renderables[objectID.handle];
-}
-
 DrawMesh* RenderScene::get_mesh(Handle<DrawMesh> objectID)
 {
 	return &meshes[objectID.handle];
@@ -598,8 +939,27 @@ Handle<DrawMesh> RenderScene::getMeshHandle(Mesh* m)
 		newMesh.original = m;
 		newMesh.firstIndex = 0;
 		newMesh.firstVertex = 0;
-		newMesh.vertexCount = static_cast<uint32_t>(m->_vertices.size());
-		newMesh.indexCount = static_cast<uint32_t>(m->_indices.size());
+		newMesh.vertexCount = m->_vertexCount;
+		newMesh.indexCount = m->_indexCount;
+		newMesh.indexType = m->_indexType;
+
+		newMesh.firstCluster = 0;
+		newMesh.clusterCount = static_cast<uint32_t>(m->_clusters.size());
+
+		if (m->_lods.empty())
+		{
+			newMesh.lodCount = 1;
+			newMesh.lods[0] = { 0, m->_indexCount };
+		}
+		else
+		{
+			//levels past the limit are dropped, the remaining ones still cover the near range
+			newMesh.lodCount = std::min(static_cast<uint32_t>(m->_lods.size()), MAX_MESH_LODS);
+			for (uint32_t i = 0; i < newMesh.lodCount; i++)
+			{
+				newMesh.lods[i] = { m->_lods[i].firstIndex, m->_lods[i].indexCount };
+			}
+		}
 
 		meshes.push_back(newMesh);
 
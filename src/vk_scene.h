@@ -19,11 +19,15 @@
 template<typename T>
 struct Handle {
 	uint32_t handle;
+	//bumped when the slot is freed and again when it is reused, so live slots are at even generations and free ones at odd.
+	//a handle from any other generation is stale. Only scene objects get recycled
+	uint32_t generation{ 0 };
 };
 
 struct MeshObject;
 struct Mesh;
 struct GPUObjectData;
+class ThreadPool;
 namespace vkutil { struct Material; }
 namespace vkutil { struct ShaderPass; }
 
@@ -31,13 +35,50 @@ struct GPUIndirectObject {
 	VkDrawIndexedIndirectCommand command;
 	uint32_t objectID;
 	uint32_t batchID;
+	//levels of detail of the batch mesh, the cull shader clamps its selection to it
+	uint32_t lodCount;
+	//clusters of the batch mesh in the scene cluster buffer, none when it is only culled as a whole
+	uint32_t firstCluster;
+	uint32_t clusterCount;
+	//first command of the batch in the pass cluster draw buffer
+	uint32_t clusterDrawFirst;
+};
+
+//cluster of a merged mesh as the cluster cull shader reads it. Bounds are in the quantized vertex space, so the object model matrix applies
+struct GPUCluster {
+	glm::vec4 sphere;
+	glm::vec4 cone; //axis and cutoff
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	int32_t vertexOffset;
+	uint32_t pad;
+};
+
+//levels of detail a mesh can draw with, the indirect buffers hold one command per batch for each of them
+constexpr uint32_t MAX_MESH_LODS = 4;
+
+//byte offset of the per batch draw counts in the cluster count buffer, after the dispatch arguments
+constexpr uint32_t CLUSTER_COUNT_OFFSET = 16;
+
+struct DrawMeshLod {
+	//relative to the first index of the mesh
+	uint32_t firstIndex;
+	uint32_t indexCount;
 };
 
 struct DrawMesh {
 	uint32_t firstVertex;
 	uint32_t firstIndex;
+	//every level of detail together, the lods subdivide this range
 	uint32_t indexCount;
 	uint32_t vertexCount;
+	uint32_t lodCount;
+	DrawMeshLod lods[MAX_MESH_LODS];
+	//range in the scene cluster buffer, only valid once merged
+	uint32_t firstCluster;
+	uint32_t clusterCount;
+	//firstIndex points into the merged index buffer of this type
+	VkIndexType indexType;
 	bool isMerged;
 
 	Mesh* original;
@@ -45,19 +86,27 @@ struct DrawMesh {
 
 
 
-struct RenderObject {
-
-	Handle<DrawMesh> meshID;
-	Handle<vkutil::Material> material;
-
-	uint32_t updateIndex;
-	uint32_t customSortKey{0};
-
-	vkutil::PerPassData<int32_t> passIndices;
-
-	glm::mat4 transformMatrix;
-
-	RenderBounds bounds;
+//only names the handles of scene objects, their data lives in RenderObjectArrays
+struct RenderObject;
+
+//every object of the scene, one array per field. The passes over all objects, like filling the object buffer or measuring bounds,
+//only stream through the fields they read. A Handle<RenderObject> indexes every array
+struct RenderObjectArrays {
+	std::vector<glm::mat4> transforms;
+	std::vector<RenderBounds> bounds;
+	std::vector<Handle<DrawMesh>> meshIDs;
+	std::vector<Handle<vkutil::Material>> materials;
+	std::vector<uint32_t> customSortKeys;
+	std::vector<vkutil::PerPassData<int32_t>> passIndices;
+	//position in RenderScene::dirtyObjects, -1 while the object is clean
+	std::vector<uint32_t> updateIndices;
+	//current generation of every slot, odd while it is free. See Handle
+	std::vector<uint32_t> generations;
+
+	size_t size() const { return transforms.size(); }
+	void reserve(size_t count);
+	//new slots start clean, outside every pass and at generation 0
+	void resize(size_t count);
 };
 
 struct GPUInstance {
@@ -81,7 +130,8 @@ public:
 		PassMaterial material;
 		Handle<DrawMesh> meshID;
 		Handle<RenderObject> original;
-		int32_t builtbatch;
+		//index of its batch in batches, the batchID of its instance
+		uint32_t builtbatch;
 		uint32_t customKey;
 	};
 	struct RenderBatch {
@@ -98,6 +148,8 @@ public:
 		PassMaterial material;
 		uint32_t first;
 		uint32_t count;
+		//count * cluster count commands from here on in the cluster draw buffer, when the mesh has clusters
+		uint32_t clusterDrawFirst;
 	};
 	
 	struct Multibatch {
@@ -112,6 +164,7 @@ public:
 
 		std::vector<Handle<RenderObject>> unbatchedObjects;
 
+		//every object of the pass sorted by key, as of the last time the batches were built. Only the rebuilds read it
 		std::vector<RenderScene::RenderBatch> flat_batches;
 
 		std::vector<PassObject> objects;
@@ -131,22 +184,64 @@ public:
 
 		MeshpassType type;
 
+		//levels of detail the indirect buffers are laid out for, the most any mesh in the pass has.
+		//the commands of lod i start at i * batches.size(), their instances at i * instanceStride
+		uint32_t lodLevels = 1;
+
+		//instances every level has room for, at least as many as the pass has objects
+		uint32_t instanceStride = 0;
+
+		//batch of every sort key, built with the batches. New objects with a known key join its batch, the others rebuild them.
+		//keys that more than one batch holds, from hash collisions, map to ~0u
+		std::unordered_map<uint64_t, uint32_t> batchLookup;
+
+		//clustered objects skip the per object commands. The cluster cull writes one command per visible cluster into clusterDrawBuffer,
+		//with its instance after the lod ranges of compactedInstanceBuffer. clusterCountBuffer starts with the cluster cull dispatch
+		//arguments, followed by the draw count of every batch at CLUSTER_COUNT_OFFSET
+		uint32_t clusterDraws = 0;
+		AllocatedBuffer<GPUInstance> clusterWorkBuffer;
+		AllocatedBuffer<uint32_t> clusterCountBuffer;
+		AllocatedBuffer<VkDrawIndexedIndirectCommand> clusterDrawBuffer;
+
+		//set when the batches got rebuilt, the whole indirect and instance buffers get uploaded again
 		bool needsIndirectRefresh = true;
 		bool needsInstanceRefresh = true;
+
+		//the batches from this one on changed their count or their ranges since the last upload, ~0u when none did.
+		//only their commands get copied, on every level
+		uint32_t firstDirtyBatch = ~0u;
+
+		//instance slots, one per pass object, that got a new object or lost theirs since the last upload. Only their instances get copied
+		std::vector<uint32_t> dirtyInstances;
+
+		//scratch of the batch rebuild sort, kept so it doesn't allocate every rebuild
+		std::vector<RenderScene::RenderBatch> sortScratch;
 	};
 
 	void init();
 
 	Handle<RenderObject> register_object(MeshObject* object);
 
-	void register_object_batch(MeshObject* first, uint32_t count);
+	//handles of the new objects are written to outHandles when given, count of them
+	void register_object_batch(MeshObject* first, uint32_t count, Handle<RenderObject>* outHandles = nullptr);
+
+	//takes the object out of every pass and frees its slot, the next registered object reuses it and its place in the object buffer.
+	//the handle and any copy of it are stale from here on
+	void unregister_object(Handle<RenderObject> objectID);
+
+	//false for handles of unregistered objects, even when their slot was reused since
+	bool is_valid(Handle<RenderObject> objectID) const;
 
 	void update_transform(Handle<RenderObject> objectID,const glm::mat4 &localToWorld);
 	void update_object(Handle<RenderObject> objectID);
 	
 	void fill_objectData(GPUObjectData* data);
-	void fill_indirectArray(GPUIndirectObject* data, MeshPass& pass);
+	//commands of the batches from firstBatch on, the ones of every level after those of the level before
+	void fill_indirectArray(GPUIndirectObject* data, MeshPass& pass, uint32_t firstBatch = 0);
+	//instance of every pass object slot, free slots get an objectID of ~0u the cull skips
 	void fill_instancesArray(GPUInstance* data, MeshPass& pass);
+	//writes the instances of pass.dirtyInstances to data, and the copies that take them to their place in the instance buffer
+	void fill_dirty_instances(GPUInstance* data, MeshPass& pass, std::vector<VkBufferCopy>& copies);
 
 	void write_object(GPUObjectData* target, Handle<RenderObject> objectID);
 	
@@ -154,17 +249,19 @@ public:
 
 	void build_batches();
 
+	//copies every registered mesh into the merged buffers. Runs once, as with releaseMergedMeshes the meshes lose their own buffers
 	void merge_meshes(class VulkanEngine* engine);
 
 	void refresh_pass(MeshPass* pass);
 
 	void build_indirect_batches(MeshPass* pass, std::vector<IndirectBatch>& outbatches, std::vector<RenderScene::RenderBatch>& inobjects);
-	RenderObject* get_object(Handle<RenderObject> objectID);
 	DrawMesh* get_mesh(Handle<DrawMesh> objectID);
 
 	vkutil::Material *get_material(Handle<vkutil::Material> objectID);
 
-	std::vector<RenderObject> renderables;
+	RenderObjectArrays renderables;
+	//unregistered slots of renderables, reused last freed first
+	std::vector<uint32_t> freeObjects;
 	std::vector<DrawMesh> meshes;
 	std::vector<vkutil::Material*> materials;
 
@@ -185,7 +282,14 @@ public:
 
 	AllocatedBuffer<Vertex> mergedVertexBuffer;
 	AllocatedBuffer<uint32_t> mergedIndexBuffer;
+	AllocatedBuffer<uint16_t> mergedIndexBuffer16;
+
+	//clusters of every merged mesh that has them
+	AllocatedBuffer<GPUCluster> clusterBuffer;
 
 	AllocatedBuffer<GPUObjectData> objectDataBuffer;
+
+	//pass refreshes, large batch sorts and instance fills split over it when set, without it they run on the calling thread
+	ThreadPool* threadPool{ nullptr };
 };
 
@@ -0,0 +1,345 @@
+#include <vk_texture_streaming.h>
+#include <vk_engine.h>
+#include <vk_textures.h>
+#include <texture_asset.h>
+
+#include "logger.h"
+#include "cvars.h"
+#include "Tracy.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+AutoCVar_Int CVAR_TextureStreaming("streaming.enable", "Load textures with their coarse mips only, and stream the finer ones by screen coverage", 1, CVarFlags::EditCheckbox);
+AutoCVar_Int CVAR_StreamingResidentSize("streaming.residentSize", "Largest side of the mips textures load with up front", 64);
+AutoCVar_Int CVAR_StreamingBudget("streaming.budgetMB", "Memory the streamed textures can take, the least covered ones drop fine mips above it", 512);
+AutoCVar_Int CVAR_StreamingObjectsPerFrame("streaming.objectsPerFrame", "Objects measured per frame for texture coverage", 16384);
+AutoCVar_Int CVAR_StreamingMaxUploads("streaming.maxUploads", "Texture mip uploads in flight at once", 4);
+
+namespace {
+	//landed uploads wait for the previous frame to finish on its own this many frames, then the swap waits on its fence
+	constexpr uint32_t MAX_FRAMES_WAITING_SWAP = 8;
+}
+
+namespace vkutil {
+
+	struct TextureStreamer::PendingDecode {
+		StagedImage staged;
+		bool decoded{ false };
+	};
+
+	void TextureStreamer::init(VulkanEngine* _engine)
+	{
+		engine = _engine;
+	}
+
+	void TextureStreamer::cleanup()
+	{
+		for (StreamedTexture& texture : textures)
+		{
+			destroy_image(texture.image);
+			if (texture.decodeTask)
+			{
+				//decoded mips that never got uploaded still own their staging buffer
+				engine->_threadPool.wait(texture.decodeTask);
+				if (texture.decode->decoded)
+				{
+					vmaDestroyBuffer(engine->_allocator, texture.decode->staged.stagingBuffer._buffer, texture.decode->staged.stagingBuffer._allocation);
+				}
+			}
+			else if (texture.uploading)
+			{
+				destroy_image(texture.pendingImage);
+			}
+		}
+		textures.clear();
+		viewLookup.clear();
+		residentBytes = 0;
+		uploadsInFlight = 0;
+	}
+
+	uint32_t TextureStreamer::resident_size() const
+	{
+		return CVAR_TextureStreaming.Get() ? static_cast<uint32_t>(std::max(CVAR_StreamingResidentSize.Get(), 1)) : 0;
+	}
+
+	void TextureStreamer::add_texture(const std::string& name, const std::string& path, const AllocatedImage& image, uint32_t firstMip)
+	{
+		assets::MappedAssetFile file;
+		if (!assets::map_binaryfile(path.c_str(), file))
+		{
+			LOG_ERROR("Texture {} can't be streamed, its file at {} is gone", name, path);
+			VulkanEngine* owner = engine;
+			engine->_mainDeletionQueue.push_function([=]() {
+				vmaDestroyImage(owner->_allocator, image._image, image._allocation);
+			});
+			return;
+		}
+		assets::TextureInfo info = assets::read_texture_info(&file);
+
+		StreamedTexture texture;
+		texture.name = name;
+		texture.path = path;
+		for (const assets::PageInfo& page : info.pages)
+		{
+			texture.mipBytes.push_back(page.originalSize);
+			texture.mipDimensions.push_back(std::max(page.width, page.height));
+		}
+		texture.tailMip = firstMip;
+		texture.image = image;
+		texture.residentMip = firstMip;
+		texture.wantedMip = firstMip;
+
+		residentBytes += bytes_from(texture, firstMip);
+		viewLookup[image._defaultView] = static_cast<uint32_t>(textures.size());
+		textures.push_back(std::move(texture));
+	}
+
+	void TextureStreamer::update(const RenderScene& scene, const glm::vec3& cameraPosition, float projectionScale)
+	{
+		ZoneScopedNC("Texture Streaming", tracy::Color::Yellow);
+
+		upload_decoded();
+
+		for (StreamedTexture& texture : textures)
+		{
+			if (texture.uploading && !texture.decodeTask && !texture.landed && engine->_uploader.is_finished(texture.upload))
+			{
+				texture.landed = true;
+			}
+		}
+		swap_landed_views();
+
+		if (textures.empty()) return;
+
+		//screen size of a slice of the objects. The wanted mips only change once the sweep went through all of them
+		materialCoverage.resize(scene.materials.size(), 0.f);
+
+		const uint32_t objectCount = static_cast<uint32_t>(scene.renderables.size());
+		const uint32_t sweepEnd = std::min(objectCount, sweepCursor + static_cast<uint32_t>(std::max(CVAR_StreamingObjectsPerFrame.Get(), 1)));
+		for (uint32_t i = sweepCursor; i < sweepEnd; i++)
+		{
+			const RenderBounds& bounds = scene.renderables.bounds[i];
+
+			//projected diameter of the bounding sphere, in pixels
+			float distance = std::max(glm::length(bounds.origin - cameraPosition) - bounds.radius, 0.1f);
+			float pixels = 2.f * bounds.radius * projectionScale / distance;
+
+			float& coverage = materialCoverage[scene.renderables.materials[i].handle];
+			coverage = std::max(coverage, pixels);
+		}
+		sweepCursor = sweepEnd;
+
+		if (sweepCursor >= objectCount)
+		{
+			for (StreamedTexture& texture : textures)
+			{
+				texture.coverage = 0;
+			}
+
+			for (size_t m = 0; m < scene.materials.size(); m++)
+			{
+				const Material* material = scene.materials[m];
+				if (!material) continue;
+
+				for (const SampledTexture& sampled : material->textures)
+				{
+					auto found = viewLookup.find(sampled.view);
+					if (found != viewLookup.end())
+					{
+						StreamedTexture& texture = textures[found->second];
+						texture.coverage = std::max(texture.coverage, materialCoverage[m]);
+					}
+				}
+			}
+
+			std::fill(materialCoverage.begin(), materialCoverage.end(), 0.f);
+			sweepCursor = 0;
+
+			choose_wanted_mips();
+		}
+
+		start_uploads();
+	}
+
+	uint64_t TextureStreamer::bytes_from(const StreamedTexture& texture, uint32_t mip) const
+	{
+		return std::accumulate(texture.mipBytes.begin() + mip, texture.mipBytes.end(), uint64_t(0));
+	}
+
+	void TextureStreamer::choose_wanted_mips()
+	{
+		//the finest mip needed is the smallest one still having a texel for every pixel of the largest object using it
+		uint64_t wantedBytes = 0;
+		for (StreamedTexture& texture : textures)
+		{
+			uint32_t mip = 0;
+			while (mip < texture.tailMip && texture.mipDimensions[mip + 1] >= texture.coverage)
+			{
+				mip++;
+			}
+			texture.wantedMip = texture.failed ? texture.residentMip : mip;
+			wantedBytes += bytes_from(texture, texture.wantedMip);
+		}
+
+		//over budget, every texture gives up its finest mip in turn, the ones covering the least of the screen first
+		const uint64_t budget = uint64_t(std::max(CVAR_StreamingBudget.Get(), 0)) * 1024 * 1024;
+		if (wantedBytes <= budget) return;
+
+		std::vector<uint32_t> order(textures.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			return textures[a].coverage < textures[b].coverage;
+		});
+
+		bool dropped = true;
+		while (wantedBytes > budget && dropped)
+		{
+			dropped = false;
+			for (uint32_t index : order)
+			{
+				StreamedTexture& texture = textures[index];
+				if (texture.failed || texture.wantedMip >= texture.tailMip) continue;
+
+				wantedBytes -= texture.mipBytes[texture.wantedMip];
+				texture.wantedMip++;
+				dropped = true;
+
+				if (wantedBytes <= budget) break;
+			}
+		}
+	}
+
+	void TextureStreamer::start_uploads()
+	{
+		const size_t maxUploads = static_cast<size_t>(std::max(CVAR_StreamingMaxUploads.Get(), 1));
+		if (uploadsInFlight >= maxUploads) return;
+
+		std::vector<uint32_t> requests;
+		for (uint32_t i = 0; i < textures.size(); i++)
+		{
+			if (!textures[i].uploading && textures[i].wantedMip != textures[i].residentMip)
+			{
+				requests.push_back(i);
+			}
+		}
+
+		//evictions first, they free memory and only upload coarse mips. Then the textures covering the most of the screen
+		std::sort(requests.begin(), requests.end(), [&](uint32_t a, uint32_t b) {
+			bool evictA = textures[a].wantedMip > textures[a].residentMip;
+			bool evictB = textures[b].wantedMip > textures[b].residentMip;
+			if (evictA != evictB) return evictA;
+			return textures[a].coverage > textures[b].coverage;
+		});
+
+		for (uint32_t index : requests)
+		{
+			if (uploadsInFlight >= maxUploads) break;
+
+			StreamedTexture& texture = textures[index];
+
+			//decoding a full mip chain takes longer than a frame, the render thread only picks up the result
+			std::shared_ptr<PendingDecode> decode = std::make_shared<PendingDecode>();
+			VulkanEngine* owner = engine;
+			std::string path = texture.path;
+			uint32_t maxSize = texture.mipDimensions[texture.wantedMip];
+			texture.decodeTask = engine->_threadPool.schedule([owner, decode, path, maxSize]() {
+				ZoneScopedNC("Decode Streamed Texture", tracy::Color::Magenta);
+				decode->decoded = stage_image_from_asset(*owner, path.c_str(), decode->staged, maxSize);
+			});
+			texture.decode = std::move(decode);
+			texture.uploading = true;
+			texture.landed = false;
+
+			uploadsInFlight++;
+		}
+	}
+
+	void TextureStreamer::upload_decoded()
+	{
+		for (StreamedTexture& texture : textures)
+		{
+			if (!texture.decodeTask || !engine->_threadPool.is_done(texture.decodeTask)) continue;
+
+			std::shared_ptr<PendingDecode> decode = std::move(texture.decode);
+			texture.decodeTask = nullptr;
+
+			if (!decode->decoded)
+			{
+				//it won't decode any better later, the texture stays at what it has
+				LOG_ERROR("Failed to stream texture {}", texture.name);
+				texture.failed = true;
+				texture.wantedMip = texture.residentMip;
+				texture.uploading = false;
+				uploadsInFlight--;
+				continue;
+			}
+
+			texture.pendingMip = decode->staged.firstMip;
+			texture.pendingImage = allocate_image_mipmapped(*engine, decode->staged);
+			texture.upload = engine->_uploader.upload_image(decode->staged, texture.pendingImage);
+
+			residentBytes += bytes_from(texture, texture.pendingMip);
+		}
+	}
+
+	void TextureStreamer::swap_landed_views()
+	{
+		bool anyLanded = std::any_of(textures.begin(), textures.end(), [](const StreamedTexture& texture) { return texture.landed; });
+		if (!anyLanded)
+		{
+			framesWaitingSwap = 0;
+			return;
+		}
+
+		//the descriptors get rewritten in place, so the previous frame can't be drawing with them anymore.
+		//the current one was already waited on
+		FrameData& lastFrame = engine->get_last_frame();
+		if (engine->_frameNumber > 0 && vkGetFenceStatus(engine->_device, lastFrame._renderFence) != VK_SUCCESS)
+		{
+			if (++framesWaitingSwap < MAX_FRAMES_WAITING_SWAP) return;
+
+			ZoneScopedNC("Wait Texture Swap", tracy::Color::Red);
+			vkWaitForFences(engine->_device, 1, &lastFrame._renderFence, true, UINT64_MAX);
+		}
+		framesWaitingSwap = 0;
+
+		std::unordered_map<VkImageView, VkImageView> replacements;
+		std::vector<AllocatedImage> replacedImages;
+		for (uint32_t i = 0; i < textures.size(); i++)
+		{
+			StreamedTexture& texture = textures[i];
+			if (!texture.landed) continue;
+
+			replacements[texture.image._defaultView] = texture.pendingImage._defaultView;
+			replacedImages.push_back(texture.image);
+
+			viewLookup.erase(texture.image._defaultView);
+			viewLookup[texture.pendingImage._defaultView] = i;
+
+			Texture& cached = engine->_loadedTextures[texture.name];
+			cached.image = texture.pendingImage;
+			cached.imageView = texture.pendingImage._defaultView;
+
+			residentBytes -= bytes_from(texture, texture.residentMip);
+			texture.image = texture.pendingImage;
+			texture.residentMip = texture.pendingMip;
+			texture.uploading = false;
+			texture.landed = false;
+			uploadsInFlight--;
+		}
+
+		engine->_materialSystem->replace_texture_views(replacements);
+
+		for (const AllocatedImage& image : replacedImages)
+		{
+			destroy_image(image);
+		}
+	}
+
+	void TextureStreamer::destroy_image(const AllocatedImage& image)
+	{
+		vkDestroyImageView(engine->_device, image._defaultView, nullptr);
+		vmaDestroyImage(engine->_allocator, image._image, image._allocation);
+	}
+}
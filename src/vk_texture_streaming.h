@@ -0,0 +1,110 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vk_upload.h>
+#include <thread_pool.h>
+
+#include <glm/glm.hpp>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class VulkanEngine;
+class RenderScene;
+
+namespace vkutil {
+
+	//keeps textures resident from their coarsest mips up to the finest one their objects cover on screen.
+	//a residency change decodes the mips that stay resident on the thread pool, uploads them into a new image through the AsyncUploader
+	//on a later frame, and once the copy landed swaps the materials over to its view and destroys the old image. Mips nobody looks at take no memory.
+	//not thread safe, call it from the render thread only
+	class TextureStreamer {
+	public:
+		void init(VulkanEngine* engine);
+
+		//destroys every image the streamer owns, uploads must be finished. Waits for the decodes still running
+		void cleanup();
+
+		//largest side of the mips textures load with up front, the finer ones are streamed. 0 when streaming is off
+		uint32_t resident_size() const;
+
+		//takes ownership of a texture of the engine cache, whose image holds the mips of the asset at path from firstMip down.
+		//the image must come from allocate_image_mipmapped
+		void add_texture(const std::string& name, const std::string& path, const AllocatedImage& image, uint32_t firstMip);
+
+		//measures part of the scene, starts the uploads and evictions it asks for, and swaps the views of the landed ones.
+		//call it once per frame, after the fence of the current frame was waited on and the uploader polled
+		void update(const RenderScene& scene, const glm::vec3& cameraPosition, float projectionScale);
+
+		size_t resident_bytes() const { return residentBytes; }
+		size_t streaming_count() const { return uploadsInFlight; }
+		size_t texture_count() const { return textures.size(); }
+
+	private:
+		//staged mips a decode task writes, read once it finished
+		struct PendingDecode;
+
+		struct StreamedTexture {
+			std::string name;
+			std::string path;
+
+			//size in bytes and largest dimension of every mip of the asset
+			std::vector<uint64_t> mipBytes;
+			std::vector<uint32_t> mipDimensions;
+			//finest mip that ever needs to stay resident
+			uint32_t tailMip;
+			//a decode failed, the texture stays with the mips it has
+			bool failed{ false };
+
+			AllocatedImage image;
+			uint32_t residentMip;
+
+			//image being decoded, then uploaded, to replace the resident one
+			bool uploading{ false };
+			bool landed{ false };
+			//set while the mips are decoding, the upload starts on the first update after the task finished
+			ThreadPool::TaskHandle decodeTask;
+			std::shared_ptr<PendingDecode> decode;
+			AllocatedImage pendingImage;
+			uint32_t pendingMip;
+			UploadHandle upload;
+
+			//largest screen size in pixels of an object using it, from the last finished sweep
+			float coverage{ 0 };
+			uint32_t wantedMip;
+		};
+
+		uint64_t bytes_from(const StreamedTexture& texture, uint32_t mip) const;
+
+		//finest mips every texture can keep within the memory budget, from the last sweep
+		void choose_wanted_mips();
+
+		//queues the decodes of the residency changes the last sweep asked for
+		void start_uploads();
+
+		//uploads the mips of the decodes that finished
+		void upload_decoded();
+
+		//materials still drawing with the old views have to be finished before the swap
+		void swap_landed_views();
+
+		void destroy_image(const AllocatedImage& image);
+
+		VulkanEngine* engine;
+
+		std::vector<StreamedTexture> textures;
+		std::unordered_map<VkImageView, uint32_t> viewLookup;
+
+		//sweep over the scene objects, per material handle
+		uint32_t sweepCursor{ 0 };
+		std::vector<float> materialCoverage;
+
+		size_t residentBytes{ 0 };
+		size_t uploadsInFlight{ 0 };
+
+		//frames the landed uploads waited for a safe point to swap at
+		uint32_t framesWaitingSwap{ 0 };
+	};
+}
@@ -11,6 +11,28 @@
 #include "asset_loader.h"
 #include "Tracy.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+
+
+VkFormat vkutil::get_texture_format(assets::TextureFormat format)
+{
+	switch (format) {
+	case assets::TextureFormat::RGBA8:
+		return VK_FORMAT_R8G8B8A8_UNORM;
+	case assets::TextureFormat::BC1:
+		return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+	case assets::TextureFormat::BC3:
+		return VK_FORMAT_BC3_UNORM_BLOCK;
+	case assets::TextureFormat::BC5:
+		return VK_FORMAT_BC5_UNORM_BLOCK;
+	case assets::TextureFormat::BC7:
+		return VK_FORMAT_BC7_UNORM_BLOCK;
+	default:
+		return VK_FORMAT_UNDEFINED;
+	}
+}
 
 bool vkutil::load_image_from_file(VulkanEngine& engine, const char* file, AllocatedImage & outImage)
 {
@@ -54,8 +76,30 @@ bool vkutil::load_image_from_file(VulkanEngine& engine, const char* file, Alloca
 
 bool vkutil::load_image_from_asset(VulkanEngine& engine, const char* filename, AllocatedImage& outImage)
 {
-	assets::AssetFile file;
-	bool loaded = assets::load_binaryfile(filename, file);
+	auto start = std::chrono::high_resolution_clock::now();
+
+	StagedImage staged;
+	if (!stage_image_from_asset(engine, filename, staged))
+	{
+		return false;
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	engine._loadStats.textureDecodeTime += std::chrono::duration<double, std::milli>(end - start).count();
+	engine._loadStats.textureBytesDecoded += staged.stagingBuffer._size;
+	engine._loadStats.texturesLoaded++;
+
+	outImage = upload_image_mipmapped(staged.width, staged.height, staged.format, engine, staged.stagingBuffer, staged.mips);
+
+	vmaDestroyBuffer(engine._allocator, staged.stagingBuffer._buffer, staged.stagingBuffer._allocation);
+
+	return true;
+}
+
+bool vkutil::stage_image_from_asset(VulkanEngine& engine, const char* filename, StagedImage& outImage, uint32_t maxSize)
+{
+	assets::MappedAssetFile file;
+	bool loaded = assets::map_binaryfile(filename, file);
 
 	if (!loaded) {
 		std::cout << "Error when loading texture " << filename << std::endl;
@@ -65,41 +109,65 @@ bool vkutil::load_image_from_asset(VulkanEngine& engine, const char* filename, A
 	assets::TextureInfo textureInfo = assets::read_texture_info(&file);
 
 	
-	VkDeviceSize imageSize = textureInfo.textureSize;
-	VkFormat image_format;
-	switch (textureInfo.textureFormat) {
-	case assets::TextureFormat::RGBA8:
-		image_format = VK_FORMAT_R8G8B8A8_UNORM;
-		break;
-	default:
+	VkFormat image_format = get_texture_format(textureInfo.textureFormat);
+	if (image_format == VK_FORMAT_UNDEFINED)
+	{
+		std::cout << "Unsupported texture format in " << filename << std::endl;
 		return false;
 	}
 
+	uint32_t firstMip = 0;
+	while (maxSize > 0 && firstMip + 1 < textureInfo.pages.size() && std::max(textureInfo.pages[firstMip].width, textureInfo.pages[firstMip].height) > maxSize)
+	{
+		firstMip++;
+	}
+
+	//pages are stored largest first, the skipped ones are a prefix of the unpacked texture
+	const uint32_t pageCount = static_cast<uint32_t>(textureInfo.pages.size()) - firstMip;
+	const uint64_t skippedSize = textureInfo.pages[firstMip].originalOffset;
+	VkDeviceSize imageSize = textureInfo.textureSize - skippedSize;
+
 	AllocatedBufferUntyped stagingBuffer = engine.create_buffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_UNKNOWN, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
 	
 	std::vector<MipmapInfo> mips;
 
 	void* data;
 	vmaMapMemory(engine._allocator, stagingBuffer._allocation, &data);
-	size_t offset = 0;
-	{
-		
-		for (int i = 0; i < textureInfo.pages.size(); i++) {
-			ZoneScopedNC("Unpack Texture", tracy::Color::Magenta);
-			MipmapInfo mip;
-			mip.dataOffset = offset;
-			mip.dataSize = textureInfo.pages[i].originalSize;
-			mips.push_back(mip);
-			assets::unpack_texture_page(&textureInfo, i, file.binaryBlob.data(), (char*)data + offset);
-
-			offset += mip.dataSize;
-		}
+	for (uint32_t i = firstMip; i < textureInfo.pages.size(); i++) {
+		MipmapInfo mip;
+		mip.dataOffset = textureInfo.pages[i].originalOffset - skippedSize;
+		mip.dataSize = textureInfo.pages[i].originalSize;
+		mips.push_back(mip);
 	}
+
+	//every page has its own source and destination range, so they decode independently
+	std::atomic<bool> unpacked{ true };
+	engine._threadPool.parallel_for(pageCount, [&](uint32_t i) {
+		ZoneScopedNC("Unpack Texture", tracy::Color::Magenta);
+		uint32_t page = firstMip + i;
+		if (!assets::unpack_texture_page(&textureInfo, page, file.binaryBlob, (char*)data + mips[i].dataOffset))
+		{
+			unpacked = false;
+		}
+	});
+
+	//cached memory is not guaranteed to be coherent
+	vmaFlushAllocation(engine._allocator, stagingBuffer._allocation, 0, VK_WHOLE_SIZE);
 	vmaUnmapMemory(engine._allocator, stagingBuffer._allocation);		
 
-	outImage = upload_image_mipmapped(textureInfo.pages[0].width, textureInfo.pages[0].height, image_format, engine, stagingBuffer,mips);
+	if (!unpacked)
+	{
+		std::cout << "Corrupted texture data in " << filename << std::endl;
+		vmaDestroyBuffer(engine._allocator, stagingBuffer._buffer, stagingBuffer._allocation);
+		return false;
+	}
 
-	vmaDestroyBuffer(engine._allocator, stagingBuffer._buffer, stagingBuffer._allocation);
+	outImage.stagingBuffer = stagingBuffer;
+	outImage.format = image_format;
+	outImage.width = textureInfo.pages[firstMip].width;
+	outImage.height = textureInfo.pages[firstMip].height;
+	outImage.mips = std::move(mips);
+	outImage.firstMip = firstMip;
 
 	return true;
 }
@@ -189,15 +257,45 @@ AllocatedImage vkutil::upload_image(int texWidth, int texHeight, VkFormat image_
 }
 
 AllocatedImage vkutil::upload_image_mipmapped(int texWidth, int texHeight, VkFormat image_format, VulkanEngine& engine, AllocatedBufferUntyped& stagingBuffer, std::vector<MipmapInfo> mips)
+{
+	StagedImage staged;
+	staged.stagingBuffer = stagingBuffer;
+	staged.format = image_format;
+	staged.width = texWidth;
+	staged.height = texHeight;
+	staged.mips = std::move(mips);
+
+	AllocatedImage newImage = create_image_mipmapped(engine, staged);
+
+	engine.immediate_submit([&](VkCommandBuffer cmd) {
+		record_image_upload(cmd, staged, newImage);
+	});
+
+	return newImage;
+}
+
+AllocatedImage vkutil::create_image_mipmapped(VulkanEngine& engine, const StagedImage& image)
+{
+	AllocatedImage newImage = allocate_image_mipmapped(engine, image);
+
+	engine._mainDeletionQueue.push_function([=, &engine]() {
+
+		vmaDestroyImage(engine._allocator, newImage._image, newImage._allocation);
+	});
+
+	return newImage;
+}
+
+AllocatedImage vkutil::allocate_image_mipmapped(VulkanEngine& engine, const StagedImage& image)
 {
 	VkExtent3D imageExtent;
-	imageExtent.width = static_cast<uint32_t>(texWidth);
-	imageExtent.height = static_cast<uint32_t>(texHeight);
+	imageExtent.width = static_cast<uint32_t>(image.width);
+	imageExtent.height = static_cast<uint32_t>(image.height);
 	imageExtent.depth = 1;
 
-	VkImageCreateInfo dimg_info = vkinit::image_create_info(image_format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, imageExtent);
+	VkImageCreateInfo dimg_info = vkinit::image_create_info(image.format, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, imageExtent);
 
-	dimg_info.mipLevels = (uint32_t)mips.size();
+	dimg_info.mipLevels = (uint32_t)image.mips.size();
 
 	AllocatedImage newImage;
 
@@ -207,77 +305,79 @@ AllocatedImage vkutil::upload_image_mipmapped(int texWidth, int texHeight, VkFor
 	//allocate and create the image
 	vmaCreateImage(engine._allocator, &dimg_info, &dimg_allocinfo, &newImage._image, &newImage._allocation, nullptr);
 
-	//transition image to transfer-receiver	
-	engine.immediate_submit([&](VkCommandBuffer cmd) {
-		VkImageSubresourceRange range;
-		range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		range.baseMipLevel = 0;
-		range.levelCount = (uint32_t)mips.size();
-		range.baseArrayLayer = 0;
-		range.layerCount = 1;
+	newImage.mipLevels = (uint32_t)image.mips.size();
 
-		VkImageMemoryBarrier imageBarrier_toTransfer = {};
-		imageBarrier_toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	//build a default imageview
+	VkImageViewCreateInfo view_info = vkinit::imageview_create_info(image.format, newImage._image, VK_IMAGE_ASPECT_COLOR_BIT);
+	view_info.subresourceRange.levelCount = newImage.mipLevels;
+	vkCreateImageView(engine._device, &view_info, nullptr, &newImage._defaultView);
 
-		imageBarrier_toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		imageBarrier_toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		imageBarrier_toTransfer.image = newImage._image;
-		imageBarrier_toTransfer.subresourceRange = range;
+	return newImage;
+}
 
-		imageBarrier_toTransfer.srcAccessMask = 0;
-		imageBarrier_toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+void vkutil::record_image_upload(VkCommandBuffer cmd, const StagedImage& image, const AllocatedImage& newImage)
+{
+	//transition image to transfer-receiver	
+	VkImageSubresourceRange range;
+	range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	range.baseMipLevel = 0;
+	range.levelCount = (uint32_t)image.mips.size();
+	range.baseArrayLayer = 0;
+	range.layerCount = 1;
 
-		//barrier the image into the transfer-receive layout
-		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier_toTransfer);
+	VkImageMemoryBarrier imageBarrier_toTransfer = {};
+	imageBarrier_toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 
-		for(int i = 0 ; i < mips.size();i++){
-		
+	imageBarrier_toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageBarrier_toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	imageBarrier_toTransfer.image = newImage._image;
+	imageBarrier_toTransfer.subresourceRange = range;
 
-		
-			VkBufferImageCopy copyRegion = {};
-			copyRegion.bufferOffset =mips[i].dataOffset;
-			copyRegion.bufferRowLength = 0;
-			copyRegion.bufferImageHeight = 0;
-
-			copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			copyRegion.imageSubresource.mipLevel = i;
-			copyRegion.imageSubresource.baseArrayLayer = 0;
-			copyRegion.imageSubresource.layerCount = 1;
-			copyRegion.imageExtent = imageExtent;
-
-			//copy the buffer into the image
-			vkCmdCopyBufferToImage(cmd, stagingBuffer._buffer, newImage._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
-
-			imageExtent.width /= 2;
-			imageExtent.height /= 2;
-		}
-		VkImageMemoryBarrier imageBarrier_toReadable = imageBarrier_toTransfer;
+	imageBarrier_toTransfer.srcAccessMask = 0;
+	imageBarrier_toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 
-		imageBarrier_toReadable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		imageBarrier_toReadable.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	//barrier the image into the transfer-receive layout
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier_toTransfer);
 
-		imageBarrier_toReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		imageBarrier_toReadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	record_image_copies(cmd, image, newImage);
 
-		//barrier the image into the shader readable layout
-		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier_toReadable);
-	});
+	VkImageMemoryBarrier imageBarrier_toReadable = imageBarrier_toTransfer;
 
+	imageBarrier_toReadable.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	imageBarrier_toReadable.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
+	imageBarrier_toReadable.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	imageBarrier_toReadable.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-	newImage.mipLevels = (uint32_t) mips.size();
+	//barrier the image into the shader readable layout
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier_toReadable);
+}
 
+void vkutil::record_image_copies(VkCommandBuffer cmd, const StagedImage& image, const AllocatedImage& newImage)
+{
+	VkExtent3D imageExtent;
+	imageExtent.width = static_cast<uint32_t>(image.width);
+	imageExtent.height = static_cast<uint32_t>(image.height);
+	imageExtent.depth = 1;
 
-	//build a default imageview
-	VkImageViewCreateInfo view_info = vkinit::imageview_create_info(image_format, newImage._image, VK_IMAGE_ASPECT_COLOR_BIT);
-	view_info.subresourceRange.levelCount = newImage.mipLevels;
-	vkCreateImageView(engine._device, &view_info, nullptr, &newImage._defaultView);
+	for(int i = 0 ; i < image.mips.size();i++){
+		
+		VkBufferImageCopy copyRegion = {};
+		copyRegion.bufferOffset = image.mips[i].dataOffset;
+		copyRegion.bufferRowLength = 0;
+		copyRegion.bufferImageHeight = 0;
 
-	engine._mainDeletionQueue.push_function([=, &engine]() {
+		copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		copyRegion.imageSubresource.mipLevel = i;
+		copyRegion.imageSubresource.baseArrayLayer = 0;
+		copyRegion.imageSubresource.layerCount = 1;
+		copyRegion.imageExtent = imageExtent;
 
-		vmaDestroyImage(engine._allocator, newImage._image, newImage._allocation);
-	});
+		//copy the buffer into the image
+		vkCmdCopyBufferToImage(cmd, image.stagingBuffer._buffer, newImage._image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
 
-	return newImage;
+		//the extent of compressed mips smaller than a block is still the mip size, not the block size
+		imageExtent.width = std::max(imageExtent.width / 2, 1u);
+		imageExtent.height = std::max(imageExtent.height / 2, 1u);
+	}
 }
-
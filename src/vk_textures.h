@@ -5,6 +5,7 @@
 
 #include <vk_types.h>
 #include <vk_engine.h>
+#include <texture_asset.h>
 
 namespace vkutil {
 
@@ -13,9 +14,39 @@ namespace vkutil {
 		size_t dataOffset;
 	};
 
+	//texture decoded into its staging buffer, waiting to be copied into an image
+	struct StagedImage {
+		AllocatedBufferUntyped stagingBuffer;
+		VkFormat format;
+		int width;
+		int height;
+		std::vector<MipmapInfo> mips;
+		//mip of the asset the staged mips start at
+		uint32_t firstMip{ 0 };
+	};
+
+	//image format of a texture asset format, VK_FORMAT_UNDEFINED when there is none
+	VkFormat get_texture_format(assets::TextureFormat format);
+
 	bool load_image_from_file(VulkanEngine& engine, const char* file, AllocatedImage& outImage);	
 	bool load_image_from_asset(VulkanEngine& engine, const char* file, AllocatedImage& outImage);
 
+	//decodes the texture asset into a new staging buffer. Mips whose largest side is above maxSize are skipped, 0 keeps all of them,
+	//the smallest mip is always kept. Does not record any gpu work, so it is safe to call from worker threads
+	bool stage_image_from_asset(VulkanEngine& engine, const char* file, StagedImage& outImage, uint32_t maxSize = 0);
+
+	//creates the image and its default view for a staged texture
+	AllocatedImage create_image_mipmapped(VulkanEngine& engine, const StagedImage& image);
+
+	//same as create_image_mipmapped, but the caller owns the image and its view and destroys both
+	AllocatedImage allocate_image_mipmapped(VulkanEngine& engine, const StagedImage& image);
+
+	//records the copy of every mip from the staging buffer, leaving the image ready for sampling
+	void record_image_upload(VkCommandBuffer cmd, const StagedImage& image, const AllocatedImage& newImage);
+
+	//records only the per mip copies, the image must already be in the transfer destination layout
+	void record_image_copies(VkCommandBuffer cmd, const StagedImage& image, const AllocatedImage& newImage);
+
 
 	AllocatedImage upload_image(int texWidth, int texHeight, VkFormat image_format, VulkanEngine& engine, AllocatedBufferUntyped& stagingBuffer);
 
@@ -0,0 +1,209 @@
+#include <vk_upload.h>
+#include <vk_initializers.h>
+#include <vk_textures.h>
+
+namespace vkutil {
+
+	void AsyncUploader::init(VkDevice _device, VmaAllocator _allocator, VkQueue transferQueue, uint32_t transferFamily, uint32_t graphicsFamily)
+	{
+		device = _device;
+		allocator = _allocator;
+		queue = transferQueue;
+		transferQueueFamily = transferFamily;
+		graphicsQueueFamily = graphicsFamily;
+
+		VkCommandPoolCreateInfo poolInfo = vkinit::command_pool_create_info(transferQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+		vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
+
+		VkSemaphoreTypeCreateInfo timelineInfo = {};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+		timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		timelineInfo.initialValue = 0;
+
+		VkSemaphoreCreateInfo semaphoreInfo = vkinit::semaphore_create_info();
+		semaphoreInfo.pNext = &timelineInfo;
+		vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timeline);
+	}
+
+	void AsyncUploader::cleanup()
+	{
+		flush();
+		wait({ nextValue - 1 });
+
+		vkDestroySemaphore(device, timeline, nullptr);
+		vkDestroyCommandPool(device, commandPool, nullptr);
+	}
+
+	AsyncUploader::Submission& AsyncUploader::get_recording()
+	{
+		if (!recording)
+		{
+			current = Submission{};
+
+			VkCommandBufferAllocateInfo allocInfo = vkinit::command_buffer_allocate_info(commandPool, 1);
+			vkAllocateCommandBuffers(device, &allocInfo, &current.cmd);
+
+			VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+			vkBeginCommandBuffer(current.cmd, &beginInfo);
+
+			recording = true;
+		}
+		return current;
+	}
+
+	UploadHandle AsyncUploader::upload_buffer(const AllocatedBufferUntyped& stagingBuffer, VkDeviceSize srcOffset, const AllocatedBufferUntyped& dst, VkDeviceSize dstOffset, VkDeviceSize size)
+	{
+		Submission& submission = get_recording();
+
+		VkBufferCopy copy;
+		copy.srcOffset = srcOffset;
+		copy.dstOffset = dstOffset;
+		copy.size = size;
+		vkCmdCopyBuffer(submission.cmd, stagingBuffer._buffer, dst._buffer, 1, &copy);
+
+		if (needs_ownership_transfer())
+		{
+			VkBufferMemoryBarrier release = vkinit::buffer_barrier(dst._buffer, transferQueueFamily);
+			release.dstQueueFamilyIndex = graphicsQueueFamily;
+			release.offset = dstOffset;
+			release.size = size;
+			release.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			release.dstAccessMask = 0;
+
+			vkCmdPipelineBarrier(submission.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &release, 0, nullptr);
+
+			//the acquire on the graphics queue has to match the release
+			VkBufferMemoryBarrier acquire = release;
+			acquire.srcAccessMask = 0;
+			acquire.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+			submission.bufferAcquires.push_back(acquire);
+		}
+
+		submission.stagingBuffers.push_back(stagingBuffer);
+
+		return { nextValue };
+	}
+
+	UploadHandle AsyncUploader::upload_image(const StagedImage& image, const AllocatedImage& dst)
+	{
+		Submission& submission = get_recording();
+
+		VkImageMemoryBarrier toTransfer = vkinit::image_barrier(dst._image, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT);
+
+		vkCmdPipelineBarrier(submission.cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &toTransfer);
+
+		record_image_copies(submission.cmd, image, dst);
+
+		//the layout change to shader read happens here, the graphics queue only acquires the image
+		VkImageMemoryBarrier release = vkinit::image_barrier(dst._image, VK_ACCESS_TRANSFER_WRITE_BIT, 0,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_ASPECT_COLOR_BIT);
+
+		if (needs_ownership_transfer())
+		{
+			release.srcQueueFamilyIndex = transferQueueFamily;
+			release.dstQueueFamilyIndex = graphicsQueueFamily;
+
+			VkImageMemoryBarrier acquire = release;
+			acquire.srcAccessMask = 0;
+			acquire.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			submission.imageAcquires.push_back(acquire);
+		}
+
+		vkCmdPipelineBarrier(submission.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &release);
+
+		submission.stagingBuffers.push_back(image.stagingBuffer);
+
+		return { nextValue };
+	}
+
+	void AsyncUploader::flush()
+	{
+		if (!recording) return;
+
+		vkEndCommandBuffer(current.cmd);
+
+		current.timelineValue = nextValue++;
+
+		VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.signalSemaphoreValueCount = 1;
+		timelineInfo.pSignalSemaphoreValues = &current.timelineValue;
+
+		VkSubmitInfo submit = vkinit::submit_info(&current.cmd);
+		submit.pNext = &timelineInfo;
+		submit.signalSemaphoreCount = 1;
+		submit.pSignalSemaphores = &timeline;
+
+		vkQueueSubmit(queue, 1, &submit, VK_NULL_HANDLE);
+
+		inFlight.push_back(std::move(current));
+		recording = false;
+	}
+
+	void AsyncUploader::poll()
+	{
+		if (inFlight.empty()) return;
+
+		vkGetSemaphoreCounterValue(device, timeline, &completedValue);
+
+		//submissions finish in order, so the finished ones are at the front
+		size_t finished = 0;
+		while (finished < inFlight.size() && inFlight[finished].timelineValue <= completedValue)
+		{
+			Submission& submission = inFlight[finished];
+
+			for (auto& buffer : submission.stagingBuffers)
+			{
+				vmaDestroyBuffer(allocator, buffer._buffer, buffer._allocation);
+			}
+			vkFreeCommandBuffers(device, commandPool, 1, &submission.cmd);
+
+			pendingBufferAcquires.insert(pendingBufferAcquires.end(), submission.bufferAcquires.begin(), submission.bufferAcquires.end());
+			pendingImageAcquires.insert(pendingImageAcquires.end(), submission.imageAcquires.begin(), submission.imageAcquires.end());
+
+			acquireValue = submission.timelineValue;
+			acquireReady = true;
+			finished++;
+		}
+		inFlight.erase(inFlight.begin(), inFlight.begin() + finished);
+	}
+
+	void AsyncUploader::wait(UploadHandle handle)
+	{
+		if (recording && handle.timelineValue >= nextValue)
+		{
+			flush();
+		}
+
+		if (handle.timelineValue > completedValue)
+		{
+			VkSemaphoreWaitInfo waitInfo = {};
+			waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+			waitInfo.semaphoreCount = 1;
+			waitInfo.pSemaphores = &timeline;
+			waitInfo.pValues = &handle.timelineValue;
+
+			vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+		}
+		poll();
+	}
+
+	bool AsyncUploader::record_acquires(VkCommandBuffer cmd)
+	{
+		//the frame waits on the semaphore even without barriers to record, which makes the copies visible to it
+		if (!acquireReady) return false;
+		acquireReady = false;
+
+		if (!pendingBufferAcquires.empty() || !pendingImageAcquires.empty())
+		{
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr,
+				static_cast<uint32_t>(pendingBufferAcquires.size()), pendingBufferAcquires.data(),
+				static_cast<uint32_t>(pendingImageAcquires.size()), pendingImageAcquires.data());
+
+			pendingBufferAcquires.clear();
+			pendingImageAcquires.clear();
+		}
+		return true;
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <vk_types.h>
+
+#include <vector>
+
+namespace vkutil {
+
+	struct StagedImage;
+
+	//an upload in flight. It is finished once the uploader timeline semaphore reaches its value
+	struct UploadHandle {
+		uint64_t timelineValue{ 0 };
+	};
+
+	//records copies on a transfer queue and submits them without waiting on the cpu.
+	//completion is tracked with a timeline semaphore that poll() reads once per frame.
+	//when the transfer queue belongs to another family than the graphics queue, every upload releases its
+	//resource on the transfer queue and record_acquires() records the matching acquire on the graphics queue.
+	//not thread safe, call it from the render thread only
+	class AsyncUploader {
+	public:
+		void init(VkDevice device, VmaAllocator allocator, VkQueue transferQueue, uint32_t transferFamily, uint32_t graphicsFamily);
+
+		void cleanup();
+
+		//copies size bytes from the staging buffer into dst. The uploader owns the staging buffer from now on
+		UploadHandle upload_buffer(const AllocatedBufferUntyped& stagingBuffer, VkDeviceSize srcOffset, const AllocatedBufferUntyped& dst, VkDeviceSize dstOffset, VkDeviceSize size);
+
+		//copies every mip of a staged texture into the image, leaving it ready for sampling. The uploader owns the staging buffer from now on
+		UploadHandle upload_image(const StagedImage& image, const AllocatedImage& dst);
+
+		//submits everything recorded since the last flush
+		void flush();
+
+		//reads the timeline semaphore and releases the resources of the finished uploads
+		void poll();
+
+		bool is_finished(UploadHandle handle) const { return handle.timelineValue <= completedValue; }
+
+		//blocks until the upload is finished, flushing it first if needed
+		void wait(UploadHandle handle);
+
+		//records the ownership acquire of every upload that finished since the last call.
+		//returns false when there was nothing to acquire, otherwise the submit of cmd must wait on get_semaphore() for get_acquire_value()
+		bool record_acquires(VkCommandBuffer cmd);
+
+		VkSemaphore get_semaphore() const { return timeline; }
+		uint64_t get_acquire_value() const { return acquireValue; }
+
+		size_t pending_uploads() const { return inFlight.size() + (recording ? 1 : 0); }
+
+	private:
+		struct Submission {
+			uint64_t timelineValue;
+			VkCommandBuffer cmd;
+			std::vector<AllocatedBufferUntyped> stagingBuffers;
+			std::vector<VkBufferMemoryBarrier> bufferAcquires;
+			std::vector<VkImageMemoryBarrier> imageAcquires;
+		};
+
+		//command buffer that the next upload gets recorded into
+		Submission& get_recording();
+
+		bool needs_ownership_transfer() const { return transferQueueFamily != graphicsQueueFamily; }
+
+		VkDevice device;
+		VmaAllocator allocator;
+		VkQueue queue;
+		uint32_t transferQueueFamily;
+		uint32_t graphicsQueueFamily;
+
+		VkCommandPool commandPool;
+		VkSemaphore timeline;
+
+		//value the next flush will signal
+		uint64_t nextValue{ 1 };
+		uint64_t completedValue{ 0 };
+		uint64_t acquireValue{ 0 };
+		bool acquireReady{ false };
+
+		bool recording{ false };
+		Submission current;
+		std::vector<Submission> inFlight;
+
+		std::vector<VkBufferMemoryBarrier> pendingBufferAcquires;
+		std::vector<VkImageMemoryBarrier> pendingImageAcquires;
+	};
+}
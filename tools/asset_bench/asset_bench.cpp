@@ -0,0 +1,185 @@
+#include <asset_loader.h>
+#include <mesh_asset.h>
+#include <texture_asset.h>
+#include <material_asset.h>
+#include <prefab_asset.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <map>
+
+namespace fs = std::filesystem;
+
+//metadata of one asset, stored in both file versions so the parsers can be compared on the same data
+struct BenchAsset {
+	std::string json;
+	std::string binary;
+	std::vector<char> blob;
+};
+
+struct BenchType {
+	std::vector<BenchAsset> assets;
+	std::function<void(int version, const BenchAsset& asset)> parse;
+};
+
+double time_parse(const BenchType& type, int version, int iterations)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < iterations; i++)
+	{
+		for (auto& asset : type.assets)
+		{
+			type.parse(version, asset);
+		}
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+void add_asset(std::map<std::string, BenchType>& types, const std::string& type, BenchAsset asset)
+{
+	types[type].assets.push_back(std::move(asset));
+}
+
+//builds a synthetic prefab shaped like the big city exports
+assets::PrefabInfo make_prefab(uint32_t nodeCount)
+{
+	//every building hangs off the first node, and draws one of 512 meshes
+	assets::PrefabInfo info;
+	for (uint32_t i = 0; i < std::min(nodeCount, 512u); i++)
+	{
+		info.meshes.push_back({ "CITY/materials/building_" + std::to_string(i % 64) + ".mat", "CITY/meshes/building_" + std::to_string(i) + ".mesh" });
+	}
+
+	for (uint32_t i = 0; i < nodeCount; i++)
+	{
+		info.nodes.push_back({ i > 0 ? 0 : -1, static_cast<uint32_t>(info.matrices.size()), static_cast<int32_t>(i % 512) });
+		info.matrices.push_back({ 1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1 });
+		info.node_names.push_back("SM_Building_" + std::to_string(i));
+	}
+	return info;
+}
+
+void add_synthetic_assets(std::map<std::string, BenchType>& types)
+{
+	assets::MeshInfo mesh{};
+	mesh.vertexBuferSize = 1 << 20;
+	mesh.indexBuferSize = 1 << 18;
+	mesh.vertexFormat = assets::VertexFormat::P32N8C8V16;
+	mesh.indexSize = 4;
+	mesh.compressionMode = assets::CompressionMode::LZ4;
+	mesh.originalFile = "CITY/meshes/building.fbx";
+	add_asset(types, "MESH", { assets::write_mesh_metadata(&mesh, assets::ASSET_VERSION_JSON), assets::write_mesh_metadata(&mesh, assets::ASSET_VERSION_BINARY) });
+
+	assets::TextureInfo texture{};
+	texture.textureFormat = assets::TextureFormat::RGBA8;
+	texture.compressionMode = assets::CompressionMode::LZ4;
+	texture.originalFile = "Sponza/textures/lion.png";
+	for (uint32_t size = 4096; size >= 1; size /= 2)
+	{
+		texture.pages.push_back({ size, size, size * size * 2, size * size * 4 });
+		texture.textureSize += size * size * 4;
+	}
+	add_asset(types, "TEXI", { assets::write_texture_metadata(&texture, assets::ASSET_VERSION_JSON), assets::write_texture_metadata(&texture, assets::ASSET_VERSION_BINARY) });
+
+	assets::MaterialInfo material{};
+	material.baseEffect = "defaultPBR";
+	material.textures["baseColor"] = "Sponza/textures/lion.tx";
+	material.textures["normals"] = "Sponza/textures/lion_normal.tx";
+	material.transparency = assets::TransparencyMode::Opaque;
+	add_asset(types, "MATX", { assets::write_material_metadata(&material, assets::ASSET_VERSION_JSON), assets::write_material_metadata(&material, assets::ASSET_VERSION_BINARY) });
+
+	assets::PrefabInfo prefab = make_prefab(20000);
+	BenchAsset prefabAsset{ assets::write_prefab_metadata(prefab, assets::ASSET_VERSION_JSON), assets::write_prefab_metadata(prefab, assets::ASSET_VERSION_BINARY) };
+	prefabAsset.blob.resize(prefab.matrices.size() * sizeof(float) * 16);
+	memcpy(prefabAsset.blob.data(), prefab.matrices.data(), prefabAsset.blob.size());
+	add_asset(types, "PRFB", std::move(prefabAsset));
+}
+
+void add_folder_assets(std::map<std::string, BenchType>& types, const fs::path& directory)
+{
+	for (auto& p : fs::recursive_directory_iterator(directory))
+	{
+		if (!p.is_regular_file()) continue;
+
+		assets::MappedAssetFile file;
+		if (!assets::map_binaryfile(p.path().string().c_str(), file)) continue;
+
+		std::string type{ file.type, 4 };
+		if (type == "MESH")
+		{
+			auto info = assets::read_mesh_info(&file);
+			add_asset(types, type, { assets::write_mesh_metadata(&info, assets::ASSET_VERSION_JSON), assets::write_mesh_metadata(&info, assets::ASSET_VERSION_BINARY) });
+		}
+		else if (type == "TEXI")
+		{
+			auto info = assets::read_texture_info(&file);
+			add_asset(types, type, { assets::write_texture_metadata(&info, assets::ASSET_VERSION_JSON), assets::write_texture_metadata(&info, assets::ASSET_VERSION_BINARY) });
+		}
+		else if (type == "MATX")
+		{
+			auto info = assets::read_material_info(&file);
+			add_asset(types, type, { assets::write_material_metadata(&info, assets::ASSET_VERSION_JSON), assets::write_material_metadata(&info, assets::ASSET_VERSION_BINARY) });
+		}
+		else if (type == "PRFB")
+		{
+			auto info = assets::read_prefab_info(&file);
+			BenchAsset asset{ assets::write_prefab_metadata(info, assets::ASSET_VERSION_JSON), assets::write_prefab_metadata(info, assets::ASSET_VERSION_BINARY) };
+			asset.blob.assign(file.binaryBlob, file.binaryBlob + file.binaryBlobSize);
+			add_asset(types, type, std::move(asset));
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::map<std::string, BenchType> types;
+
+	if (argc > 1)
+	{
+		std::cout << "Benchmarking metadata of the assets in " << argv[1] << std::endl;
+		add_folder_assets(types, argv[1]);
+	}
+	else
+	{
+		std::cout << "Benchmarking synthetic metadata, pass an asset folder to use real assets" << std::endl;
+		add_synthetic_assets(types);
+	}
+
+	auto metadata = [](int version, const BenchAsset& asset) -> std::string_view {
+		return version == assets::ASSET_VERSION_JSON ? asset.json : asset.binary;
+	};
+
+	types["MESH"].parse = [&](int version, const BenchAsset& asset) { assets::read_mesh_info(version, metadata(version, asset)); };
+	types["TEXI"].parse = [&](int version, const BenchAsset& asset) { assets::read_texture_info(version, metadata(version, asset)); };
+	types["MATX"].parse = [&](int version, const BenchAsset& asset) { assets::read_material_info(version, metadata(version, asset)); };
+	types["PRFB"].parse = [&](int version, const BenchAsset& asset) { assets::read_prefab_info(version, metadata(version, asset), asset.blob.data(), asset.blob.size()); };
+
+	const int iterations = 20;
+
+	for (auto& [name, type] : types)
+	{
+		if (type.assets.empty()) continue;
+
+		size_t jsonBytes = 0;
+		size_t binaryBytes = 0;
+		for (auto& asset : type.assets)
+		{
+			jsonBytes += asset.json.size();
+			binaryBytes += asset.binary.size();
+		}
+
+		double jsonTime = time_parse(type, assets::ASSET_VERSION_JSON, iterations);
+		double binaryTime = time_parse(type, assets::ASSET_VERSION_BINARY, iterations);
+
+		std::cout << name << ": " << type.assets.size() << " assets" << std::endl;
+		std::cout << "    json   " << jsonTime << " ms, " << jsonBytes << " bytes" << std::endl;
+		std::cout << "    binary " << binaryTime << " ms, " << binaryBytes << " bytes, " << (binaryTime > 0 ? jsonTime / binaryTime : 0) << "x faster" << std::endl;
+	}
+
+	return 0;
+}
@@ -0,0 +1,69 @@
+#include <asset_loader.h>
+#include <asset_archive.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+bool is_packed_type(const char type[4])
+{
+	const char* types[] = { "MESH", "TEXI", "MATX", "PRFB", "DICT" };
+	for (const char* t : types)
+	{
+		if (memcmp(type, t, 4) == 0) return true;
+	}
+	return false;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3)
+	{
+		std::cout << "Usage: asset_packer <asset folder> <output archive>" << std::endl;
+		return -1;
+	}
+
+	fs::path directory{ argv[1] };
+	fs::path output{ argv[2] };
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	std::vector<assets::ArchiveInput> inputs;
+	for (auto& p : fs::recursive_directory_iterator(directory))
+	{
+		if (!p.is_regular_file() || p.path() == output) continue;
+
+		//only pack files that carry a known asset header
+		assets::MappedAssetFile file;
+		if (!assets::map_binaryfile(p.path().string().c_str(), file) || !is_packed_type(file.type))
+		{
+			continue;
+		}
+
+		assets::ArchiveInput input;
+		input.path = p.path().lexically_relative(directory).generic_string();
+		input.sourceFile = p.path().string();
+		inputs.push_back(input);
+	}
+
+	//sort by path so that assets in the same folder end up next to each other
+	std::sort(inputs.begin(), inputs.end(), [](const assets::ArchiveInput& a, const assets::ArchiveInput& b) {
+		return a.path < b.path;
+	});
+
+	if (!assets::save_archive(output.string().c_str(), inputs))
+	{
+		std::cout << "Failed to write archive " << output << std::endl;
+		return -1;
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	auto diff = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
+
+	std::cout << "Packed " << inputs.size() << " assets into " << output << " in " << diff.count() << "ms" << std::endl;
+	return 0;
+}
@@ -0,0 +1,319 @@
+#include "asset_converter.h"
+
+#include <material_asset.h>
+#include <mesh_asset.h>
+#include <prefab_asset.h>
+#include <texture_asset.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <tiny_obj_loader.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <tuple>
+
+namespace fs = std::filesystem;
+
+namespace {
+	//files convert in parallel, two of them can share an output folder
+	void create_parent_folder(const fs::path& path)
+	{
+		std::error_code error;
+		fs::create_directories(path.parent_path(), error);
+	}
+
+	//material names end up in file names
+	std::string sanitize_name(const std::string& name)
+	{
+		std::string result = name;
+		for (char& c : result)
+		{
+			if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_' && c != '-') c = '_';
+		}
+		return result;
+	}
+
+	//mtl files written on windows use backslashes
+	fs::path mtl_path(const std::string& name)
+	{
+		std::string path = name;
+		std::replace(path.begin(), path.end(), '\\', '/');
+		return fs::path{ path };
+	}
+
+	//faces of one material, indexed into their own vertices
+	struct MeshGroup {
+		std::vector<assets::Vertex_f32_PNCV> vertices;
+		std::vector<uint32_t> indices;
+		//obj attribute indices to the vertex they became
+		std::map<std::tuple<int, int, int>, uint32_t> vertexLookup;
+	};
+
+	bool write_mesh(const fs::path& source, const fs::path& destination, MeshGroup& group)
+	{
+		assets::MeshInfo info;
+		info.vertexFormat = assets::VertexFormat::PNCV_F32;
+		info.vertexBuferSize = group.vertices.size() * sizeof(assets::Vertex_f32_PNCV);
+		info.indexBuferSize = group.indices.size() * sizeof(uint32_t);
+		info.indexSize = sizeof(uint32_t);
+		info.compressionMode = assets::CompressionMode::LZ4;
+		info.originalFile = source.string();
+		info.bounds = assets::calculateBounds(group.vertices.data(), group.vertices.size());
+
+		create_parent_folder(destination);
+		assets::AssetFile file = assets::pack_mesh(&info, (char*)group.vertices.data(), (char*)group.indices.data());
+		return assets::save_binaryfile(destination.string().c_str(), file);
+	}
+}
+
+bool baker::is_source_image(const fs::path& path)
+{
+	std::string extension = path.extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+	return extension == ".png" || extension == ".jpg" || extension == ".jpeg" || extension == ".tga";
+}
+
+std::string baker::converted_path(const fs::path& sourceRoot, const fs::path& source, const char* extension)
+{
+	return source.lexically_normal().lexically_relative(sourceRoot.lexically_normal()).replace_extension(extension).generic_string();
+}
+
+std::vector<fs::path> baker::find_obj_dependencies(const fs::path& source)
+{
+	std::vector<fs::path> dependencies;
+
+	std::ifstream file(source);
+	std::string line;
+	while (std::getline(file, line))
+	{
+		if (line.compare(0, 7, "mtllib ") != 0) continue;
+
+		std::istringstream names(line.substr(7));
+		std::string name;
+		while (names >> name)
+		{
+			fs::path mtl = source.parent_path() / mtl_path(name);
+			if (fs::exists(mtl))
+			{
+				dependencies.push_back(mtl);
+			}
+		}
+	}
+	return dependencies;
+}
+
+bool baker::convert_image(const fs::path& source, const fs::path& destination)
+{
+	int width, height, channels;
+	stbi_uc* pixels = stbi_load(source.string().c_str(), &width, &height, &channels, STBI_rgb_alpha);
+	if (!pixels) return false;
+
+	assets::TextureInfo info;
+	info.textureSize = uint64_t(width) * height * 4;
+	info.textureFormat = assets::TextureFormat::RGBA8;
+	info.compressionMode = assets::CompressionMode::LZ4;
+	info.originalFile = source.string();
+
+	assets::PageInfo page{};
+	page.width = width;
+	page.height = height;
+	page.originalSize = static_cast<uint32_t>(info.textureSize);
+	info.pages.push_back(page);
+
+	assets::AssetFile file = assets::pack_texture(&info, pixels);
+	stbi_image_free(pixels);
+
+	create_parent_folder(destination);
+	return assets::save_binaryfile(destination.string().c_str(), file);
+}
+
+bool baker::convert_obj(const fs::path& sourceRoot, const fs::path& source, const fs::path& outputRoot,
+	std::vector<std::string>& outputs, std::ostream& log)
+{
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string warn;
+	std::string err;
+
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, source.string().c_str(), source.parent_path().string().c_str()))
+	{
+		log << source.string() << ": " << err << std::endl;
+		return false;
+	}
+
+	//faces without a material share a group of their own, keyed -1
+	std::map<int, MeshGroup> groups;
+	size_t triangleCount = 0;
+	for (const tinyobj::shape_t& shape : shapes)
+	{
+		size_t indexOffset = 0;
+		for (size_t f = 0; f < shape.mesh.num_face_vertices.size(); f++)
+		{
+			size_t faceVertices = shape.mesh.num_face_vertices[f];
+			const tinyobj::index_t* face = &shape.mesh.indices[indexOffset];
+			indexOffset += faceVertices;
+
+			//polygons the loader could not triangulate
+			if (faceVertices != 3) continue;
+
+			int materialId = shape.mesh.material_ids.empty() ? -1 : shape.mesh.material_ids[f];
+			MeshGroup& group = groups[materialId];
+
+			//faces without normals get a flat one, so their vertices are not shared with other faces
+			float faceNormal[3] = { 0.f, 0.f, 1.f };
+			if (face[0].normal_index < 0 || face[1].normal_index < 0 || face[2].normal_index < 0)
+			{
+				const float* p0 = &attrib.vertices[3 * size_t(face[0].vertex_index)];
+				const float* p1 = &attrib.vertices[3 * size_t(face[1].vertex_index)];
+				const float* p2 = &attrib.vertices[3 * size_t(face[2].vertex_index)];
+				float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+				float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+				float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+				float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+				if (length > 0.f)
+				{
+					faceNormal[0] = n[0] / length;
+					faceNormal[1] = n[1] / length;
+					faceNormal[2] = n[2] / length;
+				}
+			}
+
+			for (int v = 0; v < 3; v++)
+			{
+				const tinyobj::index_t& idx = face[v];
+
+				//flat normals are told apart by the face they belong to
+				int normalKey = idx.normal_index >= 0 ? idx.normal_index : -1 - static_cast<int>(triangleCount);
+				auto key = std::make_tuple(idx.vertex_index, normalKey, idx.texcoord_index);
+
+				auto found = group.vertexLookup.find(key);
+				if (found != group.vertexLookup.end())
+				{
+					group.indices.push_back(found->second);
+					continue;
+				}
+
+				assets::Vertex_f32_PNCV vertex{};
+				memcpy(vertex.position, &attrib.vertices[3 * size_t(idx.vertex_index)], sizeof(vertex.position));
+				if (idx.normal_index >= 0)
+				{
+					memcpy(vertex.normal, &attrib.normals[3 * size_t(idx.normal_index)], sizeof(vertex.normal));
+				}
+				else
+				{
+					memcpy(vertex.normal, faceNormal, sizeof(vertex.normal));
+				}
+				if (attrib.colors.size() >= attrib.vertices.size())
+				{
+					memcpy(vertex.color, &attrib.colors[3 * size_t(idx.vertex_index)], sizeof(vertex.color));
+				}
+				else
+				{
+					vertex.color[0] = vertex.color[1] = vertex.color[2] = 1.f;
+				}
+				if (idx.texcoord_index >= 0)
+				{
+					//obj uvs start at the bottom of the image, vulkan ones at the top
+					vertex.uv[0] = attrib.texcoords[2 * size_t(idx.texcoord_index)];
+					vertex.uv[1] = 1.f - attrib.texcoords[2 * size_t(idx.texcoord_index) + 1];
+				}
+
+				uint32_t index = static_cast<uint32_t>(group.vertices.size());
+				group.vertices.push_back(vertex);
+				group.vertexLookup[key] = index;
+				group.indices.push_back(index);
+			}
+			triangleCount++;
+		}
+	}
+
+	if (groups.empty())
+	{
+		log << source.string() << ": no triangles" << std::endl;
+		return false;
+	}
+
+	const std::string stem = converted_path(sourceRoot, source, "");
+	const fs::path sourceFolder = source.parent_path();
+
+	//single identity matrix, every node sits at the origin of the prefab
+	assets::PrefabInfo prefab;
+	prefab.matrices.push_back({ 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f });
+
+	for (auto& [materialId, group] : groups)
+	{
+		group.vertexLookup.clear();
+
+		std::string name = materialId >= 0 ? sanitize_name(materials[materialId].name) : "default";
+		std::string meshPath = stem + "_" + name + ".mesh";
+		std::string materialPath = stem + "_" + name + ".mat";
+
+		if (!write_mesh(source, outputRoot / meshPath, group))
+		{
+			log << "Failed to write " << meshPath << std::endl;
+			return false;
+		}
+		outputs.push_back(meshPath);
+
+		assets::MaterialInfo material;
+		material.baseEffect = "defaultPBR";
+		material.transparency = assets::TransparencyMode::Opaque;
+		if (materialId >= 0)
+		{
+			const tinyobj::material_t& mtl = materials[materialId];
+
+			//texture paths in the mtl are relative to the obj, in the material to the asset folder
+			if (!mtl.diffuse_texname.empty())
+			{
+				material.textures["baseColor"] = converted_path(sourceRoot, sourceFolder / mtl_path(mtl.diffuse_texname), ".tx");
+			}
+			const std::string& normalTexture = !mtl.normal_texname.empty() ? mtl.normal_texname : mtl.bump_texname;
+			if (!normalTexture.empty())
+			{
+				material.textures["normals"] = converted_path(sourceRoot, sourceFolder / mtl_path(normalTexture), ".tx");
+			}
+
+			if (!mtl.alpha_texname.empty())
+			{
+				material.transparency = assets::TransparencyMode::Masked;
+			}
+			else if (mtl.dissolve < 1.f)
+			{
+				material.transparency = assets::TransparencyMode::Transparent;
+			}
+		}
+
+		assets::AssetFile materialFile = assets::pack_material(&material);
+		if (!assets::save_binaryfile((outputRoot / materialPath).string().c_str(), materialFile))
+		{
+			log << "Failed to write " << materialPath << std::endl;
+			return false;
+		}
+		outputs.push_back(materialPath);
+
+		prefab.nodes.push_back({ -1, 0, static_cast<int32_t>(prefab.meshes.size()) });
+		prefab.node_names.push_back(name);
+		prefab.meshes.push_back({ materialPath, meshPath });
+	}
+
+	std::string prefabPath = stem + ".pfb";
+	assets::AssetFile prefabFile = assets::pack_prefab(prefab);
+	if (!assets::save_binaryfile((outputRoot / prefabPath).string().c_str(), prefabFile))
+	{
+		log << "Failed to write " << prefabPath << std::endl;
+		return false;
+	}
+	outputs.push_back(prefabPath);
+
+	log << source.string() << ": " << triangleCount << " triangles, " << groups.size() << " materials" << std::endl;
+	return true;
+}
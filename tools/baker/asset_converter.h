@@ -0,0 +1,26 @@
+#pragma once
+
+#include <filesystem>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace baker {
+
+	//true for the image files convert_image reads
+	bool is_source_image(const std::filesystem::path& path);
+
+	//asset path the converter writes for a source file: its path under the source root, with the asset extension
+	std::string converted_path(const std::filesystem::path& sourceRoot, const std::filesystem::path& source, const char* extension);
+
+	//mtl files an obj pulls its materials from, the ones that exist on disk
+	std::vector<std::filesystem::path> find_obj_dependencies(const std::filesystem::path& source);
+
+	//decodes an image into a single RGBA8 page .tx, mips and block compression are left to the texture bake
+	bool convert_image(const std::filesystem::path& source, const std::filesystem::path& destination);
+
+	//converts an obj into a .mesh and a .mat for every material its faces use, and a .pfb placing all of them.
+	//the outputs mirror the folders of the source root under the output root, their relative paths are appended to outputs
+	bool convert_obj(const std::filesystem::path& sourceRoot, const std::filesystem::path& source, const std::filesystem::path& outputRoot,
+		std::vector<std::string>& outputs, std::ostream& log);
+}
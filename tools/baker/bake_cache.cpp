@@ -0,0 +1,145 @@
+#include "bake_cache.h"
+
+#include <nlohmann/json.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+namespace {
+	//the manifest is rewritten from scratch when the layout changes
+	constexpr int MANIFEST_VERSION = 1;
+
+	constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+	constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+
+	inline uint64_t rotate_left(uint64_t value, int bits)
+	{
+		return (value << bits) | (value >> (64 - bits));
+	}
+
+	inline uint64_t mix(uint64_t hash, uint64_t value)
+	{
+		return rotate_left(hash ^ (value * PRIME2), 31) * PRIME1;
+	}
+
+	std::string to_hex(uint64_t value)
+	{
+		char buffer[17];
+		snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(value));
+		return buffer;
+	}
+}
+
+uint64_t baker::hash_bytes(const void* data, size_t size, uint64_t seed)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	uint64_t hash = seed ^ (size * PRIME1);
+
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, bytes + i, sizeof(word));
+		hash = mix(hash, word);
+	}
+
+	uint64_t tail = 0;
+	memcpy(&tail, bytes + i, size - i);
+	hash = mix(hash, tail);
+
+	//final avalanche, so inputs that differ in a single bit spread over the whole hash
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	return hash;
+}
+
+bool baker::hash_file(const fs::path& path, uint64_t& hash)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open()) return false;
+
+	std::vector<char> contents(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(contents.data(), contents.size());
+	if (!file) return false;
+
+	hash = hash_bytes(contents.data(), contents.size(), hash);
+	return true;
+}
+
+void baker::BakeCache::load(const fs::path& manifestPath)
+{
+	_entries.clear();
+
+	std::ifstream file(manifestPath);
+	if (!file.is_open()) return;
+
+	nlohmann::json manifest = nlohmann::json::parse(file, nullptr, false);
+	if (manifest.is_discarded() || manifest.value("version", 0) != MANIFEST_VERSION) return;
+
+	for (auto& [source, entry] : manifest["sources"].items())
+	{
+		Entry loaded;
+		loaded.hash = std::stoull(entry["hash"].get<std::string>(), nullptr, 16);
+		loaded.outputs = entry["outputs"].get<std::vector<std::string>>();
+		_entries[source] = std::move(loaded);
+	}
+}
+
+bool baker::BakeCache::save(const fs::path& manifestPath) const
+{
+	nlohmann::json sources = nlohmann::json::object();
+	for (auto& [source, entry] : _entries)
+	{
+		sources[source] = { {"hash", to_hex(entry.hash)}, {"outputs", entry.outputs} };
+	}
+
+	nlohmann::json manifest;
+	manifest["version"] = MANIFEST_VERSION;
+	manifest["sources"] = std::move(sources);
+
+	std::ofstream file(manifestPath);
+	if (!file.is_open()) return false;
+
+	file << manifest.dump(1, '\t');
+	return file.good();
+}
+
+bool baker::BakeCache::is_up_to_date(const std::string& source, uint64_t hash, const fs::path& outputRoot) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	auto it = _entries.find(source);
+	if (it == _entries.end() || it->second.hash != hash) return false;
+
+	for (const std::string& output : it->second.outputs)
+	{
+		if (!fs::exists(outputRoot / output)) return false;
+	}
+	return true;
+}
+
+void baker::BakeCache::update(const std::string& source, uint64_t hash, std::vector<std::string> outputs)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_entries[source] = { hash, std::move(outputs) };
+}
+
+void baker::BakeCache::prune(const std::unordered_set<std::string>& sources)
+{
+	for (auto it = _entries.begin(); it != _entries.end();)
+	{
+		if (sources.count(it->first) == 0)
+		{
+			it = _entries.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
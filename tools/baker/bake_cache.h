@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace baker {
+
+	//64 bit hash of a byte range, 8 bytes per step. Chains when the previous hash is passed as the seed
+	uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0);
+
+	//chains the whole contents of the file into the hash, false when it can't be read
+	bool hash_file(const std::filesystem::path& path, uint64_t& hash);
+
+	//manifest of the sources a previous run converted, so the ones that did not change can be skipped.
+	//sources and outputs are relative paths, the hash covers the source contents and everything that changes its outputs
+	class BakeCache {
+	public:
+		//a missing or unreadable manifest leaves the cache empty, which converts everything
+		void load(const std::filesystem::path& manifestPath);
+
+		bool save(const std::filesystem::path& manifestPath) const;
+
+		//true when the source was converted with the same hash and every output it wrote is still there
+		bool is_up_to_date(const std::string& source, uint64_t hash, const std::filesystem::path& outputRoot) const;
+
+		//safe to call from several threads
+		void update(const std::string& source, uint64_t hash, std::vector<std::string> outputs);
+
+		//drops the sources that are not in the set anymore, their outputs stay on disk
+		void prune(const std::unordered_set<std::string>& sources);
+
+	private:
+		struct Entry {
+			uint64_t hash;
+			std::vector<std::string> outputs;
+		};
+
+		std::unordered_map<std::string, Entry> _entries;
+		mutable std::mutex _mutex;
+	};
+}
@@ -0,0 +1,969 @@
+#include <asset_compression.h>
+#include <asset_loader.h>
+#include <material_asset.h>
+#include <mesh_asset.h>
+#include <prefab_asset.h>
+#include <texture_asset.h>
+#include <thread_pool.h>
+
+#include "asset_converter.h"
+#include "bake_cache.h"
+#include "mesh_optimizer.h"
+#include "mip_generator.h"
+#include "texture_compressor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+struct BakeOptions {
+	bool overdraw{ false };
+	bool quantize{ false };
+	bool index16{ true };
+	bool dryRun{ false };
+	//levels of detail to write, including the original one
+	uint32_t lodLevels{ 1 };
+	bool clusters{ false };
+	uint32_t cacheSize{ baker::DEFAULT_CACHE_SIZE };
+	float overdrawThreshold{ 1.05f };
+	//rebuild the mip chain of RGBA8 textures from their top level
+	bool mips{ false };
+	baker::MipFilter mipFilter{ baker::MipFilter::Kaiser };
+	//block compress RGBA8 textures
+	bool textures{ false };
+	//color textures go to BC7 even when they are opaque, instead of BC1
+	bool colorBC7{ false };
+	//color textures with alpha go to BC3 instead of BC7, which encodes faster
+	bool alphaBC3{ false };
+	//converts the obj and image sources of the input folder into assets here, instead of baking assets in place
+	fs::path exportFolder;
+	//converts every source, even the ones the manifest has as up to date
+	bool force{ false };
+	//codecs of the mesh and texture blobs, LZ4 is what decodes fastest
+	assets::CompressionSettings meshCompression;
+	assets::CompressionSettings textureCompression;
+	//textures get repacked with their codec even when nothing else about them changes
+	bool recompressTextures{ false };
+	//trains a dictionary on the materials and prefabs of the folder and compresses their metadata with it
+	bool dictionary{ false };
+};
+
+struct BakeTotals {
+	size_t meshes{ 0 };
+	size_t triangles{ 0 };
+	size_t transformedBefore{ 0 };
+	size_t transformedAfter{ 0 };
+
+	size_t textures{ 0 };
+	uint64_t textureBytesBefore{ 0 };
+	uint64_t textureBytesAfter{ 0 };
+
+	size_t converted{ 0 };
+	size_t upToDate{ 0 };
+};
+
+//how the materials sample a texture, which decides its block format and how its mips are filtered.
+//ordered by priority, a texture used in several slots is baked for the last of them
+enum class TextureUsage {
+	Normal,
+	Color,
+	MaskedColor //color of an alpha tested material
+};
+
+//files bake in parallel, their log lines and the totals go through this
+std::mutex bakeMutex;
+
+//written to the export folder, keyed by source path relative to the input folder
+constexpr const char* MANIFEST_NAME = "bake_manifest.json";
+
+//at the root of the asset folder, where the engine loads it from
+constexpr const char* DICTIONARY_NAME = "metadata.dict";
+
+//metadata blocks are a few hundred bytes, a dictionary much larger than all of them together stops paying off
+constexpr size_t DICTIONARY_CAPACITY = 16 * 1024;
+
+//the blocks are tiny, so even the slowest level compresses them in no time
+constexpr int METADATA_COMPRESSION_LEVEL = 19;
+
+//the engine draws up to this many levels of detail per mesh
+constexpr uint32_t MAX_LOD_LEVELS = 4;
+
+//cluster size limits, small enough to cull well while keeping the draw count of a visible mesh low
+constexpr size_t MAX_CLUSTER_VERTICES = 64;
+constexpr size_t MAX_CLUSTER_TRIANGLES = 124;
+
+void print_stats(std::ostream& log, const char* label, const baker::VertexCacheStats& stats)
+{
+	log << "    " << label << " ACMR " << stats.acmr << ", ATVR " << stats.atvr << std::endl;
+}
+
+//appends simplified levels after the cache optimized original one, which is the first lod
+void build_lods(std::vector<uint32_t>& indices, const char* vertices, size_t vertexCount, size_t vertexStride, const BakeOptions& options, std::vector<assets::MeshLod>& lods)
+{
+	const size_t baseCount = indices.size();
+	lods.assign(1, { 0, static_cast<uint32_t>(baseCount) });
+
+	//the vertex count of a surface grows with the square of the grid resolution, every level halves it
+	uint32_t gridSize = static_cast<uint32_t>(std::sqrt(double(vertexCount)));
+	size_t previousCount = baseCount;
+
+	std::vector<uint32_t> simplified(baseCount);
+	std::vector<uint32_t> clusterStarts;
+	while (lods.size() < options.lodLevels)
+	{
+		gridSize /= 2;
+		if (gridSize < 2) break;
+
+		//every level starts from the original, the halved grids nest so the levels stay consistent
+		size_t count = baker::simplify_clustered(simplified.data(), indices.data(), baseCount, vertices, vertexCount, vertexStride, gridSize);
+		if (count == 0) break;
+
+		//a level that barely removes triangles is not worth its index memory, try a coarser grid
+		if (count > previousCount * 3 / 4) continue;
+
+		baker::optimize_vertex_cache(simplified.data(), simplified.data(), count, vertexCount, options.cacheSize, clusterStarts);
+
+		lods.push_back({ static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(count) });
+		indices.insert(indices.end(), simplified.begin(), simplified.begin() + count);
+		previousCount = count;
+	}
+}
+
+bool bake_mesh(const fs::path& path, const BakeOptions& options, BakeTotals& totals)
+{
+	assets::MeshInfo info;
+	std::vector<char> vertices;
+	std::vector<uint32_t> indices;
+	{
+		//the mapping has to be gone before the file gets rewritten
+		assets::MappedAssetFile file;
+		if (!assets::map_binaryfile(path.string().c_str(), file) || memcmp(file.type, "MESH", 4) != 0)
+		{
+			return false;
+		}
+
+		info = assets::read_mesh_info(&file);
+		if (info.indexSize != sizeof(uint16_t) && info.indexSize != sizeof(uint32_t))
+		{
+			std::lock_guard<std::mutex> lock(bakeMutex);
+			std::cout << "Skipping " << path << ", unsupported index size" << std::endl;
+			return false;
+		}
+
+		//the optimizations work on 32 bit indices, 16 bit ones get widened here
+		vertices.resize(info.vertexBuferSize);
+		indices.resize(info.indexBuferSize / info.indexSize);
+		if (!assets::unpack_mesh(&info, file.binaryBlob, file.binaryBlobSize, vertices.data(), (char*)indices.data()))
+		{
+			std::lock_guard<std::mutex> lock(bakeMutex);
+			std::cout << "Skipping " << path << ", corrupted mesh data" << std::endl;
+			return false;
+		}
+		if (info.indexSize == sizeof(uint16_t))
+		{
+			//backwards, so every index is read before the wider writes reach it
+			const char* narrow = (const char*)indices.data();
+			for (size_t i = indices.size(); i-- > 0;)
+			{
+				uint16_t index;
+				memcpy(&index, narrow + i * sizeof(uint16_t), sizeof(uint16_t));
+				indices[i] = index;
+			}
+		}
+
+		//lods get rebuilt from the most detailed level on every bake
+		if (!info.lods.empty())
+		{
+			indices.erase(indices.begin() + info.lods[0].firstIndex + info.lods[0].indexCount, indices.end());
+			indices.erase(indices.begin(), indices.begin() + info.lods[0].firstIndex);
+		}
+	}
+
+	size_t vertexStride = assets::vertex_format_size(info.vertexFormat);
+	if (vertexStride == 0)
+	{
+		std::lock_guard<std::mutex> lock(bakeMutex);
+		std::cout << "Skipping " << path << ", unknown vertex format" << std::endl;
+		return false;
+	}
+	size_t vertexCount = vertices.size() / vertexStride;
+
+	baker::VertexCacheStats before = baker::analyze_vertex_cache(indices.data(), indices.size(), vertexCount, options.cacheSize);
+
+	std::vector<uint32_t> clusterStarts;
+	baker::optimize_vertex_cache(indices.data(), indices.data(), indices.size(), vertexCount, options.cacheSize, clusterStarts);
+
+	//overdraw sorting reads float positions
+	if (options.overdraw && info.vertexFormat != assets::VertexFormat::P16N8C8V16)
+	{
+		baker::optimize_overdraw(indices.data(), indices.size(), vertices.data(), vertexCount, vertexStride, clusterStarts, options.cacheSize, options.overdrawThreshold);
+	}
+
+	//clustering reads float positions as well
+	std::vector<assets::MeshLod> lods;
+	if (options.lodLevels > 1 && info.vertexFormat != assets::VertexFormat::P16N8C8V16)
+	{
+		build_lods(indices, vertices.data(), vertexCount, vertexStride, options, lods);
+	}
+	else
+	{
+		lods.assign(1, { 0, static_cast<uint32_t>(indices.size()) });
+	}
+	const size_t baseIndexCount = lods[0].indexCount;
+
+	//every level shares the vertices, so the fetch order follows the original level first
+	size_t newVertexCount = baker::optimize_vertex_fetch(vertices.data(), indices.data(), indices.size(), vertexCount, vertexStride);
+
+	baker::VertexCacheStats after = baker::analyze_vertex_cache(indices.data(), baseIndexCount, newVertexCount, options.cacheSize);
+
+	//cluster bounds are computed from float positions, before quantization
+	std::vector<baker::Cluster> clusters;
+	if (options.clusters && info.vertexFormat != assets::VertexFormat::P16N8C8V16)
+	{
+		clusters = baker::build_clusters(indices.data(), baseIndexCount, vertices.data(), newVertexCount, vertexStride, MAX_CLUSTER_VERTICES, MAX_CLUSTER_TRIANGLES);
+	}
+
+	std::ostringstream log;
+	log << path.string() << ": " << baseIndexCount / 3 << " triangles, " << vertexCount << " vertices";
+	if (newVertexCount != vertexCount)
+	{
+		log << " (" << vertexCount - newVertexCount << " unused removed)";
+	}
+	log << std::endl;
+	for (size_t l = 1; l < lods.size(); l++)
+	{
+		log << "    lod " << l << ": " << lods[l].indexCount / 3 << " triangles" << std::endl;
+	}
+	if (!clusters.empty())
+	{
+		log << "    " << clusters.size() << " clusters" << std::endl;
+	}
+	print_stats(log, "before", before);
+	print_stats(log, "after ", after);
+
+	{
+		std::lock_guard<std::mutex> lock(bakeMutex);
+		std::cout << log.str();
+
+		totals.meshes++;
+		totals.triangles += baseIndexCount / 3;
+		totals.transformedBefore += before.verticesTransformed;
+		totals.transformedAfter += after.verticesTransformed;
+	}
+
+	if (options.dryRun) return true;
+
+	if (options.quantize && info.vertexFormat != assets::VertexFormat::P16N8C8V16)
+	{
+		//no format is smaller than the quantized one, so it converts in place
+		assets::quantize_vertices(info.vertexFormat, vertices.data(), newVertexCount, assets::get_position_quantization(info.bounds),
+			reinterpret_cast<assets::Vertex_P16N8C8V16*>(vertices.data()));
+
+		info.vertexFormat = assets::VertexFormat::P16N8C8V16;
+		vertexStride = sizeof(assets::Vertex_P16N8C8V16);
+	}
+
+	info.vertexBuferSize = newVertexCount * vertexStride;
+
+	//meshes addressable with 16 bits are stored with 16 bit indices, which the engine keeps all the way to the gpu
+	std::vector<uint16_t> indices16;
+	char* indexData = (char*)indices.data();
+	if (options.index16 && newVertexCount <= std::numeric_limits<uint16_t>::max() + size_t(1))
+	{
+		indices16.assign(indices.begin(), indices.end());
+		indexData = (char*)indices16.data();
+		info.indexSize = sizeof(uint16_t);
+	}
+	else
+	{
+		info.indexSize = sizeof(uint32_t);
+	}
+	info.indexBuferSize = indices.size() * info.indexSize;
+
+	if (lods.size() > 1)
+	{
+		info.lods = lods;
+	}
+	else
+	{
+		info.lods.clear();
+	}
+
+	//the index ranges of old clusters do not survive the reordering, they are only kept when rebuilt
+	info.clusters.clear();
+	for (const baker::Cluster& c : clusters)
+	{
+		assets::MeshCluster cluster;
+		cluster.firstIndex = c.firstIndex;
+		cluster.indexCount = c.indexCount;
+		memcpy(cluster.center, c.center, sizeof(cluster.center));
+		cluster.radius = c.radius;
+		memcpy(cluster.coneAxis, c.coneAxis, sizeof(cluster.coneAxis));
+		cluster.coneCutoff = c.coneCutoff;
+		info.clusters.push_back(cluster);
+	}
+
+	assets::AssetFile newFile = assets::pack_mesh(&info, vertices.data(), indexData, options.meshCompression);
+	if (!assets::save_binaryfile(path.string().c_str(), newFile))
+	{
+		std::lock_guard<std::mutex> lock(bakeMutex);
+		std::cout << "Failed to write " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//material slot names come from the converter, normal maps are the ones named after normals
+TextureUsage get_slot_usage(const std::string& slot, assets::TransparencyMode transparency)
+{
+	if (slot.find("normal") != std::string::npos) return TextureUsage::Normal;
+
+	return transparency == assets::TransparencyMode::Masked ? TextureUsage::MaskedColor : TextureUsage::Color;
+}
+
+//usage of every texture the materials under the asset folder reference, keyed by the normalized texture path
+std::unordered_map<std::string, TextureUsage> find_texture_usages(const fs::path& assetFolder)
+{
+	std::unordered_map<std::string, TextureUsage> usages;
+	for (auto& p : fs::recursive_directory_iterator(assetFolder))
+	{
+		if (!p.is_regular_file() || p.path().extension() != ".mat") continue;
+
+		assets::MappedAssetFile file;
+		if (!assets::map_binaryfile(p.path().string().c_str(), file) || memcmp(file.type, "MATX", 4) != 0) continue;
+
+		assets::MaterialInfo info = assets::read_material_info(&file);
+		for (auto& [slot, texture] : info.textures)
+		{
+			//texture paths in materials are relative to the asset folder
+			std::string key = (assetFolder / texture).lexically_normal().generic_string();
+
+			TextureUsage usage = get_slot_usage(slot, info.transparency);
+			auto it = usages.find(key);
+			if (it == usages.end() || usage > it->second)
+			{
+				usages[key] = usage;
+			}
+		}
+	}
+	return usages;
+}
+
+//replaces the pages with a chain generated from the first one
+void build_mip_chain(assets::TextureInfo& info, std::vector<uint8_t>& pixels, TextureUsage usage, const BakeOptions& options, ThreadPool& pool)
+{
+	baker::MipOptions mipOptions;
+	mipOptions.filter = options.mipFilter;
+	//normal maps hold vectors, not gamma encoded colors
+	mipOptions.srgb = usage != TextureUsage::Normal;
+	mipOptions.preserveCoverage = usage == TextureUsage::MaskedColor;
+
+	std::vector<baker::MipLevel> levels = baker::generate_mips(pixels.data(), info.pages[0].width, info.pages[0].height, mipOptions, pool);
+
+	pixels.clear();
+	info.pages.clear();
+	for (auto& level : levels)
+	{
+		assets::PageInfo page{};
+		page.width = level.width;
+		page.height = level.height;
+		page.originalSize = static_cast<uint32_t>(level.pixels.size());
+		page.originalOffset = pixels.size();
+		info.pages.push_back(page);
+
+		pixels.insert(pixels.end(), level.pixels.begin(), level.pixels.end());
+	}
+	info.textureSize = pixels.size();
+}
+
+//encodes every page into the block format the usage asks for
+void compress_texture_pages(assets::TextureInfo& info, std::vector<uint8_t>& pixels, TextureUsage usage, const BakeOptions& options, ThreadPool& pool)
+{
+	assets::TextureFormat format;
+	if (usage == TextureUsage::Normal)
+	{
+		format = assets::TextureFormat::BC5;
+	}
+	else if (baker::has_alpha(pixels.data(), size_t(info.pages[0].width) * info.pages[0].height))
+	{
+		format = options.alphaBC3 ? assets::TextureFormat::BC3 : assets::TextureFormat::BC7;
+	}
+	else
+	{
+		format = options.colorBC7 ? assets::TextureFormat::BC7 : assets::TextureFormat::BC1;
+	}
+
+	uint64_t compressedSize = 0;
+	for (auto& page : info.pages)
+	{
+		compressedSize += assets::texture_mip_size(format, page.width, page.height);
+	}
+
+	//every page is one mip, encoded straight into its place in the new texture
+	std::vector<uint8_t> blocks(compressedSize);
+	uint64_t offset = 0;
+	for (auto& page : info.pages)
+	{
+		uint64_t mipSize = assets::texture_mip_size(format, page.width, page.height);
+		baker::compress_texture(format, pixels.data() + page.originalOffset, page.width, page.height, blocks.data() + offset, pool);
+
+		page.originalSize = static_cast<uint32_t>(mipSize);
+		page.originalOffset = offset;
+		offset += mipSize;
+	}
+
+	info.textureFormat = format;
+	info.textureSize = compressedSize;
+	pixels = std::move(blocks);
+}
+
+bool bake_texture(const fs::path& path, TextureUsage usage, const BakeOptions& options, ThreadPool& pool, BakeTotals& totals)
+{
+	assets::TextureInfo info;
+	std::vector<uint8_t> pixels;
+	{
+		assets::MappedAssetFile file;
+		if (!assets::map_binaryfile(path.string().c_str(), file) || memcmp(file.type, "TEXI", 4) != 0)
+		{
+			return false;
+		}
+
+		info = assets::read_texture_info(&file);
+		if (info.pages.empty() || (info.textureFormat != assets::TextureFormat::RGBA8 && !options.recompressTextures))
+		{
+			//already compressed textures are not encoded twice, they only get a new codec
+			return false;
+		}
+
+		//pages too small to compress are stored raw, which only the per page unpack handles
+		pixels.resize(info.textureSize);
+		for (int i = 0; i < static_cast<int>(info.pages.size()); i++)
+		{
+			if (!assets::unpack_texture_page(&info, i, file.binaryBlob, (char*)pixels.data() + info.pages[i].originalOffset))
+			{
+				std::lock_guard<std::mutex> lock(bakeMutex);
+				std::cout << "Skipping " << path << ", corrupted texture data" << std::endl;
+				return false;
+			}
+		}
+	}
+
+	uint64_t originalSize = info.textureSize;
+
+	std::ostringstream log;
+	log << path.string() << ": " << info.pages[0].width << "x" << info.pages[0].height;
+
+	const bool rgba8 = info.textureFormat == assets::TextureFormat::RGBA8;
+	if (options.mips && rgba8)
+	{
+		build_mip_chain(info, pixels, usage, options, pool);
+		log << ", " << info.pages.size() << " " << baker::mip_filter_name(options.mipFilter) << " filtered mips";
+	}
+	else
+	{
+		log << ", " << info.pages.size() << " mips";
+	}
+
+	if (options.textures && rgba8)
+	{
+		compress_texture_pages(info, pixels, usage, options, pool);
+		log << ", " << assets::texture_format_name(info.textureFormat);
+	}
+	log << ", " << originalSize / 1024 << " KB -> " << info.textureSize / 1024 << " KB";
+	if (options.recompressTextures)
+	{
+		log << ", " << assets::compression_name(options.textureCompression.mode);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(bakeMutex);
+		std::cout << log.str() << std::endl;
+
+		totals.textures++;
+		totals.textureBytesBefore += originalSize;
+		totals.textureBytesAfter += info.textureSize;
+	}
+
+	if (options.dryRun) return true;
+
+	assets::AssetFile newFile = assets::pack_texture(&info, pixels.data(), options.textureCompression);
+	if (!assets::save_binaryfile(path.string().c_str(), newFile))
+	{
+		std::lock_guard<std::mutex> lock(bakeMutex);
+		std::cout << "Failed to write " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//hash seed of the options that change what a mesh bake writes
+uint64_t mesh_options_hash(const BakeOptions& options)
+{
+	std::ostringstream key;
+	key << "mesh " << options.overdraw << options.quantize << options.index16 << options.clusters
+		<< " " << options.lodLevels << " " << options.cacheSize << " " << options.overdrawThreshold
+		<< " " << static_cast<int>(options.meshCompression.mode) << " " << options.meshCompression.level;
+
+	std::string text = key.str();
+	return baker::hash_bytes(text.data(), text.size());
+}
+
+//hash seed of the options that change what a texture bake writes, the usage picks the format and the mip filtering
+uint64_t texture_options_hash(const BakeOptions& options, TextureUsage usage)
+{
+	std::ostringstream key;
+	key << "texture " << options.mips << options.textures << options.colorBC7 << options.alphaBC3
+		<< " " << static_cast<int>(options.mipFilter) << " " << static_cast<int>(usage)
+		<< " " << static_cast<int>(options.textureCompression.mode) << " " << options.textureCompression.level;
+
+	std::string text = key.str();
+	return baker::hash_bytes(text.data(), text.size());
+}
+
+//converts the obj and image sources under the input folder into the export folder and bakes what they wrote.
+//sources whose contents and bake options match the manifest of the last run are skipped.
+//objs go first, the materials they write decide how the textures are baked
+void convert_sources(const fs::path& input, const BakeOptions& options, ThreadPool& pool, BakeTotals& totals)
+{
+	const fs::path& output = options.exportFolder;
+	const fs::path manifestPath = output / MANIFEST_NAME;
+
+	baker::BakeCache cache;
+	if (!options.force)
+	{
+		cache.load(manifestPath);
+	}
+
+	std::vector<fs::path> objs;
+	std::vector<fs::path> images;
+	for (auto& p : fs::recursive_directory_iterator(input))
+	{
+		if (!p.is_regular_file()) continue;
+
+		if (p.path().extension() == ".obj")
+		{
+			objs.push_back(p.path());
+		}
+		else if (baker::is_source_image(p.path()))
+		{
+			images.push_back(p.path());
+		}
+	}
+
+	auto source_key = [&](const fs::path& path) {
+		return path.lexically_normal().lexically_relative(input.lexically_normal()).generic_string();
+	};
+
+	std::unordered_set<std::string> sources;
+	for (auto& p : objs) sources.insert(source_key(p));
+	for (auto& p : images) sources.insert(source_key(p));
+
+	auto skip_source = [&](const std::string& source, uint64_t hash) {
+		if (!cache.is_up_to_date(source, hash, output)) return false;
+
+		std::lock_guard<std::mutex> lock(bakeMutex);
+		totals.upToDate++;
+		return true;
+	};
+
+	//files are spread over the pool, and the mip filters and encoders of a big texture spread over it again,
+	//so workers that ran out of files help with the ones still baking
+	const uint64_t meshSeed = mesh_options_hash(options);
+	pool.parallel_for(static_cast<uint32_t>(objs.size()), [&](uint32_t i) {
+		const fs::path& obj = objs[i];
+		std::string source = source_key(obj);
+
+		//the mtl files are part of the source, an edited material converts the obj again
+		uint64_t hash = meshSeed;
+		bool readable = baker::hash_file(obj, hash);
+		for (const fs::path& mtl : baker::find_obj_dependencies(obj))
+		{
+			readable = readable && baker::hash_file(mtl, hash);
+		}
+		if (readable && skip_source(source, hash)) return;
+
+		if (options.dryRun)
+		{
+			std::lock_guard<std::mutex> lock(bakeMutex);
+			std::cout << "Would convert " << obj.string() << std::endl;
+			return;
+		}
+
+		std::vector<std::string> outputs;
+		std::ostringstream log;
+		bool converted = baker::convert_obj(input, obj, output, outputs, log);
+		{
+			std::lock_guard<std::mutex> lock(bakeMutex);
+			std::cout << log.str();
+		}
+		if (!converted) return;
+
+		for (const std::string& asset : outputs)
+		{
+			if (fs::path{ asset }.extension() == ".mesh")
+			{
+				bake_mesh(output / asset, options, totals);
+			}
+		}
+
+		cache.update(source, hash, std::move(outputs));
+
+		std::lock_guard<std::mutex> lock(bakeMutex);
+		totals.converted++;
+	});
+
+	const bool bakeTextures = options.mips || options.textures || options.recompressTextures;
+	std::unordered_map<std::string, TextureUsage> textureUsages;
+	if (bakeTextures && fs::is_directory(output))
+	{
+		textureUsages = find_texture_usages(output);
+	}
+
+	pool.parallel_for(static_cast<uint32_t>(images.size()), [&](uint32_t i) {
+		const fs::path& image = images[i];
+		std::string source = source_key(image);
+		std::string texture = baker::converted_path(input, image, ".tx");
+
+		//textures no material references are treated as color
+		TextureUsage usage = TextureUsage::Color;
+		auto found = textureUsages.find((output / texture).lexically_normal().generic_string());
+		if (found != textureUsages.end())
+		{
+			usage = found->second;
+		}
+
+		uint64_t hash = texture_options_hash(options, usage);
+		if (baker::hash_file(image, hash) && skip_source(source, hash)) return;
+
+		if (options.dryRun)
+		{
+			std::lock_guard<std::mutex> lock(bakeMutex);
+			std::cout << "Would convert " << image.string() << std::endl;
+			return;
+		}
+
+		if (!baker::convert_image(image, output / texture))
+		{
+			std::lock_guard<std::mutex> lock(bakeMutex);
+			std::cout << "Failed to convert " << image << std::endl;
+			return;
+		}
+
+		if (bakeTextures)
+		{
+			bake_texture(output / texture, usage, options, pool, totals);
+		}
+
+		cache.update(source, hash, { texture });
+
+		std::lock_guard<std::mutex> lock(bakeMutex);
+		totals.converted++;
+	});
+
+	if (options.dryRun) return;
+
+	//removed sources leave their assets behind, but not their manifest entries
+	cache.prune(sources);
+	if (!cache.save(manifestPath))
+	{
+		std::cout << "Failed to write " << manifestPath << std::endl;
+	}
+}
+
+//trains the metadata dictionary on every material and prefab under the folder and rewrites them compressed with it.
+//the previous dictionary is loaded first, the files it compressed are read back before it gets replaced
+bool compress_metadata_files(const fs::path& folder)
+{
+	const fs::path dictionaryPath = folder / DICTIONARY_NAME;
+	assets::load_dictionary(dictionaryPath.string().c_str());
+
+	struct SmallAsset {
+		fs::path path;
+		assets::AssetFile file;
+	};
+	std::vector<SmallAsset> smallAssets;
+	std::vector<std::string> samples;
+	for (auto& p : fs::recursive_directory_iterator(folder))
+	{
+		if (!p.is_regular_file() || (p.path().extension() != ".mat" && p.path().extension() != ".pfb")) continue;
+
+		//repacked, so every sample is a plain binary block whatever version the file was
+		assets::AssetFile file;
+		if (!assets::load_binaryfile(p.path().string().c_str(), file)) continue;
+
+		if (memcmp(file.type, "MATX", 4) == 0)
+		{
+			assets::MaterialInfo info = assets::read_material_info(&file);
+			file = assets::pack_material(&info);
+		}
+		else if (memcmp(file.type, "PRFB", 4) == 0)
+		{
+			file = assets::pack_prefab(assets::read_prefab_info(&file));
+		}
+		else
+		{
+			continue;
+		}
+
+		samples.push_back(file.json);
+		smallAssets.push_back({ p.path(), std::move(file) });
+	}
+
+	std::vector<char> dictionary;
+	if (!assets::train_dictionary(samples, DICTIONARY_CAPACITY, dictionary))
+	{
+		std::cout << "Not enough materials and prefabs in " << folder << " to train a dictionary" << std::endl;
+		return false;
+	}
+	assets::set_dictionary(dictionary.data(), dictionary.size());
+
+	if (!assets::save_binaryfile(dictionaryPath.string().c_str(), assets::pack_dictionary(dictionary)))
+	{
+		std::cout << "Failed to write " << dictionaryPath << std::endl;
+		return false;
+	}
+
+	size_t bytesBefore = 0;
+	size_t bytesAfter = 0;
+	for (SmallAsset& asset : smallAssets)
+	{
+		bytesBefore += asset.file.json.size();
+
+		asset.file.json = assets::compress_metadata(asset.file.json, METADATA_COMPRESSION_LEVEL);
+		asset.file.version = assets::ASSET_VERSION_COMPRESSED;
+		bytesAfter += asset.file.json.size();
+
+		if (!assets::save_binaryfile(asset.path.string().c_str(), asset.file))
+		{
+			std::cout << "Failed to write " << asset.path << std::endl;
+		}
+	}
+
+	std::cout << "Compressed the metadata of " << smallAssets.size() << " materials and prefabs with a " << dictionary.size() / 1024
+		<< " KB dictionary, " << bytesBefore / 1024 << " KB -> " << bytesAfter / 1024 << " KB" << std::endl;
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		std::cout << "Usage: baker <mesh file, texture file or asset folder> [--overdraw] [--quantize] [--index32] [--lods <levels>] [--clusters] [--cache <size>]"
+			" [--mips] [--mip-filter box|kaiser|lanczos] [--textures] [--bc7] [--bc3]"
+			" [--mesh-codec <codec>] [--texture-codec <codec>] [--dict] [--dry-run]" << std::endl;
+		std::cout << "       codecs are none, lz4, lz4hc or zstd with an optional level, as in lz4hc:12 or zstd:19" << std::endl;
+		std::cout << "       baker <source folder> --export <asset folder> [--force] [bake options]" << std::endl;
+		return -1;
+	}
+
+	BakeOptions options;
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--overdraw") == 0)
+		{
+			options.overdraw = true;
+		}
+		else if (strcmp(argv[i], "--quantize") == 0)
+		{
+			options.quantize = true;
+		}
+		else if (strcmp(argv[i], "--index32") == 0)
+		{
+			options.index16 = false;
+		}
+		else if (strcmp(argv[i], "--dry-run") == 0)
+		{
+			options.dryRun = true;
+		}
+		else if (strcmp(argv[i], "--clusters") == 0)
+		{
+			options.clusters = true;
+		}
+		else if (strcmp(argv[i], "--mips") == 0)
+		{
+			options.mips = true;
+		}
+		else if (strcmp(argv[i], "--mip-filter") == 0 && i + 1 < argc)
+		{
+			i++;
+			if (strcmp(argv[i], "box") == 0)
+			{
+				options.mipFilter = baker::MipFilter::Box;
+			}
+			else if (strcmp(argv[i], "kaiser") == 0)
+			{
+				options.mipFilter = baker::MipFilter::Kaiser;
+			}
+			else if (strcmp(argv[i], "lanczos") == 0)
+			{
+				options.mipFilter = baker::MipFilter::Lanczos;
+			}
+			else
+			{
+				std::cout << "Unknown mip filter " << argv[i] << std::endl;
+				return -1;
+			}
+		}
+		else if (strcmp(argv[i], "--textures") == 0)
+		{
+			options.textures = true;
+		}
+		else if (strcmp(argv[i], "--bc7") == 0)
+		{
+			options.colorBC7 = true;
+		}
+		else if (strcmp(argv[i], "--bc3") == 0)
+		{
+			options.alphaBC3 = true;
+		}
+		else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc)
+		{
+			options.exportFolder = argv[++i];
+		}
+		else if (strcmp(argv[i], "--force") == 0)
+		{
+			options.force = true;
+		}
+		else if (strcmp(argv[i], "--mesh-codec") == 0 && i + 1 < argc)
+		{
+			if (!assets::parse_compression_settings(argv[++i], options.meshCompression))
+			{
+				std::cout << "Unknown codec " << argv[i] << std::endl;
+				return -1;
+			}
+		}
+		else if (strcmp(argv[i], "--texture-codec") == 0 && i + 1 < argc)
+		{
+			if (!assets::parse_compression_settings(argv[++i], options.textureCompression))
+			{
+				std::cout << "Unknown codec " << argv[i] << std::endl;
+				return -1;
+			}
+			options.recompressTextures = true;
+		}
+		else if (strcmp(argv[i], "--dict") == 0)
+		{
+			options.dictionary = true;
+		}
+		else if (strcmp(argv[i], "--lods") == 0 && i + 1 < argc)
+		{
+			options.lodLevels = std::clamp(static_cast<uint32_t>(atoi(argv[++i])), 1u, MAX_LOD_LEVELS);
+		}
+		else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+		{
+			options.cacheSize = static_cast<uint32_t>(atoi(argv[++i]));
+		}
+		else
+		{
+			std::cout << "Unknown option " << argv[i] << std::endl;
+			return -1;
+		}
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	//textures bake in parallel, and the filters and encoders spread the rows of a mip over the same workers
+	ThreadPool pool;
+	pool.init(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+
+	BakeTotals totals;
+
+	const bool bakeTextures = options.mips || options.textures || options.recompressTextures;
+
+	fs::path input{ argv[1] };
+
+	//folder the materials and prefabs live in. Metadata compressed by an earlier run needs its dictionary to be read
+	fs::path assetFolder = !options.exportFolder.empty() ? options.exportFolder : (fs::is_directory(input) ? input : fs::path{});
+	if (!assetFolder.empty())
+	{
+		assets::load_dictionary((assetFolder / DICTIONARY_NAME).string().c_str());
+	}
+
+	if (!options.exportFolder.empty())
+	{
+		if (!fs::is_directory(input))
+		{
+			std::cout << "Exporting needs a source folder, " << input << " is not one" << std::endl;
+			pool.cleanup();
+			return -1;
+		}
+		convert_sources(input, options, pool, totals);
+	}
+	else if (fs::is_directory(input))
+	{
+		std::unordered_map<std::string, TextureUsage> textureUsages;
+		if (bakeTextures)
+		{
+			textureUsages = find_texture_usages(input);
+		}
+
+		std::vector<fs::path> textures;
+		for (auto& p : fs::recursive_directory_iterator(input))
+		{
+			if (!p.is_regular_file()) continue;
+
+			if (p.path().extension() == ".mesh")
+			{
+				bake_mesh(p.path(), options, totals);
+			}
+			else if (bakeTextures && p.path().extension() == ".tx")
+			{
+				textures.push_back(p.path());
+			}
+		}
+
+		pool.parallel_for(static_cast<uint32_t>(textures.size()), [&](uint32_t i) {
+			//textures no material references are treated as color
+			auto usage = textureUsages.find(textures[i].lexically_normal().generic_string());
+			bake_texture(textures[i], usage != textureUsages.end() ? usage->second : TextureUsage::Color, options, pool, totals);
+		});
+	}
+	else if (input.extension() == ".tx")
+	{
+		bake_texture(input, TextureUsage::Color, options, pool, totals);
+	}
+	else
+	{
+		bake_mesh(input, options, totals);
+	}
+
+	if (options.dictionary && !options.dryRun && !assetFolder.empty())
+	{
+		compress_metadata_files(assetFolder);
+	}
+
+	pool.cleanup();
+
+	auto end = std::chrono::high_resolution_clock::now();
+
+	if (totals.triangles > 0)
+	{
+		std::cout << "Baked " << totals.meshes << " meshes, " << totals.triangles << " triangles in "
+			<< std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+		std::cout << "    total ACMR " << float(totals.transformedBefore) / totals.triangles
+			<< " -> " << float(totals.transformedAfter) / totals.triangles
+			<< " (cache size " << options.cacheSize << ")" << std::endl;
+	}
+	if (totals.textures > 0)
+	{
+		std::cout << "Baked " << totals.textures << " textures, " << totals.textureBytesBefore / 1024 << " KB -> "
+			<< totals.textureBytesAfter / 1024 << " KB in " << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+	}
+	if (!options.exportFolder.empty())
+	{
+		std::cout << "Converted " << totals.converted << " sources, " << totals.upToDate << " up to date" << std::endl;
+	}
+
+	return 0;
+}
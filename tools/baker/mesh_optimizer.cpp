@@ -0,0 +1,565 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace {
+	struct Adjacency {
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> triangles;
+	};
+
+	//triangles using every vertex, as one flat array
+	Adjacency build_adjacency(const uint32_t* indices, size_t indexCount, size_t vertexCount)
+	{
+		Adjacency adjacency;
+		adjacency.offsets.assign(vertexCount + 1, 0);
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			adjacency.offsets[indices[i] + 1]++;
+		}
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			adjacency.offsets[v + 1] += adjacency.offsets[v];
+		}
+
+		std::vector<uint32_t> cursor(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+		adjacency.triangles.resize(indexCount);
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			adjacency.triangles[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+		return adjacency;
+	}
+
+	//fifo cache where a vertex is resident while fewer than cacheSize misses happened since it was loaded
+	struct CacheSimulator {
+		std::vector<uint32_t> loadTime;
+		uint32_t time;
+		uint32_t size;
+
+		CacheSimulator(size_t vertexCount, uint32_t cacheSize) : loadTime(vertexCount, 0), time(cacheSize + 1), size(cacheSize) {}
+
+		void reset()
+		{
+			time += size + 1;
+		}
+
+		//true on a miss
+		bool access(uint32_t vertex)
+		{
+			if (time - loadTime[vertex] > size)
+			{
+				loadTime[vertex] = time++;
+				return true;
+			}
+			return false;
+		}
+	};
+
+	struct Vec3 {
+		float x, y, z;
+	};
+
+	Vec3 load_position(const char* vertices, size_t vertexStride, uint32_t index)
+	{
+		//every engine vertex format starts with a 32 bit float position
+		Vec3 position;
+		memcpy(&position, vertices + index * vertexStride, sizeof(Vec3));
+		return position;
+	}
+}
+
+baker::VertexCacheStats baker::analyze_vertex_cache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+	CacheSimulator cache{ vertexCount, cacheSize };
+
+	std::vector<uint8_t> referenced(vertexCount, 0);
+	size_t referencedCount = 0;
+
+	VertexCacheStats stats{};
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		if (cache.access(indices[i]))
+		{
+			stats.verticesTransformed++;
+		}
+		if (!referenced[indices[i]])
+		{
+			referenced[indices[i]] = 1;
+			referencedCount++;
+		}
+	}
+
+	size_t triangleCount = indexCount / 3;
+	stats.acmr = triangleCount ? float(stats.verticesTransformed) / triangleCount : 0.f;
+	stats.atvr = referencedCount ? float(stats.verticesTransformed) / referencedCount : 0.f;
+	return stats;
+}
+
+void baker::optimize_vertex_cache(uint32_t* destination, const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize, std::vector<uint32_t>& clusterStarts)
+{
+	clusterStarts.clear();
+	if (indexCount == 0 || vertexCount == 0) return;
+
+	//the destination may alias the source
+	std::vector<uint32_t> source(indices, indices + indexCount);
+
+	Adjacency adjacency = build_adjacency(source.data(), indexCount, vertexCount);
+
+	std::vector<uint32_t> liveTriangles(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		liveTriangles[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+	}
+
+	std::vector<uint8_t> emitted(indexCount / 3, 0);
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	std::vector<uint32_t> deadEnds;
+	std::vector<uint32_t> candidates;
+
+	uint32_t time = cacheSize + 1;
+	size_t cursor = 0;
+	size_t outputTriangles = 0;
+
+	//vertex to fan around next, or -1 once every triangle was emitted
+	int64_t fanning = 0;
+	clusterStarts.push_back(0);
+
+	while (fanning >= 0)
+	{
+		candidates.clear();
+
+		uint32_t f = static_cast<uint32_t>(fanning);
+		for (uint32_t a = adjacency.offsets[f]; a < adjacency.offsets[f + 1]; a++)
+		{
+			uint32_t triangle = adjacency.triangles[a];
+			if (emitted[triangle]) continue;
+
+			for (int k = 0; k < 3; k++)
+			{
+				uint32_t v = source[triangle * 3 + k];
+				destination[outputTriangles * 3 + k] = v;
+
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				liveTriangles[v]--;
+
+				if (time - cacheTime[v] > cacheSize)
+				{
+					cacheTime[v] = time++;
+				}
+			}
+			emitted[triangle] = 1;
+			outputTriangles++;
+		}
+
+		//prefer the candidate that is still in cache and has the most triangles left to emit
+		int64_t next = -1;
+		int64_t bestPriority = -1;
+		for (uint32_t v : candidates)
+		{
+			if (liveTriangles[v] == 0) continue;
+
+			int64_t priority = 0;
+			if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+			{
+				priority = time - cacheTime[v];
+			}
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				next = v;
+			}
+		}
+
+		if (next == -1)
+		{
+			//dead end, fall back to recently used vertices and then to input order
+			while (!deadEnds.empty() && next == -1)
+			{
+				uint32_t d = deadEnds.back();
+				deadEnds.pop_back();
+				if (liveTriangles[d] > 0) next = d;
+			}
+			while (next == -1 && cursor < vertexCount)
+			{
+				if (liveTriangles[cursor] > 0) next = cursor;
+				cursor++;
+			}
+
+			if (next != -1 && outputTriangles > clusterStarts.back())
+			{
+				clusterStarts.push_back(static_cast<uint32_t>(outputTriangles));
+			}
+		}
+		fanning = next;
+	}
+}
+
+void baker::optimize_overdraw(uint32_t* indices, size_t indexCount, const char* vertices, size_t vertexCount, size_t vertexStride,
+	const std::vector<uint32_t>& clusterStarts, uint32_t cacheSize, float threshold)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0 || clusterStarts.empty()) return;
+
+	//split the hard clusters where the miss ratio since the last split is already good enough
+	std::vector<uint32_t> splits;
+	CacheSimulator cache{ vertexCount, cacheSize };
+	for (size_t c = 0; c < clusterStarts.size(); c++)
+	{
+		uint32_t begin = clusterStarts[c];
+		uint32_t end = c + 1 < clusterStarts.size() ? clusterStarts[c + 1] : static_cast<uint32_t>(triangleCount);
+
+		cache.reset();
+		uint32_t clusterMisses = 0;
+		for (uint32_t t = begin; t < end; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				clusterMisses += cache.access(indices[t * 3 + k]);
+			}
+		}
+		float target = threshold * float(clusterMisses) / float(end - begin);
+
+		cache.reset();
+		uint32_t start = begin;
+		uint32_t misses = 0;
+		splits.push_back(begin);
+		for (uint32_t t = begin; t < end; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				misses += cache.access(indices[t * 3 + k]);
+			}
+
+			if (t + 1 < end && float(misses) / float(t + 1 - start) <= target)
+			{
+				splits.push_back(t + 1);
+				start = t + 1;
+				misses = 0;
+				cache.reset();
+			}
+		}
+	}
+
+	//area weighted centroid of the mesh and of every cluster, plus the cluster average normal
+	struct Cluster {
+		uint32_t begin;
+		uint32_t end;
+		float sortKey;
+	};
+	std::vector<Cluster> clusters;
+	clusters.reserve(splits.size());
+
+	std::vector<Vec3> centroids;
+	std::vector<Vec3> normals;
+	Vec3 meshCentroid{ 0, 0, 0 };
+	float meshArea = 0;
+
+	for (size_t s = 0; s < splits.size(); s++)
+	{
+		Cluster cluster;
+		cluster.begin = splits[s];
+		cluster.end = s + 1 < splits.size() ? splits[s + 1] : static_cast<uint32_t>(triangleCount);
+
+		Vec3 centroid{ 0, 0, 0 };
+		Vec3 normal{ 0, 0, 0 };
+		float area = 0;
+		for (uint32_t t = cluster.begin; t < cluster.end; t++)
+		{
+			Vec3 p0 = load_position(vertices, vertexStride, indices[t * 3 + 0]);
+			Vec3 p1 = load_position(vertices, vertexStride, indices[t * 3 + 1]);
+			Vec3 p2 = load_position(vertices, vertexStride, indices[t * 3 + 2]);
+
+			Vec3 e1{ p1.x - p0.x, p1.y - p0.y, p1.z - p0.z };
+			Vec3 e2{ p2.x - p0.x, p2.y - p0.y, p2.z - p0.z };
+			//cross product length is twice the area, the factor cancels out
+			Vec3 n{ e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x };
+			float a = std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+
+			centroid.x += (p0.x + p1.x + p2.x) * a / 3;
+			centroid.y += (p0.y + p1.y + p2.y) * a / 3;
+			centroid.z += (p0.z + p1.z + p2.z) * a / 3;
+			normal.x += n.x;
+			normal.y += n.y;
+			normal.z += n.z;
+			area += a;
+		}
+
+		meshCentroid.x += centroid.x;
+		meshCentroid.y += centroid.y;
+		meshCentroid.z += centroid.z;
+		meshArea += area;
+
+		float inverseArea = area > 0 ? 1.f / area : 0.f;
+		centroids.push_back({ centroid.x * inverseArea, centroid.y * inverseArea, centroid.z * inverseArea });
+
+		float length = std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+		float inverseLength = length > 0 ? 1.f / length : 0.f;
+		normals.push_back({ normal.x * inverseLength, normal.y * inverseLength, normal.z * inverseLength });
+
+		clusters.push_back(cluster);
+	}
+
+	float inverseMeshArea = meshArea > 0 ? 1.f / meshArea : 0.f;
+	meshCentroid = { meshCentroid.x * inverseMeshArea, meshCentroid.y * inverseMeshArea, meshCentroid.z * inverseMeshArea };
+
+	//clusters on the outside facing away from the center occlude the rest from most view directions
+	for (size_t c = 0; c < clusters.size(); c++)
+	{
+		Vec3 d{ centroids[c].x - meshCentroid.x, centroids[c].y - meshCentroid.y, centroids[c].z - meshCentroid.z };
+		clusters[c].sortKey = d.x * normals[c].x + d.y * normals[c].y + d.z * normals[c].z;
+	}
+
+	std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) {
+		return a.sortKey > b.sortKey;
+	});
+
+	std::vector<uint32_t> sorted;
+	sorted.reserve(indexCount);
+	for (auto& cluster : clusters)
+	{
+		sorted.insert(sorted.end(), indices + cluster.begin * 3, indices + cluster.end * 3);
+	}
+	memcpy(indices, sorted.data(), sorted.size() * sizeof(uint32_t));
+}
+
+size_t baker::simplify_clustered(uint32_t* destination, const uint32_t* indices, size_t indexCount, const char* vertices, size_t vertexCount, size_t vertexStride, uint32_t gridSize)
+{
+	if (indexCount == 0 || gridSize == 0) return 0;
+
+	Vec3 min{ FLT_MAX, FLT_MAX, FLT_MAX };
+	Vec3 max{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		Vec3 p = load_position(vertices, vertexStride, indices[i]);
+		min = { std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z) };
+		max = { std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z) };
+	}
+
+	float extent = std::max({ max.x - min.x, max.y - min.y, max.z - min.z });
+	float inverseCell = extent > 0 ? float(gridSize) / extent : 0.f;
+
+	auto cell_coord = [&](float value, float origin) {
+		return std::min(static_cast<uint64_t>((value - origin) * inverseCell), uint64_t(gridSize - 1));
+	};
+
+	struct Cell {
+		Vec3 sum;
+		uint32_t count;
+		uint32_t representative;
+		float bestDistance;
+	};
+	std::vector<Cell> cells;
+	std::unordered_map<uint64_t, uint32_t> cellLookup;
+
+	const uint32_t unassigned = ~0u;
+	std::vector<uint32_t> vertexCell(vertexCount, unassigned);
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		uint32_t v = indices[i];
+		if (vertexCell[v] != unassigned) continue;
+
+		Vec3 p = load_position(vertices, vertexStride, v);
+		uint64_t key = (cell_coord(p.x, min.x) * gridSize + cell_coord(p.y, min.y)) * gridSize + cell_coord(p.z, min.z);
+
+		auto [it, inserted] = cellLookup.try_emplace(key, static_cast<uint32_t>(cells.size()));
+		if (inserted)
+		{
+			cells.push_back({ { 0, 0, 0 }, 0, v, FLT_MAX });
+		}
+		Cell& cell = cells[it->second];
+		cell.sum = { cell.sum.x + p.x, cell.sum.y + p.y, cell.sum.z + p.z };
+		cell.count++;
+		vertexCell[v] = it->second;
+	}
+
+	//the vertex nearest to the average of its cell represents it
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		if (vertexCell[v] == unassigned) continue;
+
+		Cell& cell = cells[vertexCell[v]];
+		Vec3 p = load_position(vertices, vertexStride, static_cast<uint32_t>(v));
+		Vec3 d{ p.x - cell.sum.x / cell.count, p.y - cell.sum.y / cell.count, p.z - cell.sum.z / cell.count };
+		float distance = d.x * d.x + d.y * d.y + d.z * d.z;
+		if (distance < cell.bestDistance)
+		{
+			cell.bestDistance = distance;
+			cell.representative = static_cast<uint32_t>(v);
+		}
+	}
+
+	//rotated so the smallest index comes first, which keeps the winding and makes duplicates compare equal
+	std::vector<std::array<uint32_t, 3>> triangles;
+	for (size_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		uint32_t a = cells[vertexCell[indices[i + 0]]].representative;
+		uint32_t b = cells[vertexCell[indices[i + 1]]].representative;
+		uint32_t c = cells[vertexCell[indices[i + 2]]].representative;
+		if (a == b || b == c || a == c) continue;
+
+		if (b < a && b < c) triangles.push_back({ b, c, a });
+		else if (c < a && c < b) triangles.push_back({ c, a, b });
+		else triangles.push_back({ a, b, c });
+	}
+
+	std::sort(triangles.begin(), triangles.end());
+	triangles.erase(std::unique(triangles.begin(), triangles.end()), triangles.end());
+
+	for (size_t t = 0; t < triangles.size(); t++)
+	{
+		memcpy(destination + t * 3, triangles[t].data(), sizeof(uint32_t) * 3);
+	}
+	return triangles.size() * 3;
+}
+
+std::vector<baker::Cluster> baker::build_clusters(const uint32_t* indices, size_t indexCount, const char* vertices, size_t vertexCount, size_t vertexStride, size_t maxVertices, size_t maxTriangles)
+{
+	std::vector<Cluster> clusters;
+
+	//vertices of the current cluster are stamped with its number
+	const uint32_t unstamped = ~0u;
+	std::vector<uint32_t> stamp(vertexCount, unstamped);
+	std::vector<uint32_t> clusterVertices;
+
+	auto close_cluster = [&](size_t begin, size_t end) {
+		Cluster cluster;
+		cluster.firstIndex = static_cast<uint32_t>(begin);
+		cluster.indexCount = static_cast<uint32_t>(end - begin);
+
+		//sphere around the center of the bounding box
+		Vec3 min{ FLT_MAX, FLT_MAX, FLT_MAX };
+		Vec3 max{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (uint32_t v : clusterVertices)
+		{
+			Vec3 p = load_position(vertices, vertexStride, v);
+			min = { std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z) };
+			max = { std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z) };
+		}
+		Vec3 center{ (min.x + max.x) / 2, (min.y + max.y) / 2, (min.z + max.z) / 2 };
+		float radius = 0;
+		for (uint32_t v : clusterVertices)
+		{
+			Vec3 p = load_position(vertices, vertexStride, v);
+			Vec3 d{ p.x - center.x, p.y - center.y, p.z - center.z };
+			radius = std::max(radius, std::sqrt(d.x * d.x + d.y * d.y + d.z * d.z));
+		}
+
+		//the cone axis is the average unit normal, its spread the widest angle from it to any triangle
+		std::vector<Vec3> normals;
+		Vec3 axis{ 0, 0, 0 };
+		for (size_t i = begin; i < end; i += 3)
+		{
+			Vec3 p0 = load_position(vertices, vertexStride, indices[i + 0]);
+			Vec3 p1 = load_position(vertices, vertexStride, indices[i + 1]);
+			Vec3 p2 = load_position(vertices, vertexStride, indices[i + 2]);
+
+			Vec3 e1{ p1.x - p0.x, p1.y - p0.y, p1.z - p0.z };
+			Vec3 e2{ p2.x - p0.x, p2.y - p0.y, p2.z - p0.z };
+			Vec3 n{ e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x };
+			float length = std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+			if (length == 0) continue;
+
+			n = { n.x / length, n.y / length, n.z / length };
+			normals.push_back(n);
+			axis = { axis.x + n.x, axis.y + n.y, axis.z + n.z };
+		}
+
+		float axisLength = std::sqrt(axis.x * axis.x + axis.y * axis.y + axis.z * axis.z);
+		float minDot = 1;
+		if (axisLength > 0)
+		{
+			axis = { axis.x / axisLength, axis.y / axisLength, axis.z / axisLength };
+			for (const Vec3& n : normals)
+			{
+				minDot = std::min(minDot, n.x * axis.x + n.y * axis.y + n.z * axis.z);
+			}
+		}
+
+		cluster.center[0] = center.x;
+		cluster.center[1] = center.y;
+		cluster.center[2] = center.z;
+		cluster.radius = radius;
+		cluster.coneAxis[0] = axis.x;
+		cluster.coneAxis[1] = axis.y;
+		cluster.coneAxis[2] = axis.z;
+		//a spread of 90 degrees or more always has a triangle facing the camera
+		cluster.coneCutoff = (axisLength > 0 && minDot > 0) ? std::sqrt(1 - minDot * minDot) : 1.f;
+
+		clusters.push_back(cluster);
+		clusterVertices.clear();
+	};
+
+	size_t begin = 0;
+	for (size_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		uint32_t id = static_cast<uint32_t>(clusters.size());
+
+		size_t newVertices = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			newVertices += stamp[indices[i + k]] != id;
+		}
+
+		//a triangle that shares no vertex is where the cache ordering jumped to another part of the mesh
+		size_t triangles = (i - begin) / 3;
+		bool disconnected = newVertices == 3;
+		if (triangles > 0 && (disconnected || triangles == maxTriangles || clusterVertices.size() + newVertices > maxVertices))
+		{
+			close_cluster(begin, i);
+			begin = i;
+			id = static_cast<uint32_t>(clusters.size());
+		}
+
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t v = indices[i + k];
+			if (stamp[v] != id)
+			{
+				stamp[v] = id;
+				clusterVertices.push_back(v);
+			}
+		}
+	}
+	if (indexCount - begin >= 3)
+	{
+		close_cluster(begin, indexCount - indexCount % 3);
+	}
+
+	return clusters;
+}
+
+size_t baker::optimize_vertex_fetch(char* vertices, uint32_t* indices, size_t indexCount, size_t vertexCount, size_t vertexStride)
+{
+	const uint32_t unused = ~0u;
+	std::vector<uint32_t> remap(vertexCount, unused);
+
+	uint32_t newCount = 0;
+	for (size_t i = 0; i < indexCount; i++)
+	{
+		uint32_t& target = remap[indices[i]];
+		if (target == unused)
+		{
+			target = newCount++;
+		}
+		indices[i] = target;
+	}
+
+	std::vector<char> reordered(size_t(newCount) * vertexStride);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		if (remap[v] != unused)
+		{
+			memcpy(reordered.data() + remap[v] * vertexStride, vertices + v * vertexStride, vertexStride);
+		}
+	}
+	memcpy(vertices, reordered.data(), reordered.size());
+
+	return newCount;
+}
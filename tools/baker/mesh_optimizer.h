@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace baker {
+
+	//post transform cache size the optimizations and the statistics assume
+	constexpr uint32_t DEFAULT_CACHE_SIZE = 16;
+
+	//run of consecutive triangles with its bounds, see build_clusters
+	struct Cluster {
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		float center[3];
+		float radius;
+		float coneAxis[3];
+		float coneCutoff; //sine of the cone spread, 1 when the triangles can never be back facing together
+	};
+
+	struct VertexCacheStats {
+		uint32_t verticesTransformed;
+		float acmr; //average cache miss ratio, transformed vertices per triangle
+		float atvr; //average transform to vertex ratio, transformed vertices per referenced vertex
+	};
+
+	//simulates a fifo post transform cache over the index list
+	VertexCacheStats analyze_vertex_cache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = DEFAULT_CACHE_SIZE);
+
+	//reorders the triangles for post transform cache locality (tipsify, Sander et al. 2007).
+	//clusterStarts receives the first triangle of every cluster the reordering started from a fresh vertex, which overdraw optimization reuses
+	void optimize_vertex_cache(uint32_t* destination, const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize, std::vector<uint32_t>& clusterStarts);
+
+	//sorts the clusters of an already cache optimized index list so that outward facing ones come first.
+	//clusters are split further as long as their miss ratio stays within threshold times the one of the whole cluster
+	void optimize_overdraw(uint32_t* indices, size_t indexCount, const char* vertices, size_t vertexCount, size_t vertexStride,
+		const std::vector<uint32_t>& clusterStarts, uint32_t cacheSize, float threshold);
+
+	//simplifies by clustering the vertices in a grid with gridSize cells along the largest axis of the mesh.
+	//every cell collapses into its vertex closest to the cell average, so the result keeps using the same vertex buffer.
+	//triangles that become degenerate or duplicated are dropped, returns the new index count
+	size_t simplify_clustered(uint32_t* destination, const uint32_t* indices, size_t indexCount, const char* vertices, size_t vertexCount, size_t vertexStride, uint32_t gridSize);
+
+	//splits the index list into runs of consecutive triangles that hold at most maxTriangles triangles and touch at most maxVertices vertices,
+	//with a bounding sphere and a normal cone for each. Cache optimized input keeps the runs compact.
+	//front faces are counter clockwise, the cone axis points out of them
+	std::vector<Cluster> build_clusters(const uint32_t* indices, size_t indexCount, const char* vertices, size_t vertexCount, size_t vertexStride, size_t maxVertices, size_t maxTriangles);
+
+	//reorders the vertices in the order the index list first uses them and remaps the indices.
+	//unreferenced vertices are dropped, returns the new vertex count
+	size_t optimize_vertex_fetch(char* vertices, uint32_t* indices, size_t indexCount, size_t vertexCount, size_t vertexStride);
+}
@@ -0,0 +1,288 @@
+#include "mip_generator.h"
+#include "simd.h"
+
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+	constexpr float PI = 3.14159265358979f;
+
+	struct Tap {
+		uint32_t index;
+		float weight;
+	};
+
+	//source taps of every destination texel along one axis, the same count for each
+	struct FilterTaps {
+		uint32_t tapsPerTexel;
+		std::vector<Tap> taps;
+	};
+
+	float sinc(float x)
+	{
+		if (std::abs(x) < 1e-5f) return 1.f;
+		return std::sin(PI * x) / (PI * x);
+	}
+
+	//modified bessel function of the first kind, order 0
+	float bessel0(float x)
+	{
+		float sum = 1.f;
+		float term = 1.f;
+		for (int k = 1; k < 32; k++)
+		{
+			term *= (x / (2.f * k)) * (x / (2.f * k));
+			sum += term;
+			if (term < sum * 1e-7f) break;
+		}
+		return sum;
+	}
+
+	//half width of the kernel, in destination texels
+	float filter_support(baker::MipFilter filter)
+	{
+		switch (filter) {
+		case baker::MipFilter::Box:
+			return 0.5f;
+		default:
+			return 3.f;
+		}
+	}
+
+	float filter_kernel(baker::MipFilter filter, float t)
+	{
+		t = std::abs(t);
+		switch (filter) {
+		case baker::MipFilter::Box:
+			//a source texel on the edge of the box is shared by both destination texels
+			return t < 0.5f ? 1.f : (t == 0.5f ? 0.5f : 0.f);
+		case baker::MipFilter::Kaiser:
+		{
+			constexpr float width = 3.f;
+			constexpr float alpha = 4.f;
+			if (t >= width) return 0.f;
+			float window = bessel0(alpha * std::sqrt(1.f - (t / width) * (t / width))) / bessel0(alpha);
+			return sinc(t) * window;
+		}
+		case baker::MipFilter::Lanczos:
+			return t < 3.f ? sinc(t) * sinc(t / 3.f) : 0.f;
+		}
+		return 0.f;
+	}
+
+	//edge texels are repeated, the weights of every destination texel add up to one
+	FilterTaps build_taps(baker::MipFilter filter, uint32_t sourceSize, uint32_t destinationSize)
+	{
+		float scale = float(sourceSize) / float(destinationSize);
+		float support = filter_support(filter) * scale;
+
+		FilterTaps result;
+		result.tapsPerTexel = static_cast<uint32_t>(std::ceil(support * 2.f)) + 1;
+		result.taps.resize(size_t(destinationSize) * result.tapsPerTexel);
+
+		for (uint32_t d = 0; d < destinationSize; d++)
+		{
+			float center = (d + 0.5f) * scale;
+			int first = static_cast<int>(std::floor(center - support));
+
+			Tap* taps = &result.taps[size_t(d) * result.tapsPerTexel];
+			float sum = 0.f;
+			for (uint32_t k = 0; k < result.tapsPerTexel; k++)
+			{
+				int source = first + static_cast<int>(k);
+				float weight = filter_kernel(filter, (source + 0.5f - center) / scale);
+
+				taps[k].index = static_cast<uint32_t>(std::clamp(source, 0, static_cast<int>(sourceSize) - 1));
+				taps[k].weight = weight;
+				sum += weight;
+			}
+			for (uint32_t k = 0; k < result.tapsPerTexel; k++)
+			{
+				taps[k].weight /= sum;
+			}
+		}
+		return result;
+	}
+
+	//weighted sum of the taps for one texel, all four channels at once. stride is the float distance between source texels
+	inline void filter_texel(const float* source, size_t stride, const Tap* taps, uint32_t tapCount, float* destination)
+	{
+#ifdef BAKER_SSE2
+		__m128 sum = _mm_setzero_ps();
+		for (uint32_t k = 0; k < tapCount; k++)
+		{
+			__m128 texel = _mm_loadu_ps(source + taps[k].index * stride);
+			sum = _mm_add_ps(sum, _mm_mul_ps(texel, _mm_set1_ps(taps[k].weight)));
+		}
+		_mm_storeu_ps(destination, sum);
+#else
+		float sum[4] = {};
+		for (uint32_t k = 0; k < tapCount; k++)
+		{
+			const float* texel = source + taps[k].index * stride;
+			for (int c = 0; c < 4; c++)
+			{
+				sum[c] += texel[c] * taps[k].weight;
+			}
+		}
+		for (int c = 0; c < 4; c++)
+		{
+			destination[c] = sum[c];
+		}
+#endif
+	}
+
+	float srgb_to_linear(float c)
+	{
+		return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+	}
+
+	float linear_to_srgb(float c)
+	{
+		return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+	}
+
+	uint8_t to_unorm8(float c)
+	{
+		return static_cast<uint8_t>(std::lround(std::clamp(c, 0.f, 1.f) * 255.f));
+	}
+
+	float alpha_coverage(const std::vector<float>& level, float cutoff, float scale)
+	{
+		size_t texelCount = level.size() / 4;
+		size_t covered = 0;
+		for (size_t i = 0; i < texelCount; i++)
+		{
+			if (level[i * 4 + 3] * scale > cutoff) covered++;
+		}
+		return float(covered) / float(texelCount);
+	}
+
+	//coverage only grows with the scale, so bisection finds the scale that matches the target.
+	//small levels can only reach a few coverage values, the closest side of the last step wins
+	float find_coverage_scale(const std::vector<float>& level, float cutoff, float targetCoverage)
+	{
+		float low = 0.f;
+		float high = 4.f;
+		for (int i = 0; i < 12; i++)
+		{
+			float middle = (low + high) * 0.5f;
+			if (alpha_coverage(level, cutoff, middle) < targetCoverage)
+			{
+				low = middle;
+			}
+			else
+			{
+				high = middle;
+			}
+		}
+
+		float lowError = std::abs(alpha_coverage(level, cutoff, low) - targetCoverage);
+		float highError = std::abs(alpha_coverage(level, cutoff, high) - targetCoverage);
+		return lowError < highError ? low : high;
+	}
+
+	baker::MipLevel quantize_level(const std::vector<float>& level, uint32_t width, uint32_t height, bool srgb, float alphaScale, ThreadPool& pool)
+	{
+		baker::MipLevel result;
+		result.width = width;
+		result.height = height;
+		result.pixels.resize(size_t(width) * height * 4);
+
+		pool.parallel_for(height, [&](uint32_t y) {
+			for (size_t i = size_t(y) * width; i < size_t(y + 1) * width; i++)
+			{
+				for (int c = 0; c < 3; c++)
+				{
+					float value = level[i * 4 + c];
+					result.pixels[i * 4 + c] = to_unorm8(srgb ? linear_to_srgb(std::max(value, 0.f)) : value);
+				}
+				result.pixels[i * 4 + 3] = to_unorm8(level[i * 4 + 3] * alphaScale);
+			}
+		});
+		return result;
+	}
+}
+
+std::vector<baker::MipLevel> baker::generate_mips(const uint8_t* rgba, uint32_t width, uint32_t height, const MipOptions& options, ThreadPool& pool)
+{
+	std::vector<MipLevel> levels;
+	levels.push_back({ width, height, std::vector<uint8_t>(rgba, rgba + size_t(width) * height * 4) });
+
+	float toFloat[256];
+	for (int i = 0; i < 256; i++)
+	{
+		toFloat[i] = options.srgb ? srgb_to_linear(i / 255.f) : i / 255.f;
+	}
+
+	std::vector<float> current(size_t(width) * height * 4);
+	for (size_t i = 0; i < size_t(width) * height; i++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			current[i * 4 + c] = toFloat[rgba[i * 4 + c]];
+		}
+		current[i * 4 + 3] = rgba[i * 4 + 3] / 255.f;
+	}
+
+	float targetCoverage = options.preserveCoverage ? alpha_coverage(current, options.alphaCutoff, 1.f) : 0.f;
+
+	std::vector<float> horizontal;
+	std::vector<float> next;
+	while (width > 1 || height > 1)
+	{
+		uint32_t nextWidth = std::max(width / 2, 1u);
+		uint32_t nextHeight = std::max(height / 2, 1u);
+
+		FilterTaps columns = build_taps(options.filter, width, nextWidth);
+		FilterTaps rows = build_taps(options.filter, height, nextHeight);
+
+		//separable, the horizontal pass keeps every source row
+		horizontal.resize(size_t(nextWidth) * height * 4);
+		pool.parallel_for(height, [&](uint32_t y) {
+			const float* sourceRow = &current[size_t(y) * width * 4];
+			for (uint32_t x = 0; x < nextWidth; x++)
+			{
+				filter_texel(sourceRow, 4, &columns.taps[size_t(x) * columns.tapsPerTexel], columns.tapsPerTexel, &horizontal[(size_t(y) * nextWidth + x) * 4]);
+			}
+		});
+
+		next.resize(size_t(nextWidth) * nextHeight * 4);
+		pool.parallel_for(nextHeight, [&](uint32_t y) {
+			const Tap* taps = &rows.taps[size_t(y) * rows.tapsPerTexel];
+			for (uint32_t x = 0; x < nextWidth; x++)
+			{
+				filter_texel(&horizontal[size_t(x) * 4], size_t(nextWidth) * 4, taps, rows.tapsPerTexel, &next[(size_t(y) * nextWidth + x) * 4]);
+			}
+		});
+
+		std::swap(current, next);
+		width = nextWidth;
+		height = nextHeight;
+
+		//the scale only applies to the stored level, the next one is filtered from the unscaled alpha
+		float alphaScale = 1.f;
+		if (options.preserveCoverage)
+		{
+			alphaScale = find_coverage_scale(current, options.alphaCutoff, targetCoverage);
+		}
+
+		levels.push_back(quantize_level(current, width, height, options.srgb, alphaScale, pool));
+	}
+	return levels;
+}
+
+const char* baker::mip_filter_name(MipFilter filter)
+{
+	switch (filter) {
+	case MipFilter::Box:
+		return "box";
+	case MipFilter::Kaiser:
+		return "kaiser";
+	case MipFilter::Lanczos:
+		return "lanczos";
+	}
+	return "unknown";
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+namespace baker {
+
+	enum class MipFilter {
+		Box,
+		Kaiser, //windowed sinc, width 3 and alpha 4
+		Lanczos //3 lobes
+	};
+
+	struct MipOptions {
+		MipFilter filter{ MipFilter::Kaiser };
+		//rgb is gamma encoded and gets filtered in linear space
+		bool srgb{ true };
+		//scales the alpha of every level so the same share of texels passes the alpha test as in the top level
+		bool preserveCoverage{ false };
+		float alphaCutoff{ 0.5f };
+	};
+
+	struct MipLevel {
+		uint32_t width;
+		uint32_t height;
+		std::vector<uint8_t> pixels; //rgba8
+	};
+
+	//builds the chain of a width x height rgba8 image down to 1x1, the first level is a copy of the image.
+	//every level is filtered from the unquantized previous one, rows are spread over the pool
+	std::vector<MipLevel> generate_mips(const uint8_t* rgba, uint32_t width, uint32_t height, const MipOptions& options, ThreadPool& pool);
+
+	const char* mip_filter_name(MipFilter filter);
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+//the filters and encoders of the baker have an SSE2 path, every x64 compiler provides it
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BAKER_SSE2 1
+#include <emmintrin.h>
+#endif
@@ -0,0 +1,485 @@
+#include "texture_compressor.h"
+#include "simd.h"
+
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+namespace {
+	//texels of one 4x4 block with one array per channel, so that four texels fit in a register
+	struct Block {
+		alignas(16) float channels[4][16];
+	};
+
+	void load_block(const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY, Block& block)
+	{
+		for (uint32_t y = 0; y < 4; y++)
+		{
+			uint32_t sourceY = std::min(blockY * 4 + y, height - 1);
+			for (uint32_t x = 0; x < 4; x++)
+			{
+				uint32_t sourceX = std::min(blockX * 4 + x, width - 1);
+				const uint8_t* texel = rgba + (size_t(sourceY) * width + sourceX) * 4;
+				for (int c = 0; c < 4; c++)
+				{
+					block.channels[c][y * 4 + x] = texel[c];
+				}
+			}
+		}
+	}
+
+	//picks the closest palette entry for every texel over channelCount channels starting at firstChannel.
+	//returns the summed squared error, every encoder spends most of its time here
+	float select_indices(const Block& block, int firstChannel, int channelCount, const float palette[][4], int paletteSize, uint8_t indices[16])
+	{
+		float total = 0.f;
+#ifdef BAKER_SSE2
+		for (int i = 0; i < 16; i += 4)
+		{
+			__m128 best = _mm_set1_ps(FLT_MAX);
+			__m128i bestIndex = _mm_setzero_si128();
+			for (int e = 0; e < paletteSize; e++)
+			{
+				__m128 distance = _mm_setzero_ps();
+				for (int c = 0; c < channelCount; c++)
+				{
+					__m128 d = _mm_sub_ps(_mm_load_ps(&block.channels[firstChannel + c][i]), _mm_set1_ps(palette[e][c]));
+					distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+				}
+
+				__m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+				bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(e)), _mm_andnot_si128(closer, bestIndex));
+				best = _mm_min_ps(distance, best);
+			}
+
+			alignas(16) int32_t lanes[4];
+			alignas(16) float errors[4];
+			_mm_store_si128(reinterpret_cast<__m128i*>(lanes), bestIndex);
+			_mm_store_ps(errors, best);
+			for (int k = 0; k < 4; k++)
+			{
+				indices[i + k] = static_cast<uint8_t>(lanes[k]);
+				total += errors[k];
+			}
+		}
+#else
+		for (int i = 0; i < 16; i++)
+		{
+			float best = FLT_MAX;
+			for (int e = 0; e < paletteSize; e++)
+			{
+				float distance = 0.f;
+				for (int c = 0; c < channelCount; c++)
+				{
+					float d = block.channels[firstChannel + c][i] - palette[e][c];
+					distance += d * d;
+				}
+				if (distance < best)
+				{
+					best = distance;
+					indices[i] = static_cast<uint8_t>(e);
+				}
+			}
+			total += best;
+		}
+#endif
+		return total;
+	}
+
+	//endpoints on the principal axis of the texels, found with a few power iterations on their covariance.
+	//channels past channelCount are left opaque
+	void fit_endpoints(const Block& block, int channelCount, float e0[4], float e1[4])
+	{
+		float mean[4] = {};
+		for (int c = 0; c < channelCount; c++)
+		{
+			for (int i = 0; i < 16; i++)
+			{
+				mean[c] += block.channels[c][i];
+			}
+			mean[c] /= 16.f;
+		}
+
+		float covariance[4][4] = {};
+		for (int i = 0; i < 16; i++)
+		{
+			for (int j = 0; j < channelCount; j++)
+			{
+				for (int k = 0; k < channelCount; k++)
+				{
+					covariance[j][k] += (block.channels[j][i] - mean[j]) * (block.channels[k][i] - mean[k]);
+				}
+			}
+		}
+
+		for (int c = 0; c < 4; c++)
+		{
+			e0[c] = e1[c] = c < channelCount ? mean[c] : 255.f;
+		}
+
+		//the row of the channel with the most variance never starts orthogonal to the principal axis
+		int widest = 0;
+		for (int c = 1; c < channelCount; c++)
+		{
+			if (covariance[c][c] > covariance[widest][widest]) widest = c;
+		}
+		float axis[4];
+		memcpy(axis, covariance[widest], sizeof(axis));
+
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = {};
+			float largest = 0.f;
+			for (int j = 0; j < channelCount; j++)
+			{
+				for (int k = 0; k < channelCount; k++)
+				{
+					next[j] += covariance[j][k] * axis[k];
+				}
+				largest = std::max(largest, std::abs(next[j]));
+			}
+			if (largest == 0.f) return;
+
+			for (int c = 0; c < channelCount; c++)
+			{
+				axis[c] = next[c] / largest;
+			}
+		}
+
+		float length = 0.f;
+		for (int c = 0; c < channelCount; c++)
+		{
+			length += axis[c] * axis[c];
+		}
+		length = std::sqrt(length);
+		if (length == 0.f) return;
+
+		float minT = FLT_MAX;
+		float maxT = -FLT_MAX;
+		for (int i = 0; i < 16; i++)
+		{
+			float t = 0.f;
+			for (int c = 0; c < channelCount; c++)
+			{
+				t += (block.channels[c][i] - mean[c]) * axis[c];
+			}
+			minT = std::min(minT, t);
+			maxT = std::max(maxT, t);
+		}
+
+		for (int c = 0; c < channelCount; c++)
+		{
+			float direction = axis[c] / (length * length);
+			e0[c] = std::clamp(mean[c] + direction * minT, 0.f, 255.f);
+			e1[c] = std::clamp(mean[c] + direction * maxT, 0.f, 255.f);
+		}
+	}
+
+	//least squares endpoints for the chosen indices, where weights[index] is the position of the palette entry between them.
+	//false when the indices do not pin both endpoints down
+	bool refit_endpoints(const Block& block, int channelCount, const uint8_t indices[16], const float* weights, float e0[4], float e1[4])
+	{
+		float a = 0.f, b = 0.f, c = 0.f;
+		float right0[4] = {};
+		float right1[4] = {};
+		for (int i = 0; i < 16; i++)
+		{
+			float w = weights[indices[i]];
+			a += (1.f - w) * (1.f - w);
+			b += (1.f - w) * w;
+			c += w * w;
+			for (int ch = 0; ch < channelCount; ch++)
+			{
+				right0[ch] += (1.f - w) * block.channels[ch][i];
+				right1[ch] += w * block.channels[ch][i];
+			}
+		}
+
+		float determinant = a * c - b * b;
+		if (determinant < 1e-4f) return false;
+
+		for (int ch = 0; ch < channelCount; ch++)
+		{
+			e0[ch] = std::clamp((c * right0[ch] - b * right1[ch]) / determinant, 0.f, 255.f);
+			e1[ch] = std::clamp((a * right1[ch] - b * right0[ch]) / determinant, 0.f, 255.f);
+		}
+		return true;
+	}
+
+	uint16_t pack_565(const float color[4])
+	{
+		uint16_t r = static_cast<uint16_t>(std::lround(color[0] * 31.f / 255.f));
+		uint16_t g = static_cast<uint16_t>(std::lround(color[1] * 63.f / 255.f));
+		uint16_t b = static_cast<uint16_t>(std::lround(color[2] * 31.f / 255.f));
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	}
+
+	void unpack_565(uint16_t packed, float color[4])
+	{
+		uint32_t r = (packed >> 11) & 31;
+		uint32_t g = (packed >> 5) & 63;
+		uint32_t b = packed & 31;
+		color[0] = float((r << 3) | (r >> 2));
+		color[1] = float((g << 2) | (g >> 4));
+		color[2] = float((b << 3) | (b >> 2));
+		color[3] = 255.f;
+	}
+
+	//position of every bc1 palette entry between the two endpoints
+	constexpr float BC1_WEIGHTS[4] = { 0.f, 1.f, 1.f / 3.f, 2.f / 3.f };
+
+	float encode_bc1_endpoints(const Block& block, const float e0[4], const float e1[4], uint8_t out[8], uint8_t indices[16])
+	{
+		uint16_t c0 = pack_565(e0);
+		uint16_t c1 = pack_565(e1);
+
+		//the four color mode needs c0 > c1, swapped endpoints give the same palette
+		if (c0 < c1) std::swap(c0, c1);
+
+		float palette[4][4];
+		unpack_565(c0, palette[0]);
+		unpack_565(c1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2.f * palette[0][c] + palette[1][c]) / 3.f;
+			palette[3][c] = (palette[0][c] + 2.f * palette[1][c]) / 3.f;
+		}
+
+		//equal endpoints switch to the three color mode, where only the first entry is still the same color
+		float error = select_indices(block, 0, 3, palette, c0 == c1 ? 1 : 4, indices);
+
+		uint32_t packedIndices = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			packedIndices |= uint32_t(indices[i]) << (i * 2);
+		}
+
+		memcpy(out, &c0, 2);
+		memcpy(out + 2, &c1, 2);
+		memcpy(out + 4, &packedIndices, 4);
+		return error;
+	}
+
+	void encode_bc1_block(const Block& block, uint8_t out[8])
+	{
+		float e0[4], e1[4];
+		fit_endpoints(block, 3, e0, e1);
+
+		uint8_t indices[16];
+		float error = encode_bc1_endpoints(block, e0, e1, out, indices);
+
+		//the principal axis ignores the quantization, a refit on the chosen indices usually lowers the error
+		if (error > 0.f && refit_endpoints(block, 3, indices, BC1_WEIGHTS, e0, e1))
+		{
+			uint8_t refitted[8];
+			if (encode_bc1_endpoints(block, e0, e1, refitted, indices) < error)
+			{
+				memcpy(out, refitted, sizeof(refitted));
+			}
+		}
+	}
+
+	//single channel block, also the alpha of bc3 and each channel of bc5
+	void encode_bc4_block(const Block& block, int channel, uint8_t out[8])
+	{
+		float low = 255.f;
+		float high = 0.f;
+		for (int i = 0; i < 16; i++)
+		{
+			low = std::min(low, block.channels[channel][i]);
+			high = std::max(high, block.channels[channel][i]);
+		}
+
+		//a0 > a1 selects the mode with six interpolated values
+		uint32_t a0 = static_cast<uint32_t>(high);
+		uint32_t a1 = static_cast<uint32_t>(low);
+
+		float palette[8][4];
+		palette[0][0] = float(a0);
+		palette[1][0] = float(a1);
+		for (uint32_t i = 2; i < 8; i++)
+		{
+			palette[i][0] = float(((8 - i) * a0 + (i - 1) * a1) / 7);
+		}
+
+		uint8_t indices[16];
+		select_indices(block, channel, 1, palette, a0 > a1 ? 8 : 1, indices);
+
+		uint64_t packedIndices = 0;
+		for (int i = 0; i < 16; i++)
+		{
+			packedIndices |= uint64_t(indices[i]) << (i * 3);
+		}
+
+		out[0] = static_cast<uint8_t>(a0);
+		out[1] = static_cast<uint8_t>(a1);
+		for (int i = 0; i < 6; i++)
+		{
+			out[2 + i] = static_cast<uint8_t>(packedIndices >> (i * 8));
+		}
+	}
+
+	//interpolation weights of the 4 bit bc7 indices, out of 64
+	constexpr uint32_t BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	//appends bits to a block, least significant bit first
+	struct BitWriter {
+		uint8_t* data;
+		uint32_t position{ 0 };
+
+		void write(uint32_t value, uint32_t bits)
+		{
+			for (uint32_t i = 0; i < bits; i++, position++)
+			{
+				data[position / 8] |= static_cast<uint8_t>(((value >> i) & 1) << (position % 8));
+			}
+		}
+	};
+
+	//mode 6 endpoints are 7 bits per channel plus a p-bit shared by the channels, picks the p-bit that lands closest
+	void quantize_bc7_endpoint(const float target[4], uint32_t quantized[4], uint32_t& pbit)
+	{
+		float bestError = FLT_MAX;
+		for (uint32_t p = 0; p < 2; p++)
+		{
+			uint32_t candidate[4];
+			float error = 0.f;
+			for (int c = 0; c < 4; c++)
+			{
+				candidate[c] = static_cast<uint32_t>(std::clamp(std::lround((target[c] - p) / 2.f), 0l, 127l));
+				float d = float((candidate[c] << 1) | p) - target[c];
+				error += d * d;
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				memcpy(quantized, candidate, sizeof(candidate));
+				pbit = p;
+			}
+		}
+	}
+
+	float encode_bc7_endpoints(const Block& block, const float e0[4], const float e1[4], uint8_t out[16], uint8_t indices[16])
+	{
+		uint32_t q0[4], q1[4];
+		uint32_t p0, p1;
+		quantize_bc7_endpoint(e0, q0, p0);
+		quantize_bc7_endpoint(e1, q1, p1);
+
+		float palette[16][4];
+		for (int i = 0; i < 16; i++)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				uint32_t d0 = (q0[c] << 1) | p0;
+				uint32_t d1 = (q1[c] << 1) | p1;
+				palette[i][c] = float(((64 - BC7_WEIGHTS[i]) * d0 + BC7_WEIGHTS[i] * d1 + 32) >> 6);
+			}
+		}
+
+		float error = select_indices(block, 0, 4, palette, 16, indices);
+
+		//the top bit of the first index is implied zero, swapping the endpoints flips every index
+		if (indices[0] & 8)
+		{
+			std::swap(q0, q1);
+			std::swap(p0, p1);
+			for (int i = 0; i < 16; i++)
+			{
+				indices[i] = static_cast<uint8_t>(15 - indices[i]);
+			}
+		}
+
+		memset(out, 0, 16);
+		BitWriter writer{ out };
+		writer.write(1 << 6, 7);
+		for (int c = 0; c < 4; c++)
+		{
+			writer.write(q0[c], 7);
+			writer.write(q1[c], 7);
+		}
+		writer.write(p0, 1);
+		writer.write(p1, 1);
+		writer.write(indices[0], 3);
+		for (int i = 1; i < 16; i++)
+		{
+			writer.write(indices[i], 4);
+		}
+		return error;
+	}
+
+	void encode_bc7_block(const Block& block, uint8_t out[16])
+	{
+		float e0[4], e1[4];
+		fit_endpoints(block, 4, e0, e1);
+
+		uint8_t indices[16];
+		float error = encode_bc7_endpoints(block, e0, e1, out, indices);
+
+		float weights[16];
+		for (int i = 0; i < 16; i++)
+		{
+			weights[i] = BC7_WEIGHTS[i] / 64.f;
+		}
+
+		//the indices refer to the endpoints in the order they were written, which is what the refit needs
+		if (error > 0.f && refit_endpoints(block, 4, indices, weights, e0, e1))
+		{
+			uint8_t refitted[16];
+			if (encode_bc7_endpoints(block, e0, e1, refitted, indices) < error)
+			{
+				memcpy(out, refitted, sizeof(refitted));
+			}
+		}
+	}
+}
+
+bool baker::has_alpha(const uint8_t* rgba, size_t texelCount)
+{
+	for (size_t i = 0; i < texelCount; i++)
+	{
+		if (rgba[i * 4 + 3] != 255) return true;
+	}
+	return false;
+}
+
+void baker::compress_texture(assets::TextureFormat format, const uint8_t* rgba, uint32_t width, uint32_t height, uint8_t* destination, ThreadPool& pool)
+{
+	uint32_t blocksX = (width + 3) / 4;
+	uint32_t blocksY = (height + 3) / 4;
+	uint32_t blockBytes = assets::texture_block_bytes(format);
+
+	//every row of blocks writes its own range of the destination
+	pool.parallel_for(blocksY, [&](uint32_t blockY) {
+		uint8_t* out = destination + size_t(blockY) * blocksX * blockBytes;
+
+		Block block;
+		for (uint32_t blockX = 0; blockX < blocksX; blockX++)
+		{
+			load_block(rgba, width, height, blockX, blockY, block);
+
+			switch (format) {
+			case assets::TextureFormat::BC1:
+				encode_bc1_block(block, out);
+				break;
+			case assets::TextureFormat::BC3:
+				encode_bc4_block(block, 3, out);
+				encode_bc1_block(block, out + 8);
+				break;
+			case assets::TextureFormat::BC5:
+				encode_bc4_block(block, 0, out);
+				encode_bc4_block(block, 1, out + 8);
+				break;
+			case assets::TextureFormat::BC7:
+				encode_bc7_block(block, out);
+				break;
+			default:
+				break;
+			}
+			out += blockBytes;
+		}
+	});
+}
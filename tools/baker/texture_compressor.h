@@ -0,0 +1,19 @@
+#pragma once
+
+#include <texture_asset.h>
+
+#include <cstddef>
+#include <cstdint>
+
+class ThreadPool;
+
+namespace baker {
+
+	//true when any texel of the rgba8 image is not fully opaque
+	bool has_alpha(const uint8_t* rgba, size_t texelCount);
+
+	//encodes a width x height rgba8 image into 4x4 blocks of one of the BC formats, rows of blocks are spread over the pool.
+	//destination holds texture_mip_size(format, width, height) bytes. Edge blocks repeat the last row and column of the image.
+	//BC1 drops alpha, BC5 keeps red and green, BC7 only uses mode 6 (one subset, rgba endpoints, 4 bit indices)
+	void compress_texture(assets::TextureFormat format, const uint8_t* rgba, uint32_t width, uint32_t height, uint8_t* destination, ThreadPool& pool);
+}
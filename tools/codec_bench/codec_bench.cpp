@@ -0,0 +1,204 @@
+#include <asset_compression.h>
+#include <asset_loader.h>
+#include <material_asset.h>
+#include <mesh_asset.h>
+#include <prefab_asset.h>
+#include <texture_asset.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+namespace fs = std::filesystem;
+
+//uncompressed blocks of one kind of asset, compressed one by one like the asset files do
+struct BlockSet {
+	std::vector<std::string> blocks;
+	size_t totalSize{ 0 };
+
+	void add(std::string block)
+	{
+		totalSize += block.size();
+		blocks.push_back(std::move(block));
+	}
+};
+
+struct CodecResult {
+	size_t compressedSize{ 0 };
+	double encodeMs{ 0 };
+	double decodeMs{ 0 };
+};
+
+//every block decodes this many bytes in total at least, so small sets still time well
+constexpr size_t DECODE_BYTES = 256 * 1024 * 1024;
+
+//codecs measured when none are given, from the fastest to decode to the densest
+const char* DEFAULT_CODECS[] = { "lz4", "lz4:8", "lz4hc:4", "lz4hc:9", "lz4hc:12", "zstd:1", "zstd:3", "zstd:9", "zstd:19" };
+
+void add_folder_blocks(std::map<std::string, BlockSet>& sets, const fs::path& directory)
+{
+	for (auto& p : fs::recursive_directory_iterator(directory))
+	{
+		if (!p.is_regular_file()) continue;
+
+		assets::MappedAssetFile file;
+		if (!assets::map_binaryfile(p.path().string().c_str(), file)) continue;
+
+		std::string type{ file.type, 4 };
+		if (type == "MESH")
+		{
+			auto info = assets::read_mesh_info(&file);
+			std::string block(info.vertexBuferSize + info.indexBuferSize, '\0');
+			if (!assets::unpack_mesh_contiguous(&info, file.binaryBlob, file.binaryBlobSize, block.data()))
+			{
+				std::cout << "Skipping " << p.path().string() << ", corrupted mesh data" << std::endl;
+				continue;
+			}
+			sets["meshes"].add(std::move(block));
+		}
+		else if (type == "TEXI")
+		{
+			//pages are compressed on their own, and the streaming reads them on their own
+			auto info = assets::read_texture_info(&file);
+			for (int i = 0; i < static_cast<int>(info.pages.size()); i++)
+			{
+				std::string block(info.pages[i].originalSize, '\0');
+				if (!assets::unpack_texture_page(&info, i, file.binaryBlob, block.data()))
+				{
+					std::cout << "Skipping a page of " << p.path().string() << ", corrupted texture data" << std::endl;
+					continue;
+				}
+				sets["textures"].add(std::move(block));
+			}
+		}
+		else if (type == "MATX")
+		{
+			auto info = assets::read_material_info(&file);
+			sets["metadata"].add(assets::write_material_metadata(&info, assets::ASSET_VERSION_BINARY));
+		}
+		else if (type == "PRFB")
+		{
+			sets["metadata"].add(assets::write_prefab_metadata(assets::read_prefab_info(&file), assets::ASSET_VERSION_BINARY));
+		}
+	}
+}
+
+CodecResult run_codec(const BlockSet& set, const assets::CompressionSettings& settings, bool useDictionary)
+{
+	CodecResult result;
+
+	std::vector<std::string> compressed(set.blocks.size());
+	auto encodeStart = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < set.blocks.size(); i++)
+	{
+		const std::string& block = set.blocks[i];
+		compressed[i].resize(assets::compress_bound(settings.mode, block.size()));
+		size_t size = assets::compress_block(settings, block.data(), block.size(), compressed[i].data(), compressed[i].size(), useDictionary);
+		compressed[i].resize(size);
+		result.compressedSize += size;
+	}
+	auto encodeEnd = std::chrono::high_resolution_clock::now();
+	result.encodeMs = std::chrono::duration<double, std::milli>(encodeEnd - encodeStart).count();
+
+	std::string decoded;
+	int repeats = static_cast<int>(std::clamp<size_t>(DECODE_BYTES / std::max<size_t>(set.totalSize, 1), 1, 1000));
+
+	auto decodeStart = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < repeats; r++)
+	{
+		for (size_t i = 0; i < set.blocks.size(); i++)
+		{
+			decoded.resize(set.blocks[i].size());
+			if (!assets::decompress_block(settings.mode, compressed[i].data(), compressed[i].size(), decoded.data(), decoded.size()))
+			{
+				std::cout << "Block " << i << " failed to decode" << std::endl;
+			}
+		}
+	}
+	auto decodeEnd = std::chrono::high_resolution_clock::now();
+	result.decodeMs = std::chrono::duration<double, std::milli>(decodeEnd - decodeStart).count() / repeats;
+
+	return result;
+}
+
+void print_result(const std::string& label, const BlockSet& set, const CodecResult& result)
+{
+	double megabytes = set.totalSize / (1024.0 * 1024.0);
+
+	std::cout << "    " << std::left << std::setw(16) << label << std::right << std::fixed << std::setprecision(2)
+		<< std::setw(8) << (result.compressedSize > 0 ? double(set.totalSize) / result.compressedSize : 0.0) << "x"
+		<< std::setw(12) << result.compressedSize / 1024 << " KB"
+		<< std::setw(10) << (result.encodeMs > 0 ? megabytes / (result.encodeMs / 1000.0) : 0.0) << " MB/s encode"
+		<< std::setw(10) << (result.decodeMs > 0 ? megabytes / (result.decodeMs / 1000.0) : 0.0) << " MB/s decode" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		std::cout << "Usage: codec_bench <asset folder> [codec ...]" << std::endl;
+		std::cout << "       codecs are none, lz4, lz4hc or zstd with an optional level, as in lz4hc:12 or zstd:19" << std::endl;
+		return -1;
+	}
+
+	fs::path directory{ argv[1] };
+
+	//metadata the baker compressed against a dictionary can't be read without it
+	assets::load_dictionary((directory / "metadata.dict").string().c_str());
+
+	std::vector<assets::CompressionSettings> codecs;
+	for (int i = 2; i < argc; i++)
+	{
+		assets::CompressionSettings settings;
+		if (!assets::parse_compression_settings(argv[i], settings))
+		{
+			std::cout << "Unknown codec " << argv[i] << std::endl;
+			return -1;
+		}
+		codecs.push_back(settings);
+	}
+	if (codecs.empty())
+	{
+		for (const char* name : DEFAULT_CODECS)
+		{
+			assets::CompressionSettings settings;
+			assets::parse_compression_settings(name, settings);
+			codecs.push_back(settings);
+		}
+	}
+
+	std::map<std::string, BlockSet> sets;
+	add_folder_blocks(sets, directory);
+
+	//single threaded, the decode speeds are per core
+	for (auto& [name, set] : sets)
+	{
+		std::cout << name << ": " << set.blocks.size() << " blocks, " << set.totalSize / 1024 << " KB" << std::endl;
+
+		for (const assets::CompressionSettings& settings : codecs)
+		{
+			std::string label = std::string(assets::compression_name(settings.mode)) + ":" + std::to_string(settings.level);
+			print_result(label, set, run_codec(set, settings, false));
+		}
+
+		//trained on the same blocks it compresses, which is what the baker does too
+		std::vector<char> dictionary;
+		if (name == "metadata" && assets::train_dictionary(set.blocks, 16 * 1024, dictionary))
+		{
+			assets::set_dictionary(dictionary.data(), dictionary.size());
+			for (const assets::CompressionSettings& settings : codecs)
+			{
+				if (settings.mode != assets::CompressionMode::Zstd) continue;
+
+				std::string label = std::string(assets::compression_name(settings.mode)) + ":" + std::to_string(settings.level) + "+dict";
+				print_result(label, set, run_codec(set, settings, true));
+			}
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,434 @@
+#include <asset_compression.h>
+#include <asset_loader.h>
+#include <material_asset.h>
+#include <mesh_asset.h>
+#include <prefab_asset.h>
+#include <texture_asset.h>
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+
+namespace fs = std::filesystem;
+
+//every allocation of the process goes through here, the phases read the counters before and after they run
+namespace {
+	std::atomic<uint64_t> allocationCount{ 0 };
+	std::atomic<uint64_t> allocationBytes{ 0 };
+}
+
+void* operator new(size_t size)
+{
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	allocationBytes.fetch_add(size, std::memory_order_relaxed);
+
+	void* memory = std::malloc(size ? size : 1);
+	if (!memory) throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+//the steps the engine goes through to get an asset from disk into a staging buffer
+enum class Phase {
+	Read, //mapping the file and faulting its pages in
+	Parse, //metadata, json or binary, including the zstd metadata of version 3 files
+	Decompress, //blob codec into the staging memory
+	Convert, //vertices into the engine vertex format
+	Copy, //cpu side vectors into the staging memory, only the vector mesh path has it
+	Count
+};
+
+const char* PHASE_NAMES[] = { "read", "parse", "decompress", "convert", "copy" };
+
+struct PhaseStats {
+	double ms{ 0 };
+	uint64_t allocations{ 0 };
+	uint64_t allocatedBytes{ 0 };
+};
+
+struct TypeStats {
+	uint64_t files{ 0 };
+	uint64_t fileBytes{ 0 };
+	uint64_t decodedBytes{ 0 };
+	PhaseStats phases[size_t(Phase::Count)];
+
+	double total_ms() const
+	{
+		double ms = 0;
+		for (const PhaseStats& phase : phases) ms += phase.ms;
+		return ms;
+	}
+
+	void add(const TypeStats& other)
+	{
+		files += other.files;
+		fileBytes += other.fileBytes;
+		decodedBytes += other.decodedBytes;
+		for (size_t i = 0; i < size_t(Phase::Count); i++)
+		{
+			phases[i].ms += other.phases[i].ms;
+			phases[i].allocations += other.phases[i].allocations;
+			phases[i].allocatedBytes += other.phases[i].allocatedBytes;
+		}
+	}
+};
+
+//times a phase and counts what it allocated, for as long as it is in scope
+struct PhaseTimer {
+	PhaseStats& stats;
+	std::chrono::high_resolution_clock::time_point start;
+	uint64_t startCount;
+	uint64_t startBytes;
+
+	PhaseTimer(TypeStats& type, Phase phase) : stats(type.phases[size_t(phase)])
+	{
+		startCount = allocationCount.load(std::memory_order_relaxed);
+		startBytes = allocationBytes.load(std::memory_order_relaxed);
+		start = std::chrono::high_resolution_clock::now();
+	}
+
+	~PhaseTimer()
+	{
+		auto end = std::chrono::high_resolution_clock::now();
+		stats.ms += std::chrono::duration<double, std::milli>(end - start).count();
+		stats.allocations += allocationCount.load(std::memory_order_relaxed) - startCount;
+		stats.allocatedBytes += allocationBytes.load(std::memory_order_relaxed) - startBytes;
+	}
+};
+
+//stands in for the staging buffers, grown once and reused so the codecs are timed rather than the allocator
+std::vector<char> staging;
+
+char* staging_memory(size_t size)
+{
+	if (staging.size() < size) staging.resize(size);
+	return staging.data();
+}
+
+//touches every page of a range so the read phase pays for the faults instead of the decoders
+uint64_t fault_in(const char* data, size_t size)
+{
+	uint64_t sum = 0;
+	for (size_t i = 0; i < size; i += 4096)
+	{
+		sum += static_cast<unsigned char>(data[i]);
+	}
+	return sum;
+}
+
+volatile uint64_t faultSink;
+
+void load_mesh(TypeStats& stats, const assets::MappedAssetFile& file)
+{
+	assets::MeshInfo info;
+	{
+		PhaseTimer timer(stats, Phase::Parse);
+		info = assets::read_mesh_info(&file);
+	}
+
+	size_t size = info.vertexBuferSize + info.indexBuferSize;
+	char* destination = staging_memory(size);
+	{
+		PhaseTimer timer(stats, Phase::Decompress);
+		assets::unpack_mesh_contiguous(&info, file.binaryBlob, file.binaryBlobSize, destination);
+	}
+	{
+		//in place over the decoded vertices, like the engine does in the staging buffer
+		PhaseTimer timer(stats, Phase::Convert);
+		size_t vertexSize = assets::vertex_format_size(info.vertexFormat);
+		if (vertexSize != 0)
+		{
+			assets::PositionQuantization quantization = assets::get_position_quantization(info.bounds);
+			assets::quantize_vertices(info.vertexFormat, destination, info.vertexBuferSize / vertexSize, quantization,
+				reinterpret_cast<assets::Vertex_P16N8C8V16*>(destination));
+		}
+	}
+	stats.decodedBytes += size;
+}
+
+//the mesh path the engine takes with stagedMeshDecode off: decode into vectors, convert into more vectors, then copy into staging.
+//Runs on the already parsed mesh, so only its decompress, convert and copy phases compare with the staged path
+void load_mesh_vector(TypeStats& stats, const assets::MappedAssetFile& file, assets::MeshInfo& info)
+{
+	std::vector<char> vertexBuffer;
+	std::vector<char> indexBuffer;
+	std::vector<uint32_t> indices;
+	std::vector<assets::Vertex_P16N8C8V16> vertices;
+	{
+		PhaseTimer timer(stats, Phase::Decompress);
+		vertexBuffer.resize(info.vertexBuferSize);
+		indexBuffer.resize(info.indexBuferSize);
+		assets::unpack_mesh(&info, file.binaryBlob, file.binaryBlobSize, vertexBuffer.data(), indexBuffer.data());
+	}
+	{
+		//the engine widens the indices to 32 bits when it keeps them
+		PhaseTimer timer(stats, Phase::Convert);
+		if (info.indexSize == sizeof(uint16_t))
+		{
+			const uint16_t* source = reinterpret_cast<const uint16_t*>(indexBuffer.data());
+			indices.assign(source, source + indexBuffer.size() / sizeof(uint16_t));
+		}
+		else
+		{
+			const uint32_t* source = reinterpret_cast<const uint32_t*>(indexBuffer.data());
+			indices.assign(source, source + indexBuffer.size() / sizeof(uint32_t));
+		}
+
+		size_t vertexSize = assets::vertex_format_size(info.vertexFormat);
+		if (vertexSize != 0)
+		{
+			vertices.resize(vertexBuffer.size() / vertexSize);
+			assets::PositionQuantization quantization = assets::get_position_quantization(info.bounds);
+			assets::quantize_vertices(info.vertexFormat, vertexBuffer.data(), vertices.size(), quantization, vertices.data());
+		}
+	}
+
+	size_t vertexBytes = vertices.size() * sizeof(vertices[0]);
+	size_t indexBytes = indices.size() * sizeof(uint32_t);
+	{
+		PhaseTimer timer(stats, Phase::Copy);
+		char* destination = staging_memory(vertexBytes + indexBytes);
+		memcpy(destination, vertices.data(), vertexBytes);
+		memcpy(destination + vertexBytes, indices.data(), indexBytes);
+	}
+	stats.files++;
+	stats.decodedBytes += info.vertexBuferSize + info.indexBuferSize;
+}
+
+void load_texture(TypeStats& stats, const assets::MappedAssetFile& file)
+{
+	assets::TextureInfo info;
+	{
+		PhaseTimer timer(stats, Phase::Parse);
+		info = assets::read_texture_info(&file);
+	}
+
+	size_t size = 0;
+	for (const assets::PageInfo& page : info.pages)
+	{
+		size += page.originalSize;
+	}
+	char* destination = staging_memory(size);
+	{
+		PhaseTimer timer(stats, Phase::Decompress);
+		for (int i = 0; i < static_cast<int>(info.pages.size()); i++)
+		{
+			assets::unpack_texture_page(&info, i, file.binaryBlob, destination);
+			destination += info.pages[i].originalSize;
+		}
+	}
+	stats.decodedBytes += size;
+}
+
+void load_material(TypeStats& stats, const assets::MappedAssetFile& file)
+{
+	PhaseTimer timer(stats, Phase::Parse);
+	assets::read_material_info(&file);
+}
+
+void load_prefab(TypeStats& stats, const assets::MappedAssetFile& file)
+{
+	//the matrices are copied out of the blob by the parser, there is nothing else to decode
+	PhaseTimer timer(stats, Phase::Parse);
+	assets::PrefabInfo info = assets::read_prefab_info(&file);
+	stats.decodedBytes += info.matrices.size() * sizeof(info.matrices[0]);
+}
+
+void load_file(std::map<std::string, TypeStats>& types, TypeStats& vectorMeshes, const std::string& path, uint64_t fileSize)
+{
+	//the type is only known once the header was read, so the read phase is kept aside until then
+	TypeStats read;
+	assets::MappedAssetFile file;
+	{
+		PhaseTimer timer(read, Phase::Read);
+		if (!assets::map_binaryfile(path.c_str(), file)) return;
+
+		faultSink = fault_in(file.json.data(), file.json.size()) + fault_in(file.binaryBlob, file.binaryBlobSize);
+	}
+
+	std::string type{ file.type, 4 };
+	TypeStats& stats = types[type];
+	if (type == "MESH")
+	{
+		load_mesh(stats, file);
+
+		assets::MeshInfo info = assets::read_mesh_info(&file);
+		load_mesh_vector(vectorMeshes, file, info);
+	}
+	else if (type == "TEXI")
+	{
+		load_texture(stats, file);
+	}
+	else if (type == "MATX")
+	{
+		load_material(stats, file);
+	}
+	else if (type == "PRFB")
+	{
+		load_prefab(stats, file);
+	}
+
+	read.files = 1;
+	read.fileBytes = fileSize;
+	stats.add(read);
+}
+
+double per_second(double amount, double ms)
+{
+	return ms > 0 ? amount / (ms / 1000.0) : 0.0;
+}
+
+void print_stats(const std::string& name, const TypeStats& stats)
+{
+	double ms = stats.total_ms();
+
+	std::cout << name << ": " << stats.files << " files, " << stats.fileBytes / 1024 << " KB on disk, " << stats.decodedBytes / 1024 << " KB decoded" << std::endl;
+	std::cout << std::fixed << std::setprecision(2)
+		<< "    " << per_second(double(stats.files), ms) << " files/s, "
+		<< per_second(stats.fileBytes / (1024.0 * 1024.0), ms) << " MB/s read, "
+		<< per_second(stats.decodedBytes / (1024.0 * 1024.0), ms) << " MB/s decoded" << std::endl;
+
+	for (size_t i = 0; i < size_t(Phase::Count); i++)
+	{
+		const PhaseStats& phase = stats.phases[i];
+		std::cout << "    " << std::left << std::setw(12) << PHASE_NAMES[i] << std::right
+			<< std::setw(10) << phase.ms << " ms"
+			<< std::setw(10) << phase.allocations << " allocations"
+			<< std::setw(12) << phase.allocatedBytes / 1024 << " KB allocated" << std::endl;
+	}
+}
+
+nlohmann::json stats_to_json(const TypeStats& stats)
+{
+	double ms = stats.total_ms();
+
+	nlohmann::json result;
+	result["files"] = stats.files;
+	result["file_bytes"] = stats.fileBytes;
+	result["decoded_bytes"] = stats.decodedBytes;
+	result["total_ms"] = ms;
+	result["files_per_second"] = per_second(double(stats.files), ms);
+	result["read_mb_per_second"] = per_second(stats.fileBytes / (1024.0 * 1024.0), ms);
+	result["decoded_mb_per_second"] = per_second(stats.decodedBytes / (1024.0 * 1024.0), ms);
+
+	for (size_t i = 0; i < size_t(Phase::Count); i++)
+	{
+		const PhaseStats& phase = stats.phases[i];
+		result["phases"][PHASE_NAMES[i]] = {
+			{ "ms", phase.ms },
+			{ "allocations", phase.allocations },
+			{ "allocated_bytes", phase.allocatedBytes }
+		};
+	}
+	return result;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		std::cout << "Usage: load_bench <asset folder> [--iterations N] [--json output.json]" << std::endl;
+		return -1;
+	}
+
+	fs::path directory{ argv[1] };
+	int iterations = 5;
+	std::string jsonPath;
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+		{
+			iterations = std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+		{
+			jsonPath = argv[++i];
+		}
+		else
+		{
+			std::cout << "Unknown argument " << argv[i] << std::endl;
+			return -1;
+		}
+	}
+
+	//metadata the baker compressed against a dictionary can't be read without it
+	assets::load_dictionary((directory / "metadata.dict").string().c_str());
+
+	std::vector<std::pair<std::string, uint64_t>> files;
+	for (auto& p : fs::recursive_directory_iterator(directory))
+	{
+		if (!p.is_regular_file()) continue;
+
+		//only the kinds of assets the engine loads, not the dictionary or the bake manifest
+		assets::MappedAssetFile file;
+		if (!assets::map_binaryfile(p.path().string().c_str(), file)) continue;
+
+		std::string type{ file.type, 4 };
+		if (type == "MESH" || type == "TEXI" || type == "MATX" || type == "PRFB")
+		{
+			files.push_back({ p.path().string(), p.file_size() });
+		}
+	}
+	std::sort(files.begin(), files.end());
+
+	//single threaded, the numbers are per core. Iterations after the first one read from the page cache
+	std::map<std::string, TypeStats> types;
+	//every mesh also goes through the old vector path, kept out of the totals
+	TypeStats vectorMeshes;
+	for (int i = 0; i < iterations; i++)
+	{
+		for (auto& [path, size] : files)
+		{
+			load_file(types, vectorMeshes, path, size);
+		}
+	}
+
+	std::cout << "Loaded " << files.size() << " files from " << directory.string() << " " << iterations << " times" << std::endl;
+
+	TypeStats total;
+	nlohmann::json report;
+	report["directory"] = directory.string();
+	report["iterations"] = iterations;
+	for (auto& [name, stats] : types)
+	{
+		print_stats(name, stats);
+		report["types"][name] = stats_to_json(stats);
+		total.add(stats);
+	}
+	print_stats("total", total);
+	report["total"] = stats_to_json(total);
+
+	if (vectorMeshes.files > 0)
+	{
+		print_stats("MESH vector path", vectorMeshes);
+		report["mesh_vector_path"] = stats_to_json(vectorMeshes);
+	}
+
+	if (!jsonPath.empty())
+	{
+		std::ofstream out(jsonPath);
+		if (!out)
+		{
+			std::cout << "Can't write " << jsonPath << std::endl;
+			return -1;
+		}
+		out << report.dump(4) << std::endl;
+	}
+
+	return 0;
+}
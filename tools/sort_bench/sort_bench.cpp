@@ -0,0 +1,145 @@
+#include <radix_sort.h>
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+//same layout as RenderScene::RenderBatch, a handle with its generation and the sort key
+struct Batch {
+	struct {
+		uint32_t handle;
+		uint32_t generation;
+	} object;
+	uint64_t sortKey;
+};
+
+//keys the way refresh_pass builds them, a hash of material and mesh, so many objects share a key.
+//customKey only gets set by a few objects
+std::vector<Batch> make_batches(size_t count, uint32_t materials, uint32_t meshes, std::mt19937_64& random)
+{
+	std::vector<Batch> batches(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		uint64_t material = std::hash<uint64_t>()(random() % materials) * 0x9E3779B97F4A7C15ull;
+		uint32_t mesh = static_cast<uint32_t>(random() % meshes);
+		uint32_t meshmat = static_cast<uint32_t>(material >> 32) ^ mesh;
+		uint32_t customKey = (random() % 64) == 0 ? static_cast<uint32_t>(random() % 4) : 0;
+
+		batches[i].object.handle = static_cast<uint32_t>(i);
+		batches[i].object.generation = 0;
+		batches[i].sortKey = uint64_t(meshmat) | (uint64_t(customKey) << 32);
+	}
+	//new objects come from reused pass object slots as well as fresh ones
+	std::shuffle(batches.begin(), batches.end(), random);
+	return batches;
+}
+
+//the comparator sort refresh_pass used
+void comparator_sort(std::vector<Batch>& batches)
+{
+	std::sort(batches.begin(), batches.end(), [](const Batch& A, const Batch& B) {
+		if (A.sortKey < B.sortKey) { return true; }
+		else if (A.sortKey == B.sortKey) { return A.object.handle < B.object.handle; }
+		else { return false; }
+	});
+}
+
+void radix(std::vector<Batch>& batches, std::vector<Batch>& scratch, ThreadPool* pool)
+{
+	radix_sort::sort(batches, scratch,
+		[](const Batch& batch) { return batch.sortKey; },
+		[](const Batch& batch) { return batch.object.handle; }, pool);
+}
+
+bool same_order(const std::vector<Batch>& a, const std::vector<Batch>& b)
+{
+	return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](const Batch& A, const Batch& B) {
+		return A.sortKey == B.sortKey && A.object.handle == B.object.handle;
+	});
+}
+
+//best time of the runs, every run sorts a fresh copy of the same input
+template<typename F>
+double time_sort(const std::vector<Batch>& input, std::vector<Batch>& output, int iterations, F&& function)
+{
+	double best = 0;
+	for (int i = 0; i < iterations; i++)
+	{
+		output = input;
+		auto start = std::chrono::high_resolution_clock::now();
+		function(output);
+		auto end = std::chrono::high_resolution_clock::now();
+
+		double ms = std::chrono::duration<double, std::milli>(end - start).count();
+		best = i == 0 ? ms : std::min(best, ms);
+	}
+	return best;
+}
+
+int main(int argc, char* argv[])
+{
+	int iterations = 10;
+	uint32_t materials = 64;
+	uint32_t meshes = 512;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+		{
+			iterations = std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--materials") == 0 && i + 1 < argc)
+		{
+			materials = static_cast<uint32_t>(std::max(atoi(argv[++i]), 1));
+		}
+		else if (strcmp(argv[i], "--meshes") == 0 && i + 1 < argc)
+		{
+			meshes = static_cast<uint32_t>(std::max(atoi(argv[++i]), 1));
+		}
+		else
+		{
+			std::cout << "Usage: sort_bench [--iterations N] [--materials N] [--meshes N]" << std::endl;
+			return -1;
+		}
+	}
+
+	//same split as the engine, the calling thread helps while it waits
+	ThreadPool pool;
+	pool.init(std::max(1u, std::thread::hardware_concurrency()) - 1);
+
+	std::cout << "Sorting batches of " << materials << " materials and " << meshes << " meshes, best of " << iterations
+		<< " runs, " << pool.worker_count() << " pool workers" << std::endl;
+	std::cout << std::setw(10) << "batches" << std::setw(14) << "comparator" << std::setw(14) << "radix" << std::setw(14) << "radix pool" << std::endl;
+
+	std::mt19937_64 random(42);
+	bool matching = true;
+	for (size_t count : { size_t(1000), size_t(10000), size_t(100000), size_t(1000000), size_t(4000000) })
+	{
+		std::vector<Batch> input = make_batches(count, materials, meshes, random);
+		std::vector<Batch> expected, sorted, scratch;
+
+		double comparatorMs = time_sort(input, expected, iterations, comparator_sort);
+		double radixMs = time_sort(input, sorted, iterations, [&](std::vector<Batch>& batches) { radix(batches, scratch, nullptr); });
+		bool radixMatches = same_order(expected, sorted);
+		double poolMs = time_sort(input, sorted, iterations, [&](std::vector<Batch>& batches) { radix(batches, scratch, &pool); });
+		bool poolMatches = same_order(expected, sorted);
+
+		std::cout << std::fixed << std::setprecision(3) << std::setw(10) << count
+			<< std::setw(11) << comparatorMs << " ms"
+			<< std::setw(11) << radixMs << " ms"
+			<< std::setw(11) << poolMs << " ms" << std::endl;
+
+		if (!radixMatches || !poolMatches)
+		{
+			std::cout << "    radix order differs from the comparator sort" << std::endl;
+			matching = false;
+		}
+	}
+
+	pool.cleanup();
+	return matching ? 0 : 1;
+}